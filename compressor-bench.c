@@ -0,0 +1,910 @@
+/*
+ * author: Andrea Orlandi
+ * name: compressor-bench.c
+ * description: generatore di carico per il server del progetto "remote-compressor": apre N sessioni contemporanee, ciascuna con lo stesso
+ * 				protocollo del compressor-client, e vi ripete uno schema di comandi (send di K file di S byte, compress con il
+ * 				compressore C), misurando:
+ * 					- la latenza di ogni comando (p50/p99/p999, massimo, media)
+ * 					- l'attesa di connessione (dalla connect all'assegnazione della sessione da parte del server: cresce col pool saturo)
+ * 					- il throughput (byte inviati e byte di archivi ricevuti al secondo, giri completati al secondo)
+ * 				I risultati sono stampati in tabella e, a richiesta, scritti in JSON (per confrontare versioni diverse del server).
+ * language: Italian (program, comments), English (code)
+ * notes: 1) programma scritto per l'esecuzione sotto ambienti UNIX e *nix
+ * 	  2) i file inviati sono generati in una cartella temporanea (BENCH_DIR_TEMPLATE) ed eliminati alla fine; gli archivi ricevuti sono scartati
+ *        3) di default ogni giro cambia i primi byte di ogni file, così che né lo store dei contenuti né la cache degli archivi del server >
+ *           > evitino il lavoro; con --repeat i contenuti restano uguali (per misurare proprio quei percorsi)
+ *        4) richiede un server con protocollo 2 o successivo (send a lotti); le funzioni sui socket sono le stesse del client
+ * launch: compressor-bench <host-remoto> <porta> [--sessions N] [--rounds N] [--files K] [--size S] [--codec C] [--level L] >
+ *         > [--data text|random] [--repeat] [--json file]
+*/
+
+/*  STRUTTURA DEL DOCUMENTO:
+		- librerie (base, socket, thread)
+		- macro (messaggi, parametri di default, comandi misurati)
+		- typedef (impronte, configurazione, statistiche, sessioni)
+		- funzioni (impronte, socket, comandi, dati, statistiche, sessioni)
+		- codice processo (compressor-bench)
+*/
+
+
+/*      LIBRERIE    */
+#include <stdio.h>      // librerie base
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>       // per la misura delle latenze
+#include <pthread.h>    // una sessione per thread
+#include <sys/types.h>  // librerie socket
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h> // per TCP_NODELAY e TCP_CORK
+#include <sys/uio.h>     // per l'invio vettoriale (intestazione e dati del frame insieme)
+#include <arpa/inet.h>
+#include <lz4.h>         // compressione dei blocchi inviati (protocollo 5, -llz4)
+#ifndef MSG_MORE
+#define MSG_MORE 0      /* dove mancano (non Linux), i frame partono comunque corretti: cambia solo l'accorpamento */
+#endif
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/*  MACRO  */
+#define MAX_MSG_LEN 200  /* dimensione massima dei messaggi che può inviare il client [uguali nel client] */
+#define CHUNK_SIZE 65536 /* dimensione dei blocchi con cui vengono trasferiti i file */
+#define ARCHIVE_SIZE_UNKNOWN UINT64_MAX /* dimensione dell'archivio prodotto al volo dal server: seguono frame, un frame vuoto e l'esito */
+
+#define VERSION "6.3" /* versione del programma */
+#define PROTOCOL_VERSION 7 /* versione del protocollo proposta al server alla connessione (la stessa del client) */
+#define WIRE_RAW 0   /* (protocollo 5) primo byte di ogni blocco di un file inviato: blocco così com'è [uguali nel server] */
+#define WIRE_LZ4 1   /* blocco compresso con LZ4 (solo se si è ridotto) */
+#define BATCH_NOT_SENT UINT64_MAX /* nel manifesto della send a lotti: file che non verrà inviato */
+#define BATCH_SENT 0           /* esiti per file nel rapporto della send a lotti [uguali nel server] */
+#define BATCH_SKIPPED 1
+#define BATCH_UPLOAD 5         /* (protocollo 3) risposta al manifesto: il server non ha il contenuto, va inviato */
+#define BATCH_STORED 6         /* (protocollo 3) il server aveva già il contenuto: file ricevuto senza trasferimento */
+#define XXH_PRIME1 11400714785074694791ULL /* costanti di XXH64 (impronta dei file per lo store senza duplicati) */
+#define XXH_PRIME2 14029467366897019727ULL
+#define XXH_PRIME3 1609587929392839161ULL
+#define XXH_PRIME4 9650029242287828579ULL
+#define XXH_PRIME5 2870177450012600261ULL
+#define XXH_ROTL(x,r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+#define BENCH_DIR_TEMPLATE "/tmp/compressor-bench.XXXXXX" /* cartella dei file generati (una sottocartella per sessione) */
+#define DEFAULT_SESSIONS 8         /* parametri di default del carico [modificabili da riga di comando] */
+#define DEFAULT_ROUNDS 10          // giri (send + compress) per sessione
+#define DEFAULT_FILES 4            // file per send
+#define DEFAULT_FILE_SIZE (1<<20)  // byte per file
+#define MAX_SESSIONS 1024
+#define MAX_FILES 1000
+#define STAMP_LEN 32               /* byte iniziali di ogni file riscritti ad ogni giro (contenuti sempre nuovi per il server) */
+
+#define OP_CONNECT 0     /* comandi misurati: attesa della connessione (fino all'assegnazione della sessione) .. */
+#define OP_CONFIGURE 1   // .. configure-compressor e configure-level ..
+#define OP_SEND 2        // .. ogni comando send (i file di un giro possono richiederne più di uno: comandi lunghi al massimo MAX_MSG_LEN) ..
+#define OP_COMPRESS 3    // .. compress, fino all'ultimo byte dell'archivio e al resoconto
+#define NUM_OPS 4
+
+#define CYAf   "\x1B[36m"    /* colori */
+#define GREf   "\x1B[32m"         // testo
+#define REDf   "\x1B[31m"
+#define RST    "\033[0m"	    	 // reset
+
+
+/*     NUOVI TIPI       */
+
+typedef struct xxh64_state { /* stato dell'impronta XXH64 calcolata a flusso [uguale nel client e nel server] */
+		uint64_t total;              // byte elaborati finora
+		uint64_t v[4];               // le 4 corsie di accumulo
+		unsigned char mem[32];       // blocco in sospeso (meno di 32 byte)
+		unsigned memsize;
+	} xxh64_state;
+
+typedef struct bench_conf { /* carico da generare (dalla riga di comando), uguale per tutte le sessioni */
+		struct sockaddr_in server;   // indirizzo del server (IPv4)
+		int sessions;                // sessioni contemporanee
+		int rounds;                  // giri per sessione
+		int files;                   // file per giro
+		uint64_t size;               // byte per file
+		char codec[64];              // compressore da configurare ("" = quello di default del server)
+		char level[16];              // livello da configurare ("" = nessuno)
+		int random;                  // contenuti: 0-testo (comprimibile), 1-casuali (incomprimibili)
+		int repeat;                  // 1-stessi contenuti ad ogni giro (store dei contenuti e cache degli archivi del server)
+	} bench_conf;
+
+typedef struct op_stats { /* latenze (ms) di un tipo di comando misurato */
+		double *ms;                  // campioni (riordinati alla fine per i percentili)
+		int n, cap;
+		int errors;                  // comandi falliti (connessione caduta, esito negativo): non entrano nei campioni
+	} op_stats;
+
+typedef struct bench_session { /* una sessione del carico, eseguita da un thread */
+		pthread_t tid;
+		int id;                      // n° della sessione (e della sua sottocartella)
+		const bench_conf *conf;
+		op_stats op[NUM_OPS];
+		uint64_t up_bytes;           // byte dei file inviati con successo
+		uint64_t archive_bytes;      // byte degli archivi ricevuti
+		int rounds_done;             // giri conclusi con successo
+		int proto;                   // protocollo concordato con il server
+	} bench_session;
+
+
+/* FUNZIONI */
+
+// funzioni (5) per l'impronta dei contenuti (XXH64, a flusso) [uguali nel client]
+uint64_t xxh64_round ( uint64_t acc, uint64_t input ) /* passo di rimescolamento di XXH64 su una corsia di 64 bit */
+{
+	acc += input * XXH_PRIME2;
+	acc = XXH_ROTL(acc, 31);
+	return acc * XXH_PRIME1;
+}
+
+void xxh64_init ( xxh64_state *st ) /* prepara [st] per l'impronta di un nuovo contenuto (seme 0) */
+{
+	memset(st, 0, sizeof(*st));
+	st->v[0] = XXH_PRIME1 + XXH_PRIME2;
+	st->v[1] = XXH_PRIME2;
+	st->v[2] = 0;
+	st->v[3] = -XXH_PRIME1;
+}
+
+void xxh64_update ( xxh64_state *st, const void *data, size_t len ) /* aggiunge all'impronta [st] i [len] byte di [data] (a blocchi di 32 byte) */
+{
+	const unsigned char *p = data;
+	size_t fill;
+	int i, j;
+	st->total += len;
+	while (len > 0) {
+		fill = 32 - st->memsize;                // riempio il blocco in sospeso; quando è pieno ne aggiorno le 4 corsie
+		if (fill > len)
+			fill = len;
+		memcpy(st->mem + st->memsize, p, fill);
+		st->memsize += fill;
+		p += fill;
+		len -= fill;
+		if (st->memsize < 32)
+			break;
+		for (i=0; i<4; i++) {
+			uint64_t lane = 0;
+			for (j=7; j>=0; j--)                  // lettura little-endian, indipendente dall'architettura
+				lane = (lane<<8) | st->mem[8*i+j];
+			st->v[i] = xxh64_round(st->v[i], lane);
+		}
+		st->memsize = 0;
+	}
+}
+
+uint64_t xxh64_digest ( const xxh64_state *st ) /* restituisce l'impronta dei byte passati finora a [st] (lo stato non cambia) */
+{
+	uint64_t h, k;
+	const unsigned char *p = st->mem;
+	unsigned left = st->memsize;
+	int i, j;
+	if (st->total >= 32) {
+		h = XXH_ROTL(st->v[0], 1) + XXH_ROTL(st->v[1], 7) + XXH_ROTL(st->v[2], 12) + XXH_ROTL(st->v[3], 18);
+		for (i=0; i<4; i++) {
+			h ^= xxh64_round(0, st->v[i]);
+			h = h * XXH_PRIME1 + XXH_PRIME4;
+		}
+	}
+	else
+		h = XXH_PRIME5;
+	h += st->total;
+	for (; left >= 8; left -= 8, p += 8) {      // coda: blocchi da 8, da 4 e singoli byte
+		for (k=0, j=7; j>=0; j--)
+			k = (k<<8) | p[j];
+		h ^= xxh64_round(0, k);
+		h = XXH_ROTL(h, 27) * XXH_PRIME1 + XXH_PRIME4;
+	}
+	if (left >= 4) {
+		for (k=0, j=3; j>=0; j--)
+			k = (k<<8) | p[j];
+		h ^= k * XXH_PRIME1;
+		h = XXH_ROTL(h, 23) * XXH_PRIME2 + XXH_PRIME3;
+		left -= 4;
+		p += 4;
+	}
+	for (; left > 0; left--, p++) {
+		h ^= (*p) * XXH_PRIME5;
+		h = XXH_ROTL(h, 11) * XXH_PRIME1;
+	}
+	h ^= h >> 33;                               // rimescolamento finale
+	h *= XXH_PRIME2;
+	h ^= h >> 29;
+	h *= XXH_PRIME3;
+	h ^= h >> 32;
+	return h;
+}
+
+int hash_file ( const char *path, uint64_t size, uint64_t *hash ) /* calcola in [hash] l'impronta XXH64 dei [size] byte del file [path]: 1-ok, 0-errore */
+{
+	char buf[CHUNK_SIZE];
+	xxh64_state st;
+	uint64_t done = 0;
+	size_t n;
+	FILE *fp = fopen(path, "rb");
+	if (fp==NULL)
+		return 0;
+	xxh64_init(&st);
+	while (done < size && (n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+		xxh64_update(&st, buf, n);
+		done += n;
+	}
+	fclose(fp);
+	*hash = xxh64_digest(&st);
+	return done==size;
+}
+
+// funzioni (9) sui socket: 1-ok, 0-errore [SendFrame, SendData, RecvAll, ReceiveData, ReceiveChunk, SetNoDelay, SetCork uguali nel client, SendStream nel client legge i blocchi tramite una funzione]
+int SendFrame ( int sock, const void *data, size_t dim, int more ) /* invio a [sock] il frame (intestazione + [dim] byte di [data]) con un'unica > */
+{     /* > sendmsg vettoriale, riprendendo dopo gli invii parziali; [more]=1 se seguono subito altri frame (MSG_MORE: il kernel li accorpa) */
+    int len = dim;
+    struct iovec iov[2];
+    struct msghdr mh;
+    ssize_t n;
+    iov[0].iov_base = &len;                 // intestazione: dimensione dei dati (int)
+    iov[0].iov_len = sizeof(int);
+    iov[1].iov_base = (void*)data;
+    iov[1].iov_len = dim;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = iov;
+    mh.msg_iovlen = (dim>0) ? 2 : 1;
+    while (mh.msg_iovlen > 0) {
+        n = sendmsg(sock, &mh, MSG_NOSIGNAL | (more ? MSG_MORE : 0)); // MSG_NOSIGNAL: un peer caduto dà un errore, non SIGPIPE
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return 0;
+        }
+        while (n > 0 && mh.msg_iovlen > 0) {  // invio parziale: avanzo gli iovec di quanto è già partito
+            if ((size_t)n >= mh.msg_iov[0].iov_len) {
+                n -= mh.msg_iov[0].iov_len;
+                mh.msg_iov++;
+                mh.msg_iovlen--;
+            }
+            else {
+                mh.msg_iov[0].iov_base = (char*)mh.msg_iov[0].iov_base + n;
+                mh.msg_iov[0].iov_len -= n;
+                n = 0;
+            }
+        }
+        while (mh.msg_iovlen > 0 && mh.msg_iov[0].iov_len == 0) {
+            mh.msg_iov++;
+            mh.msg_iovlen--;
+        }
+    }
+    return 1;
+}
+
+int SendData ( int sock, const void *data, size_t dim ) /* invio la quantita' [dim] di dati puntati da [data] a [sock] (un frame: intestazione e dati insieme) */
+{
+    return SendFrame(sock, data, dim, 0);
+}
+
+int RecvAll ( int sock, void *buf, size_t len ) /* ricevo da [sock] esattamente [len] byte in [buf], gestendo letture parziali e interruzioni */
+{
+    size_t total = 0;
+    ssize_t n;
+    while (total < len) {
+        n = recv(sock, (char*)buf+total, len-total, MSG_WAITALL);
+        if (n > 0) {
+            total += n;
+            continue;
+        }
+        if (n == -1 && errno == EINTR)
+            continue;
+        return 0;                             // errore o connessione chiusa dall'altro capo
+    }
+    return 1;
+}
+
+int ReceiveData ( int sock, void *data, int *len ) /* ricevo da [sock] mettendo dove punta [data]; ne scrivo la quantita' dove punta [len], se non è NULL */
+{
+    int dim;
+    if ( ! RecvAll(sock, &dim, sizeof(int)) || dim<0 ) // ricevo la dimensione dei dati che saranno spediti
+        return 0;
+    if ( ! RecvAll(sock, data, dim) )                 // ricevo finche' non ho avuto tutti i dati
+        return 0;
+    if (len!=NULL)       			         // in molti casi il ricevente sa di certo quanti dati arrivano e quindi mette NULL a [3°arg]
+        *len=dim;
+    return 1;
+}
+
+int ReceiveChunk ( int sock, void *buf, int maxlen, int *len ) /* come ReceiveData, ma rifiuta (0) i blocchi più grandi di [maxlen] byte */
+{
+    int dim;
+    if ( ! RecvAll(sock, &dim, sizeof(int)) || dim<0 || dim>maxlen )
+        return 0;
+    if ( ! RecvAll(sock, buf, dim) )
+        return 0;
+    *len = dim;
+    return 1;
+}
+
+void SetNoDelay ( int sock ) /* disattiva Nagle su [sock]: i frame di controllo (comandi, risposte brevi) partono subito, senza attese di ACK ritardati */
+{
+    int on = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+
+void SetCork ( int sock, int on ) /* [on]=1: durante i trasferimenti di massa il kernel invia solo segmenti pieni; [on]=0 li svuota */
+{
+#ifdef TCP_CORK
+    setsockopt(sock, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+#endif
+}
+
+int SendStream (int sock, FILE *fp, uint64_t size, int wire) /* invia a [sock] i [size] byte letti da [fp], un blocco (frame SendData) di > */
+{      /* > CHUNK_SIZE alla volta; con [wire] (protocollo 5) ogni blocco è preceduto dal suo formato (WIRE_*) e viaggia compresso con LZ4 se > */
+       /* > si riduce. 1-ok, 0-errore sul socket, -1-errore di lettura (il server è avvisato con un blocco vuoto) */
+    char buf[1+CHUNK_SIZE], lz[1+CHUNK_SIZE]; // buffer fissi: la memoria usata non dipende dalla dimensione del file
+    uint64_t sent = 0;
+    size_t n, want;
+    int c, more;
+    buf[0] = WIRE_RAW;
+    lz[0] = WIRE_LZ4;
+    while (sent < size) {
+        want = (size-sent > CHUNK_SIZE) ? CHUNK_SIZE : (size_t)(size-sent);
+        n = fread(buf+1, 1, want, fp);
+        if (n == 0) {                                 // il file si è accorciato o non è più leggibile: il blocco vuoto interrompe il trasferimento
+            if ( ! SendData(sock, buf, 0) )
+                return 0;
+            return -1;
+        }
+        more = (sent+n < size);                       // MSG_MORE fino all'ultimo blocco: il kernel riempie i segmenti
+        if (!wire)
+            c = SendFrame(sock, buf+1, n, more);
+        else if ( (c = LZ4_compress_default(buf+1, lz+1, n, n-1)) > 0 ) // un blocco che non si riduce (già compresso, casuale) fallisce subito..
+            c = SendFrame(sock, lz, c+1, more);
+        else
+            c = SendFrame(sock, buf, n+1, more);      // .. e parte così com'è
+        if (!c)
+            return 0;
+        sent += n;
+    }
+    return 1;
+}
+
+int ReceiveArchive (int sock, uint64_t size, uint64_t *got) /* riceve da [sock] e scarta un archivio di [size] byte grezzi o, se la dimensione > */
+{                           /* > è ignota, a frame fino a uno vuoto e all'esito del server; ne somma i byte in [got]. 1-ok, 0-errore sul socket, > */
+                            /* > -1-archivio fallito sul server */
+    char buf[CHUNK_SIZE];
+    uint64_t total = 0;
+    int n, esito;
+    if (size!=ARCHIVE_SIZE_UNKNOWN) {
+        while (total < size) {
+            n = recv(sock, buf, (size-total > CHUNK_SIZE) ? CHUNK_SIZE : (size_t)(size-total), 0);
+            if (n <= 0)
+                return 0;
+            total += n;
+        }
+        *got += total;
+        return 1;
+    }
+    while (1) {
+        if ( ! ReceiveChunk(sock, buf, CHUNK_SIZE, &n) )
+            return 0;
+        if (n == 0)                       // fine dello stream
+            break;
+        total += n;
+    }
+    if ( ! ReceiveData(sock, &esito, NULL) )
+        return 0;
+    *got += total;
+    return (esito==1) ? 1 : -1;
+}
+
+// funzioni (5) che eseguono i comandi di una sessione (lo stesso protocollo del client, senza stampe): 1-ok, 0-connessione caduta, -1-comando fallito
+int bCOMMAND (int sock, const char *cmd, int *choice) /* invia il comando [cmd] e riceve in [choice] il suo n° d'ordine (passi 2 e 3 del client) */
+{
+	return SendData(sock, cmd, strlen(cmd)) && ReceiveData(sock, choice, NULL);
+}
+
+int bMESSAGE (int sock, const char *cmd, int expected) /* comando [cmd] a cui il server risponde con un solo messaggio (configure-*): -1 se il > */
+{                                                      /* > server non lo riconosce come il comando [expected] */
+	char msg[MAX_MSG_LEN*5];
+	int choice;
+	if ( ! bCOMMAND(sock, cmd, &choice) || ! ReceiveData(sock, msg, NULL) )
+		return 0;
+	return (choice==expected) ? 1 : -1;
+}
+
+int bSENDBATCH (int sock, int n, int proto, uint64_t *up) /* invio a lotti di [n] file (come cSENDBATCH del client); in [up] i byte dei file > */
+{                                                          /* > ricevuti dal server. -1 se qualche file non è stato ricevuto */
+	char list_msg[MAX_MSG_LEN+1], *path[n], *q;
+	uint64_t size[n], manifest[2*n], offset[n];
+	int status[n+1], i, k, Bs_rcvd, per_file = (proto>=3) ? 2 : 1, rc = 1;
+	struct stat inf;
+	FILE *fp;
+	if ( ! ReceiveData (sock, &list_msg, &Bs_rcvd) )   	// 1) elenco dei path da inviare (separati da '\n')
+		return 0;
+	list_msg[Bs_rcvd]='\0';
+	for (i=0, q=list_msg; i<n; i++) {
+		path[i] = q;
+		q = strchr(q, '\n');
+		if (q!=NULL)
+			*q++ = '\0';
+		else if (i<n-1)
+			q = list_msg+Bs_rcvd;
+		size[i] = (stat(path[i], &inf)==0 && S_ISREG(inf.st_mode)) ? (uint64_t)inf.st_size : BATCH_NOT_SENT;
+		manifest[i*per_file] = size[i];
+		if (proto>=3) {
+			manifest[i*per_file+1] = 0;
+			if (size[i]!=BATCH_NOT_SENT)
+				hash_file(path[i], size[i], &manifest[i*per_file+1]);
+		}
+		status[i] = (size[i]==BATCH_NOT_SENT) ? BATCH_SKIPPED : BATCH_UPLOAD;
+	}
+	if ( ! SendData(sock, manifest, n*per_file*sizeof(uint64_t)) ) // 2) manifesto ..
+		return 0;
+	if ( proto>=3 && ! ReceiveData(sock, status, NULL) )         // 2b) .. contenuti che il server non ha ..
+		return 0;
+	memset(offset, 0, sizeof(offset));
+	if ( proto>=4 && ! ReceiveData(sock, offset, NULL) )         // .. e da quale byte inviarli
+		return 0;
+	SetCork(sock, 1);
+	for (i=0; i<n; i++) {                                      // 3) contenuti, uno dopo l'altro
+		if (status[i]!=BATCH_UPLOAD || size[i]==0)
+			continue;
+		fp = fopen(path[i], "rb");
+		if (fp!=NULL && offset[i]>0 && fseeko(fp, offset[i], SEEK_SET)!=0) {
+			fclose(fp);
+			fp = NULL;
+		}
+		if (fp==NULL) {
+			if ( ! SendData(sock, list_msg, 0) )
+				return 0;
+			continue;
+		}
+		k = SendStream(sock, fp, size[i]-offset[i], proto>=5);
+		fclose(fp);
+		if (k==0)
+			return 0;
+	}
+	SetCork(sock, 0);
+	if ( ! ReceiveData(sock, status, NULL) )                  // 4) rapporto: esito di ogni file
+		return 0;
+	for (i=0; i<n; i++)
+		if (status[i]==BATCH_SENT || status[i]==BATCH_STORED)
+			*up += size[i];
+		else
+			rc = -1;
+	return rc;
+}
+
+int bSEND (int sock, const char *cmd, int proto, uint64_t *up) /* comando send [cmd] (i file sono inviati con bSENDBATCH) */
+{
+	int choice, counter;
+	if ( ! bCOMMAND(sock, cmd, &choice) )
+		return 0;
+	if (choice!=5) {                               // non è stato riconosciuto come send: ne scarto il messaggio
+		char msg[MAX_MSG_LEN*5];
+		return ReceiveData(sock, msg, NULL) ? -1 : 0;
+	}
+	if ( ! ReceiveData(sock, &counter, NULL) )     // 0) n° di file che il server si aspetta
+		return 0;
+	if (counter==0)
+		return -1;
+	return bSENDBATCH(sock, counter, proto, up);
+}
+
+int bCOMPRESS (int sock, int proto, uint64_t *archive) /* comando compress (come cCOMPRESS del client): l'archivio è ricevuto e scartato, e > */
+{                                                      /* > in [archive] se ne sommano i byte */
+	char msg[MAX_MSG_LEN*5];
+	int choice, y, risp = 1;
+	uint64_t size, have = 0, from = 0;
+	if ( ! bCOMMAND(sock, "compress .", &choice) )
+		return 0;
+	if (choice!=6)
+		return ReceiveData(sock, msg, NULL) ? -1 : 0;
+	if ( ! ReceiveData(sock, &y, NULL) )           // 0) file inviati al server
+		return 0;
+	if (y==0)
+		return -1;
+	if ( ! ReceiveData(sock, msg, NULL) || ! ReceiveData(sock, msg, NULL) ) // 1) nome dell'archivio, 2) cartella dove salvarlo ..
+		return 0;
+	if ( ! SendData(sock, &risp, sizeof(int)) )    // 3) .. sempre accessibile: l'archivio non viene salvato
+		return 0;
+	if (proto>=4) {                                 // 3b) chiave dell'archivio e byte già ricevuti (nessuno: niente riprese)
+		uint64_t key;
+		if ( ! ReceiveData(sock, &key, NULL) || ! SendData(sock, &have, sizeof(uint64_t)) )
+			return 0;
+	}
+	if ( ! ReceiveData(sock, &y, NULL) )           // 4) archivio pronto?
+		return 0;
+	if (y==0)
+		return -1;
+	if ( ! ReceiveData(sock, &size, NULL) )        // 5) dimensione (o ARCHIVE_SIZE_UNKNOWN) ..
+		return 0;
+	if ( proto>=4 && size!=ARCHIVE_SIZE_UNKNOWN && ! ReceiveData(sock, &from, NULL) ) // 5b) .. e byte da cui riparte l'invio
+		return 0;
+	y = ReceiveArchive(sock, (size==ARCHIVE_SIZE_UNKNOWN) ? size : size-from, archive); // 6) contenuto
+	if (y==0)
+		return 0;
+	risp = (y==1);
+	if ( ! SendData(sock, &risp, sizeof(int)) )    // 7) esito lato client
+		return 0;
+	if ( risp && proto>=6 && ! ReceiveData(sock, msg, NULL) ) // 8) resoconto della scelta automatica
+		return 0;
+	return risp ? 1 : -1;
+}
+
+// funzioni (3) sui file generati per il carico
+uint64_t xorshift ( uint64_t *s ) /* generatore pseudo-casuale (xorshift64): ogni sessione ha il suo stato [s], i thread non condividono nulla */
+{
+	*s ^= *s << 13;
+	*s ^= *s >> 7;
+	*s ^= *s << 17;
+	return *s;
+}
+
+int make_files ( const bench_conf *conf, int id ) /* crea la cartella "[id]" con conf->files file da conf->size byte (testo o casuali): 1-ok, 0-errore */
+{
+	static const char *words[] = { "server", "client", "archivio", "compressione", "sessione", "thread", "socket", "blocco",
+	                               "file", "richiesta", "risposta", "errore", "connessione", "protocollo", "pool", "coda" };
+	char path[32], buf[CHUNK_SIZE], word[32];
+	uint64_t s = 0x9E3779B97F4A7C15ULL * (id+1), done, r;
+	size_t n, w, m;
+	int i;
+	FILE *fp;
+	sprintf(path, "%d", id);
+	if ( mkdir(path, 0700)!=0 && errno!=EEXIST )
+		return 0;
+	for (i=0; i<conf->files; i++) {
+		sprintf(path, "%d/%d", id, i);
+		fp = fopen(path, "wb");
+		if (fp==NULL)
+			return 0;
+		for (done=0; done<conf->size; done+=n) {
+			n = (conf->size-done > CHUNK_SIZE) ? CHUNK_SIZE : (size_t)(conf->size-done);
+			for (w=0; w<n; ) {
+				r = xorshift(&s);
+				if (conf->random) {              // 8 byte casuali alla volta
+					memcpy(word, &r, 8);
+					m = 8;
+				}
+				else if ((r>>40)%7==0)           // parole da un piccolo vocabolario, con un numero ogni tanto e righe di lunghezza variabile
+					m = sprintf(word, "%s %u%c", words[r%16], (unsigned)(r>>48), (r>>32)%11==0 ? '\n' : ' ');
+				else
+					m = sprintf(word, "%s%c", words[r%16], (r>>32)%11==0 ? '\n' : ' ');
+				if (m > n-w)                     // l'ultima parola del blocco può restare a metà
+					m = n-w;
+				memcpy(buf+w, word, m);
+				w += m;
+			}
+			if ( fwrite(buf, 1, n, fp)!=n ) {
+				fclose(fp);
+				return 0;
+			}
+		}
+		if ( fclose(fp)!=0 )
+			return 0;
+	}
+	return 1;
+}
+
+int stamp_files ( const bench_conf *conf, int id, int round ) /* riscrive i primi STAMP_LEN byte dei file della sessione [id] con il giro [round]: > */
+{                                                          /* > i contenuti cambiano (impronte nuove), la comprimibilità no. 1-ok, 0-errore */
+	char path[32], stamp[STAMP_LEN+1];
+	int i, m;
+	size_t n = (conf->size < STAMP_LEN) ? (size_t)conf->size : STAMP_LEN;
+	FILE *fp;
+	for (i=0; i<conf->files && n>0; i++) {
+		sprintf(path, "%d/%d", id, i);
+		fp = fopen(path, "r+b");
+		if (fp==NULL)
+			return 0;
+		memset(stamp, '.', STAMP_LEN);
+		m = snprintf(stamp, sizeof(stamp), "giro %d sess %d file %d", round, id, i);
+		stamp[(m < STAMP_LEN) ? m : STAMP_LEN-1] = '\n';      // il resto fino a STAMP_LEN resta a '.'
+		if ( fwrite(stamp, 1, n, fp)!=n ) {
+			fclose(fp);
+			return 0;
+		}
+		if ( fclose(fp)!=0 )
+			return 0;
+	}
+	return 1;
+}
+
+// funzioni (5) per le statistiche e i risultati
+double now_ms ( void ) /* istante attuale (orologio monotono) in millisecondi */
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec*1e3 + t.tv_nsec/1e6;
+}
+
+void op_add ( op_stats *o, double ms, int ok ) /* aggiunge a [o] un comando durato [ms] millisecondi, riuscito ([ok]=1) o no */
+{
+	if (!ok) {
+		o->errors++;
+		return;
+	}
+	if (o->n==o->cap) {
+		double *m = realloc(o->ms, (o->cap ? 2*o->cap : 64)*sizeof(double));
+		if (m==NULL)                       // campione perso, ma il comando resta misurato come riuscito nel throughput
+			return;
+		o->ms = m;
+		o->cap = o->cap ? 2*o->cap : 64;
+	}
+	o->ms[o->n++] = ms;
+}
+
+int cmp_double ( const void *a, const void *b ) /* confronto per qsort dei campioni */
+{
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x>y) - (x<y);
+}
+
+double percentile ( const op_stats *o, int permille ) /* percentile [permille]/1000 (rango più vicino) dei campioni già ordinati di [o] */
+{
+	int k = (o->n*permille + 999) / 1000;
+	if (o->n==0)
+		return 0;
+	return o->ms[(k<1) ? 0 : k-1];
+}
+
+void report ( const bench_conf *conf, op_stats *op, double seconds, uint64_t up, uint64_t archive, int rounds, int proto, const char *json ) /* > */
+{   /* > stampa la tabella dei risultati e, se [json] non è NULL, li scrive in JSON nel file [json] ("-": standard output) */
+	static const char *names[NUM_OPS] = { "connect", "configure", "send", "compress" };
+	double sum;
+	int i, j;
+	FILE *fp = NULL;
+	for (i=0; i<NUM_OPS; i++)
+		qsort(op[i].ms, op[i].n, sizeof(double), cmp_double);
+	printf(CYAf"\n%d sessioni x %d giri, %d file da %llu byte (%s) per giro, compressore %s, protocollo %d: %.2f s"RST"\n",
+	       conf->sessions, conf->rounds, conf->files, (unsigned long long)conf->size, conf->random ? "casuali" : "testo",
+	       conf->codec[0] ? conf->codec : "di default", proto, seconds);
+	printf("%-10s %8s %7s %10s %10s %10s %10s %10s\n", "comando", "n", "errori", "p50 ms", "p99 ms", "p999 ms", "max ms", "medio ms");
+	for (i=0; i<NUM_OPS; i++) {
+		if (op[i].n==0 && op[i].errors==0)
+			continue;
+		for (sum=0, j=0; j<op[i].n; j++)
+			sum += op[i].ms[j];
+		printf("%-10s %8d %7d %10.3f %10.3f %10.3f %10.3f %10.3f\n", names[i], op[i].n, op[i].errors, percentile(&op[i], 500),
+		       percentile(&op[i], 990), percentile(&op[i], 999), op[i].n ? op[i].ms[op[i].n-1] : 0, op[i].n ? sum/op[i].n : 0);
+	}
+	printf("throughput: "GREf"%.2f"RST" MiB/s inviati, "GREf"%.2f"RST" MiB/s di archivi ricevuti, "GREf"%.2f"RST" giri/s (%d giri conclusi)\n",
+	       up/seconds/(1<<20), archive/seconds/(1<<20), rounds/seconds, rounds);
+	if (json==NULL)
+		return;
+	fp = (strcmp(json, "-")==0) ? stdout : fopen(json, "w");
+	if (fp==NULL) {
+		fprintf(stderr, REDf"- %s: impossibile scrivere i risultati."RST"\n", json);
+		return;
+	}
+	fprintf(fp, "{\"version\":\"%s\",\"protocol\":%d,\"sessions\":%d,\"rounds\":%d,\"files\":%d,\"size\":%llu,\"data\":\"%s\",\"repeat\":%s,"
+	        "\"codec\":\"%s\",\"level\":\"%s\",\"seconds\":%.6f,\"upload_bytes\":%llu,\"archive_bytes\":%llu,\"rounds_done\":%d,"
+	        "\"upload_mib_s\":%.3f,\"archive_mib_s\":%.3f,\"rounds_s\":%.3f,\"commands\":{",
+	        VERSION, proto, conf->sessions, conf->rounds, conf->files, (unsigned long long)conf->size, conf->random ? "random" : "text",
+	        conf->repeat ? "true" : "false", conf->codec, conf->level, seconds, (unsigned long long)up, (unsigned long long)archive,
+	        rounds, up/seconds/(1<<20), archive/seconds/(1<<20), rounds/seconds);
+	for (i=0; i<NUM_OPS; i++) {
+		for (sum=0, j=0; j<op[i].n; j++)
+			sum += op[i].ms[j];
+		fprintf(fp, "%s\"%s\":{\"count\":%d,\"errors\":%d,\"p50_ms\":%.3f,\"p99_ms\":%.3f,\"p999_ms\":%.3f,\"max_ms\":%.3f,\"mean_ms\":%.3f}",
+		        i ? "," : "", names[i], op[i].n, op[i].errors, percentile(&op[i], 500), percentile(&op[i], 990), percentile(&op[i], 999),
+		        op[i].n ? op[i].ms[op[i].n-1] : 0, op[i].n ? sum/op[i].n : 0);
+	}
+	fprintf(fp, "}}\n");
+	if (fp!=stdout)
+		fclose(fp);
+}
+
+// funzioni (1) eseguite dai thread delle sessioni
+void *BenchSession ( void *arg ) /* una sessione del carico: connessione, configurazione, conf->rounds giri di send e compress, quit */
+{
+	bench_session *b = arg;
+	const bench_conf *conf = b->conf;
+	char cmd[MAX_MSG_LEN], item[32];
+	uint64_t token = 0;
+	double t;
+	int sock, c, v, r, i, len, ok;
+	t = now_ms();
+	sock = socket(PF_INET, SOCK_STREAM, 0);
+	if ( sock==-1 || connect(sock, (const struct sockaddr*)&conf->server, sizeof(struct sockaddr_in))!=0 ) {
+		op_add(&b->op[OP_CONNECT], 0, 0);
+		if (sock!=-1)
+			close(sock);
+		return NULL;
+	}
+	SetNoDelay(sock);
+	ok = ReceiveData(sock, &c, NULL);             // 1) il server assegna la sessione: fin qui è l'attesa della connessione
+	op_add(&b->op[OP_CONNECT], now_ms()-t, ok);
+	if (!ok)
+		goto out;
+	sprintf(cmd, "protocol %d", PROTOCOL_VERSION); // 1b) versione del protocollo (come negotiate_protocol del client, sessione sempre nuova)
+	if ( ! bCOMMAND(sock, cmd, &c) )
+		goto out;
+	if (c!=11 || ! ReceiveData(sock, &b->proto, NULL) || b->proto<2) { // un server vecchio risponde con un messaggio d'errore
+		fprintf(stderr, REDf"- Sessione %d: il server non supporta la send a lotti (protocollo 2)."RST"\n", b->id);
+		goto out;
+	}
+	if ( b->proto>=4 && (! SendData(sock, &token, sizeof(uint64_t)) || ! ReceiveData(sock, &token, NULL) || ! ReceiveData(sock, &c, NULL)) )
+		goto out;
+	if (conf->codec[0]) {                          // configurazione della sessione (misurata come un comando)
+		snprintf(cmd, sizeof(cmd), "configure-compressor %s", conf->codec);
+		t = now_ms();
+		ok = bMESSAGE(sock, cmd, 2);
+		op_add(&b->op[OP_CONFIGURE], now_ms()-t, ok==1);
+		if (ok==0)
+			goto out;
+	}
+	if (conf->level[0]) {
+		snprintf(cmd, sizeof(cmd), "configure-level %s", conf->level);
+		t = now_ms();
+		ok = bMESSAGE(sock, cmd, 12);
+		op_add(&b->op[OP_CONFIGURE], now_ms()-t, ok==1);
+		if (ok==0)
+			goto out;
+	}
+	for (r=0; r<conf->rounds; r++) {
+		if ( !conf->repeat && ! stamp_files(conf, b->id, r) ) {
+			fprintf(stderr, REDf"- Sessione %d: impossibile aggiornare i file da inviare."RST"\n", b->id);
+			break;
+		}
+		for (i=0; i<conf->files; ) {               // send: quanti più file possibile per comando (al massimo MAX_MSG_LEN-1 caratteri)
+			strcpy(cmd, "send");
+			len = 4;
+			while (i<conf->files) {
+				v = sprintf(item, " %d/%d", b->id, i);
+				if (len+v > MAX_MSG_LEN-1)
+					break;
+				strcpy(cmd+len, item);
+				len += v;
+				i++;
+			}
+			t = now_ms();
+			ok = bSEND(sock, cmd, b->proto, &b->up_bytes);
+			op_add(&b->op[OP_SEND], now_ms()-t, ok==1);
+			if (ok==0)
+				goto out;
+		}
+		t = now_ms();
+		ok = bCOMPRESS(sock, b->proto, &b->archive_bytes);
+		op_add(&b->op[OP_COMPRESS], now_ms()-t, ok==1);
+		if (ok==0)
+			goto out;
+		if (ok==1)
+			b->rounds_done++;
+		else if ( ! bMESSAGE(sock, "empty-list", 8) ) // compress fallita: i file rimasti sul server non devono finire nel giro dopo
+			goto out;
+	}
+	if ( bCOMMAND(sock, "quit", &c) )
+		shutdown(sock, SHUT_RDWR);
+out:
+	close(sock);
+	return NULL;
+}
+
+  // MAIN
+int main ( int argc, char* argv[] )   /* compressor-bench <host remoto> <porta> [opzioni]: genera il carico e ne stampa i risultati */
+{
+	bench_conf conf;
+	bench_session *s;
+	op_stats all[NUM_OPS];
+	char dir[] = BENCH_DIR_TEMPLATE, path[32], *json = NULL, *end;
+	uint64_t up = 0, archive = 0;
+	double t;
+	int i, j, port, started, rounds = 0, proto = 0, bad = 0;
+	memset(&conf, 0, sizeof(conf));
+	conf.sessions = DEFAULT_SESSIONS;
+	conf.rounds = DEFAULT_ROUNDS;
+	conf.files = DEFAULT_FILES;
+	conf.size = DEFAULT_FILE_SIZE;
+	for (i=3; i<argc && !bad; i++) {               // opzioni: tutte con un valore, tranne --repeat
+		if (strcmp(argv[i], "--repeat")==0)
+			conf.repeat = 1;
+		else if (i+1>=argc)
+			bad = 1;
+		else if (strcmp(argv[i], "--sessions")==0)
+			conf.sessions = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--rounds")==0)
+			conf.rounds = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--files")==0)
+			conf.files = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--size")==0) {   // byte, oppure con suffisso k, m o g (KiB, MiB, GiB)
+			conf.size = strtoull(argv[++i], &end, 10);
+			if (*end=='k' || *end=='K')
+				conf.size <<= 10;
+			else if (*end=='m' || *end=='M')
+				conf.size <<= 20;
+			else if (*end=='g' || *end=='G')
+				conf.size <<= 30;
+			else if (*end!='\0')
+				bad = 1;
+		}
+		else if (strcmp(argv[i], "--codec")==0)
+			snprintf(conf.codec, sizeof(conf.codec), "%s", argv[++i]);
+		else if (strcmp(argv[i], "--level")==0)
+			snprintf(conf.level, sizeof(conf.level), "%s", argv[++i]);
+		else if (strcmp(argv[i], "--data")==0) {
+			i++;
+			conf.random = (strcmp(argv[i], "random")==0);
+			bad = !conf.random && strcmp(argv[i], "text")!=0;
+		}
+		else if (strcmp(argv[i], "--json")==0)
+			json = argv[++i];
+		else
+			bad = 1;
+	}
+	if ( argc<3 || bad || conf.sessions<1 || conf.sessions>MAX_SESSIONS || conf.rounds<1 || conf.files<1 || conf.files>MAX_FILES ) {
+		fprintf(stderr, REDf"\nUso: compressor-bench <host-remoto> <porta> [--sessions N] [--rounds N] [--files K] [--size S[k|m|g]] "
+		        "[--codec C] [--level L] [--data text|random] [--repeat] [--json file]\n(sessioni da 1 a %d, file per giro da 1 a %d)"RST"\n\n",
+		        MAX_SESSIONS, MAX_FILES);
+		return 1;
+	}
+	port = atoi(argv[2]);
+	if ( (port<1024)||(port>65535) ) {
+		fprintf(stderr, REDf"\nNumero porta non valido (intero compreso tra 1024 e 65535)."RST"\n\n");
+		return 1;
+	}
+	conf.server.sin_family = AF_INET;
+	conf.server.sin_port = htons(port);
+	if ( inet_pton(AF_INET, strcmp(argv[1],"localhost")==0 ? "127.0.0.1" : argv[1], &conf.server.sin_addr)!=1 ) {
+		fprintf(stderr, REDf"\nIndirizzo IPv4 non valido (quattro numeri tra 0 e 255 separati da punto)."RST"\n\n");
+		return 1;
+	}
+	if ( mkdtemp(dir)==NULL || chdir(dir)!=0 ) {    // i path relativi ("sessione/file") tengono corti i comandi send
+		fprintf(stderr, REDf"Impossibile creare la cartella dei file da inviare."RST"\n");
+		return 1;
+	}
+	s = calloc(conf.sessions, sizeof(bench_session));
+	if (s==NULL)
+		return 1;
+	printf(CYAf"Preparazione di %d x %d file in "GREf"%s"CYAf"..."RST"\n", conf.sessions, conf.files, dir);
+	for (i=0; i<conf.sessions && !bad; i++)
+		bad = !make_files(&conf, i);
+	if (bad)
+		fprintf(stderr, REDf"Impossibile creare i file da inviare."RST"\n");
+	else {
+		t = now_ms();
+		for (i=0; i<conf.sessions; i++) {
+			s[i].id = i;
+			s[i].conf = &conf;
+			if ( pthread_create(&s[i].tid, NULL, BenchSession, &s[i])!=0 ) {
+				fprintf(stderr, REDf"Impossibile creare il thread della sessione %d."RST"\n", i);
+				break;
+			}
+		}
+		started = i;                               // sessioni effettivamente avviate
+		for (i=0; i<started; i++)
+			pthread_join(s[i].tid, NULL);
+		t = (now_ms()-t)/1e3;
+		memset(all, 0, sizeof(all));
+		for (i=0; i<started; i++) {          // unisco le statistiche delle sessioni
+			for (j=0; j<NUM_OPS; j++) {
+				op_stats *o = &s[i].op[j];
+				int k;
+				for (k=0; k<o->n; k++)
+					op_add(&all[j], o->ms[k], 1);
+				all[j].errors += o->errors;
+				free(o->ms);
+			}
+			up += s[i].up_bytes;
+			archive += s[i].archive_bytes;
+			rounds += s[i].rounds_done;
+			if (s[i].proto>proto)
+				proto = s[i].proto;
+		}
+		report(&conf, all, t>0 ? t : 1e-9, up, archive, rounds, proto, json);
+		for (j=0; j<NUM_OPS; j++)
+			free(all[j].ms);
+	}
+	for (i=0; i<conf.sessions; i++) {              // elimino i file generati
+		for (j=0; j<conf.files; j++) {
+			sprintf(path, "%d/%d", i, j);
+			unlink(path);
+		}
+		sprintf(path, "%d", i);
+		rmdir(path);
+	}
+	if ( chdir("/")==0 )
+		rmdir(dir);
+	free(s);
+	return bad;
+}
@@ -9,21 +9,36 @@
  * 					- paradigma client-server
  * 					- server concorrente multi-threaded (thread POSIX)
  * 					- comunicazione tramite Berkeley socket TCP ("stream")
- * 				   - compressione tramite il comando "tar"
+ * 				   - compressione sul server (archivio tar prodotto in-process e ricevuto mentre viene creato)
  * 					- utilizzo dei segnali (ISO C library signals)
  * 					- utilizzo delle espressioni regolari (POSIX ERE)
  * language: Italian (program, comments), English (code)
  * notes: 1) programma scritto per l'esecuzione sotto ambienti UNIX e *nix
  * 	  2) i client devono conoscere indirizzo (IPv4) e porta sul quale sta in ascolto il server
- *        3) massima dimensione dei file inviabili: 4GiB
- * launch: compressor-client <host-remoto> <porta>          
+ *        3) i file sono inviati a blocchi di CHUNK_SIZE byte, con dimensioni a 64 bit (nessun limite pratico alla dimensione)
+ *        4) con i server che lo supportano (protocollo 2) una send di più file è un unico scambio: manifesto e contenuti di seguito, poi un solo rapporto
+ *        5) dal protocollo 3 il manifesto porta l'impronta (XXH64) di ogni file: i contenuti che il server ha già nel suo store non vengono trasferiti
+ *        6) dal protocollo 4, se la connessione cade, il client si riconnette e riprende la sessione (token); una send o una compress interrotte >
+ *           > vengono ripetute e riprendono dall'ultimo byte ricevuto
+ *        7) dal protocollo 5 i blocchi dei file inviati viaggiano compressi con LZ4 (se si riducono; altrimenti così come sono)
+ *        8) dal protocollo 6, con "configure-compressor auto", la compress riporta il compressore scelto dal server con le previsioni e i valori effettivi
+ *        9) dal protocollo 7 c'è il comando configure-level (livello di compressione, per tutti i compressori)
+ *       10) modalità batch (non interattiva) con --send e/o --manifest: configurazione, send, compress e quit senza prompt, con i file letti in >
+ *           > anticipo da un piccolo pool di thread di I/O; il codice d'uscita riporta l'esito (vedi macro "EXIT_..")
+ *       11) compilare con l'opzione "-pthread" (pool di lettura anticipata e invio su più connessioni) e linkare lz4 ("-llz4")
+ *       12) dal protocollo 9, con --streams k, la sessione ha k-1 connessioni dati oltre a quella dei comandi (attach): la send vi distribuisce >
+ *           > i contenuti a pezzi, inviati in parallelo da un thread per connessione, e il server li ricompone
+ *       13) dal protocollo 10 la send accetta anche cartelle: visitate in parallelo dai thread di I/O, con i file piccoli inviati a pacchi; >
+ *           > sul server i file mantengono il percorso relativo (e nell'archivio compaiono sotto il nome della cartella)
+ * launch: compressor-client <host-remoto> <porta> [--latency N | --send file.. | --manifest elenco] [--compressor c] [--level l] [--name n] >
+ *         > [--out cartella] [--io-threads n] [--streams k]
 */
 
 /*  STRUTTURA DEL DOCUMENTO: 
-		- librerie (base, socket)
-		- macro (messaggi, versione, colori)
-		- typedef (archiviazione, lista di nomi)
-		- funzioni (stringhe, socket, funzioni del client)
+		- librerie (base, socket, pthreads)
+		- macro (messaggi, versione, modalità batch, colori)
+		- typedef (impronte, lettura anticipata)
+		- funzioni (stringhe, impronte, socket, lettura anticipata, funzioni del client, modalità batch)
 		- codice processo (compressorclient)
 */
 
@@ -36,15 +51,70 @@
 #include <string.h>
 #include <errno.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <time.h>       // per la misura della latenza (--latency)
 #include <sys/types.h>  // librerie socket
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h> // per TCP_NODELAY e TCP_CORK
+#include <sys/uio.h>     // per l'invio vettoriale (intestazione e dati del frame insieme)
 #include <arpa/inet.h>
+#include <lz4.h>         // compressione dei blocchi inviati (protocollo 5, -llz4)
+#include <pthread.h>     // per il pool di lettura anticipata dei file (modalità batch) e per l'invio su più connessioni
+#include <fcntl.h>       // per la lettura dei pezzi dei file (pread) inviati su più connessioni
+#include <dirent.h>      // per la visita delle cartelle inviate (protocollo 10)
+#ifndef MSG_MORE
+#define MSG_MORE 0      /* dove mancano (non Linux), i frame partono comunque corretti: cambia solo l'accorpamento */
+#endif
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
 
 /*  MACRO  */
 #define MAX_MSG_LEN 200  /* dimensione massima dei messaggi che può inviare il client */
+#define CHUNK_SIZE 65536 /* dimensione dei blocchi con cui vengono trasferiti i file (buffer fisso, memoria costante) */
+#define ARCHIVE_SIZE_UNKNOWN UINT64_MAX /* dimensione dell'archivio prodotto al volo dal server: seguono frame, un frame vuoto e l'esito */
 
 #define VERSION "6.3" /* versione del programma */
+#define PROTOCOL_VERSION 10 /* versione del protocollo proposta al server alla connessione (2: send a lotti; 3: lotti con impronte; 4: ripresa; > */
+                           /* > 5: blocchi inviati compressi con LZ4; 6: resoconto della scelta automatica del compressore; 7: configure-level; > */
+                           /* > 8: stats; 9: connessioni dati con attach e contenuti a pezzi; 10: cartelle con i file piccoli a pacchi) */
+#define WIRE_RAW 0   /* (protocollo 5) primo byte di ogni blocco di un file inviato: blocco così com'è [uguali nel server] */
+#define WIRE_LZ4 1   /* blocco compresso con LZ4 (solo se si è ridotto) */
+#define MAX_STREAMS 16    /* (protocollo 9) connessioni massime di una sessione, quella dei comandi compresa [uguale nel server] */
+#define PIECE_HEADER 16   /* (protocollo 9) intestazione di un pezzo: n° del file nel lotto (32 bit, poi 32 a zero) e posizione (64 bit) [uguale nel server] */
+#define PACK_SIZE (1<<20) /* (protocollo 10) byte massimi (non compressi) di un pacco di file piccoli di una cartella [uguale nel server] */
+#define PACK_SMALL (256<<10) /* (protocollo 10) file di una cartella che viaggiano nei pacchi: fino a questa dimensione; i più grandi partono da soli */
+#define PACK_ENTRY 24     /* (protocollo 10) intestazione di un file nel pacco: lunghezza del percorso e permessi (32 bit), dimensione e mtime (64 bit) [uguale nel server] */
+#define PACK_FILES 'P'    /* (protocollo 10) frame di una cartella: pacco di file piccoli (WIRE_* e il pacco) o file grande (intestazione e percorso, poi il > */
+#define PACK_LARGE 'L'    /* > contenuto a blocchi come nella send) [uguali nel server] */
+#define TREE_PATH_MAX 4096 /* (protocollo 10) lunghezza massima del percorso relativo di un file di una cartella [uguale nel server] */
+#define RECONNECT_TRIES 5   /* tentativi di riconnessione dopo una caduta (protocollo 4), con attese di 0, 1, 2, 4, 8 secondi */
+#define BATCH_NOT_SENT UINT64_MAX /* nel manifesto della send a lotti: file che non verrà inviato */
+#define BATCH_TREE (UINT64_MAX-1) /* (protocollo 10) nel manifesto: cartella, i cui file partono a pacchi dopo i contenuti */
+#define BATCH_SENT 0           /* esiti per file nel rapporto della send a lotti [uguali nel server] */
+#define BATCH_SKIPPED 1
+#define BATCH_DUPLICATE 2
+#define BATCH_WRITE_ERROR 3
+#define BATCH_READ_ERROR 4
+#define BATCH_UPLOAD 5         /* (protocollo 3) risposta al manifesto: il server non ha il contenuto, va inviato */
+#define BATCH_STORED 6         /* (protocollo 3) il server aveva già il contenuto: file ricevuto senza trasferimento */
+#define XXH_PRIME1 11400714785074694791ULL /* costanti di XXH64 (impronta dei file per lo store senza duplicati) */
+#define XXH_PRIME2 14029467366897019727ULL
+#define XXH_PRIME3 1609587929392839161ULL
+#define XXH_PRIME4 9650029242287828579ULL
+#define XXH_PRIME5 2870177450012600261ULL
+#define XXH_ROTL(x,r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+#define IO_THREADS_BATCH 4   /* thread di I/O che leggono in anticipo i file da inviare, nella modalità batch [--io-threads] */
+#define READAHEAD_BLOCKS 16  /* blocchi (di CHUNK_SIZE) di un file letti in anticipo rispetto all'invio */
+#define READAHEAD_FILES 2    /* file letti in anticipo per ogni thread di I/O, oltre a quello in invio (memoria limitata) */
+#define EXIT_OK 0            /* (modalità batch) codici d'uscita: tutto ok */
+#define EXIT_USAGE 1         /* argomenti non validi, o elenco dei file illeggibile */
+#define EXIT_CONNECTION 2    /* server irraggiungibile, o connessione caduta senza riuscire a riprendere la sessione */
+#define EXIT_CONFIG 3        /* compressore, livello o nome dell'archivio rifiutati dal server */
+#define EXIT_FILES 4         /* uno o più file non inviati (inaccessibili, errori di lettura o di scrittura sul server) */
+#define EXIT_COMPRESS 5      /* archivio non creato dal server o non salvato nella cartella indicata */
 
 #define PROMPT "remote-compressor> " /* command prompt a schermo */
 
@@ -58,6 +128,83 @@
 #define RST    "\033[0m"	    	 // reset	
 
 
+/*     NUOVI TIPI       */
+
+typedef struct xxh64_state { /* stato dell'impronta XXH64 calcolata a flusso [uguale nel server] */
+		uint64_t total;              // byte elaborati finora
+		uint64_t v[4];               // le 4 corsie di accumulo
+		unsigned char mem[32];       // blocco in sospeso (meno di 32 byte)
+		unsigned memsize;
+	} xxh64_state;
+
+typedef struct ra_file { /* lettura anticipata di un file da inviare */
+		const char *path;
+		uint64_t from, size;         // byte da leggere: da from (ripresa, protocollo 4) a size
+		int active;                  // 1 = il file va inviato (e quindi letto)
+		char (*blk)[CHUNK_SIZE];     // anello di READAHEAD_BLOCKS blocchi, allocato quando un thread di I/O prende il file
+		size_t len[READAHEAD_BLOCKS];
+		unsigned head, tail;         // blocchi consumati dall'invio (head) e letti dal thread di I/O (tail)
+		size_t pos;                  // byte già consumati del blocco head
+		int done;                    // 1 = lettura finita (completa o interrotta da un errore)
+	} ra_file;
+
+typedef struct readahead { /* pool di thread di I/O che leggono in anticipo, nell'ordine, i file di una send a lotti */
+		pthread_mutex_t m;
+		pthread_cond_t filled;       // un blocco è stato letto (vi attende l'invio)
+		pthread_cond_t drained;      // un blocco è stato consumato, o l'invio è passato al file successivo (vi attendono i thread di I/O)
+		ra_file *f;
+		int n, next, head;           // file del lotto, prossimo da prendere, file in invio
+		int quit;
+		pthread_t *threads;
+		int nthreads;
+	} readahead;
+
+typedef struct data_streams { /* (protocollo 9) connessioni dati aggiunte alla sessione con attach: la send vi invia i contenuti a pezzi */
+		int sock[MAX_STREAMS-1];
+		int n;                       // connessioni aggiunte (oltre a quella dei comandi)
+		int want;                    // connessioni richieste (--streams, meno quella dei comandi)
+	} data_streams;
+
+typedef struct stripe { /* (protocollo 9) invio dei contenuti a pezzi su più connessioni: ogni thread di invio prende il prossimo pezzo */
+		pthread_mutex_t m;
+		int *fd;                     // file aperti (-1: non apribile, il primo pezzo ne annuncia l'abbandono)
+		uint64_t *next, *size;       // prossimo byte da assegnare e dimensione di ogni file
+		int *active;                 // 1 = il file va inviato
+		int n, cur;                  // file del lotto, primo con pezzi ancora da assegnare
+		int socks[MAX_STREAMS];      // connessioni (quella dei comandi e quelle dati), ..
+		int k, taken;                // .. quante sono e quante sono già state prese da un thread
+		int lost;                    // 1 = una connessione è caduta: gli altri thread smettono
+	} stripe;
+
+typedef struct tree_file { /* (protocollo 10) file regolare trovato nella visita di una cartella da inviare */
+		char *rel;                   // percorso relativo alla cartella
+		uint64_t size;
+		uint32_t mode;               // permessi
+		int64_t mtime;               // data dell'ultima modifica
+	} tree_file;
+
+typedef struct tree_walk { /* (protocollo 10) visita in parallelo di una cartella da inviare e invio a pacchi dei suoi file piccoli */
+		pthread_mutex_t m;
+		pthread_cond_t more;         // una sottocartella è stata accodata, o la visita è finita
+		const char *root;            // la cartella (come indicata nella send)
+		char **dirs;                 // sottocartelle (percorsi relativi) ancora da leggere ..
+		int ndirs, capdirs, busy;    // .., e thread che ne stanno leggendo una
+		tree_file *f;                // file regolari trovati (link simbolici e file speciali si saltano)
+		int n, cap;
+		int next;                    // primo file non ancora messo in un pacco
+		int unread;                  // file non letti e sottocartelle non aperte
+		pthread_mutex_t send;        // un pacco alla volta sulla connessione [sock]
+		int sock, lost;              // .. e sua caduta (gli altri thread smettono)
+	} tree_walk;
+
+typedef struct hash_jobs { /* impronte dei file del manifesto, calcolate in parallelo dai thread di I/O */
+		pthread_mutex_t m;
+		char **path;
+		uint64_t *size, *hash;       // dimensione (BATCH_NOT_SENT: file escluso) e impronta di ogni file
+		int n, next;
+	} hash_jobs;
+
+
 /* FUNZIONI */ 
 
 // funzioni (2) sulle stringhe [uguali per client e server]
@@ -86,186 +233,1475 @@ char *del_chars ( char *r, char x )  /* toglie tutte le occorrenze del carattere
   return r;
 }
 
-// funzioni (2) sui socket: 1-ok, 0-errore 
+// funzioni (5) per l'impronta dei contenuti (XXH64, a flusso) [xxh64_round, xxh64_init, xxh64_update e xxh64_digest uguali per client e server]
+uint64_t xxh64_round ( uint64_t acc, uint64_t input ) /* passo di rimescolamento di XXH64 su una corsia di 64 bit */
+{
+	acc += input * XXH_PRIME2;
+	acc = XXH_ROTL(acc, 31);
+	return acc * XXH_PRIME1;
+}
+
+void xxh64_init ( xxh64_state *st ) /* prepara [st] per l'impronta di un nuovo contenuto (seme 0) */
+{
+	memset(st, 0, sizeof(*st));
+	st->v[0] = XXH_PRIME1 + XXH_PRIME2;
+	st->v[1] = XXH_PRIME2;
+	st->v[2] = 0;
+	st->v[3] = -XXH_PRIME1;
+}
+
+void xxh64_update ( xxh64_state *st, const void *data, size_t len ) /* aggiunge all'impronta [st] i [len] byte di [data] (a blocchi di 32 byte) */
+{
+	const unsigned char *p = data;
+	size_t fill;
+	int i, j;
+	st->total += len;
+	while (len > 0) {
+		fill = 32 - st->memsize;                // riempio il blocco in sospeso; quando è pieno ne aggiorno le 4 corsie
+		if (fill > len)
+			fill = len;
+		memcpy(st->mem + st->memsize, p, fill);
+		st->memsize += fill;
+		p += fill;
+		len -= fill;
+		if (st->memsize < 32)
+			break;
+		for (i=0; i<4; i++) {
+			uint64_t lane = 0;
+			for (j=7; j>=0; j--)                  // lettura little-endian, indipendente dall'architettura
+				lane = (lane<<8) | st->mem[8*i+j];
+			st->v[i] = xxh64_round(st->v[i], lane);
+		}
+		st->memsize = 0;
+	}
+}
+
+uint64_t xxh64_digest ( const xxh64_state *st ) /* restituisce l'impronta dei byte passati finora a [st] (lo stato non cambia) */
+{
+	uint64_t h, k;
+	const unsigned char *p = st->mem;
+	unsigned left = st->memsize;
+	int i, j;
+	if (st->total >= 32) {
+		h = XXH_ROTL(st->v[0], 1) + XXH_ROTL(st->v[1], 7) + XXH_ROTL(st->v[2], 12) + XXH_ROTL(st->v[3], 18);
+		for (i=0; i<4; i++) {
+			h ^= xxh64_round(0, st->v[i]);
+			h = h * XXH_PRIME1 + XXH_PRIME4;
+		}
+	}
+	else
+		h = XXH_PRIME5;
+	h += st->total;
+	for (; left >= 8; left -= 8, p += 8) {      // coda: blocchi da 8, da 4 e singoli byte
+		for (k=0, j=7; j>=0; j--)
+			k = (k<<8) | p[j];
+		h ^= xxh64_round(0, k);
+		h = XXH_ROTL(h, 27) * XXH_PRIME1 + XXH_PRIME4;
+	}
+	if (left >= 4) {
+		for (k=0, j=3; j>=0; j--)
+			k = (k<<8) | p[j];
+		h ^= k * XXH_PRIME1;
+		h = XXH_ROTL(h, 23) * XXH_PRIME2 + XXH_PRIME3;
+		left -= 4;
+		p += 4;
+	}
+	for (; left > 0; left--, p++) {
+		h ^= (*p) * XXH_PRIME5;
+		h = XXH_ROTL(h, 11) * XXH_PRIME1;
+	}
+	h ^= h >> 33;                               // rimescolamento finale
+	h *= XXH_PRIME2;
+	h ^= h >> 29;
+	h *= XXH_PRIME3;
+	h ^= h >> 32;
+	return h;
+}
+
+int hash_file ( const char *path, uint64_t size, uint64_t *hash ) /* calcola in [hash] l'impronta XXH64 dei [size] byte del file [path]: 1-ok, 0-errore */
+{
+	char buf[CHUNK_SIZE];
+	xxh64_state st;
+	uint64_t done = 0;
+	size_t n;
+	FILE *fp = fopen(path, "rb");
+	if (fp==NULL)
+		return 0;
+	xxh64_init(&st);
+	while (done < size && (n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+		xxh64_update(&st, buf, n);
+		done += n;
+	}
+	fclose(fp);
+	*hash = xxh64_digest(&st);
+	return done==size;              // il file è cambiato nel frattempo: meglio inviarlo senza impronta (lo stesso vale per il server)
+}
+
+// funzioni (11) sui socket: 1-ok, 0-errore [SendFrame, SendData, RecvAll, ReceiveData, ReceiveChunk, SetNoDelay e SetCork uguali per client e server]
    /* sono duali: quando c'è una dall'altra parte della connessione c'è l'altra: esse fanno tx dimensione dati-> rx dimensione dati -> tx dati -> rx dati */
-int SendData (int sock, const void *data, size_t dim) /* va avanti finché non invia il blocco, grande [dim], puntato da [data] al socket [sock] */
+int SendFrame ( int sock, const void *data, size_t dim, int more ) /* invio a [sock] il frame (intestazione + [dim] byte di [data]) con un'unica > */
+{     /* > sendmsg vettoriale, riprendendo dopo gli invii parziali; [more]=1 se seguono subito altri frame (MSG_MORE: il kernel li accorpa) */
+    int len = dim;
+    struct iovec iov[2];
+    struct msghdr mh;
+    ssize_t n;
+    iov[0].iov_base = &len;                 // intestazione: dimensione dei dati (int)
+    iov[0].iov_len = sizeof(int);
+    iov[1].iov_base = (void*)data;
+    iov[1].iov_len = dim;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = iov;
+    mh.msg_iovlen = (dim>0) ? 2 : 1;
+    while (mh.msg_iovlen > 0) {
+        n = sendmsg(sock, &mh, MSG_NOSIGNAL | (more ? MSG_MORE : 0)); // MSG_NOSIGNAL: un peer caduto dà un errore, non SIGPIPE
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return 0;
+        }
+        while (n > 0 && mh.msg_iovlen > 0) {  // invio parziale: avanzo gli iovec di quanto è già partito
+            if ((size_t)n >= mh.msg_iov[0].iov_len) {
+                n -= mh.msg_iov[0].iov_len;
+                mh.msg_iov++;
+                mh.msg_iovlen--;
+            }
+            else {
+                mh.msg_iov[0].iov_base = (char*)mh.msg_iov[0].iov_base + n;
+                mh.msg_iov[0].iov_len -= n;
+                n = 0;
+            }
+        }
+        while (mh.msg_iovlen > 0 && mh.msg_iov[0].iov_len == 0) {
+            mh.msg_iov++;
+            mh.msg_iovlen--;
+        }
+    }
+    return 1;
+}
+
+int SendData ( int sock, const void *data, size_t dim ) /* invio la quantita' [dim] di dati puntati da [data] a [sock] (un frame: intestazione e dati insieme) */
 {
-    int total = 0, rc, n, bytesleft = dim;
-    rc = send( sock, &dim, sizeof(int), 0 );        // invio dimensione (ReceiveData deve sapere quanti bit aspettarsi)
-    if ( (rc==-1)||(rc<sizeof(int)) )
-		       return 0;					
-    while(total < dim) {						 // ciclo finché non ho inviati "dim" dati oppure c'è un errore)
-        n = send( sock, data+total, bytesleft, 0 );
-        if (n == -1) 
-		  break;
-        total += n;
-        bytesleft -= n; 
+    return SendFrame(sock, data, dim, 0);
+}
+
+int RecvAll ( int sock, void *buf, size_t len ) /* ricevo da [sock] esattamente [len] byte in [buf], gestendo letture parziali e interruzioni */
+{
+    size_t total = 0;
+    ssize_t n;
+    while (total < len) {
+        n = recv(sock, (char*)buf+total, len-total, MSG_WAITALL);
+        if (n > 0) {
+            total += n;
+            continue;
+        }
+        if (n == -1 && errno == EINTR)
+            continue;
+        return 0;                             // errore o connessione chiusa dall'altro capo
+    }
+    return 1;
+}
+
+int ReceiveData ( int sock, void *data, int *len ) /* ricevo da [sock] mettendo dove punta [data]; ne scrivo la quantita' dove punta [len], se non è NULL */
+{
+    int dim;
+    if ( ! RecvAll(sock, &dim, sizeof(int)) || dim<0 ) // ricevo la dimensione dei dati che saranno spediti
+        return 0;
+    if ( ! RecvAll(sock, data, dim) )                 // ricevo finche' non ho avuto tutti i dati
+        return 0;
+    if (len!=NULL)       			         // in molti casi il ricevente sa di certo quanti dati arrivano e quindi mette NULL a [3°arg]
+        *len=dim;
+    return 1;
+}
+
+int ReceiveChunk ( int sock, void *buf, int maxlen, int *len ) /* come ReceiveData, ma rifiuta (0) i blocchi più grandi di [maxlen] byte */
+{
+    int dim;
+    if ( ! RecvAll(sock, &dim, sizeof(int)) || dim<0 || dim>maxlen )
+        return 0;
+    if ( ! RecvAll(sock, buf, dim) )
+        return 0;
+    *len = dim;
+    return 1;
+}
+
+void SetNoDelay ( int sock ) /* disattiva Nagle su [sock]: i frame di controllo (comandi, risposte brevi) partono subito, senza attese di ACK ritardati */
+{
+    int on = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+
+void SetCork ( int sock, int on ) /* [on]=1: durante i trasferimenti di massa il kernel invia solo segmenti pieni; [on]=0 li svuota */
+{
+#ifdef TCP_CORK
+    setsockopt(sock, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+#endif
+}
+
+int SendStream (int sock, size_t (*rd)(void*, char*, size_t), void *src, uint64_t size, int wire) /* invia a [sock] i [size] byte letti con > */
+{      /* > [rd]([src]) (da un file, o dai blocchi letti in anticipo), un blocco (frame SendData) di CHUNK_SIZE alla volta; con [wire] (protocollo 5) > */
+       /* > ogni blocco è preceduto dal suo formato (WIRE_*) e viaggia compresso con LZ4 se si riduce. 1-ok, 0-errore sul socket, -1-errore di > */
+       /* > lettura (il server è avvisato con un blocco vuoto) */
+    char buf[1+CHUNK_SIZE], lz[1+CHUNK_SIZE]; // buffer fissi: la memoria usata non dipende dalla dimensione del file
+    uint64_t sent = 0;
+    size_t n, want;
+    int c, more;
+    buf[0] = WIRE_RAW;
+    lz[0] = WIRE_LZ4;
+    while (sent < size) {
+        want = (size-sent > CHUNK_SIZE) ? CHUNK_SIZE : (size_t)(size-sent);
+        n = rd(src, buf+1, want);
+        if (n == 0) {                                 // il file si è accorciato o non è più leggibile: il blocco vuoto interrompe il trasferimento
+            if ( ! SendData(sock, buf, 0) )
+                return 0;
+            return -1;
+        }
+        more = (sent+n < size);                       // MSG_MORE fino all'ultimo blocco: il kernel riempie i segmenti
+        if (!wire)
+            c = SendFrame(sock, buf+1, n, more);
+        else if ( (c = LZ4_compress_default(buf+1, lz+1, n, n-1)) > 0 ) // un blocco che non si riduce (già compresso, casuale) fallisce subito..
+            c = SendFrame(sock, lz, c+1, more);
+        else
+            c = SendFrame(sock, buf, n+1, more);      // .. e parte così com'è
+        if (!c)
+            return 0;
+        sent += n;
     }
-    return (n==-1)?0:1; 						 // comunico l'esito al chiamante
-} 
+    return 1;
+}
 
-int ReceiveData (int sock, void *data, int *len) /* va avanti a ricevere dati da [sock], memorizzando i bit dove punta [data] e il n° dove punta [len] */
+size_t file_read (void *fp, char *buf, size_t want) /* sorgente dei blocchi di SendStream: fread dal file [fp] */
 {
-    int total = 0, rc, n, dim, bytesleft;         
-    rc = recv( sock, &dim, sizeof(int), 0 ); 			// SendData mi dice quanti dati mi invierà 	
-    if ( (rc==-1)||(rc<sizeof(int)) )			 
-	 	     return 0;			       	// errore su ricezione quantità di dati in arrivo
-    bytesleft = dim;
-    while(total < dim) {
-        n = recv( sock, data+total, bytesleft, 0 );     
-        if (n == -1) 			       	// errore su ricezione dati
-		break;
+    return fread(buf, 1, want, (FILE*)fp);
+}
+
+int ReceiveRaw (int sock, FILE *fp, uint64_t size) /* riceve da [sock] [size] byte grezzi (senza frame) e li scrive man mano su [fp]; se [fp] è >  */
+{                                                  /* > NULL o la scrittura fallisce li scarta: 1-ok, 0-errore sul socket, -1-errore di scrittura */
+    char buf[CHUNK_SIZE];
+    uint64_t total = 0;
+    int n, rc = 1;
+    while (total < size) {
+        n = recv(sock, buf, (size-total > CHUNK_SIZE) ? CHUNK_SIZE : (size_t)(size-total), 0);
+        if (n <= 0)                       // errore o connessione chiusa dal server
+            return 0;
+        if ( fp!=NULL && rc==1 && fwrite(buf, 1, n, fp)!=(size_t)n )
+            rc = -1;                      // continuo comunque a ricevere per restare allineato col server
         total += n;
-        bytesleft -= n;
-    } 
-    if (len!=NULL)		       // se SendData (corrispettivo) voleva sapere quanti dati mi sono arrivati faceva puntare >
-	       *len=dim;               // > [len] a una locazione (un intero per la precisione): in tal caso ci metto la quantità richiesta 
-    return (n==-1)?0:1; 
-} 
+    }
+    return rc;
+}
+
+int ReceiveFramed (int sock, FILE *fp) /* riceve da [sock] un archivio prodotto al volo (frame fino a uno vuoto, poi l'esito del server) > */
+{                                      /* > scrivendolo man mano su [fp]: 1-ok, 0-errore sul socket, -1-errore di scrittura o archivio fallito */
+    char buf[CHUNK_SIZE];
+    int len, rc = 1, esito;
+    while (1) {
+        if ( ! ReceiveChunk(sock, buf, CHUNK_SIZE, &len) )
+            return 0;
+        if (len == 0)                     // fine dello stream
+            break;
+        if ( fp!=NULL && rc==1 && fwrite(buf, 1, len, fp)!=(size_t)len )
+            rc = -1;
+    }
+    if ( ! ReceiveData(sock, &esito, NULL) )
+        return 0;
+    return (esito==1) ? rc : -1;
+}
+
+// funzioni (7) per la lettura anticipata dei file da inviare: un piccolo pool di thread di I/O calcola le impronte e legge i contenuti, così il >
+// > socket non attende mai il disco locale
+
+void *hash_worker ( void *arg ) /* THREAD DI I/O: calcola le impronte dei file del manifesto non ancora presi da altri thread */
+{
+	hash_jobs *j = arg;
+	int i;
+	while (1) {
+		pthread_mutex_lock(&j->m);
+		i = j->next++;
+		pthread_mutex_unlock(&j->m);
+		if (i>=j->n)
+			break;
+		j->hash[i] = 0;              // 0 se non calcolabile: il server non lo troverà nello store e lo chiederà
+		if (j->size[i]!=BATCH_NOT_SENT && j->size[i]!=BATCH_TREE)
+			hash_file(j->path[i], j->size[i], &j->hash[i]);
+	}
+	return NULL;
+}
+
+void hash_files ( char **path, uint64_t *size, uint64_t *hash, int n, int threads ) /* impronte in [hash] degli [n] file [path] di dimensione > */
+{                                             /* > [size] (BATCH_NOT_SENT: esclusi), con [threads] thread di I/O (0 o 1: le calcola il chiamante) */
+	hash_jobs j = { PTHREAD_MUTEX_INITIALIZER, path, size, hash, n, 0 };
+	pthread_t t[threads>1 ? threads : 1];
+	int i, started = 0;
+	for (i=1; i<threads && i<n; i++)   // il chiamante è il primo dei [threads]
+		if (pthread_create(&t[started], NULL, hash_worker, &j)==0)
+			started++;
+	hash_worker(&j);                 // anche il chiamante lavora (e finisce da solo se non è partito nessun thread)
+	for (i=0; i<started; i++)
+		pthread_join(t[i], NULL);
+	pthread_mutex_destroy(&j.m);
+}
+
+void *ra_worker ( void *arg ) /* THREAD DI I/O: prende, nell'ordine, il prossimo file da inviare e ne legge i blocchi finché c'è posto nel suo > */
+{                             /* > anello; non va oltre READAHEAD_FILES file per thread davanti a quello in invio */
+	readahead *ra = arg;
+	ra_file *f;
+	FILE *fp;
+	uint64_t left;
+	size_t n;
+	pthread_mutex_lock(&ra->m);
+	while (1) {
+		while (ra->next<ra->n && !ra->f[ra->next].active)
+			ra->next++;
+		if (ra->quit || ra->next>=ra->n)
+			break;
+		if (ra->next >= ra->head + ra->nthreads*READAHEAD_FILES) {  // abbastanza avanti: si aspetta che l'invio prosegua
+			pthread_cond_wait(&ra->drained, &ra->m);
+			continue;
+		}
+		f = &ra->f[ra->next++];
+		pthread_mutex_unlock(&ra->m);
+		f->blk = malloc(READAHEAD_BLOCKS*sizeof(*f->blk));
+		fp = (f->blk!=NULL) ? fopen(f->path, "rb") : NULL;
+		if (fp!=NULL && f->from>0 && fseeko(fp, f->from, SEEK_SET)!=0) {
+			fclose(fp);
+			fp = NULL;
+		}
+		left = (fp!=NULL) ? f->size-f->from : 0;   // file non apribile: nessun blocco, l'invio lo segnala al server con un blocco vuoto
+		pthread_mutex_lock(&ra->m);
+		while (left>0 && !ra->quit) {
+			if (f->tail - f->head == READAHEAD_BLOCKS) {     // anello pieno: l'invio è indietro
+				pthread_cond_wait(&ra->drained, &ra->m);
+				continue;
+			}
+			pthread_mutex_unlock(&ra->m);
+			n = fread(f->blk[f->tail % READAHEAD_BLOCKS], 1, (left > CHUNK_SIZE) ? CHUNK_SIZE : (size_t)left, fp);
+			pthread_mutex_lock(&ra->m);
+			if (n==0)                                        // il file si è accorciato o non è più leggibile
+				break;
+			f->len[f->tail % READAHEAD_BLOCKS] = n;
+			f->tail++;
+			left -= n;
+			pthread_cond_broadcast(&ra->filled);
+		}
+		if (fp!=NULL)
+			fclose(fp);
+		f->done = 1;
+		pthread_cond_broadcast(&ra->filled);
+	}
+	pthread_mutex_unlock(&ra->m);
+	return NULL;
+}
 
-// funzioni (3) eseguite dal client quando richiede un servizio tramite un comando
+int ra_start ( readahead *ra, char **path, uint64_t *from, uint64_t *size, int *active, int n, int threads ) /* avvia [threads] thread di I/O > */
+{      /* > che leggono, dal byte [from] al byte [size], gli [n] file [path] con [active]=1: 1-ok (si ferma con ra_stop), 0-errore (il chiamante > */
+       /* > legge allora da sé) */
+	int i;
+	memset(ra, 0, sizeof(readahead));
+	ra->f = calloc(n, sizeof(ra_file));
+	ra->threads = calloc(threads, sizeof(pthread_t));
+	if (ra->f==NULL || ra->threads==NULL) {
+		free(ra->f);
+		free(ra->threads);
+		return 0;
+	}
+	for (i=0; i<n; i++) {
+		ra->f[i].path = path[i];
+		ra->f[i].from = from[i];
+		ra->f[i].size = size[i];
+		ra->f[i].active = active[i];
+	}
+	ra->n = n;
+	pthread_mutex_init(&ra->m, NULL);
+	pthread_cond_init(&ra->filled, NULL);
+	pthread_cond_init(&ra->drained, NULL);
+	for (i=0; i<threads; i++)
+		if (pthread_create(&ra->threads[ra->nthreads], NULL, ra_worker, ra)==0)
+			ra->nthreads++;
+	if (ra->nthreads==0) {           // nessun thread partito: nessun blocco ancora allocato
+		pthread_mutex_destroy(&ra->m);
+		pthread_cond_destroy(&ra->filled);
+		pthread_cond_destroy(&ra->drained);
+		free(ra->f);
+		free(ra->threads);
+		return 0;
+	}
+	return 1;
+}
 
-void cCMDS0_478 (int sock_client) /* help(1),show-config(2),config-name(3),config-compressor(4),show-list(7),empty-list(8), caso di comando non valido (0)*/
+size_t ra_read ( void *src, char *buf, size_t want ) /* sorgente dei blocchi di SendStream: fino a [want] byte del file in invio di [src] > */
+{                                                     /* > (un readahead), attendendo il thread di I/O se non li ha ancora letti; 0 se finito o errore */
+	readahead *ra = src;
+	ra_file *f = &ra->f[ra->head];
+	size_t n;
+	char *b;
+	pthread_mutex_lock(&ra->m);
+	while (f->head==f->tail && !f->done)
+		pthread_cond_wait(&ra->filled, &ra->m);
+	if (f->head==f->tail) {
+		pthread_mutex_unlock(&ra->m);
+		return 0;
+	}
+	pthread_mutex_unlock(&ra->m);    // il blocco head è già letto: il thread di I/O non lo tocca finché non lo si consuma
+	b = f->blk[f->head % READAHEAD_BLOCKS];
+	n = f->len[f->head % READAHEAD_BLOCKS] - f->pos;
+	if (n>want)
+		n = want;
+	memcpy(buf, b+f->pos, n);
+	f->pos += n;
+	if (f->pos == f->len[f->head % READAHEAD_BLOCKS]) {
+		f->pos = 0;
+		pthread_mutex_lock(&ra->m);
+		f->head++;
+		pthread_cond_broadcast(&ra->drained);
+		pthread_mutex_unlock(&ra->m);
+	}
+	return n;
+}
+
+void ra_next ( readahead *ra, int i ) /* l'invio passa al file [i]: i blocchi dei file precedenti (già inviati) si liberano */
+{
+	int k;
+	pthread_mutex_lock(&ra->m);
+	for (k=ra->head; k<i; k++)
+		if (ra->f[k].done) {         // (quelli non ancora finiti li libera ra_stop)
+			free(ra->f[k].blk);
+			ra->f[k].blk = NULL;
+		}
+	ra->head = i;
+	pthread_cond_broadcast(&ra->drained);
+	pthread_mutex_unlock(&ra->m);
+}
+
+void ra_stop ( readahead *ra ) /* ferma i thread di I/O (anche a metà lettura, se l'invio è stato interrotto) e libera i blocchi */
 {
-	char msg[MAX_MSG_LEN*2] = "";					
+	int i;
+	pthread_mutex_lock(&ra->m);
+	ra->quit = 1;
+	pthread_cond_broadcast(&ra->drained);
+	pthread_mutex_unlock(&ra->m);
+	for (i=0; i<ra->nthreads; i++)
+		pthread_join(ra->threads[i], NULL);
+	for (i=0; i<ra->n; i++)
+		free(ra->f[i].blk);
+	free(ra->f);
+	free(ra->threads);
+	pthread_mutex_destroy(&ra->m);
+	pthread_cond_destroy(&ra->filled);
+	pthread_cond_destroy(&ra->drained);
+}
+
+// funzioni (5) per l'invio su più connessioni (protocollo 9): connessioni dati aggiunte alla sessione, pezzi dei file distribuiti tra loro
+
+void close_streams ( data_streams *ds ) /* chiude le connessioni dati di [ds] */
+{
+	int i;
+	for (i=0; i<ds->n; i++)
+		close(ds->sock[i]);
+	ds->n = 0;
+}
+
+int attach_streams ( data_streams *ds, struct sockaddr_in *server_address, uint64_t token ) /* apre fino a ds->want connessioni dati verso > */
+{   /* > [server_address] e le aggiunge alla sessione [token] (corrispettivo sul server: "sATTACH"), chiudendo prima quelle precedenti (di una > */
+    /* > connessione caduta); si ferma al primo rifiuto. Il n° di connessioni aggiunte */
+	char cmd[MAX_MSG_LEN];
+	int sock, c, choice, ok;
+	close_streams(ds);
+	sprintf(cmd, "attach %016llx", (unsigned long long)token);
+	while (ds->n < ds->want) {
+		sock = socket( PF_INET, SOCK_STREAM, 0 );
+		if (sock==-1)
+			break;
+		ok = 0;
+		if ( connect(sock, (const struct sockaddr*)server_address, sizeof(struct sockaddr_in))!=0 || ! ReceiveData(sock, &c, NULL) // 1) benvenuto
+		     || ! SendData(sock, cmd, strlen(cmd)) || ! ReceiveData(sock, &choice, NULL) || choice!=14   // 2) attach, come primo comando
+		     || ! ReceiveData(sock, &ok, NULL) || ok!=1 ) {                                              // 3) esito
+			close(sock);
+			break;
+		}
+		ds->sock[ds->n++] = sock;
+	}
+	return ds->n;
+}
+
+int stripe_take ( stripe *st, uint32_t *f, uint64_t *off, size_t *len ) /* assegna il prossimo pezzo (file [f], dal byte [off], [len] byte, al più > */
+{                                                                        /* > CHUNK_SIZE): 1-assegnato, 0-pezzi finiti o connessione caduta */
+	int rc = 0;
+	pthread_mutex_lock(&st->m);
+	while (st->cur<st->n && (!st->active[st->cur] || st->next[st->cur]>=st->size[st->cur]))
+		st->cur++;
+	if (!st->lost && st->cur<st->n) {
+		*f = st->cur;
+		*off = st->next[st->cur];
+		*len = (st->size[st->cur]-*off > CHUNK_SIZE) ? CHUNK_SIZE : (size_t)(st->size[st->cur]-*off);
+		st->next[st->cur] += *len;
+		rc = 1;
+	}
+	pthread_mutex_unlock(&st->m);
+	return rc;
+}
+
+void *stripe_worker ( void *arg ) /* THREAD DI INVIO: prende una connessione di [arg] (uno stripe) e vi invia i pezzi finché ce ne sono, poi il frame > */
+{                                 /* > vuoto che chiude i pezzi di questa connessione; un pezzo senza blocco dice al server che il file non è più leggibile */
+	stripe *st = arg;
+	char buf[PIECE_HEADER+1+CHUNK_SIZE], lz[PIECE_HEADER+1+CHUNK_SIZE]; // buffer fissi, come in SendStream
+	uint32_t f;
+	uint64_t off;
+	size_t len;
+	ssize_t got;
+	int sock, c, ok = 1;
+	pthread_mutex_lock(&st->m);
+	sock = st->socks[st->taken++];
+	pthread_mutex_unlock(&st->m);
+	memset(buf, 0, PIECE_HEADER);
+	SetCork(sock, 1);                                          // pezzi a segmenti pieni, come i contenuti su una connessione sola
+	while (ok && stripe_take(st, &f, &off, &len)) {
+		memcpy(buf, &f, sizeof(f));
+		memcpy(buf+8, &off, sizeof(off));
+		got = (st->fd[f]>=0) ? pread(st->fd[f], buf+PIECE_HEADER+1, len, off) : -1;
+		if (got!=(ssize_t)len) {                               // il file si è accorciato o non è più leggibile: niente più pezzi suoi
+			pthread_mutex_lock(&st->m);
+			st->next[f] = st->size[f];
+			pthread_mutex_unlock(&st->m);
+			ok = SendFrame(sock, buf, PIECE_HEADER, 1);
+			continue;
+		}
+		if ( (c = LZ4_compress_default(buf+PIECE_HEADER+1, lz+PIECE_HEADER+1, len, len-1)) > 0 ) { // (protocollo 9 => 5: blocchi compressi)
+			memcpy(lz, buf, PIECE_HEADER);
+			lz[PIECE_HEADER] = WIRE_LZ4;
+			ok = SendFrame(sock, lz, PIECE_HEADER+1+c, 1);
+		}
+		else {
+			buf[PIECE_HEADER] = WIRE_RAW;
+			ok = SendFrame(sock, buf, PIECE_HEADER+1+len, 1);
+		}
+	}
+	if (ok)
+		ok = SendFrame(sock, buf, 0, 0);                       // fine dei pezzi su questa connessione
+	SetCork(sock, 0);
+	if (!ok) {
+		pthread_mutex_lock(&st->m);
+		st->lost = 1;
+		pthread_mutex_unlock(&st->m);
+	}
+	return NULL;
+}
+
+int send_striped ( int sock_client, data_streams *ds, int k, char **path, uint64_t *from, uint64_t *size, int *active, int n ) /* invia gli [n] > */
+{    /* > file [path] con [active]=1, dal byte [from] al byte [size], a pezzi sulla connessione dei comandi e sulle prime [k]-1 connessioni dati > */
+     /* > di [ds], un thread di invio per connessione (il chiamante è il primo). 1-ok, 0-connessione caduta */
+	stripe st;
+	pthread_t t[MAX_STREAMS];
+	uint64_t next[n];
+	int fd[n], i, started = 0;
+	memset(&st, 0, sizeof(stripe));
+	for (i=0; i<n; i++) {
+		fd[i] = active[i] ? open(path[i], O_RDONLY|O_CLOEXEC) : -1;
+		next[i] = from[i];
+	}
+	pthread_mutex_init(&st.m, NULL);
+	st.fd = fd;
+	st.next = next;
+	st.size = size;
+	st.active = active;
+	st.n = n;
+	st.k = k;
+	st.socks[0] = sock_client;
+	for (i=1; i<k; i++)
+		st.socks[i] = ds->sock[i-1];
+	for (i=1; i<k; i++)
+		if (pthread_create(&t[started], NULL, stripe_worker, &st)==0)
+			started++;
+	stripe_worker(&st);              // il chiamante invia anch'esso (da solo, se non è partito nessun thread)
+	for (i=0; i<started; i++)
+		pthread_join(t[i], NULL);
+	for (i=st.taken; i<k; i++)       // connessioni senza thread: tutti i pezzi sono passati dalle altre, basta il frame vuoto
+		if ( ! SendData(st.socks[i], &st, 0) )
+			st.lost = 1;
+	for (i=0; i<n; i++)
+		if (fd[i]>=0)
+			close(fd[i]);
+	pthread_mutex_destroy(&st.m);
+	return !st.lost;
+}
+
+// funzioni (4) per l'invio di cartelle (protocollo 10): visita in parallelo, file piccoli a pacchi, file grandi da soli
+
+void *tree_worker ( void *arg ) /* THREAD DI I/O: legge le sottocartelle in coda di [arg] (un tree_walk), accodando quelle che vi trova e > */
+{                               /* > annotando i file regolari, finché la coda è vuota e nessun altro thread ne sta leggendo una (visita finita) */
+	tree_walk *tw = arg;
+	char path[2*TREE_PATH_MAX+2], *rel, *child;
+	DIR *d;
+	struct dirent *de;
+	struct stat st;
+	void *v;
+	pthread_mutex_lock(&tw->m);
+	while (1) {
+		while (tw->ndirs==0 && tw->busy>0)
+			pthread_cond_wait(&tw->more, &tw->m);
+		if (tw->ndirs==0)
+			break;
+		rel = tw->dirs[--tw->ndirs];
+		tw->busy++;
+		pthread_mutex_unlock(&tw->m);
+		snprintf(path, sizeof(path), "%s/%s", tw->root, rel);
+		d = opendir(path);
+		pthread_mutex_lock(&tw->m);
+		if (d==NULL)
+			tw->unread++;
+		pthread_mutex_unlock(&tw->m);
+		while (d!=NULL && (de = readdir(d))!=NULL) {
+			if (strcmp(de->d_name,".")==0 || strcmp(de->d_name,"..")==0)
+				continue;
+			if (fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW)!=0 || !(S_ISDIR(st.st_mode) || S_ISREG(st.st_mode)))
+				continue;                // link simbolici (possibili cicli) e file speciali non si inviano
+			child = malloc(strlen(rel)+strlen(de->d_name)+2);
+			if (child!=NULL)
+				sprintf(child, "%s%s%s", rel, (rel[0]!='\0') ? "/" : "", de->d_name);
+			pthread_mutex_lock(&tw->m);
+			if (child==NULL || strlen(child)>TREE_PATH_MAX) {
+				tw->unread++;
+				free(child);
+			}
+			else if (S_ISDIR(st.st_mode)) {   // la legge il primo thread libero
+				if (tw->ndirs==tw->capdirs && (v = realloc(tw->dirs, 2*tw->capdirs*sizeof(char*)))!=NULL) {
+					tw->dirs = v;
+					tw->capdirs *= 2;
+				}
+				if (tw->ndirs<tw->capdirs) {
+					tw->dirs[tw->ndirs++] = child;
+					pthread_cond_signal(&tw->more);
+				}
+				else {
+					tw->unread++;
+					free(child);
+				}
+			}
+			else {
+				if (tw->n==tw->cap && (v = realloc(tw->f, ((tw->cap>0) ? 2*tw->cap : 256)*sizeof(tree_file)))!=NULL) {
+					tw->f = v;
+					tw->cap = (tw->cap>0) ? 2*tw->cap : 256;
+				}
+				if (tw->n<tw->cap) {
+					tw->f[tw->n].rel = child;
+					tw->f[tw->n].size = st.st_size;
+					tw->f[tw->n].mode = st.st_mode & 07777;
+					tw->f[tw->n].mtime = st.st_mtime;
+					tw->n++;
+				}
+				else {
+					tw->unread++;
+					free(child);
+				}
+			}
+			pthread_mutex_unlock(&tw->m);
+		}
+		if (d!=NULL)
+			closedir(d);
+		free(rel);
+		pthread_mutex_lock(&tw->m);
+		tw->busy--;
+	}
+	pthread_cond_broadcast(&tw->more);   // visita finita: anche gli altri thread in attesa escono
+	pthread_mutex_unlock(&tw->m);
+	return NULL;
+}
+
+int tree_cmp ( const void *a, const void *b ) /* per qsort: file di una cartella in ordine di percorso */
+{
+	return strcmp(((const tree_file*)a)->rel, ((const tree_file*)b)->rel);
+}
+
+void *pack_worker ( void *arg ) /* THREAD DI I/O: prende da [arg] (un tree_walk) i file piccoli che seguono, finché stanno in un pacco, li legge, > */
+{                               /* > comprime il pacco con LZ4 (se si riduce) e lo invia; poi passa al pacco successivo, finché ce ne sono */
+	tree_walk *tw = arg;
+	char *buf = malloc(2+PACK_SIZE), *lz = malloc(2+PACK_SIZE), path[2*TREE_PATH_MAX+2], *p, *out;
+	int first, last, i, fd, c, len, ok = (buf!=NULL && lz!=NULL);
+	uint32_t plen;
+	uint64_t got;
+	size_t used;
+	ssize_t r = 0;
+	tree_file *f;
+	while (ok) {
+		pthread_mutex_lock(&tw->m);
+		for (first=tw->next, used=0; !tw->lost && tw->next<tw->n; tw->next++) {
+			f = &tw->f[tw->next];
+			if (f->size > PACK_SMALL)            // i file grandi partono dopo, da soli
+				continue;
+			if (used+PACK_ENTRY+strlen(f->rel)+f->size > PACK_SIZE)
+				break;
+			used += PACK_ENTRY+strlen(f->rel)+f->size;
+		}
+		last = tw->next;
+		pthread_mutex_unlock(&tw->m);
+		if (first==last)
+			break;
+		for (i=first, p=buf+2; i<last; i++) {
+			f = &tw->f[i];
+			if (f->size > PACK_SMALL)
+				continue;
+			plen = strlen(f->rel);
+			snprintf(path, sizeof(path), "%s/%s", tw->root, f->rel);
+			fd = open(path, O_RDONLY|O_CLOEXEC);
+			for (got=0, r=0; fd>=0 && got<f->size && (r = read(fd, p+PACK_ENTRY+plen+got, f->size-got))>0; )
+				got += r;                        // un file accorciato nel frattempo parte con quello che ha
+			if (fd>=0)
+				close(fd);
+			if (fd<0 || r<0) {
+				pthread_mutex_lock(&tw->m);
+				tw->unread++;
+				pthread_mutex_unlock(&tw->m);
+				continue;
+			}
+			memcpy(p, &plen, 4);
+			memcpy(p+4, &f->mode, 4);
+			memcpy(p+8, &got, 8);
+			memcpy(p+16, &f->mtime, 8);
+			memcpy(p+PACK_ENTRY, f->rel, plen);
+			p += PACK_ENTRY+plen+got;
+		}
+		if (p==buf+2)
+			continue;
+		len = p-buf-2;
+		if ( (c = LZ4_compress_default(buf+2, lz+2, len, len-1)) > 0 ) { // un pacco che non si riduce parte così com'è
+			lz[0] = PACK_FILES;
+			lz[1] = WIRE_LZ4;
+			out = lz;
+			len = c;
+		}
+		else {
+			buf[0] = PACK_FILES;
+			buf[1] = WIRE_RAW;
+			out = buf;
+		}
+		pthread_mutex_lock(&tw->send);
+		ok = SendFrame(tw->sock, out, 2+len, 1);
+		pthread_mutex_unlock(&tw->send);
+		if (!ok) {
+			pthread_mutex_lock(&tw->m);
+			tw->lost = 1;
+			pthread_mutex_unlock(&tw->m);
+		}
+	}
+	free(buf);
+	free(lz);
+	return NULL;
+}
+
+int send_tree ( int sock_client, const char *root, int threads, int proto, int *unread ) /* (protocollo 10) invia i file della cartella > */
+{  /* > [root]: la visitano [threads] thread di I/O (il solo chiamante se 0), poi altrettanti mettono i file piccoli nei pacchi e li inviano; > */
+   /* > quelli grandi partono dopo, uno alla volta a blocchi, e un frame vuoto chiude la cartella. Somma in [unread] i file che non si sono > */
+   /* > potuti leggere. 1-ok, 0-connessione caduta */
+	tree_walk tw;
+	pthread_t t[(threads>1) ? threads-1 : 1];
+	char path[2*TREE_PATH_MAX+2], hdr[1+PACK_ENTRY+TREE_PATH_MAX];
+	int i, started, k = 1;
+	uint32_t plen;
+	FILE *fp;
+	memset(&tw, 0, sizeof(tree_walk));
+	pthread_mutex_init(&tw.m, NULL);
+	pthread_mutex_init(&tw.send, NULL);
+	pthread_cond_init(&tw.more, NULL);
+	tw.root = root;
+	tw.sock = sock_client;
+	tw.dirs = malloc(sizeof(char*));
+	if (tw.dirs!=NULL && (tw.dirs[0] = strdup(""))!=NULL) {  // si parte dalla cartella stessa (percorso relativo vuoto)
+		tw.ndirs = 1;
+		tw.capdirs = 1;
+	}
+	else
+		tw.unread++;
+	for (i=started=0; i<threads-1; i++)          // il chiamante è uno dei thread
+		if (pthread_create(&t[started], NULL, tree_worker, &tw)==0)
+			started++;
+	tree_worker(&tw);
+	for (i=0; i<started; i++)
+		pthread_join(t[i], NULL);
+	qsort(tw.f, tw.n, sizeof(tree_file), tree_cmp); // pacchi in ordine di percorso: sul server i file si aggiungono in fondo all'elenco
+	SetCork(sock_client, 1);
+	for (i=started=0; i<threads-1; i++)
+		if (pthread_create(&t[started], NULL, pack_worker, &tw)==0)
+			started++;
+	pack_worker(&tw);
+	for (i=0; i<started; i++)
+		pthread_join(t[i], NULL);
+	for (i=tw.next; i<tw.n && !tw.lost; i++)    // file piccoli rimasti senza pacco (memoria esaurita)
+		if (tw.f[i].size <= PACK_SMALL)
+			tw.unread++;
+	for (i=0; i<tw.n && k==1 && !tw.lost; i++) { // file grandi, da soli
+		if (tw.f[i].size <= PACK_SMALL)
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", root, tw.f[i].rel);
+		if ( (fp = fopen(path, "rb"))==NULL ) {
+			tw.unread++;
+			continue;
+		}
+		plen = strlen(tw.f[i].rel);
+		hdr[0] = PACK_LARGE;
+		memcpy(hdr+1, &plen, 4);
+		memcpy(hdr+5, &tw.f[i].mode, 4);
+		memcpy(hdr+9, &tw.f[i].size, 8);
+		memcpy(hdr+17, &tw.f[i].mtime, 8);
+		memcpy(hdr+1+PACK_ENTRY, tw.f[i].rel, plen);
+		k = SendFrame(sock_client, hdr, 1+PACK_ENTRY+plen, 1) ? SendStream(sock_client, file_read, fp, tw.f[i].size, proto>=5) : 0;
+		fclose(fp);
+		if (k==-1) {                             // errore di lettura: il server ha avuto il blocco vuoto e scarta il file
+			tw.unread++;
+			k = 1;
+		}
+	}
+	if (tw.lost)
+		k = 0;
+	if (k==1)
+		k = SendData(sock_client, hdr, 0);       // fine della cartella
+	SetCork(sock_client, 0);
+	*unread += tw.unread;
+	for (i=0; i<tw.ndirs; i++)
+		free(tw.dirs[i]);
+	free(tw.dirs);
+	for (i=0; i<tw.n; i++)
+		free(tw.f[i].rel);
+	free(tw.f);
+	pthread_cond_destroy(&tw.more);
+	pthread_mutex_destroy(&tw.send);
+	pthread_mutex_destroy(&tw.m);
+	return k;
+}
+
+// funzioni (8) eseguite dal client quando richiede un servizio tramite un comando
+
+int cCMDS0_478 (int sock_client) /* help(1),show-config(2),config-name(3),config-compressor(4),show-list(7),empty-list(8),config-threads(10), > */
+{                                /* > config-level(12), caso di comando non valido (0): 1-ok, 0-errore di comunicazione, -1-il server ha >  */
+                                 /* > risposto con un messaggio d'errore (in rosso: e.g. compressore inesistente). Dal protocollo 10 l'elenco > */
+                                 /* > di show-list arriva fino a CHUNK_SIZE byte (i file delle cartelle inviate) */
+	char msg[CHUNK_SIZE+1] = "";					
 	int Bs_rcvd;
-	if ( ! ReceiveData (sock_client, &msg, &Bs_rcvd) ){ // 1) ricevo e stampo il messaggio che arriva dal server
+	if ( ! ReceiveChunk (sock_client, msg, CHUNK_SIZE, &Bs_rcvd) ){ // 1) ricevo (al più CHUNK_SIZE byte) e stampo il messaggio che arriva dal server
 	  	fprintf (stderr, "Impossibile comunicare col server\n");
-		return;                 // errore nella comunicazione col compressor-server
+		return 0;               // errore nella comunicazione col compressor-server
 	}
 	msg[Bs_rcvd]='\0'; 	         // append di NUL al vettore di caratteri ricevuto, che non lo comprendeva (risparmio 1B)
 	printf("%s", msg);
+	return (strncmp(msg, REDf, strlen(REDf))==0) ? -1 : 1;
 }
 
-void cSEND (int sock_client)      /* Invio al server di un singolo file (corrispettivo sul server: "sSEND") */
+void cSTATS (int sock_client) /* stats(13): come cCMDS0_478, ma la tabella delle metriche del server può superare MAX_MSG_LEN*5 byte (fino a CHUNK_SIZE) */
 {
+	char msg[CHUNK_SIZE+1];
+	int Bs_rcvd;
+	if ( ! ReceiveChunk (sock_client, msg, CHUNK_SIZE, &Bs_rcvd) ){ // 1) ricevo e stampo la tabella
+	  	fprintf (stderr, "Impossibile comunicare col server\n");
+		return;
+	}
+	msg[Bs_rcvd]='\0';
+	printf("%s", msg);
+}
+
+int cSEND (int sock_client)      /* Invio al server di un singolo file (corrispettivo sul server: "sSEND"): 1-inviato, 0-errore di comunicazione, > */
+{                                /* > -1-file non inviato */
 	FILE *fp;      	// per operare sul file da inviare
 	struct stat inf;            // vi metterò la lunghezza del file da inviare
-	unsigned int size; 				       // usando un intero senza segno per la dimensione del tar esso potrà essere al massimo 4Gib 
+	uint64_t size; 				       // dimensione a 64 bit: nessun limite pratico alla dimensione del file inviato
 	int risp, Bs_rcvd; 
-	char *dyn;   						       	// punterà alla zona di memoria dove metterò temporaneamente il file da inviare
 	char filepath[MAX_MSG_LEN], msg[MAX_MSG_LEN]; 
 	if ( ! ReceiveData (sock_client, &filepath, &Bs_rcvd) )   		// 1)ricevo dal server il percorso del file da inviare	
-		return;		
+		return 0;		
 	filepath[Bs_rcvd]='\0';			
-	stat( filepath, &inf ); 	// informazioni varie sul file
-	if ( S_ISREG(inf.st_mode)==0 || access(filepath,R_OK)==(-1) ) { // gestione problemi d'accesso al file da inviare
+	if ( stat( filepath, &inf )!=0 || S_ISREG(inf.st_mode)==0 || access(filepath,R_OK)==(-1) ) { // gestione problemi d'accesso al file da inviare
 		fprintf (stderr, REDf"- "MAGb WHIf"%s"RST REDf": percorso non corrispondente ad un file accessibile in lettura."RST"\n", filepath);
 		risp=0;
 		if ( !SendData(sock_client, &risp, sizeof(int)) )   // 2e) comunico al server che l'invio file è fallito perchè il file non esiste (mando 0)
-			return;		
-		return;	
+			return 0;		
+		return -1;	
 	}
 	risp=1; // controlli sul path del file da inviare andati a buon fine
 	if ( ! SendData(sock_client, &risp, sizeof(int)) )	 // 2) comunico al server che è tutto ok e dunque mi appresto ad inviare il file (mando 1) 
-		return;		
+		return 0;		
 	if ( ! ReceiveData(sock_client, &risp, NULL) )           // 3) il server mi dice come proseguire: "-1"-tutto ok. "0"-file già inviato 
-		return;		
+		return 0;		
 	if (risp==0) {
 		fprintf (stderr, REDf"- %s: al server e' stato gia' inviato un file con questo nome."RST"\n", filepath);  
-		return;
+		return -1;
 	}	
 	size = inf.st_size;    	       	// mi procuro la dimensione del file da inviare
-	if ( ! SendData(sock_client, &size, sizeof(unsigned int)) ) 	// 4) invio dimensione file
-		return;		
+	if ( ! SendData(sock_client, &size, sizeof(uint64_t)) ) 	// 4) invio dimensione file (64 bit)
+		return 0;		
 	if (size!=0) {             //se sto mandando un file vuoto non devo
 		risp=1;					// ipotizzo che l'apertura del file abbia successo (d'altronde ho controllato già l'accesso)
 		fp = fopen(filepath, "rb");   		// apro il file da inviare (in lettura perchè devo solo mandare il suo contenuto al server)
 		if (fp==NULL) {
 			risp=0;
 			if ( ! SendData(sock_client, &risp, sizeof(int)) )  // 5e[opz]) comunico al server non riesco a aprire il file:  la send termina
-				return;
+				return 0;
 			fprintf (stderr, REDf"- %s: impossibile aprire il file."RST"\n", filepath);
-			return;
+			return -1;
 		}
-		if ( ! SendData(sock_client, &risp, sizeof(int)) )		 // 5[opz]) comunico al server che l'apertura del file da inviare è riuscita
-				return;
-		dyn = malloc(size);   			       	// alloco memoria dinamica per i dati del file aperto, che userò poi per mandarlo via socket
-		fread(dyn, 1, size, fp);        	// lettura file	
-		if ( ! SendData(sock_client, dyn, size) )  	         // 6[opzionale se file nn vuoto]) invio del contenuto del file
-			return;	
-		fflush(fp);	 	// un po' di pulizia..
+		if ( ! SendData(sock_client, &risp, sizeof(int)) ) {		 // 5[opz]) comunico al server che l'apertura del file da inviare è riuscita
+			fclose(fp);
+			return 0;
+		}
+		risp = SendStream(sock_client, file_read, fp, size, 0);  // 6[opzionale se file nn vuoto]) invio del contenuto del file a blocchi
 		fclose(fp);   
-		free(dyn); 
+		if (risp==0)
+			return 0;	
+		if (risp==-1)
+			fprintf (stderr, REDf"- %s: errore di lettura durante l'invio."RST"\n", filepath);
 	}
 	if ( ! ReceiveData (sock_client, &msg, &Bs_rcvd) )  		    // 7) ricevo dal server il messaggio (win or fail) da visualizzare
-		return;		
+		return 0;		
 	msg[Bs_rcvd]= '\0'; 
 	printf(CYAf"%s"RST, msg);   								// stampo a video il messaggio ricevuto dal server
+	return (size==0 || risp==1) && strstr(msg, "inviato con successo")!=NULL ? 1 : -1;
 }
 
-void cCOMPRESS (int sock_client)  /* Compressione remota di uno o più file e ricezione dell'archivio così creato (corrispettivo sul server: "sCOMPRESS") */
-{					        // ATTENZIONE: una volta creato l'archivio compresso i file inviati vengono eliminati
+int cSENDBATCH (int sock_client, int n, int proto, int threads, data_streams *ds, int *failed, int *held) /* Invio al server di [n] file a lotti, > */
+{     /* > protocollo [proto]>=2 (corrispettivo sul server: "sSENDBATCH"): niente attese tra un file e l'altro, manifesto e contenuti partono di > */
+      /* > seguito, poi un solo rapporto. Dal protocollo 3 il manifesto porta anche le impronte, e il server risponde dicendo quali contenuti gli > */
+      /* > mancano; dal 4 anche da quale byte (invio interrotto da una caduta); dal 5 i blocchi dei contenuti viaggiano compressi con LZ4; dal 9, > */
+      /* > con le connessioni dati [ds], i contenuti partono a pezzi su tutte le connessioni insieme; dal 10 un path può essere una cartella > */
+      /* > (send_tree). Con [threads]>0 le impronte (e, su una sola connessione, i contenuti) sono letti in anticipo da altrettanti thread di I/O. > */
+      /* > In [failed] (se non NULL) il n° di file non inviati (i nomi già presenti sul server esclusi), in [held] (se non NULL) quanti file > */
+      /* > ha ora il server, anche dei lotti precedenti. 1-comando concluso, 0-connessione caduta */
+	char list_msg[MAX_MSG_LEN+1], *path[n], *q;
+	uint64_t size[n], manifest[2*n], offset[n], hash[n];
+	int status[2*n+1], active[n], unread[n], i, k, Bs_rcvd, sent = 0, per_file = (proto>=3) ? 2 : 1, ahead = 0, streams = 1;
+	struct stat inf;
+	readahead ra;
+	FILE *fp;
+	if ( ! ReceiveData (sock_client, &list_msg, &Bs_rcvd) )   	// 1) ricevo dal server l'elenco dei path da inviare (separati da '\n')
+		return 0;
+	list_msg[Bs_rcvd]='\0';
+	for (i=0, q=list_msg; i<n; i++) {
+		path[i] = q;
+		q = strchr(q, '\n');
+		if (q!=NULL)
+			*q++ = '\0';
+		else if (i<n-1)             // elenco più corto del previsto: i file mancanti risultano non inviati
+			q = list_msg+Bs_rcvd;
+		unread[i] = 0;
+		if ( proto>=10 && stat( path[i], &inf )==0 && S_ISDIR(inf.st_mode) && access(path[i],R_OK|X_OK)==0 )
+			size[i] = BATCH_TREE;   // [protocollo 10] cartella: i suoi file partono a pacchi, dopo i contenuti
+		else if ( stat( path[i], &inf )!=0 || S_ISREG(inf.st_mode)==0 || access(path[i],R_OK)==(-1) ) { // gestione problemi d'accesso al file
+			fprintf (stderr, REDf"- "MAGb WHIf"%s"RST REDf": percorso non corrispondente ad un file accessibile in lettura."RST"\n", path[i]);
+			size[i] = BATCH_NOT_SENT;
+		}
+		else
+			size[i] = inf.st_size;
+		manifest[i*per_file] = size[i];
+		status[i] = (size[i]==BATCH_NOT_SENT) ? BATCH_SKIPPED : BATCH_UPLOAD;
+	}
+	if (proto>=3) {                 // impronte dei contenuti (in parallelo sui thread di I/O)
+		hash_files(path, size, hash, n, threads);
+		for (i=0; i<n; i++)
+			manifest[i*per_file+1] = hash[i];
+	}
+	if ( ! SendData(sock_client, manifest, n*per_file*sizeof(uint64_t)) ) // 2) manifesto: dimensione (64 bit) di ogni file, o BATCH_NOT_SENT, ..
+		return 0;                                                         // .. e dal protocollo 3 la sua impronta
+	if ( proto>=3 && ! ReceiveData(sock_client, status, NULL) )         // 2b) [protocollo 3] contenuti che il server non ha (BATCH_UPLOAD) ..
+		return 0;
+	memset(offset, 0, sizeof(offset));
+	if ( proto>=4 && ! ReceiveData(sock_client, offset, NULL) )         // .. e [protocollo 4] da quale byte inviarli
+		return 0;
+	if ( proto>=9 && ! ReceiveData(sock_client, &streams, NULL) )       // 2c) [protocollo 9] connessioni su cui il server attende i contenuti
+		return 0;
+	if (streams<1 || streams-1 > ((ds!=NULL) ? ds->n : 0))            // il server non può contare connessioni dati che il client non ha
+		return 0;
+	for (i=0; i<n; i++)
+		active[i] = (status[i]==BATCH_UPLOAD && size[i]>0 && size[i]!=BATCH_TREE);
+	if (streams>1) {                                           // 3) [protocollo 9] contenuti a pezzi, su tutte le connessioni insieme
+		for (i=0; i<n; i++)
+			if (active[i] && offset[i]>0)
+				printf(CYAf"- Invio di "GREf"%s"CYAf" ripreso dal byte "GREf"%llu"CYAf".\n"RST, path[i], (unsigned long long)offset[i]);
+		if ( ! send_striped(sock_client, ds, streams, path, offset, size, active, n) )
+			return 0;
+	}
+	else {
+		if (threads>0)                                             // i thread di I/O leggono i contenuti mentre si inviano quelli precedenti
+			ahead = ra_start(&ra, path, offset, size, active, n, threads);
+		SetCork(sock_client, 1);                                   // i contenuti partono a segmenti pieni (il cork si toglie prima del rapporto)
+		for (i=0, k=1; i<n && k!=0; i++) {                        // 3) contenuti, uno dopo l'altro
+			if (!active[i])
+				continue;
+			if (offset[i]>0)
+				printf(CYAf"- Invio di "GREf"%s"CYAf" ripreso dal byte "GREf"%llu"CYAf".\n"RST, path[i], (unsigned long long)offset[i]);
+			if (ahead) {                                           // blocchi già letti dal thread di I/O (un file non apribile non ne ha: ..
+				ra_next(&ra, i);
+				k = SendStream(sock_client, ra_read, &ra, size[i]-offset[i], proto>=5);  // .. parte il blocco vuoto, come sotto)
+				continue;
+			}
+			fp = fopen(path[i], "rb");
+			if (fp!=NULL && offset[i]>0 && fseeko(fp, offset[i], SEEK_SET)!=0) {
+				fclose(fp);
+				fp = NULL;
+			}
+			if (fp==NULL) {                                        // il blocco vuoto dice al server che questo file non arriverà
+				k = SendData(sock_client, list_msg, 0);
+				continue;
+			}
+			k = SendStream(sock_client, file_read, fp, size[i]-offset[i], proto>=5);
+			fclose(fp);
+		}
+		if (ahead)
+			ra_stop(&ra);
+		if (k==0)
+			return 0;
+		SetCork(sock_client, 0);                                   // svuoto l'ultimo segmento parziale
+	}
+	for (i=0; i<n; i++)                                        // 3b) [protocollo 10] le cartelle, una dopo l'altra
+		if ( size[i]==BATCH_TREE && status[i]==BATCH_UPLOAD && ! send_tree(sock_client, path[i], threads, proto, &unread[i]) )
+			return 0;
+	if ( ! ReceiveData(sock_client, status, NULL) )           // 4) rapporto: esito di ogni file e n° di file inviati finora (dal protocollo >
+		return 0;                                              // > 10 anche quanti file sono arrivati per ogni path)
+	for (i=0; i<n; i++) {
+		if (size[i]==BATCH_TREE) {
+			sent += status[n+1+i];
+			if (failed!=NULL)
+				*failed += unread[i] + (status[i]==BATCH_WRITE_ERROR || status[i]==BATCH_READ_ERROR);
+		}
+		else if (status[i]==BATCH_SENT || status[i]==BATCH_STORED)
+			sent++;
+		else if (failed!=NULL && status[i]!=BATCH_DUPLICATE)
+			(*failed)++;
+	}
+	if (held!=NULL)
+		*held = status[n];
+	k = status[n] - sent;                                      // file già presenti sul server prima di questo lotto
+	for (i=0; i<n; i++) {
+		char *name = strrchr(path[i], '/');
+		name = (name==NULL) ? path[i] : name+1;
+		if (size[i]==BATCH_TREE) {                             // [protocollo 10] cartella: un rigo per tutti i suoi file
+			k += status[n+1+i];
+			printf(CYAf"- Cartella "GREf"%s"CYAf": "GREf"%d"CYAf" file inviati ("GREf"%d"CYAf" in tutto).\n"RST, path[i], status[n+1+i], k);
+			if (unread[i]>0)
+				fprintf (stderr, REDf"- %s: %d file non letti (illeggibili o con un percorso troppo lungo)."RST"\n", path[i], unread[i]);
+			if (status[i]==BATCH_DUPLICATE)
+				fprintf (stderr, REDf"- %s: alcuni file hanno un nome gia' inviato al server e sono stati scartati."RST"\n", path[i]);
+			else if (status[i]==BATCH_WRITE_ERROR)
+				printf(YELf"CLIENT: il server non e' stato in grado di ricevere alcuni file di %s."RST"\n", path[i]);
+			else if (status[i]==BATCH_READ_ERROR)
+				fprintf (stderr, REDf"- %s: errore di lettura durante l'invio di alcuni file."RST"\n", path[i]);
+			continue;
+		}
+		switch (status[i]) {
+			case BATCH_SENT:
+			case BATCH_STORED:
+				k++;
+				printf(CYAf"- File "GREf"%s"CYAf" inviato con successo "RST, name);
+				if (status[i]==BATCH_STORED)
+					printf(CYAf"(gia' presente sul server, contenuto non trasferito) "RST);
+				if (k==1)
+					printf(CYAf"("GREf"1"CYAf" file inviato).\n"RST);
+				else
+					printf("("GREf"%d"CYAf" file inviati).\n"RST, k);
+				break;
+			case BATCH_DUPLICATE:
+				fprintf (stderr, REDf"- %s: al server e' stato gia' inviato un file con questo nome."RST"\n", path[i]);
+				break;
+			case BATCH_WRITE_ERROR:
+				printf(YELf"CLIENT: il server non e' stato in grado di ricevere il file %s; invio fallito."RST"\n", name);
+				break;
+			case BATCH_READ_ERROR:
+				fprintf (stderr, REDf"- %s: errore di lettura durante l'invio."RST"\n", path[i]);
+				break;
+		}                           // BATCH_SKIPPED: già segnalato prima dell'invio
+	}
+	return 1;
+}
+
+int cCOMPRESS (int sock_client, int proto, int *saved)  /* Compressione remota di uno o più file e ricezione dell'archivio così creato > */
+{           /* > (corrispettivo sul server: "sCOMPRESS"); dal protocollo 4 ([proto]) un download interrotto lascia il file a metà, e la compress > */
+            /* > ripetuta dopo la riconnessione lo riprende dall'ultimo byte ricevuto; dal 6 riporta la scelta automatica del compressore. > */
+            /* > 1-comando concluso (con o senza successo: in [saved], se non NULL, 1 se l'archivio è stato salvato), 0-connessione caduta */
+					        // ATTENZIONE: una volta creato l'archivio compresso i file inviati vengono eliminati
 	FILE *fp;			        // per salvare il tar inviatomi  								  
 	int y, risp, Bs_rcvd;
-	unsigned int size;        		           // poichè uso un intero C senza segno per la dimensione dell'archivio compresso, questo >
-	char *tmp_archive;        		           // > potrà essere grande al massimo 4.294.967.295 B (4GiB), ipotesi fattibile 
-	char temp[MAX_MSG_LEN]="", path[MAX_MSG_LEN*2]="";
+	uint64_t size;        		           // dimensione dell'archivio a 64 bit: viene scritto su disco man mano che arriva, senza buffer grandi quanto lui
+	uint64_t key = 0, have = 0, from = 0;    // [protocollo 4] chiave dell'archivio, byte già ricevuti in un tentativo precedente, byte da cui riparte
+	char temp[MAX_MSG_LEN]="", path[MAX_MSG_LEN*2]="", part[MAX_MSG_LEN*2+40];
 	struct stat sb;	
+	if (saved!=NULL)
+		*saved = 0;
 	if ( ! ReceiveData (sock_client, &y, NULL) )   		 // 0)  y>0: ci sono file inviati, y=0: non sono stati inviati file */
-		return;		
+		return 0;		
 	if (y==0) {
 		printf (REDf"- Al server non e' stato inviato alcun file.\n"RST); // da qui in poi il suo corrispettivo sul server è sCOMPRESS
-		return;
+		return 1;
 	}
 	if ( ! ReceiveData (sock_client, &temp, &Bs_rcvd) )  // 1) ricevo dal server il nome dell'archivio compresso e lo memorizzo in temp*/        
-		return;		
+		return 0;		
 	temp[Bs_rcvd]='\0'; 								 // contiene il nome dell'archivio (e.g."nome.tar.xz")
 	if ( ! ReceiveData (sock_client, &path, &Bs_rcvd) )  // 2) ricevo dal server il percorso dove salvare l'archivio compresso e lo memorizzo*/
-		return;		
+		return 0;		
 	path[Bs_rcvd]='\0'; 					         // contiene il path della directory dove salvare l'archivio(e.g."./alfa/beta/")
 	risp=1;
 	if ( stat(del_chars(path,'\"'), &sb)!=0 || S_ISDIR(sb.st_mode)==0 || access(del_chars(path,'\"'), W_OK)!=0 ) 
 		risp=0;    					       	 // il percorso si riferisce ad una cartella dove posso scrivere? (no=0, sì=1)
 	if ( ! SendData(sock_client, &risp, sizeof(int)) )   //  3) comunico al server se posso accedere al path specificato
-		return;		
+		return 0;		
 	if (risp==0) {						      	// comunico all'utente che il path indicato per salvare il file non è utilizzabile
 		fprintf (stderr, REDf"- "MAGb WHIf"%s"RST REDf": questo percorso non esiste o non si hanno permessi per accedervi.\n"RST, path);
-		return;	
+		return 1;	
 	}	
+	strcat(path, temp); 	       	 // creo il path completo dell'archivio (locale) aggiugendovi alla fine (append) il nome dell'archivio (in temp)
+	strcpy(part, path);              // file in cui si riceve (a metà finché il download non è concluso)
+	if (proto>=4) {
+		if ( ! ReceiveData (sock_client, &key, NULL) )  // 3b) [protocollo 4] chiave dell'archivio (0 se il server non può riprenderne l'invio) ..
+			return 0;
+		if (key!=0) {
+			sprintf(part, "%s.%016llx.part", path, (unsigned long long)key);
+			if ( stat(part, &sb)==0 )
+				have = sb.st_size;
+		}
+		if ( ! SendData(sock_client, &have, sizeof(uint64_t)) ) // .. a cui rispondo con i byte che ne ho già
+			return 0;
+	}
 	if ( ! ReceiveData (sock_client, &y, NULL) )   // 4) il file compresso è creato e accessibile al server (quindi inviabile)? Sì[y=1] oppure No[y=0]. 
-		return;		
+		return 0;		
 	if (y==0) {
 		fprintf (stderr, REDf"- Il server non e' stato in grado di creare o accedere al file compresso.\n"RST);
-		return;
+		return 1;
 	}	
-	if ( ! ReceiveData (sock_client, &size, NULL) )  // 5) ricezione dimensione archivioo (ridondante: la potrei ricevere con la ReceiveData > 
-		return;					 // > dopo, ma quando la invoco devo già sapere quanto è grande il buffer dove metterne il contenuto
-	tmp_archive = malloc(size);  	    // alloco in memoria dinamica uno spazio sufficiente (buffer) a contenere l'archivio che mi invierà il server 
-	if ( ! ReceiveData (sock_client, tmp_archive, NULL) )// 6) ricezione contenuto dell'archivio compresso
-		return;		 
-	strcat(path, temp); 	       	 // creo il path completo dell'archivio (locale) aggiugendovi alla fine (append) il nome dell'archivio (in temp)
-	fp = fopen(path, "wb");    					 // creo il file locale (archivio), per ora vuoto
-	if(fp == NULL){
-		free(tmp_archive);
-		fprintf (stderr, REDf"- Impossibile creare il file-archivio nel percorso indicato.\n"RST); //errore di creazione
+	if ( ! ReceiveData (sock_client, &size, NULL) )  // 5) ricezione dimensione archivio (64 bit): seguono size byte grezzi oppure, se ignota, dei frame
+		return 0;
+	if ( proto>=4 && size!=ARCHIVE_SIZE_UNKNOWN && ! ReceiveData (sock_client, &from, NULL) ) // 5b) [protocollo 4] byte da cui riparte l'invio
+		return 0;
+	if (from>0 && from==have) {
+		fp = fopen(part, "ab");                      // ripresa: i byte mancanti si accodano a quelli già ricevuti
+		printf(CYAf"- Download ripreso dal byte "GREf"%llu"CYAf".\n"RST, (unsigned long long)from);
+	}
+	else
+		fp = fopen(part, "wb");    					 // creo il file locale (archivio) prima della ricezione, così da scriverlo man mano
+	if (size==ARCHIVE_SIZE_UNKNOWN)               // 6) ricezione contenuto dell'archivio compresso (scartato se non ho potuto creare il file):
+		y = ReceiveFramed(sock_client, fp);      // > prodotto al volo dal server, a frame, oppure ..
+	else
+		y = ReceiveRaw(sock_client, fp, size-from); // > .. di dimensione nota, byte grezzi
+	if (fp!=NULL)
+		fclose(fp);
+	if (y==0) {                                  // connessione caduta a metà: elimino l'archivio incompleto, a meno che il download si possa riprendere
+		if (fp!=NULL && key==0)
+			remove(part);
+		return 0;
+	}
+	if (fp==NULL || y==-1 || (key!=0 && rename(part, path)!=0)) {
+		if (fp!=NULL)
+			remove(part);
+		if (fp==NULL)
+			fprintf (stderr, REDf"- Impossibile creare il file-archivio nel percorso indicato.\n"RST); //errore di creazione
+		else
+			fprintf (stderr, REDf"- Archivio non ricevuto: errore di scrittura o di compressione sul server.\n"RST);
 		risp=0;
-		if ( !SendData(sock_client, &risp, sizeof(int)))      // 7e) comunico al server che la creazione dell'archivio lato client è fallita (0) 
-			return; 
-		return;                                          
+		return SendData(sock_client, &risp, sizeof(int)); // 7e) comunico al server che la creazione dell'archivio lato client è fallita (0) 
 	}
-	fwrite(tmp_archive, 1, size, fp);       			  // scrivo sul file l'archivio ricevuto
 	risp=1;	
 	if ( ! SendData(sock_client, &risp, sizeof(int)) )    // 7) comunico al server la creazione dell'archivio lato client è riuscita (1)
-		return;		
-	fflush(fp);			 // chiudo lo stream, elimino il buffer e stampo a video l'esito positivo della sCompress
-	fclose(fp);
-	free(tmp_archive);
+		return 0;		
+	if (saved!=NULL)
+		*saved = 1;
 	printf(CYAf"- Archivio "GREf"%s"CYAf" ricevuto con successo.\n"RST, temp); 
+	if (proto>=6) {
+		if ( ! ReceiveData (sock_client, &path, &Bs_rcvd) ) // 8) [protocollo 6] resoconto della scelta automatica del compressore (vuoto se non c'è stata)
+			return 0;
+		path[Bs_rcvd]='\0';
+		printf("%s", path);
+	}
+	return 1;
+}
+
+int negotiate_protocol (int sock_client, uint64_t *token, int *files) /* propone al server PROTOCOL_VERSION e restituisce la versione concordata > */
+{   /* > (1 con i server che non conoscono il comando "protocol"), 0 se cade la connessione (corrispettivo sul server: "sPROTOCOL"). Dal protocollo > */
+    /* > 4 presenta il [token] della sessione da riprendere (0: nessuna) e vi riceve quello della sessione; in [files] i file che la sessione ripresa > */
+    /* > ha già (-1: sessione nuova) */
+	char msg[MAX_MSG_LEN*5];
+	int choice, v;
+	*files = -1;
+	sprintf(msg, "protocol %d", PROTOCOL_VERSION);
+	if ( ! SendData(sock_client, msg, strlen(msg)) )          // 1) proposta della versione (come un comando)
+		return 0;
+	if ( ! ReceiveData(sock_client, &choice, NULL) )          // 2) un server vecchio lo tratta come comando non valido (0) ..
+		return 0;
+	if (choice!=11)
+		return ReceiveData(sock_client, msg, NULL) ? 1 : 0;   // .. e ne invia il messaggio d'errore, che scarto: si usa il protocollo 1
+	if ( ! ReceiveData(sock_client, &v, NULL) )               // 3) versione concordata
+		return 0;
+	if (v>=4) {
+		if ( ! SendData(sock_client, token, sizeof(uint64_t)) )  // 4) [protocollo 4] token della sessione da riprendere
+			return 0;
+		if ( ! ReceiveData(sock_client, token, NULL) || ! ReceiveData(sock_client, files, NULL) ) // 5) token di questa sessione e file già inviati
+			return 0;
+	}
+	return v;
+}
+
+int reconnect (int *sock_client, struct sockaddr_in *server_address, int *proto, uint64_t *token, data_streams *ds) /* dopo la caduta della > */
+{   /* > connessione si riconnette al server [server_address] (fino a RECONNECT_TRIES tentativi) e riprende la sessione [token], riaprendo le > */
+    /* > connessioni dati [ds] (protocollo 9): 1-riconnesso, 0-server irraggiungibile */
+	int i, c, files;
+	close(*sock_client);
+	printf(REDf"- Connessione con il server interrotta: riconnessione in corso..."RST"\n");
+	for (i=0; i<RECONNECT_TRIES; i++) {
+		if (i>0)
+			sleep(1<<(i-1));        // attese crescenti: il collegamento potrebbe impiegare un po' a tornare
+		*sock_client = socket( PF_INET, SOCK_STREAM, 0 );
+		if (*sock_client==-1)
+			continue;
+		if ( connect(*sock_client, (const struct sockaddr*)server_address, sizeof(struct sockaddr_in))==0 ) {
+			SetNoDelay(*sock_client);
+			if ( ReceiveData(*sock_client, &c, NULL) && (*proto = negotiate_protocol(*sock_client, token, &files))!=0 ) {
+				if (files>=0)
+					printf(CYAf"- Sessione ripresa ("GREf"%d"CYAf" file gia' inviati al server).\n"RST, files);
+				else
+					printf(YELf"- Riconnesso, ma la sessione precedente non e' piu' disponibile: i file vanno inviati di nuovo.\n"RST);
+				close_streams(ds);      // quelle vecchie il server le ha chiuse con la connessione caduta
+				if (*proto>=9 && ds->want>0)
+					attach_streams(ds, server_address, *token);
+				return 1;
+			}
+		}
+		close(*sock_client);
+	}
+	return 0;
+}
+
+void measure_latency (int sock_client, int n) /* esegue [n] volte "show-configuration" e stampa i tempi di andata e ritorno (min/medio/max/p99, ms) */
+{                                               /* > misura la latenza per comando del canale di controllo (si usa con --latency N) */
+	char msg[MAX_MSG_LEN*5];
+	const char *cmd = "show-configuration";
+	double rtt[n], sum = 0, t;
+	struct timespec t0, t1;
+	int i, j, choice;
+	for (i=0; i<n; i++) {
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		if ( ! SendData(sock_client, cmd, strlen(cmd)) || ! ReceiveData(sock_client, &choice, NULL)
+		     || ! ReceiveData(sock_client, msg, NULL) ) {
+			fprintf (stderr, REDf"Errore con la connessione durante la misura della latenza."RST"\n");
+			return;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		rtt[i] = (t1.tv_sec-t0.tv_sec)*1e3 + (t1.tv_nsec-t0.tv_nsec)/1e6;
+		sum += rtt[i];
+		for (j=i; j>0 && rtt[j-1]>rtt[j]; j--) {  // mantengo i tempi ordinati (per minimo, massimo e percentile)
+			t = rtt[j]; rtt[j] = rtt[j-1]; rtt[j-1] = t;
+		}
+	}
+	printf(CYAf"- Latenza su "GREf"%d"CYAf" comandi (ms):"RST" min %.3f, medio %.3f, max %.3f, p99 %.3f\n",
+	       n, rtt[0], sum/n, rtt[n-1], rtt[(n*99)/100 < n ? (n*99)/100 : n-1]);
+}
+
+// funzioni (4) della modalità batch (non interattiva): gli stessi comandi del prompt, generati dagli argomenti, con un codice d'uscita per l'esito
+
+int read_manifest ( const char *file, char ***files, int *n ) /* aggiunge a [files] (che ne ha [n]) i path del file [file], uno per riga > */
+{                                                              /* > ("-": standard input; righe vuote ignorate): 1-ok, 0-errore */
+	char line[4096], **v;
+	FILE *fp = (strcmp(file, "-")==0) ? stdin : fopen(file, "r");
+	int len;
+	if (fp==NULL)
+		return 0;
+	while (fgets(line, sizeof(line), fp)!=NULL) {
+		len = strlen(line);
+		while (len>0 && (line[len-1]=='\n' || line[len-1]=='\r'))
+			line[--len] = '\0';
+		if (len==0)
+			continue;
+		v = realloc(*files, (*n+1)*sizeof(char*));
+		if (v==NULL || (v[*n] = strdup(line))==NULL) {
+			if (v!=NULL)
+				*files = v;
+			if (fp!=stdin)
+				fclose(fp);
+			return 0;
+		}
+		*files = v;
+		(*n)++;
+	}
+	if (fp!=stdin)
+		fclose(fp);
+	return 1;
+}
+
+int batch_command (int *sock_client, struct sockaddr_in *server_address, int *proto, uint64_t *token, const char *cmd, int threads, data_streams *ds, int *failed, int *held) /* > */
+{   /* > esegue [cmd] come se fosse stato digitato al prompt; dopo una caduta si riconnette e lo ripete (send e compress riprendono dall'ultimo > */
+    /* > byte ricevuto, come nel ciclo interattivo). In [failed] si sommano i file non inviati, in [held] quanti file ha ora il server (send). > */
+    /* > Il codice d'uscita (EXIT_..) dell'esito */
+	int choice, counter, saved, i, r, lost;
+	printf(YELf"%s"RST"%s\n", PROMPT, cmd);     // come se lo si fosse digitato
+	while (1) {
+		choice = -1;
+		lost = 0;
+		if ( SendData(*sock_client, cmd, strlen(cmd)) && ! ReceiveData(*sock_client, &choice, NULL) )
+			choice = -1;
+		switch (choice) {
+			case -1:                                // connessione caduta prima della risposta
+				break;
+			case 5:{ //send
+				if ( ! ReceiveData(*sock_client, &counter, NULL) )
+					break;
+				if (*proto>=2) {
+					if (counter>0 && ! cSENDBATCH(*sock_client, counter, *proto, threads, ds, &lost, held))
+						break;
+				}
+				else {
+					for (i=0, r=1; i<counter && r!=0; i++)
+						if ( (r = cSEND(*sock_client))==-1 )
+							lost++;
+					if (r==0)
+						break;
+					*held += counter - lost;
+				}
+				*failed += lost;
+				return (lost>0) ? EXIT_FILES : EXIT_OK;
+			}
+			case 6:{ //compress
+				if ( ! cCOMPRESS(*sock_client, *proto, &saved) )
+					break;
+				return saved ? EXIT_OK : EXIT_COMPRESS;
+			}
+			case 9: //quit
+				return EXIT_OK;
+			default:{ // configure-compressor, configure-level, configure-name (e comando non valido)
+				r = cCMDS0_478(*sock_client);
+				if (r==0)
+					break;
+				return (r==1 && choice!=0) ? EXIT_OK : EXIT_CONFIG;
+			}
+		}
+		if (*proto<4 || ! reconnect(sock_client, server_address, proto, token, ds))
+			return EXIT_CONNECTION;
+	}
 }
 
- 
- // MAIN
-int main ( int argc, char* argv[] )   /* corpo del processo client: per lanciarlo si usa "compressor-client <host remoto> <porta>" */
-{	
+int batch_path_ok ( const char *path ) /* 1 se [path] può stare in un comando send (al più MAX_MSG_LEN-1 caratteri, tra virgolette se ha spazi), 0 altrimenti */
+{
+	return strchr(path, '"')==NULL && strchr(path, '\n')==NULL && strlen("send ")+strlen(path)+2 < MAX_MSG_LEN;
+}
+
+int run_batch (int *sock_client, struct sockaddr_in *server_address, int *proto, uint64_t *token, char **files, int n, char *opt[], int threads, data_streams *ds) /* > */
+{   /* > modalità batch: configura compressore, livello e nome ([opt]: valori di --compressor, --level, --name, --out; NULL se non indicati), invia > */
+    /* > gli [n] file [files] (con più send se i path non stanno in un comando), comprime nella cartella --out (default: quella corrente) ed esce. > */
+    /* > Il codice d'uscita: il primo errore di configurazione o di connessione, altrimenti il più grave tra quelli di send e compress */
+	const char *cfg[3] = { "configure-compressor", "configure-level", "configure-name" };
+	char cmd[MAX_MSG_LEN+1], *name;
+	int skip[n], i, j, len, rc, failed = 0, held = 0, worst = EXIT_OK;
+	for (i=0; i<3; i++) {
+		if (opt[i]==NULL)
+			continue;
+		if (strlen(cfg[i])+1+strlen(opt[i])+3 > MAX_MSG_LEN) {
+			fprintf (stderr, REDf"- %s: valore troppo lungo."RST"\n", opt[i]);
+			return EXIT_USAGE;
+		}
+		sprintf(cmd, strchr(opt[i], ' ') ? "%s \"%s\"" : "%s %s", cfg[i], opt[i]);
+		if ( (rc = batch_command(sock_client, server_address, proto, token, cmd, threads, ds, &failed, &held))!=EXIT_OK )
+			return rc;
+	}
+	for (i=0; i<n; i++) {            // sul server i file sono identificati dal nome: un secondo file con lo stesso nome non verrebbe accettato
+		name = strrchr(files[i], '/');
+		name = (name==NULL) ? files[i] : name+1;
+		for (j=0; j<i; j++)
+			if (!skip[j] && strcmp(strrchr(files[j],'/') ? strrchr(files[j],'/')+1 : files[j], name)==0)
+				break;
+		skip[i] = (j<i || !batch_path_ok(files[i]));
+		if (skip[i]) {
+			fprintf (stderr, REDf"- "MAGb WHIf"%s"RST REDf": %s."RST"\n", files[i], (j<i) ? "nome gia' usato da un altro file dell'elenco" 
+			         : "percorso non utilizzabile in un comando (troppo lungo o con virgolette)");
+			failed++;
+		}
+	}
+	for (i=0; i<n; ) {               // send con quanti più path possibile per comando
+		strcpy(cmd, "send");
+		len = strlen(cmd);
+		for (; i<n; i++) {
+			if (skip[i])
+				continue;
+			if (len+strlen(files[i])+3 >= MAX_MSG_LEN)
+				break;
+			len += sprintf(cmd+len, strchr(files[i], ' ') ? " \"%s\"" : " %s", files[i]);
+		}
+		if (len==4)
+			break;
+		rc = batch_command(sock_client, server_address, proto, token, cmd, threads, ds, &failed, &held);
+		if (rc==EXIT_CONNECTION)
+			return rc;
+		if (rc>worst)
+			worst = rc;
+	}
+	if (held>0) {                    // il server ha almeno un file (anche di una cartella): compress
+		snprintf(cmd, sizeof(cmd), strchr(opt[3], ' ') ? "compress \"%s\"" : "compress %s", opt[3]);
+		rc = batch_command(sock_client, server_address, proto, token, cmd, threads, ds, &failed, &held);
+		if (rc==EXIT_CONNECTION)
+			return rc;
+		if (rc>worst)
+			worst = rc;
+	}
+	else
+		fprintf (stderr, REDf"- Nessun file inviato: archivio non creato."RST"\n");
+	if (failed>0 && worst==EXIT_OK)  // (file scartati prima di inviarli)
+		worst = EXIT_FILES;
+	rc = batch_command(sock_client, server_address, proto, token, "quit", threads, ds, &failed, &held);
+	return (rc!=EXIT_OK) ? rc : worst;
+}
+
+  // MAIN
+int main ( int argc, char* argv[] )   /* corpo del processo client: per lanciarlo si usa "compressor-client <host remoto> <porta> [--latency N]" */
+{	                                   /* > oppure, in modalità batch, [--send file.. | --manifest elenco] [--compressor c] [--level l] [--name n] > */
+	                                   /* > [--out cartella] [--io-threads n] (vedi run_batch); in entrambe [--streams k] (connessioni per i > */
+	                                   /* > contenuti, protocollo 9); il codice d'uscita è uno degli EXIT_.. */
 	char *IPv4address_string; 							// stringa corrispondente all'indirizzo (IPv4) del server 
 	int port, sock_client, c;                		// porta su cui il server è in ascolto, socket descriptor del client, un intero
 	struct sockaddr_in server_address; 				// indirizzo del server (IPv4)
 	int quitexit=0;
-	if (argc!=3) { 										// controllo numero argomenti
+	int proto, resumed;                              // versione del protocollo concordata con il server, file della sessione ripresa
+	uint64_t token = 0;                              // [protocollo 4] token con cui riprendere la sessione dopo una caduta
+	int resume_cmd = 0;                              // 1: ripeto il comando interrotto dalla caduta (send o compress: riprende il trasferimento)
+	char clientCommand[MAX_MSG_LEN+1];
+	int latency = 0;                                 // se >0: n° di comandi con cui misurare la latenza (modalità non interattiva)
+	char **files = NULL;                             // (modalità batch) file da inviare, da --send e --manifest
+	char *opt[4] = { NULL, NULL, NULL, "." };        // (modalità batch) --compressor, --level, --name, --out
+	int nfiles = 0, batch = 0, io_threads = -1, i, bad = (argc<3);  // io_threads: thread di lettura anticipata dei file (-1: default)
+	data_streams ds = { {0}, 0, 0 };                 // [protocollo 9] connessioni dati (--streams k: k-1 oltre a quella dei comandi)
+	for (i=3; i<argc && !bad; i++) {
+		if (strcmp(argv[i],"--latency")==0 && i+1<argc)
+			latency = atoi(argv[++i]);
+		else if (strcmp(argv[i],"--send")==0) {
+			batch = 1;
+			for (; i+1<argc && strncmp(argv[i+1],"--",2)!=0; i++) {
+				char **v = realloc(files, (nfiles+1)*sizeof(char*));
+				if (v==NULL || (v[nfiles] = strdup(argv[i+1]))==NULL) {
+					bad = 1;
+					break;
+				}
+				files = v;
+				nfiles++;
+			}
+		}
+		else if (strcmp(argv[i],"--manifest")==0 && i+1<argc) {
+			batch = 1;
+			if ( ! read_manifest(argv[++i], &files, &nfiles) ) {
+				fprintf (stderr, REDf"\nImpossibile leggere l'elenco dei file %s."RST"\n\n", argv[i]);
+				return EXIT_USAGE;
+			}
+		}
+		else if (strcmp(argv[i],"--compressor")==0 && i+1<argc)
+			opt[0] = argv[++i];
+		else if (strcmp(argv[i],"--level")==0 && i+1<argc)
+			opt[1] = argv[++i];
+		else if (strcmp(argv[i],"--name")==0 && i+1<argc)
+			opt[2] = argv[++i];
+		else if (strcmp(argv[i],"--out")==0 && i+1<argc)
+			opt[3] = argv[++i];
+		else if (strcmp(argv[i],"--io-threads")==0 && i+1<argc && isdigit(argv[i+1][0]))
+			io_threads = atoi(argv[++i]);
+		else if (strcmp(argv[i],"--streams")==0 && i+1<argc && atoi(argv[i+1])>=1 && atoi(argv[i+1])<=MAX_STREAMS)
+			ds.want = atoi(argv[++i]) - 1;
+		else
+			bad = 1;
+	}
+	if (io_threads<0)
+		io_threads = batch ? IO_THREADS_BATCH : 0;   // al prompt i file si leggono (come prima) mentre li si invia
+	if ( bad || latency<0 || latency>100000 || (latency>0 && batch) || (batch && nfiles==0) 
+	     || (!batch && (opt[0]!=NULL || opt[1]!=NULL || opt[2]!=NULL || strcmp(opt[3],".")!=0)) ) { 	// controllo argomenti
 	        fprintf (stderr, REDf"\nIl programma compressor-client deve essere lanciato specificando, nell'ordine,"); 
-                fprintf(stderr,"l'indirizzo IPv4 della macchina dove gira il server e la porta su cui esso e' in ascolto."RST"\n\n");
-		return 0;
+                fprintf(stderr,"l'indirizzo IPv4 della macchina dove gira il server e la porta su cui esso e' in ascolto;\n");
+		fprintf(stderr,"poi, facoltativi: --latency N oppure (modalità batch) --send file.. e/o --manifest elenco, con --compressor c, "
+		        "--level l, --name n, --out cartella, --io-threads n; --streams k (da 1 a %d connessioni per i contenuti)."RST"\n\n", MAX_STREAMS);
+		return EXIT_USAGE;
 	}                     			        	// memorizzo i parametri del programma inseriti da riga di comando invocandolo: 
 	IPv4address_string = argv[1];    			        // stringa relativa ai 4 ottetti dell'indirizzo IPv4
 	port = atoi(argv[2]);           					// porta (il client dovrà conoscere su quale il server sta ascoltando)
@@ -274,53 +1710,83 @@ int main ( int argc, char* argv[] )   /* corpo del processo client: per lanciarl
 			strcpy(IPv4address_string,"127.0.0.1");    // gestione "speciale" per l'indirizzo di loopback (utile in fase di test)
 		else {
 			fprintf (stderr, REDf"\nIndirizzo IPv4 non valido (quattro numeri tra 0 e 255 separati da punto)."RST"\n\n");
-			return 0;
+			return EXIT_USAGE;
 		}
 	}
 	if ( (port<1024)||(port>65535) ) {   				// controllo porta
 		fprintf (stderr, REDf"\nNumero porta non valido (intero compreso tra 1024 e 65535)."RST"\n\n");
-		return 0;
+		return EXIT_USAGE;
 	}
 	memset( &server_address, 0, sizeof(server_address) ); // preparazione indirizzo e porta del server (3 passi)
 	server_address.sin_family = AF_INET;   								  // I) sin family (indirizzo IPv4) 
 	c = inet_pton( AF_INET, IPv4address_string, &server_address.sin_addr ); // II) sin addr da notazione puntata a numerica
 	if (c==0) {
 		fprintf (stderr, REDf"Indirizzo non convertibile in formato numerico."RST"\n");
-		return 0; 
+		return EXIT_USAGE; 
 	}
 	server_address.sin_port = htons(port); 		       	  // III) network ordering del port number (Short): da formato di host (H) a rete (N) 
 	sock_client = socket( PF_INET, SOCK_STREAM, 0 ); 		 // creazione del socket del client (ha solo questo)
 	if (sock_client==-1) {
 		fprintf (stderr, REDf"Impossibile creare il socket."RST"\n");   
-		return 0; 										 // errore creazione socket: il client termina 
+		return EXIT_CONNECTION; 										 // errore creazione socket: il client termina 
 	}
 	printf(CYAf"\nConnessione al server in corso..."RST"\n");
 	c = connect( sock_client, (const struct sockaddr*)&server_address, sizeof(struct sockaddr_in) ); 
 	if (c!=0) {										 	 // richiesta connessione al server
 		fprintf (stderr, REDf"-Connessione al server fallita (controllare indirizzo e porta)."RST"\n\n");
-		return 0;
+		return EXIT_CONNECTION;
 	} 						        	 // qui c=0, ma subito dopo lo sovrascrivo (ma non mi interessa cosa c'è in c)
+	SetNoDelay(sock_client);                     // i comandi sono frame brevi: niente attese di Nagle sul canale di controllo
 	if ( ! ReceiveData(sock_client, &c, NULL) ) 		 // 1) il server mi informa che mi è stato assegnato un thread del pool
-		return 0;	
+		return EXIT_CONNECTION;	
+	proto = negotiate_protocol(sock_client, &token, &resumed); // 1b) versione del protocollo (send a lotti, ripresa se il server la supporta)
+	if (proto==0)
+		return EXIT_CONNECTION;
+	if (ds.want>0 && latency==0) {                 // 1c) [protocollo 9] connessioni dati aggiunte alla sessione
+		if (proto>=9)
+			attach_streams(&ds, &server_address, token);
+		if (ds.n<ds.want)
+			fprintf (stderr, YELf"- Il server accetta %d connessioni dati su %d: i contenuti viaggiano su %d connessioni."RST"\n", ds.n, ds.want, ds.n+1);
+	}
+	if (batch) {                                   // modalità batch: configurazione, send, compress e quit senza prompt
+		c = run_batch(&sock_client, &server_address, &proto, &token, files, nfiles, opt, io_threads, &ds);
+		close(sock_client);
+		close_streams(&ds);
+		for (i=0; i<nfiles; i++)
+			free(files[i]);
+		free(files);
+		printf(REDb WHIf"Terminazione REMOTE COMPRESSOR client."RST"\n\n");
+		return c;
+	}
+	if (latency>0) {                               // modalità di misura: niente prompt, poi la quit come da utente
+		int choice;
+		measure_latency(sock_client, latency);
+		if ( SendData(sock_client, "quit", 4) && ReceiveData(sock_client, &choice, NULL) )
+			quitexit = 1;
+		close(sock_client);
+		return quitexit ? EXIT_OK : EXIT_CONNECTION;
+	}
 	printf ("\n"REDb WHIf"REMOTE COMPRESSOR client, v %s"RST"\n", VERSION);
 	printf (CYAf"- Connesso al server "GREf"%s"CYAf" sulla porta "GREf"%d"CYAf".\n"RST, IPv4address_string, port);
 	printf ("Digitare "GREf"help"RST" per visualizzare i comandi disponibili.\n");
 	printf (CYAf"- ATTENZIONE:"RST"\n        *inserire comandi di lunghezza massima "GREf"%d"RST" caratteri.\n", MAX_MSG_LEN);
 	printf ("        *racchiudere i nomi contententi spazi tra virgolette ("GREf"\""RST".."GREf"\""RST")\n"); 
 	while(1){                      	           // ciclo di invio comandi al server (pool thread) fino a che non c'è la quit (programma interattivo)
-		char clientCommand[MAX_MSG_LEN+1];
-		int choice, len; 
+		int choice = -1, len; 
 		quitexit=0;
-		printf( YELf"%s"RST, PROMPT );  					 // prompt a schermo
-		fgets( clientCommand, MAX_MSG_LEN, stdin ); 	 // ricezione comando scritto dal client da tastiera 
-		strcpy( clientCommand, trim_side_spaces(clientCommand) ); // tolgo gli spazi a sx e dx del comando
+		if (resume_cmd)                 // dopo la riconnessione ripeto il comando interrotto, senza prompt
+			resume_cmd = 0;
+		else {
+			printf( YELf"%s"RST, PROMPT );  					 // prompt a schermo
+			fgets( clientCommand, MAX_MSG_LEN, stdin ); 	 // ricezione comando scritto dal client da tastiera 
+			strcpy( clientCommand, trim_side_spaces(clientCommand) ); // tolgo gli spazi a sx e dx del comando
+		}
 		len = strlen( clientCommand );		
 		if (len==0)  			       	 // se il comando è vuoto ricomincio col prompt saltando alla prossima iterazione del ciclo while
 			continue;		 						
-		if ( ! SendData( sock_client, &clientCommand, len) )  // 2) informo il server del comando eseguito dall'utente-client (privo del NUL finale)
-			break;			
-		if ( ! ReceiveData (sock_client, &choice, NULL) )// 3) ricevo dal server il numero d'ordine del comando ricevuto (0-7) 
-			break;			
+		if ( SendData( sock_client, &clientCommand, len) )  // 2) informo il server del comando eseguito dall'utente-client (privo del NUL finale)
+			if ( ! ReceiveData (sock_client, &choice, NULL) )// 3) ricevo dal server il numero d'ordine del comando ricevuto (0-13) 
+				choice = -1;            // connessione caduta: non si sa se il comando è stato eseguito
 		switch (choice){// A seconda del comando eseguo azioni diverse (invoco una funzione specifica, tranne per la quit)
 			case 0: // comando non valido
 			case 1: // help
@@ -328,20 +1794,38 @@ int main ( int argc, char* argv[] )   /* corpo del processo client: per lanciarl
 			case 3: // configure-name
 			case 4: // show-configuration
 			case 7: //show-list
-			case 8:{//empty-list 
+			case 8: //empty-list 
+			case 10: //configure-threads
+			case 12:{//configure-level
 				cCMDS0_478(sock_client); // help,show-c,config-n,config-c e il caso di comando non valido prevedono solo >
 				continue;                // > che il client riceva il messaggio da stampare dal server e lo mandi a video
 			}
+			case 13:{//stats
+				cSTATS(sock_client);
+				continue;
+			}
+			case 14:{//attach (solo come primo comando di una connessione dati: sulla connessione dei comandi il server lo rifiuta)
+				if ( ! ReceiveData (sock_client, &c, NULL) )
+					break;
+				fprintf (stderr, REDf" - attach: comando riservato alle connessioni dati (--streams)."RST"\n");
+				continue;
+			}
 			case 5:{ //send
 				int counter, i;
 				if ( ! ReceiveData (sock_client, &counter, NULL) )  //  0)  memorizzo quanti file devo inviare al server (n° di cSend)
 					break;
+				if (proto>=2) {               // protocollo 2: un unico scambio per tutti i file
+					if (counter>0 && ! cSENDBATCH (sock_client, counter, proto, io_threads, &ds, NULL, NULL))
+						break;
+					continue;
+				}
 				for (i=0;i<counter;i++)	       	// alcuni di questi path potrebbero riferirsi a file non esistenti o non accessibili, 
 					cSEND (sock_client);  				// ma devo comunque tentare gli invii [chiamare le cSEND])
 				continue;
 			}
 			case 6: { //compress
-				cCOMPRESS (sock_client);
+				if ( ! cCOMPRESS (sock_client, proto, NULL) )
+					break;
 				continue;
 			}
 			case 9:{ //quit
@@ -349,7 +1833,9 @@ int main ( int argc, char* argv[] )   /* corpo del processo client: per lanciarl
 				break;        // esco dallo switch (farò subito la chiusura del socket con il server)
 			}
 		} //fine switch
-		break;  			      	// se esco dallo switch (per quit o per caduta del server) esco anche dal while 		
+		if (quitexit || proto<4 || ! reconnect(&sock_client, &server_address, &proto, &token, &ds))
+			break;  			      	// se esco dallo switch (per quit o per caduta del server) esco anche dal while 		
+		resume_cmd = (choice==5 || choice==6); // send e compress interrotte riprendono (dal protocollo 4) dall'ultimo byte ricevuto
 	} //fine while
     if (!quitexit) 
 	   printf(REDf"Errore con la connessione: il server non risponde\n");
@@ -359,6 +1845,7 @@ int main ( int argc, char* argv[] )   /* corpo del processo client: per lanciarl
     c = close(sock_client);  			  				 
     if (c<0)
 	   perror(REDf"close"RST);
+    close_streams(&ds);
     printf(REDb WHIf"Terminazione REMOTE COMPRESSOR client."RST"\n\n");
-	 return 0; 
+	 return quitexit ? EXIT_OK : EXIT_CONNECTION; 
 }  //fine main del client (terminazione applicativo lato client)
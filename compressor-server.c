@@ -6,28 +6,45 @@
  * 				Informatica dell'Università di Pisa, tenuto dal prof. Anastasi.
  * 				Le caratteristiche principali dell'applicazione "remote-compressor" sono:
  * 					- paradigma client-server
- * 					- server concorrente multi-threaded (thread POSIX): POOL_DIMENSION thread Server ed 1 thread Listener
+ * 					- server concorrente multi-threaded (thread POSIX): pool elastico di thread Server, IO_THREADS thread di I/O (epoll) ed 1 thread Listener
+ * 					- sessioni indipendenti dai thread: un ServerThread è occupato solo mentre esegue un comando, non per tutta la connessione
+ * 					- scheduler dei lavori di compressione (un worker per core, work-stealing), dimensionato indipendentemente dal pool
  * 					- comunicazione tramite Berkeley socket TCP ("stream")
- * 				   - compressione tramite il comando "tar"
+ * 				   - archiviazione (tar) e compressione in-process, con i codec linkati (zlib, bzip2, liblzma, zstd, lz4, LZW interno)
+ * 				   - metriche senza lock (istogrammi HDR per comando e per codec, byte, occupazione del pool): comando stats ed endpoint Prometheus locale
+ * 				   - log strutturato asincrono (anelli senza lock per thread, testo o JSON lines) con tracce opzionali delle fasi di ogni comando
+ * 				   - upload su più connessioni TCP della stessa sessione (attach): i file arrivano a pezzi e sono ricomposti nell'area di lavoro
+ * 				   - invio di cartelle intere: i file piccoli arrivano impacchettati e sono salvati con il loro percorso relativo
+ * 				   - compressione anticipata (opzionale): ogni file è archiviato e compresso appena arriva, la compress chiude soltanto l'archivio
  * 					- utilizzo dei segnali (ISO C library signals)
  * 					- utilizzo delle espressioni regolari (POSIX ERE)
  * language: Italian (program, comments), English (code)
  * notes: 1) programma scritto per l'esecuzione sotto ambienti UNIX e *nix
- *        2) compilare con l'opzione "-pthread"
- *        3) avviare il server [eventualmente in background] ( "compressor-server <porta> [&] ")
+ *        2) compilare con l'opzione "-pthread" e linkare i codec ("-lz -lbz2 -llzma -lzstd -llz4") e la libreria matematica ("-lm")
+ *        3) avviare il server [eventualmente in background] ( "compressor-server [opzioni] <porta> [min max [job]] [&] "), con [min max] dimensioni del pool e [job] worker di compressione >
+ *           > (default: core); opzioni del log: --log text|json, --log-level debug|info|warn|error, --trace (fasi di ogni comando); >
+ *           > --workspace-mem MiB: file di ogni sessione tenuti in memoria (default WS_MEM_SESSION, 0: tutti su disco); --fsync none|data|full: >
+ *           > persistenza dei file ricevuti su disco, dello store e della cache (none: lasciata al kernel, il default); --eager: ogni file >
+ *           > ricevuto è archiviato e compresso subito, in sottofondo, e la compress chiude soltanto l'archivio
  * 	  4) per terminare il server inviargli SIGINT una volta che tutti i client si sono disconnessi
- *	  5) il programma crea nella directory corrente una cartella contenente tante subdirectory quanti sono i thread del pool [vedi macro "POOL_.."]   
+ *	  5) il programma crea nella directory corrente una cartella contenente una subdirectory per ogni sessione aperta [vedi macro "POOL_.."]: >
+ *           > i file ricevuti stanno in memoria (memfd) entro i budget per sessione e globale [macro "WS_MEM_.."], oltre vanno su disco; >
+ *           > le cartelle svuotate o chiuse sono rinominate e cancellate da un thread di pulizia (nessun comando della shell)
+ *        6) compilato con "-DCODEC_BENCH" diventa il banco di prova dei codec ("codec-bench"): stessi archiviatore e codec del server, su corpus >
+ *           > sintetici e cartelle indicate, con velocità di compressione e decompressione, rapporto e picco di memoria (tabella e JSON)
 */
 
 /*  STRUTTURA DEL DOCUMENTO: 
 		- librerie (base, segnali, socket, pthreads, regex, directory)
 		- macro (pool, archivi, listen, regex, messaggi, versione, colori)
-		- typedef (archiviazione, lista di nomi)
+		- typedef (archiviazione, lista di nomi, sessioni)
 		- variabili globali (sincronizzazione, compressione)
-		- funzioni (stringhe, socket, sync, regex, tar, funzioni del server, comandi del client e loro parametri)
+		- funzioni (stringhe, impronte, log, socket, sync, scheduler, compressione, regex, funzioni del server, comandi del client e loro parametri)
 		- gestori segnali (SIGINT)
-		- codice thread (poolserver, listenerserver)
-		- codice processo (compressorserver)
+		- esecuzione dei comandi
+		- codice thread (poolserver, I/O, metriche, listenerserver; quello del log è tra le funzioni del log, quello di pulizia tra quelle dell'area di lavoro)
+		- banco di prova dei codec (solo con -DCODEC_BENCH: corpus, decompressori, prove in processi figli)
+		- codice processo (compressorserver, o codec-bench con -DCODEC_BENCH)
 */
 
 
@@ -39,35 +56,176 @@
 #include <string.h>
 #include <errno.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <stdarg.h>     // per gli eventi del log (campi chiave/valore in numero variabile)
 #include <signal.h>     // per i segnali 
 #include <sys/types.h>  // per i socket 
 #include <sys/socket.h>
+#include <sys/epoll.h>  // per l'attesa dei comandi di più sessioni sullo stesso thread di I/O
+#include <poll.h>       // per i pezzi dei file che arrivano insieme da più connessioni della stessa sessione (protocollo 9)
 #include <netinet/in.h>
+#include <netinet/tcp.h> // per TCP_NODELAY e TCP_CORK
+#include <sys/uio.h>     // per l'invio vettoriale (intestazione e dati del frame insieme)
 #include <arpa/inet.h>
 #include <pthread.h>   // per i POSIX pthreads (man pthreads)
+#include <semaphore.h> // per l'attesa dei ServerThread inattivi sulla coda di consegna
+#include <stdatomic.h> // per la coda di consegna senza lock (C11)
+#include <sched.h>
+#include <time.h>
 #include <regex.h>     // per le espressioni regolari 
 #include <dirent.h>    // per le cartelle 
+#include <fcntl.h>     // per l'invio dell'archivio senza copie in spazio utente
+#include <zlib.h>      // librerie dei codec usati dall'archiviatore in-process (-lz -lbz2 -llzma -lzstd -llz4)
+#include <bzlib.h>
+#include <lzma.h>
+#include <zstd.h>      // (-lzstd, con il supporto multithread)
+#include <lz4frame.h>  // formato a frame di lz4 (.lz4), come il comando "lz4"
+#include <math.h>      // per l'entropia dei campioni (configure-compressor auto, -lm)
+#include <lz4.h>       // blocchi dei file ricevuti compressi dal client (protocollo 5, -llz4)
+#include <sys/wait.h>     // (banco di prova dei codec, -DCODEC_BENCH) prove in processi figli e loro picco di memoria
+#include <sys/resource.h>
+#include <limits.h>        // INT_MAX (descrittori per i file delle sessioni in memoria)
+#ifdef __linux__
+#include <sys/sendfile.h>
+#include <sys/syscall.h>   // per memfd_create (file della sessione in memoria)
+#endif
+#ifndef MSG_MORE
+#define MSG_MORE 0      /* dove mancano (non Linux), i frame partono comunque corretti: cambia solo l'accorpamento */
+#endif
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
 
 
 
 /*  MACRO  */
-#define POOL_DIMENSION 4              // dimensione del pool di Thread Servers (n° massimo di client serviti contemporanamente)
+#define POOL_MIN_THREADS 4            // dimensione minima (iniziale) del pool di Thread Servers [modificabile da riga di comando]
+#define POOL_MAX_THREADS 64           // dimensione massima del pool (n° massimo di comandi eseguiti contemporaneamente) [idem]
+#define POOL_LIMIT 1024               // limite superiore ammesso per le dimensioni del pool
+#define POOL_IDLE_TIMEOUT 30          // secondi di inattività dopo i quali un ServerThread oltre il minimo termina (il pool si restringe)
+#define HANDOFF_QUEUE_SIZE 4096       // celle della coda di consegna delle sessioni ai ServerThread (potenza di 2)
 #define POOL_ROOT_DIR "PoolFolders"      // cartella locale del compressore lato server
-#define POOL_FOLDER_PREFIX "T"	         // prefisso al numero d'ordine delle cartelle per i file temporanei dei thread del pool (ognuno serve un client)
+#define POOL_FOLDER_PREFIX "T"	         // prefisso al numero d'ordine delle cartelle per i file temporanei delle sessioni (una per client connesso)
+#define IO_THREADS 2                    // thread di I/O che attendono (con epoll) i comandi delle sessioni connesse
+#define IO_MAX_EVENTS 64                // eventi restituiti al massimo da una singola epoll_wait
+#define IO_TIMEOUT_MS 500               // timeout della epoll_wait (i thread di I/O si accorgono così della chiusura del server)
 
 #define BACKLOG 100                     // per la coda della listen [si veda https://www.freebsd.org/cgi/man.cgi?query=listen&sektion=2]
 
 #define DEFAULT_ARCHIVE_NAME "archivio" // nome di default dell'archivio che creo con la "compress"
 #define DEFAULT_COMPRESSOR_INDEX 0      // gnuzip (0 è l'indice di riga, nella matrice dei compressori, relativo a tale algoritmo)
-#define NUM_COMPRESSORS 4               // n° algoritmi di compressione supportati dal programma (devono comunque essere installati nel SO)
+#define NUM_COMPRESSORS 6               // n° algoritmi di compressione supportati dal programma (codec linkati nel server, vedi "codecs")
 #define MAX_COMPR_NAME_LENGTH 10        // lunghezza dell'archivio con il nome più lungo, arrotondata per eccesso al multiplo di 10 più vicino
+#define AUTO_NONE 0                     // configure-compressor con un nome: compressore fisso
+#define AUTO_TIME 1                     // configure-compressor auto time <s>: il rapporto migliore entro un tempo previsto di <s> secondi
+#define AUTO_RATIO 2                    // configure-compressor auto ratio <r>: il compressore più veloce che raggiunge il rapporto <r>
+#define AUTO_DEFAULT_SECONDS 10.0       // obiettivo di "configure-compressor auto" senza altri parametri
+#define AUTO_SAMPLES 8                  // campioni presi a intervalli regolari dai file inviati per le prove di compressione..
+#define AUTO_SAMPLE_SIZE (32<<10)       // ..ciascuno di 32KiB
+#define AUTO_ENTROPY_MAX 7.5            // bit per byte oltre i quali i dati sono già compressi (media, archivi): si prova solo lz4 (il più veloce)
+#define AUTO_CANDIDATES 9               // coppie (compressore, livello) provate dalla scelta automatica (vedi auto_candidates)
+#define AUTO_RATIO_SLACK 0.02           // rapporti entro il 2% sono considerati pari: vince il compressore più veloce
+#define GZ_LEVEL 6                      // livelli di compressione di default dei codec (gli stessi dei rispettivi comandi), usati finché il client..
+#define BZ_LEVEL 9                      // ..non ne sceglie un altro con configure-level
+#define XZ_LEVEL 6
+#define ZST_LEVEL 3
+#define LZ4_LEVEL 1                     // (da 3 in su lz4 usa la variante HC, più lenta e più compatta)
+#define LEVEL_DEFAULT (-1)              // configure-level default: ogni codec usa il proprio livello di default
+#define MAX_LEVEL 19                    // livello più alto accettato da configure-level (quello massimo di zstd senza --ultra)
+#define ZST_LONG_WINDOW 27              // finestra (2^27 = 128MiB) delle corrispondenze a lungo raggio di zstd, come "zstd --long" (default dei decompressori)
+#define GZ_BLOCK_SIZE (1<<20)           // blocchi della compressione parallela: 1MiB per gzip, un blocco bzip2 da 900k, 8MiB (= dizionario) per xz
+#define BZ_BLOCK_SIZE 900000
+#define XZ_BLOCK_SIZE (8<<20)
+#define LZ4_BLOCK_SIZE (4<<20)          // blocchi della compressione parallela di lz4 (frame indipendenti); zstd usa i propri thread
+#define PB_FREE 0                       // stati di un blocco della compressione parallela
+#define PB_READY 1                      // (affidato allo scheduler, da comprimere o in compressione)
+#define PB_DONE 2
+#define PB_ERROR 3
+#define SCHED_DEQUE_SIZE 256            // lavori che possono attendere nella coda di ciascun worker dello scheduler (potenza di 2)
+#define DEFAULT_THREADS 1               // thread di compressione per richiesta (configure-threads)
+#define MAX_THREADS 64
+#define LZW_BITS 16                     // n° massimo di bit dei codici LZW (formato .Z di compress)
+#define LZW_HSIZE 69001                 // dimensione (primo) della tabella hash del dizionario LZW, come in compress(1)
+#define LZW_CHECK_GAP 10000             // byte tra due controlli del rapporto di compressione a dizionario LZW pieno (CLEAR se peggiora), come in compress(1)
+#define TAR_BLOCK 512                   // blocco e record del formato tar
+#define TAR_RECORD 10240
+#define ARCHIVE_SIZE_UNKNOWN UINT64_MAX // dimensione annunciata quando l'archivio è prodotto al volo: seguono frame SendData, un frame vuoto e l'esito
 
 
 #define FILEPATH_REGEX "([^ \n]+)|([^ \"\n]*(\"[^\"]*\"|[^ \"\n]))+" // espressione regolare path dei file della send [POSIX  Extended Regular Syntax (ERE)]
 
 #define MAX_MSG_LEN 200  // dimensione massima dei messaggi che può inviare il client
+#define CHUNK_SIZE 65536 // dimensione dei blocchi con cui vengono ricevuti i file (buffer fisso, memoria costante per client)
 
 #define VERSION "6.3" // versione del programma
+#define PROTOCOL_VERSION 10 // versione più recente del protocollo (1: send un file alla volta; 2: send a lotti; 3: lotti con impronte; 4: sessioni > 
+                           // > ripristinabili e trasferimenti ripresi dall'ultimo byte ricevuto; 5: blocchi inviati compressi con LZ4; 6: resoconto > 
+                           // > della scelta automatica del compressore alla fine della compress; 7: comando configure-level; 8: comando stats; >
+                           // > 9: connessioni dati aggiuntive con "attach" e contenuti a pezzi su tutte; 10: cartelle con i file piccoli >
+                           // > impacchettati), negoziata con "protocol"
+#define WIRE_RAW 0         // (protocollo 5) primo byte di ogni blocco di un file ricevuto: blocco così com'è
+#define WIRE_LZ4 1         // blocco compresso dal client con LZ4
+#define MAX_STREAMS 16     // (protocollo 9) connessioni di una sessione su cui possono arrivare i contenuti: quella dei comandi più le connessioni dati
+#define PIECE_HEADER 16    // (protocollo 9) intestazione di un pezzo: n° del file nel lotto (32 bit, poi 32 a zero) e posizione (64 bit), seguita dal blocco
+#define PACK_SIZE (1<<20)  // (protocollo 10) byte massimi (non compressi) di un pacco di file piccoli di una cartella
+#define PACK_ENTRY 24      // (protocollo 10) intestazione di un file nel pacco: lunghezza del percorso e permessi (32 bit), dimensione e mtime (64 bit)
+#define PACK_FILES 'P'     // (protocollo 10) frame di una cartella: pacco di file piccoli (formato WIRE_* e poi il pacco, compresso se si riduce) ..
+#define PACK_LARGE 'L'     // .. o file grande (intestazione e percorso; il contenuto segue a blocchi, come quello dei file della send)
+#define TREE_PATH_MAX 4096 // (protocollo 10) lunghezza massima del percorso relativo di un file di una cartella inviata
+#define SESSION_PARK_TIMEOUT 300 // secondi per cui la sessione di un client caduto (protocollo 4) attende che il client si riconnetta
+#define SESSION_RESUME_WAIT 30   // secondi di attesa, alla riconnessione, che la vecchia connessione del client venga chiusa
+#define PART_FOLDER_SUFFIX ".part" // cartella (accanto a quella della sessione) dei file arrivati a metà, ripresi alla riconnessione
+#define WS_MEM_SESSION 128          // MiB dei file di una sessione tenuti in memoria (memfd); oltre, i nuovi file vanno su disco [--workspace-mem]
+#define WS_MEM_TOTAL (1ULL<<30)     // byte in memoria dei file di tutte le sessioni insieme (anche di quelle parcheggiate)
+#define SPARE_FOLDER_SUFFIX ".new"  // cartella di scorta, vuota, di una sessione: prende il posto della sua cartella quando la si svuota
+#define TRASH_FOLDER_SUFFIX ".del"  // (+ n° d'ordine) cartella scartata, in attesa che il thread di pulizia la cancelli
+#define FSYNC_NONE 0                // persistenza dei file ricevuti su disco [--fsync]: ci pensa il kernel (default)
+#define FSYNC_DATA 1                // fdatasync di ogni file ricevuto su disco, di ogni contenuto dello store e archivio della cache
+#define FSYNC_FULL 2                // come FSYNC_DATA, e anche fsync delle cartelle in cui compaiono
+#define BATCH_NOT_SENT UINT64_MAX // nel manifesto della send a lotti: file che il client non invierà (non accessibile)
+#define BATCH_TREE (UINT64_MAX-1) // (protocollo 10) nel manifesto: cartella, i cui file arrivano impacchettati dopo i contenuti
+#define BATCH_SENT 0           // esiti per file della send a lotti (rapporto finale al client)
+#define BATCH_SKIPPED 1        // non inviato: il client non può accedervi
+#define BATCH_DUPLICATE 2      // scartato: c'è già un file con quel nome
+#define BATCH_WRITE_ERROR 3    // il server non è riuscito a salvarlo
+#define BATCH_READ_ERROR 4     // il client ha interrotto l'invio (errore di lettura)
+#define BATCH_UPLOAD 5         // (protocollo 3, risposta al manifesto) il server non ha il contenuto: il client lo invii
+#define BATCH_STORED 6         // (protocollo 3) ricevuto senza trasferimento: contenuto già presente nello store, collegato nella cartella
+#define ARCHIVE_CACHE_DIR "ArchiveCache" // archivi già compressi, per chiave (file inviati e compressore): una compress identica li riusa
+#define ARCHIVE_CACHE_BUDGET (1ULL<<30) // spazio massimo della cache degli archivi; oltre si eliminano quelli usati meno di recente (LRU)
+#define EAGER_QUEUE 256                 // (--eager) file ricevuti che possono attendere di entrare nell'archivio anticipato (oltre, la ricezione aspetta)
+#define BLOB_STORE_DIR "BlobStore" // store dei contenuti ricevuti, per impronta e dimensione: sopravvive alle sessioni e ai riavvii
+#define LOG_DEBUG 0                     // livelli del log (--log-level): solo gli eventi di livello pari o superiore vengono registrati
+#define LOG_INFO 1
+#define LOG_WARN 2
+#define LOG_ERROR 3
+#define LOG_RING_SIZE 256               // eventi nell'anello di ciascun thread (potenza di 2): se è pieno gli eventi vengono scartati e contati
+#define LOG_RECORD_SIZE 512             // byte massimi di un evento formattato
+#define LOG_FLUSH_MS 20                 // pausa del thread del log quando gli anelli sono vuoti
+#define TRACE_RECV 0                    // fasi delle tracce per sessione (--trace): ricezione dalla rete, ..
+#define TRACE_WRITE 1                   // .. scrittura su disco, ..
+#define TRACE_COMPRESS 2                // .. tar e compressione, ..
+#define TRACE_SEND 3                    // .. invio al client
+#define TRACE_PHASES 4
+#define NUM_COMMANDS 15                 // comandi del protocollo, per n° d'ordine (da 0, comando non valido, a 14, attach)
+#define STATS_MAX_LEN CHUNK_SIZE        // testo massimo della risposta a stats e, dal protocollo 10, a show-list (il client lo riceve in un solo blocco)
+#define METRICS_PORT_OFFSET 1000        // metriche in formato Prometheus (HTTP) su 127.0.0.1, alla porta del server + METRICS_PORT_OFFSET
+#define HIST_SUB_BITS 3                 // istogrammi HDR: 2^3 intervalli lineari per ogni potenza di 2 (errore relativo al più 12.5%)
+#define HIST_BUCKETS 304                // intervalli di un istogramma: (40-2)*8, durate fino a 2^40 us (circa 12 giorni)
+#define HIST_PROM_MIN 6                 // limiti ("le") esportati in Prometheus: le potenze di 2 da 2^6 us (64 us) ..
+#define HIST_PROM_MAX 35                // .. a 2^35 us (circa 9.5 ore)
+#define CB_DIR_TEMPLATE "/tmp/codec-bench.XXXXXX" // (banco di prova dei codec, -DCODEC_BENCH) cartella dei corpus sintetici e degli archivi
+#define CB_DEFAULT_SIZE (32<<20)        // byte di ciascun corpus sintetico (text, log, binary, media)
+#define CB_TINY_SIZE (4<<20)            // byte del corpus "tiny": tanti file piccoli, da CB_TINY_MIN a CB_TINY_MAX byte
+#define CB_TINY_MIN 64
+#define CB_TINY_MAX 2048
+#define CB_MAX_CORPORA 64               // corpus di una misura, compresi quelli indicati come cartelle
+#define XXH_PRIME1 11400714785074694791ULL // costanti di XXH64 (impronta dei file per lo store dei contenuti)
+#define XXH_PRIME2 14029467366897019727ULL
+#define XXH_PRIME3 1609587929392839161ULL
+#define XXH_PRIME4 9650029242287828579ULL
+#define XXH_PRIME5 2870177450012600261ULL
+#define XXH_ROTL(x,r) (((x) << (r)) | ((x) >> (64 - (r))))
 
 #define CYAf  "\x1B[36m"    /* colori */
 #define GREf  "\x1B[32m"         // testo
@@ -84,6 +242,10 @@
 typedef struct  compr_parameters {  /* contiene il nome dell'archivio e il codice del compressore utilizzato */
 		int compressor_index;   // 0-gnuzip, 1-bzip2, 2-xz, 3-compress (vedi compressors_matrix)...[gnuzip/0 default]
 		char* archive_name;     // punterà alla stringa con il nome da dare all'archivio ["archivio" default] 
+		int threads;            // thread usati per comprimere (compressione parallela a blocchi se >1) [DEFAULT_THREADS default]
+		int level;              // livello di compressione (ricondotto all'intervallo di ciascun codec) [LEVEL_DEFAULT default]
+		int auto_mode;          // AUTO_NONE (compressore fisso), AUTO_TIME o AUTO_RATIO: compressore scelto ad ogni compress [AUTO_NONE default]
+		double auto_target;     // obiettivo della scelta automatica: secondi (AUTO_TIME) o rapporto di compressione (AUTO_RATIO)
 	} comp_param;
 	
 	
@@ -94,188 +256,3230 @@ typedef struct element { /* elemento base della lista dei nomi dei file da invia
 
 typedef elem* list;	 /* per semplificare la scrittura delle funzioni che operano sulla suddetta lista */
 
+typedef struct xxh64_state { /* stato dell'impronta XXH64 calcolata a flusso (i contenuti arrivano a blocchi) */
+		uint64_t total;              // byte elaborati finora
+		uint64_t v[4];               // le 4 corsie di accumulo
+		unsigned char mem[32];       // blocco in sospeso (meno di 32 byte)
+		unsigned memsize;
+	} xxh64_state;
+
+typedef struct lzw_state { /* stato del codec LZW (compress): dizionario hash e accumulatore di bit */
+		int32_t htab[LZW_HSIZE];      // chiavi (prefisso, carattere), -1 se la posizione è libera
+		uint16_t codetab[LZW_HSIZE];  // codice associato a ogni chiave
+		int free_ent, dec_free;       // prossima voce del dizionario del compressore e di quello (in ritardo di uno) del decompressore
+		int n_bits, maxcode, group;   // larghezza attuale dei codici, limite oltre cui allargarli, codici emessi nel gruppo corrente
+		int ent, first;               // prefisso corrente (-1 se nessuno), 1 finché non è stato emesso il primo codice
+		uint64_t acc;                 // bit in attesa di completare un byte
+		int nacc, outlen;             // n° di bit in acc, byte già presenti nel buffer d'uscita
+		int maxbits;                  // n° massimo di bit dei codici (livello, da 9 a LZW_BITS, come "compress -b")
+		uint64_t in_count, out_count; // byte letti ed emessi, per il rapporto di compressione ..
+		uint64_t checkpoint, ratio;   // .. da ricontrollare (a dizionario pieno) quando in_count arriva a checkpoint, e l'ultimo misurato (x256)
+	} lzw_state;
+
+typedef struct archive_writer { /* archiviatore in-process: riceve lo stream tar, lo comprime e consegna i byte compressi a [sink] */
+		int compressor_index;       // riga di compressors_matrix (e di codecs) 
+		union {
+			z_stream z;
+			bz_stream bz;
+			lzma_stream xz;
+			ZSTD_CCtx *zst;
+			struct {
+				LZ4F_cctx *ctx;
+				unsigned char *buf;     // uscita di lz4: LZ4F_compressUpdate chiede spazio per il caso peggiore, oltre CHUNK_SIZE
+				size_t cap;
+				int started;            // intestazione del frame già emessa (non in lz4_init: il client non attende ancora byte)
+			} lz4;
+		} s;                        // stato del codec di libreria in uso
+		lzw_state *lzw;             // stato del codec LZW (compress)
+		struct pcodec *par;         // compressione parallela a blocchi (NULL se sequenziale)
+		int level;                  // livello di compressione (già ricondotto all'intervallo del codec)
+		int threads;                // thread chiesti per la compressione (zstd li usa direttamente, senza blocchi)
+		int (*sink)( void *ctx, const void *buf, size_t len ); // destinazione dei byte compressi (e.g. il socket del client): 1-ok, 0-errore
+		void *sink_ctx;
+		unsigned char out[CHUNK_SIZE]; // buffer d'uscita del codec
+		uint64_t in_bytes, out_bytes;  // byte dello stream tar e byte compressi prodotti
+		uint64_t sink_us;           // (--trace) microsecondi passati nella destinazione (invio al client)
+		int failed;                 // 1 se la destinazione ha smesso di accettare dati
+	} archive_writer;
+
+typedef struct codec_ops { /* operazioni di un codec (una riga per ogni compressore di compressors_matrix): 1-ok, 0-errore */
+		int (*init) ( archive_writer *aw );
+		int (*write) ( archive_writer *aw, const void *data, size_t len );
+		int (*finish) ( archive_writer *aw );   // svuota il codec e scrive il suo trailer
+		void (*end) ( archive_writer *aw );     // libera le risorse del codec
+		int (*block) ( const unsigned char *in, size_t in_len, unsigned char *out, size_t *out_len, int level ); // blocco indipendente (NULL: non > 
+		                                        // > parallelizzabile a blocchi)
+		size_t (*bound) ( size_t len );         // dimensione massima di un blocco compresso
+		size_t block_size;                      // dimensione dei blocchi dello stream tar nella compressione parallela
+		int min_level, max_level, def_level;    // intervallo dei livelli di compressione e livello di default
+	} codec_ops;
+
+typedef struct sched_task { /* lavoro eseguito da un worker dello scheduler (una compressione intera o un suo blocco) */
+		void (*run) ( void *arg );
+		void *arg;
+		atomic_int done;            // 1 quando run è terminata (vi attende sched_wait)
+		int heavy;                  // 1 = lavoro lungo (una compress intera): non lo esegue un worker che attende un blocco
+	} sched_task;
+
+typedef struct sched_deque { /* coda di un worker: il proprietario lavora dal fondo (LIFO), gli altri rubano dalla cima (FIFO) */
+		pthread_mutex_t m;
+		sched_task *ring[SCHED_DEQUE_SIZE];
+		size_t top, bottom;         // lavori presenti: da top (il più vecchio) a bottom-1 (il più recente)
+	} sched_deque;
+
+typedef struct scheduler { /* scheduler dei lavori di compressione: un worker per core, con work-stealing tra le code */
+		int nworkers;
+		sched_deque *dq;
+		pthread_t *threads;
+		pthread_mutex_t m;
+		pthread_cond_t work, done;  // nuovi lavori da eseguire / lavori terminati
+		int sleeping;               // worker in attesa di lavoro (protetto da m)
+		atomic_int pending;         // lavori accodati e non ancora prelevati
+		atomic_uint next;           // coda di destinazione (a turno) dei lavori inviati da thread esterni allo scheduler
+		int quit;
+	} scheduler;
+
+typedef struct pblock { /* blocco dello stream tar nella compressione parallela */
+		unsigned char *in, *out;
+		size_t in_len, out_len, out_cap;
+		uint64_t seq;               // posizione del blocco nello stream (i blocchi compressi sono consegnati in quest'ordine)
+		int state;                  // PB_FREE, PB_READY (affidato allo scheduler), PB_DONE, PB_ERROR
+		sched_task task;            // compressione del blocco come lavoro dello scheduler
+		struct pcodec *pc;
+	} pblock;
+
+typedef struct pcodec { /* compressione a blocchi indipendenti, eseguiti dai worker dello scheduler (pigz-style per gzip, per blocco per bzip2 e xz) */
+		int (*block) ( const unsigned char *in, size_t in_len, unsigned char *out, size_t *out_len, int level );
+		size_t block_size;
+		int level;
+		int nslots;
+		pblock *slots;              // anello di 2*threads blocchi: il produttore riempie mentre i worker comprimono
+		uint64_t next_fill, next_emit;
+	} pcodec;
+
+typedef struct ws_file { /* file dell'area di lavoro di una sessione */
+		char *name;                 // nome (come nell'archivio; per i file a metà, con impronta e dimensione davanti)
+		int fd;                     // memfd con il contenuto, -1 se il file è su disco (nella cartella della sessione)
+		uint64_t mem;               // byte di memoria riservati (la dimensione annunciata dal client)
+		int meta;                   // (protocollo 10) 1: permessi e data sono quelli del client (file di una cartella), entrano nella chiave della cache
+	} ws_file;
+
+typedef struct ws_list { /* elenco di file dell'area di lavoro, ordinato per nome (l'ordine dell'archivio) */
+		ws_file *v;
+		int n, cap;
+	} ws_list;
+
+typedef struct workspace { /* area di lavoro di una sessione: i file ricevuti, in memoria entro i budget, su disco gli altri */
+		char dir[MAX_MSG_LEN*5];    // cartella su disco (T<id>, in POOL_ROOT_DIR): file oltre i budget, collegati dallo store o ripresi (su disco)
+		char partdir[MAX_MSG_LEN*5+8]; // cartella dei file arrivati a metà che non stanno in memoria
+		int dfd, pfd;               // descrittori delle due cartelle (-1: la cartella dei file a metà non è ancora stata creata)
+		ws_list files;              // file ricevuti, da archiviare
+		ws_list parts;              // (protocollo 4) file arrivati a metà, per riprenderne l'invio dopo una caduta
+		uint64_t mem;               // byte in memoria (riservati) di questa sessione
+		struct eager_archive *eager; // (--eager) archivio costruito con i file ricevuti finora (NULL: nessuno)
+	} workspace;
+
+typedef struct ws_trash { /* cartella scartata da un'area di lavoro, in coda al thread di pulizia */
+		struct ws_trash *next;
+		int fd;                     // la cartella aperta (-1 se non lo è)
+		char name[];                // nome (già rinominato) in POOL_ROOT_DIR
+	} ws_trash;
+
+typedef struct compress_job { /* lavoro dello scheduler per la compress: tar e compressione della cartella della sessione */
+		sched_task task;
+		archive_writer *aw;
+		workspace *ws;
+		int rc;                     // esito di build_archive e chiusura del codec (1-ok, 0-errore, -1-file illeggibile)
+	} compress_job;
+
+
+typedef struct auto_pick { /* lavoro dello scheduler per "configure-compressor auto": campioni dei file, prove di compressione e scelta */
+		sched_task task;
+		workspace *ws;
+		const comp_param *p;        // obiettivo (tempo o rapporto) e thread della compressione
+		int compressor_index;       // compressore scelto (-1: nessun file leggibile)..
+		int level;                  // ..e suo livello
+		double ratio, seconds;      // rapporto e tempo previsti per l'intero archivio
+		double entropy;             // entropia stimata dei campioni (bit per byte)
+		uint64_t total;             // byte dei file da comprimere
+	} auto_pick;
+
+typedef struct eager_file { /* (--eager) file ricevuto che attende di entrare nell'archivio anticipato */
+		char *name;                 // nome nell'archivio
+		int fd;                     // contenuto, aperto alla ricezione (la lista dei file della sessione intanto può cambiare)
+		struct stat st;
+	} eager_file;
+
+typedef struct eager_archive { /* (--eager) archivio costruito mentre arrivano i file: ognuno è archiviato e compresso appena ricevuto, sullo scheduler */
+		sched_task task;            // lavoro che svuota la coda (affidato di nuovo quando, a coda vuota, arriva un altro file)
+		archive_writer aw;          // archiviatore, aperto al primo file, in uscita su [fp]
+		int compressor_index, level, threads; // parametri con cui è stato preparato: se cambiano l'archivio non serve più
+		pthread_mutex_t m;
+		pthread_cond_t c;           // la coda ha di nuovo posto / il lavoro l'ha svuotata
+		eager_file q[EAGER_QUEUE];  // file da archiviare, in ordine d'arrivo (anello da [head])
+		int head, nq;
+		int running;                // 1 se il lavoro è affidato allo scheduler (protetto da m)
+		int submitted;              // 1 se il lavoro è stato affidato almeno una volta (prima di riaffidarlo se ne attende la fine)
+		atomic_int cancel;          // 1: l'archivio è scartato, il lavoro smette di comprimere
+		int files;                  // file accodati finora
+		int rc;                     // esito (come build_archive): 1-ok, 0-errore del codec o della scrittura, -1-file illeggibile
+		uint64_t us;                // microsecondi di tar e compressione
+		FILE *fp;                   // archivio compresso in costruzione (NULL prima del primo file e dopo la chiusura)
+		char tmp[64];               // suo nome: file temporaneo della cache (entra in cache alla compress)
+	} eager_archive;
+
+
+typedef struct log_record { /* evento del log già formattato (una riga di testo o di JSON) */
+		uint64_t us;                // istante dell'evento (mono_us): il thread del log fonde gli anelli in ordine di tempo
+		int len;
+		char text[LOG_RECORD_SIZE];
+	} log_record;
+
+typedef struct log_ring { /* anello degli eventi di un thread: solo lui vi scrive (tail), solo il thread del log vi legge (head) */
+		log_record rec[LOG_RING_SIZE];
+		char pad0[64];              // head e tail su linee di cache diverse
+		atomic_size_t head;         // prossimo evento da scaricare
+		char pad1[64];
+		atomic_size_t tail;         // prossima posizione da riempire
+		size_t end;                 // (thread del log) tail letto all'inizio dello scaricamento
+		atomic_int in_use;          // 1 se un thread vivo lo usa (0: riusabile da un nuovo thread)
+		int id;                     // n° dell'anello (campo "thread" del log)
+		struct log_ring *next;      // elenco di tutti gli anelli
+	} log_ring;
+
+typedef struct trace { /* (--trace) fasi del comando in corso su un ServerThread: microsecondi e byte per fase (TRACE_*) */
+		int on;
+		uint64_t us[TRACE_PHASES];
+		uint64_t bytes[TRACE_PHASES];
+	} trace;
+
+typedef struct histogram { /* istogramma HDR (log-lineare) delle durate, in microsecondi: aggiornato senza lock da tutti i thread */
+		atomic_ullong count;        // valori registrati
+		atomic_ullong sum;          // loro somma (media, _sum di Prometheus)
+		atomic_ullong max;
+		atomic_uint bucket[HIST_BUCKETS]; // valori per intervallo (vedi hist_index)
+	} histogram;
+
+typedef struct metrics { /* metriche del server: solo contatori atomici (rilassati), nessun lock sul percorso dei comandi */
+		histogram cmd[NUM_COMMANDS];        // durata di ogni comando, per n° d'ordine (vedi identify_command)
+		atomic_ullong cmd_lost[NUM_COMMANDS]; // comandi durante i quali il client è caduto
+		histogram handoff;                  // attesa delle sessioni nella coda di consegna (da assign_client al ServerThread)
+		histogram codec_time[NUM_COMPRESSORS]; // durata delle compress effettive (non servite dalla cache), per codec
+		atomic_ullong codec_in[NUM_COMPRESSORS], codec_out[NUM_COMPRESSORS]; // byte dello stream tar e byte compressi, per codec
+		atomic_ullong bytes_in, bytes_out;  // byte ricevuti e inviati sui socket delle sessioni
+		atomic_int pool_busy_max;           // massimo di ServerThread occupati contemporaneamente
+		time_t started;                     // avvio del server
+	} metrics;
+
+typedef struct cb_result { /* (banco di prova dei codec) misura di una prova, riportata dal processo figlio che l'ha eseguita */
+		int ok;                       // 1 se la prova è riuscita (per la decompressione: contenuto integro e della dimensione attesa)
+		uint64_t in_bytes, out_bytes; // byte dello stream tar e dell'archivio compresso
+		double seconds;               // durata della compressione o della decompressione
+		long peak_kib;                // picco di memoria residente (KiB) oltre quella del processo all'inizio della prova
+	} cb_result;
+
+typedef struct tree_result { /* (protocollo 10) esito della ricezione dei file di una cartella (ReceiveTree) */
+		int files, dup;             // file ricevuti e file scartati perché il nome era già presente
+		int werr, rerr;             // file non salvati (errore di scrittura) e file interrotti dal client (errore di lettura)
+		uint64_t bytes;             // byte dei file ricevuti
+	} tree_result;
+
+typedef struct upload { /* file di una send a lotti in ricezione (sSENDBATCH) */
+		FILE *fp;                   // dove si scrive il contenuto (NULL: scartato, perché doppione o non creato)
+		ws_list *target;            // elenco del file: quelli a metà (dal protocollo 4) o quelli della sessione
+		int k;                      // posizione del file in [target] (cambia se nel frattempo vi si aggiungono o tolgono altri file)
+		const char *name;           // nome del file in [target]: con più file aperti insieme (protocollo 9) la posizione si ricerca
+		int active;                 // 1 = il contenuto è atteso (aperto con upload_open)
+		int dup;                    // 1 = nome già presente: il contenuto si riceve e si scarta
+		int r, werr;                // esito della ricezione (come ReceiveStream) ed errore di scrittura
+		uint64_t size, offset, got; // dimensione, byte da cui riprende l'invio, byte ricevuti (a pezzi, protocollo 9)
+		xxh64_state h;              // impronta del contenuto
+	} upload;
+
+typedef struct cache_tee { /* destinazione dei byte compressi di una compress non in cache: socket del client e file temporaneo della cache */
+		int *sock;
+		int sock_ok;                // 0 dopo la caduta del client: l'archivio viene completato lo stesso, per la cache (e la ripresa del download)
+		FILE *fp;                   // NULL se la copia per la cache è stata abbandonata (errore di scrittura)
+	} cache_tee;
+
+typedef struct cache_entry { /* archivio della cache, per l'eliminazione LRU */
+		uint64_t key;               // chiave (è anche il nome del file)
+		uint64_t size;
+		struct timespec used;       // ultimo uso (mtime del file)
+	} cache_entry;
+
+typedef struct session { /* sessione di un client connesso: vive dalla accept alla disconnessione, indipendentemente dai ServerThread che la servono */
+		int sock;                   // connected socket del client
+		struct sockaddr_in addr;    // indirizzo del client
+		int id;                     // n° d'ordine della sessione (dà il nome alla sua cartella locale)
+		workspace ws;               // file ricevuti dal client (in memoria o nella cartella locale)
+		int io;                     // thread di I/O a cui è affidata tra un comando e l'altro
+		comp_param p;               // parametri di compressione scelti dal client
+		int file_counter;           // file ricevuti dal client e non ancora compressi
+		int proto;                  // versione del protocollo concordata con il client (1 finché non la negozia con "protocol")
+		uint64_t token;             // identificativo segreto con cui il client può riprendere la sessione dopo una caduta (protocollo 4)
+		int parked;                 // 1 se il client è caduto e la sessione attende la sua riconnessione (da [parked_at])
+		time_t parked_at;
+		struct session *next;       // elenco delle sessioni (attive e parcheggiate), per il ripristino
+		int hdr_got, cmd_len, cmd_got; // stato della lettura non bloccante del comando (byte dell'intestazione letti, lunghezza, byte letti)
+		char cmd[MAX_MSG_LEN+1];    // ultimo comando ricevuto
+		int choice;                 // suo n° d'ordine (per le metriche)
+		struct timespec queued;     // istante della consegna al pool (attesa nella coda di consegna)
+		int chan[MAX_STREAMS-1];    // (protocollo 9) connessioni dati aggiunte dal client con attach (protetto da park_lock)
+		int nchan;
+	} session;
+
+typedef struct handoff_cell { /* cella della coda di consegna: [seq] dice se è libera per un produttore o pronta per un consumatore */
+		atomic_size_t seq;
+		session *s;
+	} handoff_cell;
+
+typedef struct handoff_queue { /* coda MPMC limitata senza lock (Vyukov): thread di I/O -> ServerThread */
+		handoff_cell cells[HANDOFF_QUEUE_SIZE];
+		char pad0[64];              // head e tail su linee di cache diverse (produttori e consumatori non si disturbano)
+		atomic_size_t head;         // prossima posizione da prelevare
+		char pad1[64];
+		atomic_size_t tail;         // prossima posizione da riempire
+	} handoff_queue;
 
 
 /*   VARIABILI GLOBALI     */	
 	pthread_mutex_t mutex;	     // per mutua esclusione su condizione
-	pthread_cond_t PoolSleep;    // attesa risveglio di un ServerThread quando il Listener Thread vuol fornirgli un client (uso broadcast->no sem)
-	pthread_cond_t PoolBusy;     // attesa risveglio del ListenerThread quando tutti i ServerThread sono occupati con i clienti
 	pthread_cond_t PoolReady;      // in fase di inizializzazione del pool indica l'attesa in operazioni preliminari di tutti i ServerThread
-	pthread_cond_t ClientAssigned; // attesa che il singolo ServerThread del pool riceva dal Listener i dati del client
-   int in_service;          /* quanti thread del pool stanno servendo un client (da 0 a POOL_DIMENSION)*/
-   int c_sock_array;        /* socket descriptor del connected socket da assegnare ad un ServerThread (passaggio del sd tra Listener e Server)*/
-   struct sockaddr_in c_sockaddr_array; // indirizzo del client da comunicare ad un ServerThread (passaggio tra Listener e Server)	
+	pthread_cond_t PoolExit;       // attesa (del ListenerThread in chiusura) che tutti i ServerThread siano terminati
+	sem_t PoolItems;               // sessioni accodate in ready_q non ancora prelevate (vi attendono i ServerThread inattivi)
+	handoff_queue ready_q;         // sessioni con un comando completo, in attesa di un ServerThread
+	atomic_int pool_idle;          // ServerThread in attesa di una sessione
+	int pool_threads;              // ServerThread attualmente nel pool (tra pool_min e pool_max, protetto da mutex)
+	int pool_next_id;              // id del prossimo ServerThread creato
+	int pool_min, pool_max;        // dimensioni minima e massima del pool
+	int job_workers;               // worker dello scheduler dei lavori di compressione (0: uno per core)
+	scheduler sched;               // scheduler dei lavori di compressione
+	pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER; // per l'eliminazione (LRU) degli archivi dalla cache
+	atomic_uint cache_hits, cache_misses; // compress servite dalla cache / che hanno richiesto la compressione
+	metrics srv_metrics;           // metriche (comando stats e formato Prometheus)
+	log_ring * _Atomic log_rings;  // anelli del log, uno per thread che registra eventi (mai tolti: quelli dei thread terminati si riusano)
+	atomic_int log_ring_ids;
+	atomic_ullong log_dropped;     // eventi scartati perché l'anello era pieno (segnalati dal thread del log)
+	atomic_int log_running;
+	pthread_key_t log_key;         // il suo distruttore libera l'anello del thread che termina
+	pthread_t log_thread;
+	__thread log_ring *log_self;   // anello del thread corrente
+	int log_level = LOG_INFO;      // livello minimo degli eventi registrati (--log-level)
+	int log_json = 0;              // 1: eventi in JSON lines (--log json); 0: testo (colorato) chiave=valore
+	int log_trace = 0;             // 1: tracce per sessione delle fasi di ogni comando (--trace)
+	__thread trace cur_trace;      // traccia del comando in corso sul thread
+	atomic_ullong ws_mem_total;    // byte dei file delle sessioni tenuti in memoria (entro WS_MEM_TOTAL)
+	uint64_t ws_mem_session = (uint64_t)WS_MEM_SESSION<<20; // byte in memoria per sessione (0: tutti i file su disco)
+	int ws_fd_max = 0;             // descrittori oltre i quali i nuovi file delle sessioni vanno su disco (3/4 di RLIMIT_NOFILE; 0: nessun limite)
+	int pool_dirfd = -1;           // POOL_ROOT_DIR aperta: le cartelle delle sessioni vi si creano, rinominano e cancellano con le funzioni *at
+	int fsync_policy = FSYNC_NONE; // persistenza dei file ricevuti su disco (--fsync)
+	int eager_mode = 0;            // 1: ogni file ricevuto è archiviato e compresso subito, la compress chiude solo l'archivio (--eager)
+	ws_trash *reclaim_q;           // cartelle scartate da cancellare (protetto da reclaim_lock)
+	pthread_mutex_t reclaim_lock = PTHREAD_MUTEX_INITIALIZER;
+	pthread_cond_t reclaim_cond = PTHREAD_COND_INITIALIZER;
+	pthread_t reclaim_thread;
+	int reclaim_running;           // 1 = il thread di pulizia è attivo
+	atomic_uint trash_seq;         // n° d'ordine delle cartelle scartate (nomi sempre diversi)
+	int ms = -1;                   // socket di ascolto delle metriche (chiuso da SIGINT come ss); -1 se non attivo
+	__thread int sched_self = -1;  // indice del worker dello scheduler che esegue il thread corrente (-1: thread esterno)
+   int n_sessions;          // sessioni (client connessi) attualmente aperte
+   session *sessions;       // tutte le sessioni, comprese quelle parcheggiate (protetto da park_lock)
+   pthread_mutex_t park_lock = PTHREAD_MUTEX_INITIALIZER;
+   pthread_cond_t park_cond = PTHREAD_COND_INITIALIZER; // una sessione è stata parcheggiata (la attende chi la vuole riprendere)
+   int next_session_id;     // n° d'ordine della prossima sessione
+   int epfd[IO_THREADS];    // istanze epoll dei thread di I/O
 	int closing;      // 1 = è stata ordinata la chiusura (ordinata) del server; 0 = tutto procede normalmente
 	int ss;           // ci copio il socket_descriptor del listen_sock, così il sighandler può chiuderlo, sbloccando così il ListenerThread sull'accept
 	int ReadyThreads; // quanti pool thread hanno completato le operazioni di inizializzazione (al termine delle quali il ListenerThread si sveglia)
-	int assignedFlag; // 0= ListenerThread non ha completato l'assegnazione di un client a un PoolThread; 1= tutti i client hanno un PoolThread
-	char compressors_matrix[NUM_COMPRESSORS][3][MAX_COMPR_NAME_LENGTH]= { //  3 colonne e tante righe quanti sono i compressori supportati (via tar)
-		{"gnuzip", "gz", "z"}, 
-		{"bzip2", "bz2", "j"},  
-		{"xz", "xz", "J"},
-		{"compress", "Z", "Z"}
-	};  // nome compressore ,  estensione(senza ".") , opzione per il comando tar 
+	char compressors_matrix[NUM_COMPRESSORS][2][MAX_COMPR_NAME_LENGTH]= { //  2 colonne e tante righe quanti sono i compressori supportati (vedi codecs)
+		{"gnuzip", "gz"}, 
+		{"bzip2", "bz2"},  
+		{"xz", "xz"},
+		{"compress", "Z"},
+		{"zstd", "zst"},
+		{"lz4", "lz4"}
+	};  // nome compressore ,  estensione(senza ".") 
+	const char *command_names[NUM_COMMANDS] = { "invalid", "help", "configure-compressor", "configure-name", "show-configuration", "send", // nomi ..
+		"compress", "show-list", "empty-list", "quit", "configure-threads", "protocol", "configure-level", "stats", "attach" }; // .. dei comandi >
+		// > nelle metriche
+	int auto_candidates[AUTO_CANDIDATES][2] = { // coppie (riga di compressors_matrix, livello) provate da "configure-compressor auto"; la prima..
+		{5, 1},                                 // ..(la più veloce) è l'unica provata sui dati già compressi: lz4
+		{4, 1}, {4, 3}, {4, 9}, {4, 19},        // zstd
+		{0, GZ_LEVEL}, {1, BZ_LEVEL}, {2, XZ_LEVEL}, {3, LZW_BITS}
+	};
  
  
 
-/*     FUNZIONI (con eventuale indicazione di come interpretare il ritorno: di solito      */
+/*     FUNZIONI (con eventuale indicazione di come interpretare il ritorno: di solito      */
+
+// funzioni (2) sulle stringhe [uguali per client e server]
+
+char *trim_side_spaces ( char *s )  /* toglie gli spazi a sx e dx della stringa [s] e la restituisce */	
+{ 
+  int i=0, k=0, j=(strlen(s)-1);
+  while ( isspace(s[i]) && s[i]!='\0' )
+    i++;
+  while ( isspace(s[j]) && j>= 0 )
+    j--;
+  while ( i<=j )
+    s[k++] = s[i++];
+  s[k]='\0';
+  return s;
+}
+
+char *del_chars ( char *r, char x )  /* toglie tutte le occorrenze del char [x] nella stringa [r]  e restituisce [r] modificata */	
+{
+  int i=0, k=0;
+  char s[strlen(r)+1];
+  strcpy(s,r);
+  for (i=0; s[i]!='\0'; i++) 
+		if (s[i]!=x)
+			r[k++]=s[i];
+  r[k]='\0';
+  return r;
+}
+
+
+// funzioni (4) per l'impronta dei contenuti (XXH64, a flusso) [uguali per client e server]
+uint64_t xxh64_round ( uint64_t acc, uint64_t input ) /* passo di rimescolamento di XXH64 su una corsia di 64 bit */
+{
+	acc += input * XXH_PRIME2;
+	acc = XXH_ROTL(acc, 31);
+	return acc * XXH_PRIME1;
+}
+
+void xxh64_init ( xxh64_state *st ) /* prepara [st] per l'impronta di un nuovo contenuto (seme 0) */
+{
+	memset(st, 0, sizeof(*st));
+	st->v[0] = XXH_PRIME1 + XXH_PRIME2;
+	st->v[1] = XXH_PRIME2;
+	st->v[2] = 0;
+	st->v[3] = -XXH_PRIME1;
+}
+
+void xxh64_update ( xxh64_state *st, const void *data, size_t len ) /* aggiunge all'impronta [st] i [len] byte di [data] (a blocchi di 32 byte) */
+{
+	const unsigned char *p = data;
+	size_t fill;
+	int i, j;
+	st->total += len;
+	while (len > 0) {
+		fill = 32 - st->memsize;                // riempio il blocco in sospeso; quando è pieno ne aggiorno le 4 corsie
+		if (fill > len)
+			fill = len;
+		memcpy(st->mem + st->memsize, p, fill);
+		st->memsize += fill;
+		p += fill;
+		len -= fill;
+		if (st->memsize < 32)
+			break;
+		for (i=0; i<4; i++) {
+			uint64_t lane = 0;
+			for (j=7; j>=0; j--)                  // lettura little-endian, indipendente dall'architettura
+				lane = (lane<<8) | st->mem[8*i+j];
+			st->v[i] = xxh64_round(st->v[i], lane);
+		}
+		st->memsize = 0;
+	}
+}
+
+uint64_t xxh64_digest ( const xxh64_state *st ) /* restituisce l'impronta dei byte passati finora a [st] (lo stato non cambia) */
+{
+	uint64_t h, k;
+	const unsigned char *p = st->mem;
+	unsigned left = st->memsize;
+	int i, j;
+	if (st->total >= 32) {
+		h = XXH_ROTL(st->v[0], 1) + XXH_ROTL(st->v[1], 7) + XXH_ROTL(st->v[2], 12) + XXH_ROTL(st->v[3], 18);
+		for (i=0; i<4; i++) {
+			h ^= xxh64_round(0, st->v[i]);
+			h = h * XXH_PRIME1 + XXH_PRIME4;
+		}
+	}
+	else
+		h = XXH_PRIME5;
+	h += st->total;
+	for (; left >= 8; left -= 8, p += 8) {      // coda: blocchi da 8, da 4 e singoli byte
+		for (k=0, j=7; j>=0; j--)
+			k = (k<<8) | p[j];
+		h ^= xxh64_round(0, k);
+		h = XXH_ROTL(h, 27) * XXH_PRIME1 + XXH_PRIME4;
+	}
+	if (left >= 4) {
+		for (k=0, j=3; j>=0; j--)
+			k = (k<<8) | p[j];
+		h ^= k * XXH_PRIME1;
+		h = XXH_ROTL(h, 23) * XXH_PRIME2 + XXH_PRIME3;
+		left -= 4;
+		p += 4;
+	}
+	for (; left > 0; left--, p++) {
+		h ^= (*p) * XXH_PRIME5;
+		h = XXH_ROTL(h, 11) * XXH_PRIME1;
+	}
+	h ^= h >> 33;                               // rimescolamento finale
+	h *= XXH_PRIME2;
+	h ^= h >> 29;
+	h *= XXH_PRIME3;
+	h ^= h >> 32;
+	return h;
+}
+
+// funzioni (9) del log asincrono: ogni thread scrive i propri eventi (chiave/valore) in un anello senza lock, il thread del log li scarica su stdout
+
+uint64_t mono_us ( void ) /* istante corrente (CLOCK_MONOTONIC) in microsecondi: i tempi del log e delle tracce */
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec*1000000ULL + t.tv_nsec/1000;
+}
+
+void log_ring_release ( void *r ) /* distruttore della chiave log_key: il thread che termina libera il suo anello (il thread del log > */
+{                                 /* > ne scarica comunque i record rimasti) per il prossimo thread creato */
+	atomic_store_explicit(&((log_ring*)r)->in_use, 0, memory_order_release);
+}
+
+log_ring *log_ring_get ( void ) /* anello del thread corrente: alla prima chiamata ne prende uno libero (di un thread terminato, e.g. il pool > */
+{                               /* > che si restringe) o ne crea uno nuovo e lo aggiunge all'elenco; NULL se la memoria non basta */
+	log_ring *r;
+	int free_ring;
+	if (log_self!=NULL)
+		return log_self;
+	for (r=atomic_load(&log_rings); r!=NULL; r=r->next) {
+		free_ring = 0;
+		if (atomic_compare_exchange_strong(&r->in_use, &free_ring, 1))
+			break;
+	}
+	if (r==NULL) {
+		r = calloc(1, sizeof(log_ring));
+		if (r==NULL)
+			return NULL;
+		atomic_init(&r->in_use, 1);
+		r->id = atomic_fetch_add(&log_ring_ids, 1);
+		r->next = atomic_load(&log_rings);
+		while (!atomic_compare_exchange_weak(&log_rings, &r->next, r)) // inserimento in testa senza lock (gli anelli non vengono mai tolti)
+			;
+	}
+	log_self = r;
+	pthread_setspecific(log_key, r);    // al termine del thread l'anello torna libero (log_ring_release)
+	return r;
+}
+
+size_t log_value ( char *dst, size_t cap, const char *v ) /* copia in [dst] (al più [cap] byte) la stringa [v] tra virgolette, con gli escape > */
+{                                                         /* > di JSON (validi anche per il formato testo); restituisce i byte scritti */
+	size_t n = 0;
+	if (cap<3)
+		return 0;
+	dst[n++] = '"';
+	for ( ; *v!='\0' && n+8<cap; v++) {
+		unsigned char c = *v;
+		if (c=='"' || c=='\\')
+			n += sprintf(dst+n, "\\%c", c);
+		else if (c<0x20)
+			n += sprintf(dst+n, "\\u%04x", c);  // (anche i codici colore ANSI, che qui non servono)
+		else
+			dst[n++] = c;
+	}
+	dst[n++] = '"';
+	return n;
+}
+
+void log_event ( int level, const char *event, ... ) /* registra l'evento [event] con livello [level] e i campi che seguono: coppie chiave, > */
+{   /* > valore terminate da NULL; il primo carattere della chiave dà il tipo del valore ("s:" stringa, "d:" int, "u:" uint64_t, "f:" double). > */
+    /* > Il record è formattato qui (testo o JSON lines, vedi log_json) e accodato senza lock all'anello del thread: se è pieno l'evento è > */
+    /* > scartato e contato (il thread del log lo segnala), così chi registra non attende mai stdout */
+	static const char *names[] = { "debug", "info", "warn", "error" };
+	static const char *colors[] = { CYAf, GREf, YELf, REDf };
+	log_ring *r;
+	log_record *rec;
+	char *b;
+	const char *key;
+	size_t n, cap = LOG_RECORD_SIZE, t, h;
+	va_list ap;
+	if (level<log_level)
+		return;
+	r = log_ring_get();
+	if (r==NULL) {
+		atomic_fetch_add_explicit(&log_dropped, 1, memory_order_relaxed);
+		return;
+	}
+	t = atomic_load_explicit(&r->tail, memory_order_relaxed);  // solo questo thread scrive tail
+	h = atomic_load_explicit(&r->head, memory_order_acquire);
+	if (t-h == LOG_RING_SIZE) {
+		atomic_fetch_add_explicit(&log_dropped, 1, memory_order_relaxed);
+		return;
+	}
+	rec = &r->rec[t & (LOG_RING_SIZE-1)];
+	rec->us = mono_us();
+	b = rec->text;
+	if (log_json) {
+		struct timespec now;
+		struct tm tm;
+		clock_gettime(CLOCK_REALTIME, &now);
+		gmtime_r(&now.tv_sec, &tm);
+		n = strftime(b, cap, "{\"ts\":\"%Y-%m-%dT%H:%M:%S", &tm);
+		n += snprintf(b+n, cap-n, ".%03ldZ\",\"mono_us\":%llu,\"level\":\"%s\",\"thread\":%d,\"event\":\"%s\"", now.tv_nsec/1000000,
+		              (unsigned long long)rec->us, names[level], r->id, event);
+	}
+	else {
+		struct timespec now;
+		struct tm tm;
+		clock_gettime(CLOCK_REALTIME, &now);
+		localtime_r(&now.tv_sec, &tm);
+		n = strftime(b, cap, "%H:%M:%S", &tm);
+		n += snprintf(b+n, cap-n, ".%03ld %s%-5s"RST" %s%s"RST, now.tv_nsec/1000000, colors[level], names[level], CYAf, event);
+	}
+	va_start(ap, event);
+	while ( (key = va_arg(ap, const char*))!=NULL ) {
+		if (n+32>=cap) {                // record pieno: i campi rimanenti vanno persi, ma gli argomenti vanno comunque consumati
+			switch (key[0]) {
+				case 's': va_arg(ap, const char*); break;
+				case 'd': va_arg(ap, int); break;
+				case 'u': va_arg(ap, uint64_t); break;
+				case 'f': va_arg(ap, double); break;
+			}
+			continue;
+		}
+		n += snprintf(b+n, cap-n, log_json ? ",\"%s\":" : " %s=", key+2);
+		switch (key[0]) {
+			case 's': n += log_value(b+n, cap-n-2, va_arg(ap, const char*)); break;
+			case 'd': n += snprintf(b+n, cap-n, "%d", va_arg(ap, int)); break;
+			case 'u': n += snprintf(b+n, cap-n, "%llu", (unsigned long long)va_arg(ap, uint64_t)); break;
+			case 'f': n += snprintf(b+n, cap-n, "%.3f", va_arg(ap, double)); break;
+		}
+		if (n>=cap-2)
+			n = cap-3;
+	}
+	va_end(ap);
+	if (log_json)
+		b[n++] = '}';
+	b[n++] = '\n';
+	rec->len = n;
+	atomic_store_explicit(&r->tail, t+1, memory_order_release); // pubblico il record al thread del log
+}
+
+int log_drain ( void ) /* (thread del log) scrive su stdout i record presenti negli anelli, fondendoli in ordine di tempo (ogni anello è già > */
+{                        /* > ordinato): restituisce quanti ne ha scritti */
+	log_ring *r, *first, *min;
+	size_t h;
+	int n = 0;
+	unsigned long long lost = atomic_exchange(&log_dropped, 0);
+	first = atomic_load(&log_rings);
+	for (r=first; r!=NULL; r=r->next)   // i record accodati da qui in poi aspettano il prossimo giro
+		r->end = atomic_load_explicit(&r->tail, memory_order_acquire);
+	for (;;) {
+		min = NULL;
+		for (r=first; r!=NULL; r=r->next) {
+			h = atomic_load_explicit(&r->head, memory_order_relaxed);  // solo il thread del log scrive head
+			if (h!=r->end && (min==NULL || r->rec[h & (LOG_RING_SIZE-1)].us < min->rec[atomic_load_explicit(&min->head,
+			                  memory_order_relaxed) & (LOG_RING_SIZE-1)].us))
+				min = r;
+		}
+		if (min==NULL)
+			break;
+		h = atomic_load_explicit(&min->head, memory_order_relaxed);
+		fwrite(min->rec[h & (LOG_RING_SIZE-1)].text, 1, min->rec[h & (LOG_RING_SIZE-1)].len, stdout);
+		atomic_store_explicit(&min->head, h+1, memory_order_release); // libero il record per il produttore
+		n++;
+	}
+	if (lost>0) {
+		if (log_json)
+			printf("{\"mono_us\":%llu,\"level\":\"warn\",\"event\":\"log_dropped\",\"count\":%llu}\n", (unsigned long long)mono_us(), lost);
+		else
+			printf(YELf"warn "RST" log_dropped count=%llu\n", lost);
+	}
+	if (n>0 || lost>0)
+		fflush(stdout);                 // una sola scrittura (e un solo lock di stdio) per giro, anche se stdout è una pipe lenta
+	return n;
+}
+
+void *log_flusher ( void *unused ) /* THREAD DEL LOG: scarica gli anelli ogni LOG_FLUSH_MS millisecondi (subito di nuovo se erano pieni di record) */
+{
+	struct timespec ts = { 0, LOG_FLUSH_MS*1000000L };
+	while (atomic_load(&log_running)) {
+		if (log_drain()==0)
+			nanosleep(&ts, NULL);
+	}
+	log_drain();                        // ultimi eventi registrati prima di log_stop
+	pthread_exit(NULL);
+}
+
+int log_start ( void ) /* avvia il thread del log: 1-ok, 0-errore (gli eventi restano allora negli anelli, senza bloccare nessuno) */
+{
+	pthread_key_create(&log_key, log_ring_release);
+	atomic_store(&log_running, 1);
+	if (pthread_create(&log_thread, NULL, log_flusher, NULL)!=0) {
+		atomic_store(&log_running, 0);
+		return 0;
+	}
+	return 1;
+}
+
+void log_stop ( void ) /* ferma il thread del log dopo l'ultimo scaricamento (tutti i thread che registrano eventi sono terminati) */
+{
+	if (atomic_exchange(&log_running, 0))
+		pthread_join(log_thread, NULL);
+}
+
+
+// funzioni (10) sui socket: 1-ok, 0-errore [SendFrame, SendData, RecvAll, ReceiveData, ReceiveChunk, SetNoDelay e SetCork uguali per client e server, >
+// > tranne il conteggio dei byte per le metriche in SendFrame e RecvAll]
+   /* quando c'è una dall'altra parte della connessione c'è l'altra: esse fanno tx dimensione dati-> rx dimensione dati -> tx dati -> rx dati */
+int SendFrame ( int sock, const void *data, size_t dim, int more ) /* invio a [sock] il frame (intestazione + [dim] byte di [data]) con un'unica > */
+{     /* > sendmsg vettoriale, riprendendo dopo gli invii parziali; [more]=1 se seguono subito altri frame (MSG_MORE: il kernel li accorpa) */
+    int len = dim;
+    struct iovec iov[2];
+    struct msghdr mh;
+    ssize_t n;
+    iov[0].iov_base = &len;                 // intestazione: dimensione dei dati (int)
+    iov[0].iov_len = sizeof(int);
+    iov[1].iov_base = (void*)data;
+    iov[1].iov_len = dim;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = iov;
+    mh.msg_iovlen = (dim>0) ? 2 : 1;
+    while (mh.msg_iovlen > 0) {
+        n = sendmsg(sock, &mh, MSG_NOSIGNAL | (more ? MSG_MORE : 0)); // MSG_NOSIGNAL: un peer caduto dà un errore, non SIGPIPE
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return 0;
+        }
+        while (n > 0 && mh.msg_iovlen > 0) {  // invio parziale: avanzo gli iovec di quanto è già partito
+            if ((size_t)n >= mh.msg_iov[0].iov_len) {
+                n -= mh.msg_iov[0].iov_len;
+                mh.msg_iov++;
+                mh.msg_iovlen--;
+            }
+            else {
+                mh.msg_iov[0].iov_base = (char*)mh.msg_iov[0].iov_base + n;
+                mh.msg_iov[0].iov_len -= n;
+                n = 0;
+            }
+        }
+        while (mh.msg_iovlen > 0 && mh.msg_iov[0].iov_len == 0) {
+            mh.msg_iov++;
+            mh.msg_iovlen--;
+        }
+    }
+    atomic_fetch_add_explicit(&srv_metrics.bytes_out, sizeof(int)+dim, memory_order_relaxed);
+    return 1;
+}
+
+int SendData ( int sock, const void *data, size_t dim ) /* invio la quantita' [dim] di dati puntati da [data] a [sock] (un frame: intestazione e dati insieme) */
+{
+    return SendFrame(sock, data, dim, 0);
+}
+
+int RecvAll ( int sock, void *buf, size_t len ) /* ricevo da [sock] esattamente [len] byte in [buf], gestendo letture parziali e interruzioni */
+{
+    size_t total = 0;
+    ssize_t n;
+    while (total < len) {
+        n = recv(sock, (char*)buf+total, len-total, MSG_WAITALL);
+        if (n > 0) {
+            total += n;
+            continue;
+        }
+        if (n == -1 && errno == EINTR)
+            continue;
+        return 0;                             // errore o connessione chiusa dall'altro capo
+    }
+    atomic_fetch_add_explicit(&srv_metrics.bytes_in, len, memory_order_relaxed);
+    return 1;
+}
+
+int ReceiveData ( int sock, void *data, int *len ) /* ricevo da [sock] mettendo dove punta [data]; ne scrivo la quantita' dove punta [len], se non è NULL */
+{
+    int dim;
+    if ( ! RecvAll(sock, &dim, sizeof(int)) || dim<0 ) // ricevo la dimensione dei dati che saranno spediti
+        return 0;
+    if ( ! RecvAll(sock, data, dim) )                 // ricevo finche' non ho avuto tutti i dati
+        return 0;
+    if (len!=NULL)       			         // in molti casi il ricevente sa di certo quanti dati arrivano e quindi mette NULL a [3°arg]
+        *len=dim;
+    return 1;
+}
+
+int ReceiveChunk ( int sock, void *buf, int maxlen, int *len ) /* come ReceiveData, ma rifiuta (0) i blocchi più grandi di [maxlen] byte */
+{
+    int dim;
+    if ( ! RecvAll(sock, &dim, sizeof(int)) || dim<0 || dim>maxlen )
+        return 0;
+    if ( ! RecvAll(sock, buf, dim) )
+        return 0;
+    *len = dim;
+    return 1;
+}
+
+void SetNoDelay ( int sock ) /* disattiva Nagle su [sock]: i frame di controllo (comandi, risposte brevi) partono subito, senza attese di ACK ritardati */
+{
+    int on = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+
+void SetCork ( int sock, int on ) /* [on]=1: durante i trasferimenti di massa il kernel invia solo segmenti pieni; [on]=0 li svuota */
+{
+#ifdef TCP_CORK
+    setsockopt(sock, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+#endif
+}
+
+int ReceiveStream ( int sock, FILE *fp, uint64_t size, xxh64_state *h, uint64_t *wire ) /* ricevo da [sock] [size] byte a blocchi (frame > */
+{    /* > SendData) e li scrivo man mano su [fp] (se NULL o in caso di errore di scrittura li scarto), aggiornando l'impronta [h] se non è NULL. > */
+     /* > Se [wire] non è NULL (protocollo 5) ogni blocco inizia con il suo formato (WIRE_*) e va decompresso; vi sommo i byte arrivati dalla rete. > */
+     /* > 1-ok, 0-errore sul socket o blocco non valido (anche oltre i [size] byte), -1-invio interrotto dal client o errore di scrittura */
+    char buf[1+CHUNK_SIZE], out[CHUNK_SIZE], *data;
+    uint64_t total = 0, t = 0;
+    int len, rc = 1;
+    while (total < size) {
+        if (cur_trace.on)
+            t = mono_us();
+        if ( ! ReceiveChunk(sock, buf, (wire!=NULL) ? 1+CHUNK_SIZE : CHUNK_SIZE, &len) )
+            return 0;
+        if (cur_trace.on) {               // (--trace) attesa dei dati dalla rete
+            cur_trace.us[TRACE_RECV] += mono_us()-t;
+            cur_trace.bytes[TRACE_RECV] += len;
+            t = mono_us();
+        }
+        if (len == 0)                     // blocco vuoto: il client non riesce più a leggere il file
+            return -1;
+        data = buf;
+        if (wire!=NULL) {
+            *wire += len;
+            if (buf[0]==WIRE_LZ4)
+                len = LZ4_decompress_safe(buf+1, out, len-1, CHUNK_SIZE), data = out;
+            else if (buf[0]==WIRE_RAW)
+                len--, data = buf+1;
+            else
+                len = -1;
+            if (len <= 0)                 // blocco corrotto o formato sconosciuto: il flusso non è più affidabile
+                return 0;
+        }
+        if ((uint64_t)len > size-total)  // oltre la dimensione annunciata (e riservata): errore di protocollo
+            return 0;
+        if ( fp!=NULL && rc==1 && fwrite(data, 1, len, fp)!=(size_t)len )
+            rc = -1;                      // disco pieno o simili: continuo a ricevere (scartando) per restare allineato col client
+        if (cur_trace.on) {               // (--trace) decompressione LZ4 e scrittura su disco
+            cur_trace.us[TRACE_WRITE] += mono_us()-t;
+            cur_trace.bytes[TRACE_WRITE] += len;
+        }
+        if (h!=NULL)
+            xxh64_update(h, data, len);
+        total += len;
+    }
+    return rc;
+}
+
+int SendFileRaw ( int sock, int fd, uint64_t size ) /* invio a [sock] i [size] byte del file [fd] così come sono (senza frame), direttamente >  */
+{                                                   /* > dal descrittore al socket con sendfile(2) (nessuna copia in spazio utente): 1-ok, 0-errore */
+    uint64_t sent = 0, t = cur_trace.on ? mono_us() : 0;
+    ssize_t n;
+#ifdef __linux__
+    while (sent < size) {
+        size_t want = (size-sent > (1<<30)) ? (1<<30) : (size_t)(size-sent); // sendfile trasferisce al più ~2GiB per chiamata
+        n = sendfile(sock, fd, NULL, want);
+        if (n > 0) {
+            sent += n;
+            continue;
+        }
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1 && (errno == EINVAL || errno == ENOSYS) && sent == 0)
+            break;                         // sendfile non supportato per questo descrittore: ripiego sulla copia con buffer
+        return 0;
+    }
+#endif
+    while (sent < size) {                  // ripiego portabile: read + send con un buffer fisso
+        char buf[CHUNK_SIZE];
+        size_t want = (size-sent > CHUNK_SIZE) ? CHUNK_SIZE : (size_t)(size-sent);
+        ssize_t r = read(fd, buf, want), w = 0;
+        if (r <= 0)
+            return 0;
+        while (w < r) {
+            n = send(sock, buf+w, r-w, 0);
+            if (n == -1)
+                return 0;
+            w += n;
+        }
+        sent += r;
+    }
+    atomic_fetch_add_explicit(&srv_metrics.bytes_out, size, memory_order_relaxed);
+    if (cur_trace.on) {
+        cur_trace.us[TRACE_SEND] += mono_us()-t;
+        cur_trace.bytes[TRACE_SEND] += size;
+    }
+    return 1;
+}
+
+
+// funzioni (10) per le metriche: istogrammi HDR senza lock, testo del comando stats, formato Prometheus dell'endpoint locale
+
+uint64_t elapsed_us ( const struct timespec *t0 ) /* microsecondi trascorsi dall'istante [t0] (CLOCK_MONOTONIC) */
+{
+	struct timespec t1;
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return (t1.tv_sec-t0->tv_sec)*1000000LL + (t1.tv_nsec-t0->tv_nsec)/1000;
+}
+
+int hist_index ( uint64_t v ) /* intervallo dell'istogramma per il valore [v]: esatto sotto 2^HIST_SUB_BITS, poi 2^HIST_SUB_BITS intervalli > */
+{                             /* > uguali per ogni potenza di 2 (come HdrHistogram): l'errore relativo resta costante su tutta la scala */
+	int m, i;
+	if (v < (1<<HIST_SUB_BITS))
+		return v;
+	m = 63 - __builtin_clzll(v);            // potenza di 2 più alta contenuta in v
+	i = (m-HIST_SUB_BITS+1)*(1<<HIST_SUB_BITS) + ((v >> (m-HIST_SUB_BITS)) & ((1<<HIST_SUB_BITS)-1));
+	return (i<HIST_BUCKETS) ? i : HIST_BUCKETS-1;
+}
+
+uint64_t hist_bound ( int i ) /* limite superiore (escluso) dei valori dell'intervallo [i] (inverso di hist_index) */
+{
+	int m;
+	if (i < (1<<HIST_SUB_BITS))
+		return i+1;
+	m = i/(1<<HIST_SUB_BITS) + HIST_SUB_BITS-1;
+	return ((uint64_t)((1<<HIST_SUB_BITS) + i%(1<<HIST_SUB_BITS)) + 1) << (m-HIST_SUB_BITS);
+}
+
+void hist_record ( histogram *h, uint64_t v ) /* registra in [h] il valore [v] (microsecondi): solo incrementi atomici, nessun lock */
+{
+	uint64_t max = atomic_load_explicit(&h->max, memory_order_relaxed);
+	atomic_fetch_add_explicit(&h->bucket[hist_index(v)], 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&h->sum, v, memory_order_relaxed);
+	atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+	while (v>max && !atomic_compare_exchange_weak_explicit(&h->max, &max, v, memory_order_relaxed, memory_order_relaxed))
+		;                                   // la CAS fallita ricarica max: riprovo solo se v è ancora il massimo
+}
+
+double hist_percentile ( histogram *h, double q ) /* valore (in ms) sotto cui cade la frazione [q] dei valori di [h]: il limite superiore > */
+{                                                 /* > dell'intervallo che la raggiunge, al più il massimo registrato; 0 se [h] è vuoto */
+	uint64_t n = 0, total = 0, want, max = atomic_load_explicit(&h->max, memory_order_relaxed), v;
+	int i;
+	for (i=0; i<HIST_BUCKETS; i++)
+		total += atomic_load_explicit(&h->bucket[i], memory_order_relaxed);
+	if (total==0)
+		return 0;
+	want = (uint64_t)ceil(q*total);
+	for (i=0; i<HIST_BUCKETS && n<want; i++)
+		n += atomic_load_explicit(&h->bucket[i], memory_order_relaxed);
+	v = hist_bound(i-1) - 1;
+	return ((v<max) ? v : max) / 1000.0;
+}
+
+void metrics_busy ( void ) /* aggiorna il massimo di ServerThread occupati (chiamata quando un ServerThread prende una sessione) */
+{
+	int busy = pool_threads - atomic_load(&pool_idle), max = atomic_load_explicit(&srv_metrics.pool_busy_max, memory_order_relaxed);
+	while (busy>max && !atomic_compare_exchange_weak_explicit(&srv_metrics.pool_busy_max, &max, busy, memory_order_relaxed, memory_order_relaxed))
+		;
+}
+
+void metrics_text ( FILE *out ) /* scrive su [out] le metriche in forma di tabella (risposta al comando stats) */
+{
+	session *x;
+	histogram *h;
+	int i, active, threads, idle, parked = 0;
+	uint64_t in, cout;
+	pthread_mutex_lock(&mutex);
+	active = n_sessions;
+	threads = pool_threads;
+	pthread_mutex_unlock(&mutex);
+	pthread_mutex_lock(&park_lock);
+	for (x=sessions; x!=NULL; x=x->next)
+		parked += x->parked;
+	pthread_mutex_unlock(&park_lock);
+	idle = atomic_load(&pool_idle);
+	fprintf(out, CYAf" - Statistiche del server (attivo da "GREf"%ld"CYAf" s):"RST"\n", (long)(time(NULL)-srv_metrics.started));
+	fprintf(out, "   sessioni %d (%d parcheggiate); pool %d thread (da %d a %d), %d occupati (al massimo %d), %d inattivi\n", active, parked,
+	        threads, pool_min, pool_max, threads-idle, atomic_load(&srv_metrics.pool_busy_max), idle);
+	fprintf(out, "   byte ricevuti %llu, inviati %llu; cache degli archivi %u hit, %u miss; file in memoria %.1f MiB\n",
+	        (unsigned long long)atomic_load(&srv_metrics.bytes_in), (unsigned long long)atomic_load(&srv_metrics.bytes_out),
+	        atomic_load(&cache_hits), atomic_load(&cache_misses), atomic_load(&ws_mem_total)/1048576.0);
+	h = &srv_metrics.handoff;
+	fprintf(out, "   attesa nella coda di consegna: %llu sessioni, p50 %.3f ms, p99 %.3f ms, max %.3f ms\n", (unsigned long long)atomic_load(&h->count),
+	        hist_percentile(h, 0.5), hist_percentile(h, 0.99), atomic_load(&h->max)/1000.0);
+	fprintf(out, YELf"   %-21s %7s %6s %10s %10s %10s %10s %10s"RST"\n", "comando", "n", "persi", "media ms", "p50 ms", "p99 ms", "p999 ms", "max ms");
+	for (i=0; i<NUM_COMMANDS; i++) {
+		h = &srv_metrics.cmd[i];
+		if (atomic_load(&h->count)==0)
+			continue;
+		fprintf(out, "   %-21s %7llu %6llu %10.3f %10.3f %10.3f %10.3f %10.3f\n", command_names[i], (unsigned long long)atomic_load(&h->count),
+		        (unsigned long long)atomic_load(&srv_metrics.cmd_lost[i]), (double)atomic_load(&h->sum)/atomic_load(&h->count)/1000.0,
+		        hist_percentile(h, 0.5), hist_percentile(h, 0.99), hist_percentile(h, 0.999), atomic_load(&h->max)/1000.0);
+	}
+	fprintf(out, YELf"   %-21s %7s %10s %10s %8s %10s %10s"RST"\n", "compressore", "n", "MiB tar", "MiB compr", "rapporto", "p50 s", "p99 s");
+	for (i=0; i<NUM_COMPRESSORS; i++) {
+		h = &srv_metrics.codec_time[i];
+		if (atomic_load(&h->count)==0)
+			continue;
+		in = atomic_load(&srv_metrics.codec_in[i]);
+		cout = atomic_load(&srv_metrics.codec_out[i]);
+		fprintf(out, "   %-21s %7llu %10.1f %10.1f %8.3f %10.3f %10.3f\n", compressors_matrix[i][0], (unsigned long long)atomic_load(&h->count),
+		        in/1048576.0, cout/1048576.0, (cout>0) ? (double)in/cout : 0, hist_percentile(h, 0.5)/1000, hist_percentile(h, 0.99)/1000);
+	}
+}
+
+void prom_histogram ( FILE *out, const char *name, const char *label, const char *value, histogram *h ) /* scrive su [out] l'istogramma [h] > */
+{   /* > come istogramma Prometheus [name] (in secondi), con l'etichetta [label]=[value] se [label]!=NULL: i limiti sono le potenze di 2 da > */
+    /* > 2^HIST_PROM_MIN a 2^HIST_PROM_MAX us, che coincidono con limiti di intervalli HDR (nessun intervallo va diviso tra due "le") */
+	char lbl[64] = "", sep[2] = "";
+	uint64_t n = 0;
+	int i = 0, k;
+	if (label!=NULL) {
+		snprintf(lbl, sizeof(lbl), "%s=\"%s\"", label, value);
+		strcpy(sep, ",");
+	}
+	for (k=HIST_PROM_MIN; k<=HIST_PROM_MAX; k++) {
+		for ( ; i<HIST_BUCKETS && hist_bound(i)<=(1ULL<<k); i++)
+			n += atomic_load_explicit(&h->bucket[i], memory_order_relaxed);
+		fprintf(out, "%s_bucket{%s%sle=\"%g\"} %llu\n", name, lbl, sep, (double)(1ULL<<k)/1e6, (unsigned long long)n);
+	}
+	for ( ; i<HIST_BUCKETS; i++)
+		n += atomic_load_explicit(&h->bucket[i], memory_order_relaxed);
+	fprintf(out, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, lbl, sep, (unsigned long long)n);
+	if (label!=NULL)
+		snprintf(lbl, sizeof(lbl), "{%s=\"%s\"}", label, value);
+	fprintf(out, "%s_sum%s %.6f\n", name, lbl, atomic_load(&h->sum)/1e6);
+	fprintf(out, "%s_count%s %llu\n", name, lbl, (unsigned long long)n); // lo stesso n del +Inf, anche se nel frattempo arrivano valori
+}
+
+void metrics_prometheus ( FILE *out ) /* scrive su [out] le metriche nel formato di testo di Prometheus (endpoint locale /metrics) */
+{
+	session *x;
+	int i, active, threads, parked = 0;
+	pthread_mutex_lock(&mutex);
+	active = n_sessions;
+	threads = pool_threads;
+	pthread_mutex_unlock(&mutex);
+	pthread_mutex_lock(&park_lock);
+	for (x=sessions; x!=NULL; x=x->next)
+		parked += x->parked;
+	pthread_mutex_unlock(&park_lock);
+	fprintf(out, "# HELP compressor_command_duration_seconds Durata dei comandi, per comando.\n# TYPE compressor_command_duration_seconds histogram\n");
+	for (i=0; i<NUM_COMMANDS; i++)
+		prom_histogram(out, "compressor_command_duration_seconds", "command", command_names[i], &srv_metrics.cmd[i]);
+	fprintf(out, "# HELP compressor_command_lost_total Comandi durante i quali il client e' caduto.\n# TYPE compressor_command_lost_total counter\n");
+	for (i=0; i<NUM_COMMANDS; i++)
+		fprintf(out, "compressor_command_lost_total{command=\"%s\"} %llu\n", command_names[i], (unsigned long long)atomic_load(&srv_metrics.cmd_lost[i]));
+	fprintf(out, "# HELP compressor_handoff_wait_seconds Attesa delle sessioni nella coda di consegna ai ServerThread.\n"
+	             "# TYPE compressor_handoff_wait_seconds histogram\n");
+	prom_histogram(out, "compressor_handoff_wait_seconds", NULL, NULL, &srv_metrics.handoff);
+	fprintf(out, "# HELP compressor_compress_duration_seconds Durata delle compress non servite dalla cache, per compressore.\n"
+	             "# TYPE compressor_compress_duration_seconds histogram\n");
+	for (i=0; i<NUM_COMPRESSORS; i++)
+		prom_histogram(out, "compressor_compress_duration_seconds", "codec", compressors_matrix[i][0], &srv_metrics.codec_time[i]);
+	fprintf(out, "# HELP compressor_compress_input_bytes_total Byte dello stream tar compressi, per compressore.\n"
+	             "# TYPE compressor_compress_input_bytes_total counter\n");
+	for (i=0; i<NUM_COMPRESSORS; i++)
+		fprintf(out, "compressor_compress_input_bytes_total{codec=\"%s\"} %llu\n", compressors_matrix[i][0],
+		        (unsigned long long)atomic_load(&srv_metrics.codec_in[i]));
+	fprintf(out, "# HELP compressor_compress_output_bytes_total Byte compressi prodotti, per compressore.\n"
+	             "# TYPE compressor_compress_output_bytes_total counter\n");
+	for (i=0; i<NUM_COMPRESSORS; i++)
+		fprintf(out, "compressor_compress_output_bytes_total{codec=\"%s\"} %llu\n", compressors_matrix[i][0],
+		        (unsigned long long)atomic_load(&srv_metrics.codec_out[i]));
+	fprintf(out, "# TYPE compressor_received_bytes_total counter\ncompressor_received_bytes_total %llu\n", (unsigned long long)atomic_load(&srv_metrics.bytes_in));
+	fprintf(out, "# TYPE compressor_sent_bytes_total counter\ncompressor_sent_bytes_total %llu\n", (unsigned long long)atomic_load(&srv_metrics.bytes_out));
+	fprintf(out, "# TYPE compressor_archive_cache_hits_total counter\ncompressor_archive_cache_hits_total %u\n", atomic_load(&cache_hits));
+	fprintf(out, "# TYPE compressor_archive_cache_misses_total counter\ncompressor_archive_cache_misses_total %u\n", atomic_load(&cache_misses));
+	fprintf(out, "# TYPE compressor_workspace_memory_bytes gauge\ncompressor_workspace_memory_bytes %llu\n",
+	        (unsigned long long)atomic_load(&ws_mem_total));
+	fprintf(out, "# TYPE compressor_sessions gauge\ncompressor_sessions %d\n", active);
+	fprintf(out, "# TYPE compressor_sessions_parked gauge\ncompressor_sessions_parked %d\n", parked);
+	fprintf(out, "# TYPE compressor_pool_threads gauge\ncompressor_pool_threads %d\n", threads);
+	fprintf(out, "# TYPE compressor_pool_busy_threads gauge\ncompressor_pool_busy_threads %d\n", threads-atomic_load(&pool_idle));
+	fprintf(out, "# TYPE compressor_pool_busy_threads_max gauge\ncompressor_pool_busy_threads_max %d\n", atomic_load(&srv_metrics.pool_busy_max));
+	fprintf(out, "# TYPE compressor_pool_max_threads gauge\ncompressor_pool_max_threads %d\n", pool_max);
+	fprintf(out, "# TYPE compressor_uptime_seconds gauge\ncompressor_uptime_seconds %ld\n", (long)(time(NULL)-srv_metrics.started));
+}
+
+int metrics_open ( int port ) /* apre il socket di ascolto delle metriche su 127.0.0.1:[port] (solo locale): il socket, -1 se errore */
+{
+	struct sockaddr_in a;
+	int sock = socket(PF_INET, SOCK_STREAM, 0), option = 1;
+	if (sock==-1)
+		return -1;
+	memset(&a, 0, sizeof(a));
+	a.sin_family = AF_INET;
+	a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	a.sin_port = htons(port);
+	if ( setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &option, sizeof(option))<0 || bind(sock, (struct sockaddr*)&a, sizeof(a))<0 
+	     || listen(sock, 16)<0 ) {
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+
+// funzioni (26) sull'area di lavoro delle sessioni: file in memoria (memfd) entro i budget, altrimenti su disco nella cartella della sessione, >
+// > raggiunta col suo descrittore (openat, unlinkat, renameat: nessuna shell); le cartelle scartate sono cancellate in background
+
+int workspace_filter ( const struct dirent *de ) /* per scandir: esclude "." e ".." */
+{
+	return strcmp(de->d_name,".")!=0 && strcmp(de->d_name,"..")!=0;
+}
+
+int ws_memfd ( const char *name ) /* file anonimo in memoria per il contenuto [name] (memfd, solo Linux): il descrittore, -1 se non disponibile */
+{
+#if defined(__linux__) && defined(SYS_memfd_create)
+	int fd = syscall(SYS_memfd_create, name, 1);  // 1 = MFD_CLOEXEC
+	if (fd>=0 && ws_fd_max>0 && fd>=ws_fd_max) { // ogni file in memoria tiene aperto il suo descrittore: quando stanno per finire (e.g. >
+		close(fd);                               // > cartelle con migliaia di file) i nuovi file vanno su disco
+		return -1;
+	}
+	if (fd>=0)
+		fchmod(fd, 0644);        // un memfd nasce con permessi 0777: nell'archivio il file appare come se fosse stato scritto su disco
+	return fd;
+#else
+	return -1;
+#endif
+}
+
+void rm_contents ( int dfd ) /* cancella tutto il contenuto (sottocartelle comprese) della cartella aperta [dfd], che resta aperta */
+{
+	DIR *d;
+	struct dirent *de;
+	int fd = dup(dfd);               // closedir chiude il descrittore che riceve
+	if (fd<0 || (d = fdopendir(fd))==NULL) {
+		if (fd>=0)
+			close(fd);
+		return;
+	}
+	while ( (de = readdir(d))!=NULL ) {
+		if (strcmp(de->d_name,".")==0 || strcmp(de->d_name,"..")==0)
+			continue;
+		if (de->d_type==DT_DIR || (unlinkat(dfd, de->d_name, 0)!=0 && (errno==EISDIR || errno==EPERM))) {
+			int sub = openat(dfd, de->d_name, O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);   // sottocartella: prima il contenuto
+			if (sub>=0) {
+				rm_contents(sub);
+				close(sub);
+			}
+			unlinkat(dfd, de->d_name, AT_REMOVEDIR);
+		}
+	}
+	closedir(d);
+}
+
+int rm_tree_at ( int dirfd, const char *name ) /* cancella la cartella [name] (relativa a [dirfd], o AT_FDCWD) con tutto il contenuto: 1-ok, 0-errore */
+{
+	int fd = openat(dirfd, name, O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+	if (fd<0)
+		return errno==ENOENT;        // (una cartella che non c'è è già cancellata)
+	rm_contents(fd);
+	close(fd);
+	return unlinkat(dirfd, name, AT_REMOVEDIR)==0;
+}
+
+void *reclaimer ( void *unused ) /* THREAD DI PULIZIA: cancella le cartelle scartate dalle sessioni (svuotate dopo la compress, o chiuse) */
+{
+	ws_trash *t;
+	pthread_mutex_lock(&reclaim_lock);
+	while (1) {
+		while (reclaim_q==NULL && reclaim_running)
+			pthread_cond_wait(&reclaim_cond, &reclaim_lock);
+		if (reclaim_q==NULL)         // fermato e senza più cartelle da cancellare
+			break;
+		t = reclaim_q;
+		reclaim_q = t->next;
+		pthread_mutex_unlock(&reclaim_lock);
+		if (t->fd>=0) {              // la cartella è ancora aperta: la si svuota dal suo descrittore, senza risolvere percorsi
+			rm_contents(t->fd);
+			close(t->fd);
+			unlinkat(pool_dirfd, t->name, AT_REMOVEDIR);
+		}
+		else
+			rm_tree_at(pool_dirfd, t->name);
+		free(t);
+		pthread_mutex_lock(&reclaim_lock);
+	}
+	pthread_mutex_unlock(&reclaim_lock);
+	pthread_exit(NULL);
+}
+
+int reclaim_start ( void ) /* avvia il thread di pulizia: 1-ok, 0-errore (le cartelle sono allora cancellate subito, da chi le scarta) */
+{
+	reclaim_running = 1;
+	if (pthread_create(&reclaim_thread, NULL, reclaimer, NULL)!=0) {
+		reclaim_running = 0;
+		return 0;
+	}
+	return 1;
+}
+
+void reclaim_stop ( void ) /* ferma il thread di pulizia dopo che ha cancellato tutte le cartelle ancora in coda */
+{
+	pthread_mutex_lock(&reclaim_lock);
+	if (!reclaim_running) {
+		pthread_mutex_unlock(&reclaim_lock);
+		return;
+	}
+	reclaim_running = 0;
+	pthread_cond_signal(&reclaim_cond);
+	pthread_mutex_unlock(&reclaim_lock);
+	pthread_join(reclaim_thread, NULL);
+}
+
+void ws_discard ( const char *name, int fd ) /* scarta la cartella [name] di POOL_ROOT_DIR (aperta come [fd], o -1): la rinomina subito, così il > */
+{                                            /* > nome torna libero, e la fa cancellare dal thread di pulizia (a cui passa [fd]) */
+	char trash[ strlen(name)+32 ];
+	ws_trash *t;
+	sprintf(trash, "%s%s%u", name, TRASH_FOLDER_SUFFIX, atomic_fetch_add(&trash_seq, 1));
+	if (renameat(pool_dirfd, name, pool_dirfd, trash)!=0) {
+		if (fd>=0)
+			close(fd);
+		if (errno!=ENOENT)
+			rm_tree_at(pool_dirfd, name);
+		return;
+	}
+	t = malloc(sizeof(ws_trash)+strlen(trash)+1);
+	pthread_mutex_lock(&reclaim_lock);
+	if (t==NULL || !reclaim_running) {   // senza thread di pulizia (o memoria) la cancello qui
+		pthread_mutex_unlock(&reclaim_lock);
+		if (fd>=0)
+			close(fd);
+		rm_tree_at(pool_dirfd, trash);
+		free(t);
+		return;
+	}
+	t->fd = fd;
+	strcpy(t->name, trash);
+	t->next = reclaim_q;
+	reclaim_q = t;
+	pthread_cond_signal(&reclaim_cond);
+	pthread_mutex_unlock(&reclaim_lock);
+}
+
+void sync_dir ( const char *dir ) /* (--fsync full) rende persistenti su disco le voci (file creati, rinominati, collegati) della cartella [dir] */
+{
+	int fd = open(dir, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	if (fd>=0) {
+		fsync(fd);
+		close(fd);
+	}
+}
+
+void ws_init ( workspace *ws, int id ) /* prepara l'area di lavoro (vuota) della sessione [id], creando e aprendo la sua cartella e quella di > */
+{                                      /* > scorta (vuota, per svuotare l'area di lavoro con uno scambio di nomi) */
+	char spare[ sizeof(ws->dir)+8 ];
+	memset(ws, 0, sizeof(workspace));
+	snprintf(ws->dir, sizeof(ws->dir), "%s%d", POOL_FOLDER_PREFIX, id);
+	snprintf(ws->partdir, sizeof(ws->partdir), "%s%s", ws->dir, PART_FOLDER_SUFFIX);
+	sprintf(spare, "%s%s", ws->dir, SPARE_FOLDER_SUFFIX);
+	ws->pfd = -1;
+	mkdirat(pool_dirfd, ws->dir, 0755);    // (POOL_ROOT_DIR, già creata e aperta dal ListenerThread)
+	ws->dfd = openat(pool_dirfd, ws->dir, O_RDONLY|O_DIRECTORY|O_CLOEXEC);  // -1: i file oltre i budget non potranno essere ricevuti
+	mkdirat(pool_dirfd, spare, 0755);
+}
+
+int ws_find ( ws_list *l, const char *name ) /* posizione del file [name] nell'elenco (ordinato) [l]; -1 se non c'è */
+{
+	int lo = 0, hi = l->n-1, mid, c;
+	while (lo<=hi) {
+		mid = (lo+hi)/2;
+		c = strcmp(name, l->v[mid].name);
+		if (c==0)
+			return mid;
+		if (c<0)
+			hi = mid-1;
+		else
+			lo = mid+1;
+	}
+	return -1;
+}
+
+int ws_add ( ws_list *l, const char *name, int fd, uint64_t mem ) /* inserisce in [l], in ordine di nome, il file [name] (memfd [fd] con [mem] > */
+{                                                                   /* > byte riservati, o -1 se su disco): la sua posizione, -1 se manca memoria */
+	int i;
+	char *copy = strdup(name);
+	if (copy==NULL)
+		return -1;
+	if (l->n==l->cap) {
+		int cap = (l->cap>0) ? 2*l->cap : 16;
+		ws_file *v = realloc(l->v, cap*sizeof(ws_file));
+		if (v==NULL) {
+			free(copy);
+			return -1;
+		}
+		l->v = v;
+		l->cap = cap;
+	}
+	for (i=l->n; i>0 && strcmp(name, l->v[i-1].name)<0; i--)  // i file arrivano di solito già in ordine: lo spostamento è breve
+		l->v[i] = l->v[i-1];
+	l->v[i].name = copy;
+	l->v[i].fd = fd;
+	l->v[i].mem = mem;
+	l->v[i].meta = 0;
+	l->n++;
+	return i;
+}
+
+int ws_dirfd ( workspace *ws, ws_list *l ) /* descrittore della cartella su disco dei file di [l] (-1 se manca) */
+{
+	return (l==&ws->parts) ? ws->pfd : ws->dfd;
+}
+
+void ws_drop ( workspace *ws, ws_list *l, int i ) /* elimina il file [i] di [l]: chiude il memfd e libera la memoria riservata, o lo cancella dal disco */
+{
+	ws_file *f = &l->v[i];
+	if (f->fd>=0) {
+		close(f->fd);
+		ws->mem -= f->mem;
+		atomic_fetch_sub(&ws_mem_total, f->mem);
+	}
+	else
+		unlinkat(ws_dirfd(ws, l), f->name, 0);
+	free(f->name);
+	memmove(f, f+1, (l->n-i-1)*sizeof(ws_file));
+	l->n--;
+}
+
+int ws_create ( workspace *ws, ws_list *l, const char *name, uint64_t size ) /* crea in [l] il file vuoto [name], che riceverà [size] byte: in > */
+{     /* > memoria se rientra nel budget della sessione (ws_mem_session) e in quello globale (WS_MEM_TOTAL), altrimenti su disco. La posizione, -1 se errore */
+	uint64_t total;
+	int fd = -1, i;
+	if (ws_mem_session>0 && ws->mem+size <= ws_mem_session) {
+		total = atomic_fetch_add(&ws_mem_total, size);  // riservo subito: più sessioni non possono superare insieme il budget globale
+		if (total+size <= WS_MEM_TOTAL)
+			fd = ws_memfd(name);
+		if (fd<0)
+			atomic_fetch_sub(&ws_mem_total, size);
+		else
+			ws->mem += size;
+	}
+	if (fd<0) {                      // oltre i budget (o senza memfd): file su disco, come prima dell'area in memoria
+		int dfd;
+		const char *sl;
+		if (l==&ws->parts && ws->pfd<0) {  // la cartella dei file a metà si crea solo se serve
+			mkdirat(pool_dirfd, ws->partdir, 0755);
+			ws->pfd = openat(pool_dirfd, ws->partdir, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+		}
+		for (sl=strchr(name, '/'); sl!=NULL; sl=strchr(sl+1, '/')) { // (protocollo 10) file di una cartella: prima le sue sottocartelle
+			char sub[sl-name+1];
+			memcpy(sub, name, sl-name);
+			sub[sl-name] = '\0';
+			mkdirat(ws_dirfd(ws, l), sub, 0755);
+		}
+		dfd = openat(ws_dirfd(ws, l), name, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+		if (dfd<0)
+			return -1;
+		close(dfd);
+	}
+	i = ws_add(l, name, fd, (fd>=0) ? size : 0);
+	if (i<0) {
+		if (fd>=0) {
+			close(fd);
+			ws->mem -= size;
+			atomic_fetch_sub(&ws_mem_total, size);
+		}
+		else
+			unlinkat(ws_dirfd(ws, l), name, 0);
+	}
+	return i;
+}
+
+FILE *ws_writer ( workspace *ws, ws_list *l, int i ) /* apre in scrittura il file [i] di [l], in coda a quanto contiene già: NULL se errore > */
+{                                                    /* > (senza O_APPEND: i pezzi del protocollo 9 si scrivono al loro posto con pwrite) */
+	ws_file *f = &l->v[i];
+	FILE *fp;
+	int fd;
+	if (f->fd<0)
+		fd = openat(ws_dirfd(ws, l), f->name, O_WRONLY|O_CLOEXEC);
+	else
+		fd = dup(f->fd);             // la posizione è condivisa col memfd: un solo comando alla volta usa l'area di lavoro della sessione
+	if (fd<0 || lseek(fd, 0, SEEK_END)<0 || (fp = fdopen(fd, "wb"))==NULL) {  // (fdopen non tronca)
+		if (fd>=0)
+			close(fd);
+		return NULL;
+	}
+	return fp;
+}
+
+int ws_close ( workspace *ws, ws_list *l, int i, FILE *fp ) /* chiude [fp], aperto con ws_writer sul file [i] di [l]; un file su disco è prima > */
+{                                                           /* > reso persistente secondo fsync_policy. 0-ok, EOF-errore (come fclose) */
+	int err = 0;
+	if (l->v[i].fd<0 && fsync_policy!=FSYNC_NONE) {
+		err = (fflush(fp)!=0 || fdatasync(fileno(fp))!=0);
+		if (fsync_policy==FSYNC_FULL && !err)
+			err = (fsync(ws_dirfd(ws, l))!=0);   // anche la voce del file nella cartella
+	}
+	if (fclose(fp)!=0 || err)
+		return EOF;
+	return 0;
+}
+
+int ws_reader ( workspace *ws, ws_list *l, int i ) /* apre in lettura il file [i] di [l], dall'inizio: il descrittore, -1 se errore */
+{
+	ws_file *f = &l->v[i];
+	int fd;
+	if (f->fd<0)
+		return openat(ws_dirfd(ws, l), f->name, O_RDONLY|O_CLOEXEC);
+	fd = dup(f->fd);
+	if (fd>=0 && lseek(fd, 0, SEEK_SET)<0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int ws_stat ( workspace *ws, ws_list *l, int i, struct stat *st ) /* attributi del file [i] di [l] (quelli di un file su disco per i memfd): 1-ok, 0-errore */
+{
+	ws_file *f = &l->v[i];
+	if (f->fd<0)
+		return fstatat(ws_dirfd(ws, l), f->name, st, 0)==0 && S_ISREG(st->st_mode);
+	return fstat(f->fd, st)==0;      // permessi 0644 dalla creazione (ws_memfd), o quelli del client per i file di una cartella
+}
+
+int ws_move ( workspace *ws, int i, const char *name ) /* il file a metà [i], ricevuto ora per intero, passa tra i file della sessione come [name]: > */
+{                                                      /* > 1-ok, 0-errore (il file a metà resta) */
+	ws_file f = ws->parts.v[i];
+	int j;
+	if (f.fd<0) {
+		if (renameat(ws->pfd, f.name, ws->dfd, name)!=0)
+			return 0;
+		if (fsync_policy==FSYNC_FULL)
+			fsync(ws->dfd);
+	}
+	j = ws_add(&ws->files, name, f.fd, f.mem);
+	if (j<0)
+		return 0;
+	free(f.name);                    // il memfd (e la sua memoria riservata) ora appartiene all'elenco dei file
+	memmove(&ws->parts.v[i], &ws->parts.v[i+1], (ws->parts.n-i-1)*sizeof(ws_file));
+	ws->parts.n--;
+	return 1;
+}
+
+int ws_link ( workspace *ws, const char *name, const char *src ) /* aggiunge ai file della sessione [name], collegando (hard link) il file [src] > */
+{                                                                /* > (e.g. un contenuto dello store): 1-ok, 0-errore */
+	if (linkat(AT_FDCWD, src, ws->dfd, name, 0)!=0)
+		return 0;
+	if (ws_add(&ws->files, name, -1, 0)<0) {
+		unlinkat(ws->dfd, name, 0);
+		return 0;
+	}
+	if (fsync_policy==FSYNC_FULL)
+		fsync(ws->dfd);
+	return 1;
+}
+
+void ws_store ( workspace *ws, int i, const char *blobpath ) /* mette il file [i] della sessione nello store dei contenuti come [blobpath]: > */
+{          /* > collegandolo se è su disco, copiandolo (nel kernel) se è in memoria; se un'altra sessione l'ha appena aggiunto va bene lo stesso */
+	ws_file *f = &ws->files.v[i];
+	char tmp[ strlen(blobpath)+20 ];
+	int in, out;
+	struct stat st;
+	if (f->fd<0) {
+		if (linkat(ws->dfd, f->name, AT_FDCWD, blobpath, 0)==0 && fsync_policy==FSYNC_FULL)
+			sync_dir(BLOB_STORE_DIR);
+		return;
+	}
+	if (access(blobpath, F_OK)==0 || fstat(f->fd, &st)!=0)
+		return;
+	sprintf(tmp, "%s.tmp%d", blobpath, f->fd);
+	in = ws_reader(ws, &ws->files, i);
+	out = open(tmp, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+	if (in>=0 && out>=0) {
+		off_t done = 0;
+#ifdef __linux__
+		ssize_t n;
+		while (done < st.st_size && (n = sendfile(out, in, NULL, st.st_size-done)) > 0)
+			done += n;
+#endif
+		if (done==st.st_size && (fsync_policy==FSYNC_NONE || fdatasync(out)==0) && close(out)==0) {
+			out = -1;
+			if (rename(tmp, blobpath)==0 && fsync_policy==FSYNC_FULL)   // appare nello store solo completo
+				sync_dir(BLOB_STORE_DIR);
+		}
+	}
+	if (out>=0)
+		close(out);
+	if (in>=0)
+		close(in);
+	remove(tmp);                     // (non c'è più, se la rename è riuscita)
+}
+
+int ws_clear ( workspace *ws, ws_list *l ) /* toglie tutti i file di [l], liberando la memoria riservata (i file su disco restano: li cancella il > */
+{                                          /* > chiamante): il n° di file che erano su disco */
+	int i, disk = 0;
+	for (i=0; i<l->n; i++) {
+		if (l->v[i].fd>=0) {
+			close(l->v[i].fd);
+			ws->mem -= l->v[i].mem;
+			atomic_fetch_sub(&ws_mem_total, l->v[i].mem);
+		}
+		else
+			disk++;
+		free(l->v[i].name);
+	}
+	l->n = 0;
+	return disk;
+}
+
+void eager_drop ( workspace *ws ); // scarta l'archivio anticipato (definita più avanti, tra le funzioni della compressione anticipata)
+
+void ws_reset ( workspace *ws, int parts ) /* svuota l'area di lavoro (dopo la compress, o con empty-list); con [parts]=1 elimina anche i file > */
+{     /* > rimasti a metà, che non verranno più ripresi. Se c'erano file su disco la cartella della sessione viene scambiata con quella di scorta, > */
+      /* > vuota: costo costante qualunque sia il n° di file, che il thread di pulizia cancella poi con la vecchia cartella */
+	char spare[ sizeof(ws->dir)+8 ];
+	eager_drop(ws);                  // (--eager) l'archivio dei file tolti non serve più (dopo la compress è già stato spedito)
+	if (ws_clear(ws, &ws->files)>0 && ws->dfd>=0) {
+		sprintf(spare, "%s%s", ws->dir, SPARE_FOLDER_SUFFIX);
+		ws_discard(ws->dir, ws->dfd);
+		ws->dfd = -1;
+		if (renameat(pool_dirfd, spare, pool_dirfd, ws->dir)!=0)   // (scorta mancante: la cartella si ricrea)
+			mkdirat(pool_dirfd, ws->dir, 0755);
+		ws->dfd = openat(pool_dirfd, ws->dir, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+		mkdirat(pool_dirfd, spare, 0755);                        // scorta per il prossimo svuotamento
+	}
+	if (parts) {
+		ws_clear(ws, &ws->parts);
+		if (ws->pfd>=0) {
+			ws_discard(ws->partdir, ws->pfd);
+			ws->pfd = -1;
+		}
+	}
+}
+
+void ws_free ( workspace *ws ) /* libera l'area di lavoro e ne scarta le cartelle (file inviati, file arrivati a metà e scorta) */
+{
+	char spare[ sizeof(ws->dir)+8 ];
+	eager_drop(ws);
+	ws_clear(ws, &ws->files);
+	ws_clear(ws, &ws->parts);
+	free(ws->files.v);
+	free(ws->parts.v);
+	sprintf(spare, "%s%s", ws->dir, SPARE_FOLDER_SUFFIX);
+	unlinkat(pool_dirfd, spare, AT_REMOVEDIR);
+	ws_discard(ws->dir, ws->dfd);
+	if (ws->pfd>=0)
+		ws_discard(ws->partdir, ws->pfd);
+	ws->dfd = ws->pfd = -1;
+}
+
+int ws_scan ( workspace *ws, const char *dir ) /* (banco di prova dei codec) area di lavoro con i file regolari della cartella [dir], lasciati > */
+{                                              /* > su disco: il n° di file, -1 se errore (si libera con ws_clear, che non tocca [dir]) */
+	struct dirent **names;
+	struct stat st;
+	int n, i, rc = 0;
+	memset(ws, 0, sizeof(workspace));
+	ws->pfd = -1;
+	ws->dfd = open(dir, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	if (ws->dfd<0 || (n = scandir(dir, &names, workspace_filter, alphasort))<0)
+		return -1;
+	for (i=0; i<n; i++) {
+		if (rc>=0 && fstatat(ws->dfd, names[i]->d_name, &st, 0)==0 && S_ISREG(st.st_mode))
+			rc = (ws_add(&ws->files, names[i]->d_name, -1, 0)<0) ? -1 : rc+1;
+		free(names[i]);
+	}
+	free(names);
+	return rc;
+}
+
+
+// funzioni (20) su semafori, thread, coda di consegna, sessioni e variabili globali (condivise)
+
+void hq_init ( handoff_queue *q ) /* inizializza la coda [q] vuota: ogni cella parte con il numero di sequenza pari alla sua posizione */
+{
+	size_t i;
+	for (i=0; i<HANDOFF_QUEUE_SIZE; i++) {
+		atomic_init(&q->cells[i].seq, i);
+		q->cells[i].s = NULL;
+	}
+	atomic_init(&q->head, 0);
+	atomic_init(&q->tail, 0);
+}
+
+int hq_push ( handoff_queue *q, session *s ) /* accoda senza lock la sessione [s] (coda MPMC limitata di Vyukov): 1-ok, 0-coda piena */
+{
+	size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+	for (;;) {
+		handoff_cell *c = &q->cells[pos & (HANDOFF_QUEUE_SIZE-1)];
+		size_t seq = atomic_load_explicit(&c->seq, memory_order_acquire);
+		intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+		if (dif==0) {                 // cella libera per la posizione pos: provo a prenotarla spostando tail
+			if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos+1, memory_order_relaxed, memory_order_relaxed)) {
+				c->s = s;
+				atomic_store_explicit(&c->seq, pos+1, memory_order_release); // pubblico la sessione ai consumatori
+				return 1;
+			}                         // altrimenti la CAS ha già ricaricato pos: riprovo
+		}
+		else if (dif<0)
+			return 0;                 // la cella contiene ancora una sessione non prelevata: coda piena
+		else
+			pos = atomic_load_explicit(&q->tail, memory_order_relaxed);  // un altro produttore mi ha preceduto
+	}
+}
+
+session *hq_pop ( handoff_queue *q ) /* preleva senza lock la sessione più vecchia dalla coda [q]; NULL se è vuota */
+{
+	size_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+	for (;;) {
+		handoff_cell *c = &q->cells[pos & (HANDOFF_QUEUE_SIZE-1)];
+		size_t seq = atomic_load_explicit(&c->seq, memory_order_acquire);
+		intptr_t dif = (intptr_t)seq - (intptr_t)(pos+1);
+		if (dif==0) {
+			if (atomic_compare_exchange_weak_explicit(&q->head, &pos, pos+1, memory_order_relaxed, memory_order_relaxed)) {
+				session *s = c->s;
+				atomic_store_explicit(&c->seq, pos+HANDOFF_QUEUE_SIZE, memory_order_release); // libero la cella per il giro successivo
+				return s;
+			}
+		}
+		else if (dif<0)
+			return NULL;              // nessuna sessione pubblicata in questa cella: coda vuota
+		else
+			pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+	}
+}
+
+void *codice__Server_Thread ( void *PoolID ); // codice dei ServerThread (definito più avanti, tra i codici dei thread)
+
+int grow_pool ( void ) /* aggiunge un ServerThread al pool se non si è già a pool_max: 1-creato, 0-pool al massimo o errore */
+{
+	pthread_t t;
+	pthread_attr_t attr;
+	int *id, rc = 0;
+	pthread_mutex_lock(&mutex);
+	if (pool_threads<pool_max && closing==0) {
+		id = malloc(sizeof(int));  // id assegnato al nuovo ServerThread (NON è il suo TID), lo libera il thread stesso
+		if (id!=NULL) {
+			*id = pool_next_id++;
+			pthread_attr_init(&attr);
+			pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED); // i thread del pool possono terminare da soli (pool che si restringe)
+			if (pthread_create(&t, &attr, codice__Server_Thread, (void*)id)==0) {
+				pool_threads++;
+				rc = 1;
+			}
+			else {
+				fprintf (stderr, REDf"Errore di creazione del thread %d."RST"\n", *id);
+				free(id);
+			}
+			pthread_attr_destroy(&attr);
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+	return rc;
+}
+
+void create_pool ( void )  /* il ListenerThread crea i primi pool_min ServerThreads e attende che siano tutti pronti */
+{
+	int t;
+	ReadyThreads=0; // ancora non ci sono Threads del pool, dunque 0 sono pronti (è incrementato nelle azioni iniziali dei thread appena creati)        
+	pthread_cond_init(&PoolReady, NULL);   // inizializzazione dei semafori
+	pthread_cond_init(&PoolExit, NULL);
+	sem_init(&PoolItems, 0, 0);            // conta le sessioni accodate e non ancora prelevate da un ServerThread
+	hq_init(&ready_q);
+	atomic_init(&pool_idle, 0);
+	pool_threads = 0;
+	pool_next_id = 0;
+	for (t=0; t<pool_min; t++)
+		if (!grow_pool()) {               // se fallisce la creazione d'un solo thread iniziale il ListenerThread termina e riporta l'errore (join del main)
+			char *sret = malloc(30);
+			strcpy(sret,"Pool thread creation error");		
+			pthread_exit((void*)sret);
+		}
+	pthread_mutex_lock(&mutex);
+	while (ReadyThreads<pool_min)             // attendo che tutti i ServerThread iniziali siano in attesa di una sessione >
+		pthread_cond_wait(&PoolReady, &mutex);  // > (mi sveglia l'ultimo che diventa pronto con la Signal nel suo codice)
+	pthread_mutex_unlock(&mutex);
+}
+
+void assign_client ( session *s )  /* con essa un thread di I/O consegna al pool la sessione [s], di cui ha appena letto per intero il prossimo comando: >   */
+{	                           /* > la accoda senza lock e sveglia un ServerThread inattivo; se non ce ne sono abbastanza il pool cresce (fino a pool_max) */
+	int pending;
+	clock_gettime(CLOCK_MONOTONIC, &s->queued);            // da qui l'attesa nella coda (metriche)
+	while (!hq_push(&ready_q, s))   // coda piena (caso limite): cedo la CPU ai ServerThread finché non ne prelevano una
+		sched_yield();
+	sem_post(&PoolItems);
+	sem_getvalue(&PoolItems, &pending);                    // sessioni accodate non ancora prese in carico
+	if (pending > atomic_load(&pool_idle))                 // più lavoro che thread inattivi: il pool cresce di un thread
+		grow_pool();
+}
+ 
+session *wait_and_start( int id ) /* il ServerThread [id]-esimo del pool attende una sessione da servire e la restituisce; NULL se deve terminare >  */
+{                                 /* > (server in chiusura, oppure inattivo da POOL_IDLE_TIMEOUT secondi con più di pool_min thread nel pool)   */
+	struct timespec ts;
+	session *s;
+	int rc;
+	for (;;) {
+		atomic_fetch_add(&pool_idle, 1);
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += POOL_IDLE_TIMEOUT;
+		while ( (rc = sem_timedwait(&PoolItems, &ts))<0 && errno==EINTR )
+			;
+		atomic_fetch_sub(&pool_idle, 1);
+		if (rc==0) {
+			if ( (s = hq_pop(&ready_q)) != NULL ) {
+				hist_record(&srv_metrics.handoff, elapsed_us(&s->queued));
+				metrics_busy();
+				return s;
+			}
+			if (closing!=0)           // risveglio dovuto a SIGINT (non c'è alcuna sessione da servire)
+				break;
+			continue;
+		}
+		pthread_mutex_lock(&mutex);   // timeout: il thread si ritira se il pool è sopra la dimensione minima
+		if (pool_threads>pool_min || closing!=0) {
+			pool_threads--;
+			pthread_cond_signal(&PoolExit);
+			pthread_mutex_unlock(&mutex);
+			return NULL;
+		}
+		pthread_mutex_unlock(&mutex);
+	}
+	pthread_mutex_lock(&mutex);
+	pool_threads--;
+	pthread_cond_signal(&PoolExit);   // il ListenerThread in chiusura attende che il pool si sia svuotato
+	pthread_mutex_unlock(&mutex);
+	return NULL;
+}
+
+uint64_t session_token ( int id ) /* genera il token (segreto, casuale) di una nuova sessione [id] */
+{
+	uint64_t t = 0;
+	struct timespec now;
+	int fd = open("/dev/urandom", O_RDONLY);
+	if (fd>=0) {
+		if (read(fd, &t, sizeof(t))!=sizeof(t))
+			t = 0;
+		close(fd);
+	}
+	if (t==0) {                     // senza /dev/urandom: orologio e id rimescolati (comunque mai 0, che vuol dire "nessun token")
+		xxh64_state st;
+		clock_gettime(CLOCK_REALTIME, &now);
+		xxh64_init(&st);
+		xxh64_update(&st, &now, sizeof(now));
+		xxh64_update(&st, &id, sizeof(id));
+		t = xxh64_digest(&st) | 1;
+	}
+	return t;
+}
+
+session *session_open ( int sock, struct sockaddr_in addr ) /* crea la sessione del client appena accettato (socket [sock], indirizzo [addr]), > */
+{                                                           /* > con i parametri di default e la sua area di lavoro; NULL se non c'è memoria */
+	session *s = calloc(1, sizeof(session));
+	int active;                     // sessioni attive, per il log
+	if (s==NULL)
+		return NULL;
+	s->sock = sock;
+	s->addr = addr;
+	s->p.archive_name = malloc( (strlen(DEFAULT_ARCHIVE_NAME)+1)*(sizeof(char)) );
+	strcpy ( s->p.archive_name, DEFAULT_ARCHIVE_NAME );   // impostazione di default sul nome dell'archivio compresso (una stringa)
+	s->p.compressor_index = DEFAULT_COMPRESSOR_INDEX;     // opzione di default sul compressore da utilizzare (indice entry compressors_matrix)
+	s->p.threads = DEFAULT_THREADS;                       // compressione sequenziale finché il client non chiede più thread
+	s->p.level = LEVEL_DEFAULT;                           // ogni codec al proprio livello di default
+	s->p.auto_mode = AUTO_NONE;                           // compressore fisso finché il client non chiede "auto"
+	s->proto = 1;                                         // i client che non negoziano parlano il protocollo originale
+	pthread_mutex_lock(&mutex);
+	s->id = next_session_id++;
+	active = ++n_sessions;
+	pthread_mutex_unlock(&mutex);
+	s->io = s->id % IO_THREADS;                           // i thread di I/O si spartiscono le sessioni a turno
+	s->token = session_token(s->id);
+	pthread_mutex_lock(&park_lock);
+	s->next = sessions;
+	sessions = s;
+	pthread_mutex_unlock(&park_lock);
+	ws_init(&s->ws, s->id);            // area di lavoro della sessione, con la sua cartella (sotto POOL_ROOT_DIR, già creata dal ListenerThread)
+	log_event(LOG_INFO, "session_open", "s:client", inet_ntoa(addr.sin_addr), "d:session", s->id, "d:active", active, NULL);
+	return s;
+}
+
+void session_unlink ( session *s ) /* toglie [s] dall'elenco delle sessioni (chiamata con park_lock acquisito) */
+{
+	session **q;
+	for (q=&sessions; *q!=NULL; q=&(*q)->next)
+		if (*q==s) {
+			*q = s->next;
+			break;
+		}
+}
+
+void session_free ( session *s ) /* libera l'area di lavoro della sessione [s] (file inviati e file arrivati a metà) e la sessione */
+{
+	ws_free(&s->ws);        // cancella anche le cartelle della sessione (la directory madre verrà eliminata dal Listener)
+	free(s->p.archive_name);
+	free(s);
+}
+
+void session_end ( session *s, int quit ) /* chiude la connessione della sessione [s] (ordinata se [quit]=1) e le sue connessioni dati; se il > */
+{                         /* > client è caduto e può riprenderla (protocollo 4) la parcheggia per SESSION_PARK_TIMEOUT secondi, altrimenti la libera */
+	int park = (quit==0 && s->proto>=4), active, i;
+	if (quit==1){ //disconnessione client via quit
+		if (shutdown(s->sock, SHUT_RDWR)<0)      	
+			perror("shutdown");
+		if (close(s->sock)<0)         								
+			perror("close");	 	// chiudo il socket di comunicazione ("connected") col client che stavo servendo 
+	}
+	else { 							// la connessione col client è saltata (non per effetto del comando quit)
+		shutdown(s->sock, SHUT_RDWR);
+		close(s->sock);
+	}			
+	pthread_mutex_lock(&mutex);
+	active = --n_sessions;          // le sessioni parcheggiate non contano: non impediscono la chiusura del server
+	pthread_mutex_unlock(&mutex);
+	if (quit==1)
+		log_event(LOG_INFO, "session_close", "s:client", inet_ntoa(s->addr.sin_addr), "d:session", s->id, "d:active", active, NULL);
+	else if (park)                  // (l'evento precede il parcheggio: dopo, la sessione può già essere ripresa e liberata)
+		log_event(LOG_WARN, "session_lost", "s:client", inet_ntoa(s->addr.sin_addr), "d:session", s->id, "d:active", active,
+		          "d:resumable_s", SESSION_PARK_TIMEOUT, NULL);
+	else
+		log_event(LOG_WARN, "session_lost", "s:client", inet_ntoa(s->addr.sin_addr), "d:session", s->id, "d:active", active, NULL);
+	pthread_mutex_lock(&park_lock);
+	for (i=0; i<s->nchan; i++) {    // le connessioni dati cadono con quella dei comandi (dopo la riconnessione il client le riapre)
+		shutdown(s->chan[i], SHUT_RDWR);
+		close(s->chan[i]);
+	}
+	s->nchan = 0;
+	if (park) {                     // cartelle e parametri restano: il client può riprendere la sessione riconnettendosi
+		s->sock = -1;
+		s->parked = 1;
+		s->parked_at = time(NULL);
+		pthread_cond_broadcast(&park_cond);
+	}
+	else
+		session_unlink(s);
+	pthread_mutex_unlock(&park_lock);
+	if (!park)
+		session_free(s);
+}
+
+int session_resume ( session *s, uint64_t token ) /* la sessione [s], appena aperta, prende il posto di quella del [token] (cartelle, file > */
+{          /* > inviati, parametri): 1-ripristinata, 0-nessuna sessione con quel token (scaduta) o la vecchia connessione non si chiude */
+	session *o;
+	struct timespec deadline;
+	int rc = 0;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += SESSION_RESUME_WAIT;
+	pthread_mutex_lock(&park_lock);
+	for (o=sessions; o!=NULL && (o->token!=token || o==s); o=o->next)
+		;
+	if (o!=NULL && !o->parked) {    // il server non si è ancora accorto della caduta (link interrotto senza RST, o comando in corso): ..
+		shutdown(o->sock, SHUT_RDWR);  // .. chiudo la vecchia connessione e attendo che la sessione venga parcheggiata
+		while (!o->parked && rc==0)
+			rc = pthread_cond_timedwait(&park_cond, &park_lock, &deadline);
+		rc = 0;
+	}
+	if (o!=NULL && o->parked) {
+		session_unlink(o);
+		rc = 1;
+	}
+	pthread_mutex_unlock(&park_lock);
+	if (rc==0)
+		return 0;
+	ws_free(&s->ws);                // l'area di lavoro nuova non serve: la sessione riprende con quella della sessione parcheggiata
+	s->ws = o->ws;                  // (file in memoria compresi)
+	s->id = o->id;                  // il thread di I/O resta quello della nuova connessione
+	s->file_counter = o->file_counter;
+	free(s->p.archive_name);
+	s->p = o->p;
+	s->token = o->token;
+	free(o);
+	return 1;
+}
+
+int session_attach ( session *s, uint64_t token ) /* (protocollo 9) la connessione della sessione [s], appena aperta, diventa una connessione > */
+{     /* > dati della sessione attiva del [token]: le si risponde 1 e passa a quella, lasciando il suo thread di I/O. 1-aggiunta, 0-nessuna sessione > */
+      /* > attiva con quel token o già MAX_STREAMS connessioni (la risposta spetta al chiamante), -1-il client non ha ricevuto la risposta */
+	session *o;
+	int one = 1, rc = 0;
+	pthread_mutex_lock(&park_lock);
+	for (o=sessions; o!=NULL && (o->token!=token || o==s); o=o->next)
+		;
+	if (o!=NULL && !o->parked && o->proto>=9 && o->nchan<MAX_STREAMS-1) {
+		rc = -1;
+		if (SendData(s->sock, &one, sizeof(int))) {  // (sotto il lock: la sessione [o] non può chiudere la connessione prima della risposta)
+			epoll_ctl(epfd[s->io], EPOLL_CTL_DEL, s->sock, NULL);
+			o->chan[o->nchan++] = s->sock;
+			s->sock = -1;
+			rc = 1;
+			log_event(LOG_INFO, "channel_attached", "s:client", inet_ntoa(s->addr.sin_addr), "d:session", o->id, "d:streams", 1+o->nchan, NULL);
+		}
+	}
+	pthread_mutex_unlock(&park_lock);
+	return rc;
+}
+
+void session_detach ( session *s ) /* libera la sessione [s] la cui connessione è diventata una connessione dati di un'altra sessione (attach) */
+{
+	pthread_mutex_lock(&mutex);
+	n_sessions--;
+	pthread_mutex_unlock(&mutex);
+	pthread_mutex_lock(&park_lock);
+	session_unlink(s);
+	pthread_mutex_unlock(&park_lock);
+	session_free(s);
+}
+
+void session_expire ( void ) /* libera le sessioni parcheggiate da più di SESSION_PARK_TIMEOUT secondi (i client non sono tornati) */
+{
+	session *o, *expired = NULL;
+	time_t now = time(NULL);
+	pthread_mutex_lock(&park_lock);
+	for (o=sessions; o!=NULL; ) {
+		session *next = o->next;
+		if (o->parked && now - o->parked_at > SESSION_PARK_TIMEOUT) {
+			session_unlink(o);
+			o->next = expired;
+			expired = o;
+		}
+		o = next;
+	}
+	pthread_mutex_unlock(&park_lock);
+	while (expired!=NULL) {         // le cartelle si cancellano fuori dal lock
+		o = expired->next;
+		log_event(LOG_INFO, "session_expired", "d:session", expired->id, NULL);  // il client non si è riconnesso
+		session_free(expired);
+		expired = o;
+	}
+}
+
+void session_wait_command ( session *s ) /* riconsegna la sessione [s] al suo thread di I/O, in attesa (senza occupare thread) del prossimo comando */
+{
+	struct epoll_event ev;
+	ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;   // ONESHOT: finché un thread la sta servendo, nessun altro evento della sessione viene consegnato
+	ev.data.ptr = s;
+	if (epoll_ctl(epfd[s->io], EPOLL_CTL_MOD, s->sock, &ev)<0)
+		session_end(s, 0);
+}
+
+int read_command ( session *s ) /* legge (senza bloccarsi) quanto è arrivato del prossimo comando della sessione [s], riprendendo da dove era > */
+{                               /* > rimasta: 1-comando completo, 0-incompleto (si riprende al prossimo evento), -1-connessione chiusa o frame non valido */
+	int n;
+	while (s->hdr_got < (int)sizeof(int)) {           // intestazione del frame (lunghezza del comando)
+		n = recv(s->sock, (char*)&s->cmd_len + s->hdr_got, sizeof(int) - s->hdr_got, MSG_DONTWAIT);
+		if (n==0)
+			return -1;
+		if (n<0)
+			return (errno==EAGAIN || errno==EWOULDBLOCK || errno==EINTR) ? 0 : -1;
+		s->hdr_got += n;
+		atomic_fetch_add_explicit(&srv_metrics.bytes_in, n, memory_order_relaxed);
+		if (s->hdr_got==sizeof(int) && (s->cmd_len<0 || s->cmd_len>MAX_MSG_LEN))
+			return -1;                                // un comando più lungo di MAX_MSG_LEN non può venire da un client valido
+	}
+	while (s->cmd_got < s->cmd_len) {                 // testo del comando
+		n = recv(s->sock, s->cmd + s->cmd_got, s->cmd_len - s->cmd_got, MSG_DONTWAIT);
+		if (n==0)
+			return -1;
+		if (n<0)
+			return (errno==EAGAIN || errno==EWOULDBLOCK || errno==EINTR) ? 0 : -1;
+		s->cmd_got += n;
+		atomic_fetch_add_explicit(&srv_metrics.bytes_in, n, memory_order_relaxed);
+	}
+	s->cmd[s->cmd_len] = '\0';
+	s->hdr_got = s->cmd_got = 0;                      // pronto per il comando successivo
+	return 1;
+}
+
+void ListenerSock_and_Sem_Destroy( int list_sock )  /* il ListenerThread elimina tutti i semafori e chiude il socket di ascolto [list_sock] */
+{
+	pthread_mutex_destroy(&mutex);        // distruzione dei semafori 
+	pthread_cond_destroy(&PoolReady);
+	pthread_cond_destroy(&PoolExit);
+	sem_destroy(&PoolItems);
+	if (close(list_sock)<0)    	     // chiusura del listening socket
+		perror("close");
+}
+
+
+// funzioni (8) dello scheduler dei lavori di compressione (work-stealing)
+
+sched_task *sched_deque_take ( sched_deque *d, int bottom, int light ) /* toglie dalla coda [d] il lavoro in fondo ([bottom]=1) o in cima; > */
+{                              /* > con [light]=1 il primo lavoro breve a partire da quell'estremo (quelli lunghi restano al loro posto); NULL se non c'è */
+	sched_task *t = NULL;
+	size_t i, j;
+	pthread_mutex_lock(&d->m);
+	for (j=0; j < d->bottom - d->top; j++) {
+		i = bottom ? d->bottom-1-j : d->top+j;
+		t = d->ring[i & (SCHED_DEQUE_SIZE-1)];
+		if (!(light && t->heavy))
+			break;
+		t = NULL;
+	}
+	if (t!=NULL) {
+		if (bottom) {                      // compatto la coda verso l'estremo da cui ho prelevato
+			for (; i+1 < d->bottom; i++)
+				d->ring[i & (SCHED_DEQUE_SIZE-1)] = d->ring[(i+1) & (SCHED_DEQUE_SIZE-1)];
+			d->bottom--;
+		}
+		else {
+			for (; i > d->top; i--)
+				d->ring[i & (SCHED_DEQUE_SIZE-1)] = d->ring[(i-1) & (SCHED_DEQUE_SIZE-1)];
+			d->top++;
+		}
+	}
+	pthread_mutex_unlock(&d->m);
+	return t;
+}
+
+sched_task *sched_take ( int self, int light ) /* preleva un lavoro: prima dal fondo della coda del worker [self] (il più recente, i cui dati > */
+{                        /* > sono ancora in cache), poi rubando dalla cima (il più vecchio) delle code degli altri; con [light]=1 solo lavori brevi; NULL se non ce ne sono */
+	sched_task *t = NULL;
+	int i, k;
+	if (self>=0)
+		t = sched_deque_take(&sched.dq[self], 1, light);
+	for (i=1; t==NULL && i<=sched.nworkers; i++) {   // work-stealing: si parte dalla coda successiva alla propria
+		k = ((self<0 ? 0 : self) + i) % sched.nworkers;
+		if (k!=self)
+			t = sched_deque_take(&sched.dq[k], 0, light);
+	}
+	if (t!=NULL)
+		atomic_fetch_sub(&sched.pending, 1);
+	return t;
+}
+
+void sched_run ( sched_task *t ) /* esegue il lavoro [t] e sveglia chi ne attende la fine */
+{
+	t->run(t->arg);
+	pthread_mutex_lock(&sched.m);
+	atomic_store(&t->done, 1);
+	pthread_cond_broadcast(&sched.done);
+	pthread_mutex_unlock(&sched.m);
+}
+
+void sched_submit ( sched_task *t, void (*run)(void*), void *arg, int heavy ) /* affida allo scheduler il lavoro [run]([arg]), descritto da [t]: > */
+{                                              /* > un worker lo mette nella propria coda, un thread esterno in quella dei worker a turno */
+	int i, k;
+	t->run = run;
+	t->arg = arg;
+	t->heavy = heavy;
+	atomic_store(&t->done, 0);
+	k = (sched_self>=0) ? sched_self : (int)(atomic_fetch_add(&sched.next, 1) % sched.nworkers);
+	for (i=0; i<sched.nworkers; i++) {
+		sched_deque *d = &sched.dq[(k+i) % sched.nworkers];
+		pthread_mutex_lock(&d->m);
+		if (d->bottom - d->top < SCHED_DEQUE_SIZE) {
+			d->ring[d->bottom++ & (SCHED_DEQUE_SIZE-1)] = t;
+			pthread_mutex_unlock(&d->m);
+			atomic_fetch_add(&sched.pending, 1);
+			pthread_mutex_lock(&sched.m);
+			if (sched.sleeping>0)
+				pthread_cond_signal(&sched.work);
+			pthread_mutex_unlock(&sched.m);
+			return;
+		}
+		pthread_mutex_unlock(&d->m);
+	}
+	sched_run(t);   // tutte le code piene (caso limite): il lavoro viene eseguito dal chiamante
+}
+
+void sched_wait ( sched_task *t ) /* attende la fine del lavoro [t]; un worker nel frattempo esegue altri lavori (così non blocca mai il core) */
+{
+	while (atomic_load(&t->done)==0) {
+		sched_task *o = (sched_self>=0) ? sched_take(sched_self, 1) : NULL; // solo blocchi: un'altra compress ritarderebbe questa
+		if (o!=NULL) {
+			sched_run(o);
+			continue;
+		}
+		pthread_mutex_lock(&sched.m);
+		if (atomic_load(&t->done)==0)     // [t] è in esecuzione su un altro worker (o, per un thread esterno, ancora in coda)
+			pthread_cond_wait(&sched.done, &sched.m);
+		pthread_mutex_unlock(&sched.m);
+	}
+}
+
+void *sched_worker ( void *arg ) /* worker dello scheduler: esegue lavori (propri o rubati) finché lo scheduler non viene fermato */
+{
+	sched_self = *(int*)arg;
+	free(arg);
+	while (1) {
+		sched_task *t = sched_take(sched_self, 0);
+		if (t!=NULL) {
+			sched_run(t);
+			continue;
+		}
+		pthread_mutex_lock(&sched.m);
+		if (sched.quit) {
+			pthread_mutex_unlock(&sched.m);
+			break;
+		}
+		if (atomic_load(&sched.pending)==0) {     // nessun lavoro in nessuna coda: dormo fino al prossimo sched_submit
+			sched.sleeping++;
+			pthread_cond_wait(&sched.work, &sched.m);
+			sched.sleeping--;
+		}
+		pthread_mutex_unlock(&sched.m);
+	}
+	return NULL;
+}
+
+int sched_init ( int n ) /* avvia lo scheduler con [n] worker (uno per core se [n]=0): 1-ok, 0-errore */
+{
+	int i;
+	if (n<=0)
+		n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (n<=0)
+		n = 1;
+	memset(&sched, 0, sizeof(scheduler));
+	sched.dq = calloc(n, sizeof(sched_deque));
+	sched.threads = calloc(n, sizeof(pthread_t));
+	if (sched.dq==NULL || sched.threads==NULL)
+		return 0;
+	pthread_mutex_init(&sched.m, NULL);
+	pthread_cond_init(&sched.work, NULL);
+	pthread_cond_init(&sched.done, NULL);
+	sched.nworkers = n;
+	for (i=0; i<n; i++)
+		pthread_mutex_init(&sched.dq[i].m, NULL);
+	for (i=0; i<n; i++) {
+		int *id = malloc(sizeof(int));
+		if (id==NULL)
+			return 0;
+		*id = i;
+		if (pthread_create(&sched.threads[i], NULL, sched_worker, id)!=0) {
+			free(id);
+			return 0;
+		}
+	}
+	printf(RST"Creato scheduler di compressione [%d worker].\n", n);
+	return 1;
+}
+
+void sched_stop ( void ) /* ferma i worker dello scheduler (non ci sono più lavori: tutte le sessioni sono chiuse) e ne libera le code */
+{
+	int i;
+	pthread_mutex_lock(&sched.m);
+	sched.quit = 1;
+	pthread_cond_broadcast(&sched.work);
+	pthread_mutex_unlock(&sched.m);
+	for (i=0; i<sched.nworkers; i++) {
+		pthread_join(sched.threads[i], NULL);
+		pthread_mutex_destroy(&sched.dq[i].m);
+	}
+	pthread_mutex_destroy(&sched.m);
+	pthread_cond_destroy(&sched.work);
+	pthread_cond_destroy(&sched.done);
+	free(sched.dq);
+	free(sched.threads);
+}
+
+
+// funzioni (61) per la compressione: archiviatore tar in-process, codec (zlib, bzip2, liblzma, zstd, lz4, LZW), compressione parallela a blocchi, destinazioni
+
+int aw_deliver ( archive_writer *aw, const void *buf, size_t len ) /* consegna alla destinazione [aw->sink] [len] byte compressi di [buf]: 1-ok, 0-errore */
+{
+	if (len==0)
+		return 1;
+	uint64_t t = log_trace ? mono_us() : 0;  // (può girare su un worker dello scheduler: la traccia del comando la legge da aw)
+	aw->out_bytes += len;
+	if ( ! aw->sink(aw->sink_ctx, buf, len) ) {
+		aw->failed = 1;            // la destinazione (di solito il socket del client) non accetta più dati
+		return 0;
+	}
+	if (log_trace)
+		aw->sink_us += mono_us()-t;
+	return 1;
+}
+
+int aw_emit ( archive_writer *aw, size_t len ) { return aw_deliver(aw, aw->out, len); } // i primi [len] byte del buffer d'uscita
+
+int gz_init ( archive_writer *aw )   /* codec gnuzip: deflate di zlib con intestazione gzip (windowBits 15+16) */
+{
+	memset(&aw->s.z, 0, sizeof(z_stream));
+	return deflateInit2(&aw->s.z, aw->level, Z_DEFLATED, 15+16, 8, Z_DEFAULT_STRATEGY)==Z_OK;
+}
+
+int gz_run ( archive_writer *aw, const void *data, size_t len, int flush ) /* comprime [len] byte (o svuota, se [flush]) e li consegna */
+{
+	int rc;
+	aw->s.z.next_in = (Bytef*)data;
+	aw->s.z.avail_in = len;
+	do {
+		aw->s.z.next_out = aw->out;
+		aw->s.z.avail_out = CHUNK_SIZE;
+		rc = deflate(&aw->s.z, flush ? Z_FINISH : Z_NO_FLUSH);
+		if (rc==Z_STREAM_ERROR)
+			return 0;
+		if ( ! aw_emit(aw, CHUNK_SIZE-aw->s.z.avail_out) )
+			return 0;
+	} while ( aw->s.z.avail_out==0 || (flush && rc!=Z_STREAM_END) );
+	return 1;
+}
+
+int gz_write ( archive_writer *aw, const void *data, size_t len ) { return gz_run(aw, data, len, 0); }
+int gz_finish ( archive_writer *aw ) { return gz_run(aw, NULL, 0, 1); }
+void gz_end ( archive_writer *aw ) { deflateEnd(&aw->s.z); }
+
+int bz_init ( archive_writer *aw )   /* codec bzip2: libbz2 con blocchi da 100k per livello (900k al livello di default, come "bzip2 -9") */
+{
+	memset(&aw->s.bz, 0, sizeof(bz_stream));
+	return BZ2_bzCompressInit(&aw->s.bz, aw->level, 0, 0)==BZ_OK;
+}
+
+int bz_run ( archive_writer *aw, const void *data, size_t len, int flush )
+{
+	int rc;
+	aw->s.bz.next_in = (char*)data;
+	aw->s.bz.avail_in = len;
+	do {
+		aw->s.bz.next_out = (char*)aw->out;
+		aw->s.bz.avail_out = CHUNK_SIZE;
+		rc = BZ2_bzCompress(&aw->s.bz, flush ? BZ_FINISH : BZ_RUN);
+		if (rc<0)
+			return 0;
+		if ( ! aw_emit(aw, CHUNK_SIZE-aw->s.bz.avail_out) )
+			return 0;
+	} while ( aw->s.bz.avail_in>0 || aw->s.bz.avail_out==0 || (flush && rc!=BZ_STREAM_END) );
+	return 1;
+}
+
+int bz_write ( archive_writer *aw, const void *data, size_t len ) { return bz_run(aw, data, len, 0); }
+int bz_finish ( archive_writer *aw ) { return bz_run(aw, NULL, 0, 1); }
+void bz_end ( archive_writer *aw ) { BZ2_bzCompressEnd(&aw->s.bz); }
+
+int xz_init ( archive_writer *aw )   /* codec xz: liblzma, preset del livello (6 di default) e controllo CRC64 (come il comando "xz") */
+{
+	lzma_stream init = LZMA_STREAM_INIT;
+	aw->s.xz = init;
+	return lzma_easy_encoder(&aw->s.xz, aw->level, LZMA_CHECK_CRC64)==LZMA_OK;
+}
+
+int xz_run ( archive_writer *aw, const void *data, size_t len, int flush )
+{
+	lzma_ret rc;
+	aw->s.xz.next_in = data;
+	aw->s.xz.avail_in = len;
+	do {
+		aw->s.xz.next_out = aw->out;
+		aw->s.xz.avail_out = CHUNK_SIZE;
+		rc = lzma_code(&aw->s.xz, flush ? LZMA_FINISH : LZMA_RUN);
+		if (rc!=LZMA_OK && rc!=LZMA_STREAM_END)
+			return 0;
+		if ( ! aw_emit(aw, CHUNK_SIZE-aw->s.xz.avail_out) )
+			return 0;
+	} while ( aw->s.xz.avail_in>0 || aw->s.xz.avail_out==0 || (flush && rc!=LZMA_STREAM_END) );
+	return 1;
+}
+
+int xz_write ( archive_writer *aw, const void *data, size_t len ) { return xz_run(aw, data, len, 0); }
+int xz_finish ( archive_writer *aw ) { return xz_run(aw, NULL, 0, 1); }
+void xz_end ( archive_writer *aw ) { lzma_end(&aw->s.xz); }
+
+int zst_init ( archive_writer *aw )  /* codec zstd: corrispondenze a lungo raggio (come "zstd --long") e, con più thread, i worker interni di > */
+{                                    /* > libzstd (un unico frame, compresso a sezioni in parallelo) invece dei blocchi dello scheduler */
+	aw->s.zst = ZSTD_createCCtx();
+	if (aw->s.zst==NULL)
+		return 0;
+	if ( ZSTD_isError(ZSTD_CCtx_setParameter(aw->s.zst, ZSTD_c_compressionLevel, aw->level))
+	     || ZSTD_isError(ZSTD_CCtx_setParameter(aw->s.zst, ZSTD_c_enableLongDistanceMatching, 1))
+	     || ZSTD_isError(ZSTD_CCtx_setParameter(aw->s.zst, ZSTD_c_windowLog, ZST_LONG_WINDOW))
+	     || ZSTD_isError(ZSTD_CCtx_setParameter(aw->s.zst, ZSTD_c_checksumFlag, 1)) ) {
+		ZSTD_freeCCtx(aw->s.zst);
+		return 0;
+	}
+	if (aw->threads>1)               // libzstd senza supporto multithread rifiuta il parametro: si comprime comunque, in sequenza
+		ZSTD_CCtx_setParameter(aw->s.zst, ZSTD_c_nbWorkers, aw->threads);
+	return 1;
+}
+
+int zst_run ( archive_writer *aw, const void *data, size_t len, int flush )
+{
+	ZSTD_inBuffer in = { data, len, 0 };
+	ZSTD_outBuffer out;
+	size_t rc;
+	do {
+		out.dst = aw->out;
+		out.size = CHUNK_SIZE;
+		out.pos = 0;
+		rc = ZSTD_compressStream2(aw->s.zst, &out, &in, flush ? ZSTD_e_end : ZSTD_e_continue);
+		if (ZSTD_isError(rc))
+			return 0;
+		if ( ! aw_emit(aw, out.pos) )
+			return 0;
+	} while ( in.pos<in.size || (flush && rc!=0) );   // rc: byte ancora da svuotare (0 a frame concluso)
+	return 1;
+}
+
+int zst_write ( archive_writer *aw, const void *data, size_t len ) { return zst_run(aw, data, len, 0); }
+int zst_finish ( archive_writer *aw ) { return zst_run(aw, NULL, 0, 1); }
+void zst_end ( archive_writer *aw ) { ZSTD_freeCCtx(aw->s.zst); }
+
+void lz4_end ( archive_writer *aw )
+{
+	LZ4F_freeCompressionContext(aw->s.lz4.ctx);
+	free(aw->s.lz4.buf);
+}
+
+int lz4_init ( archive_writer *aw )  /* codec lz4: formato a frame (come il comando "lz4"), con checksum del contenuto */
+{
+	LZ4F_preferences_t prefs;
+	memset(&prefs, 0, sizeof(prefs));
+	prefs.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+	memset(&aw->s.lz4, 0, sizeof(aw->s.lz4));
+	aw->s.lz4.cap = LZ4F_compressBound(CHUNK_SIZE, &prefs);
+	aw->s.lz4.buf = malloc(aw->s.lz4.cap);
+	if (aw->s.lz4.buf==NULL || LZ4F_isError(LZ4F_createCompressionContext(&aw->s.lz4.ctx, LZ4F_VERSION))) {
+		free(aw->s.lz4.buf);
+		return 0;
+	}
+	return 1;
+}
+
+int lz4_begin ( archive_writer *aw )  /* emette l'intestazione del frame al primo byte da comprimere (o alla chiusura) */
+{
+	LZ4F_preferences_t prefs;
+	size_t n;
+	if (aw->s.lz4.started)
+		return 1;
+	memset(&prefs, 0, sizeof(prefs));
+	prefs.compressionLevel = aw->level;
+	prefs.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+	aw->s.lz4.started = 1;
+	n = LZ4F_compressBegin(aw->s.lz4.ctx, aw->s.lz4.buf, aw->s.lz4.cap, &prefs);
+	return !LZ4F_isError(n) && aw_deliver(aw, aw->s.lz4.buf, n);
+}
+
+int lz4_write ( archive_writer *aw, const void *data, size_t len )
+{
+	const char *p = data;
+	size_t n, chunk;
+	if ( ! lz4_begin(aw) )
+		return 0;
+	while (len>0) {                   // a pezzi di CHUNK_SIZE: il buffer d'uscita è dimensionato per il caso peggiore di questa quantità
+		chunk = (len > CHUNK_SIZE) ? CHUNK_SIZE : len;
+		n = LZ4F_compressUpdate(aw->s.lz4.ctx, aw->s.lz4.buf, aw->s.lz4.cap, p, chunk, NULL);
+		if (LZ4F_isError(n) || ! aw_deliver(aw, aw->s.lz4.buf, n))
+			return 0;
+		p += chunk;
+		len -= chunk;
+	}
+	return 1;
+}
+
+int lz4_finish ( archive_writer *aw )
+{
+	size_t n;
+	if ( ! lz4_begin(aw) )
+		return 0;
+	n = LZ4F_compressEnd(aw->s.lz4.ctx, aw->s.lz4.buf, aw->s.lz4.cap, NULL);
+	return !LZ4F_isError(n) && aw_deliver(aw, aw->s.lz4.buf, n);
+}
+
+int lzw_putbits ( archive_writer *aw, unsigned int code, int bits ) /* accoda [bits] bit di [code] (dal meno significativo, come compress(1)) */
+{
+	lzw_state *l = aw->lzw;
+	l->acc |= (uint64_t)code << l->nacc;
+	l->nacc += bits;
+	while (l->nacc >= 8) {
+		aw->out[l->outlen++] = l->acc & 0xff;
+		l->acc >>= 8;
+		l->nacc -= 8;
+		l->out_count++;
+		if (l->outlen==CHUNK_SIZE) {
+			if ( ! aw_emit(aw, l->outlen) )
+				return 0;
+			l->outlen = 0;
+		}
+	}
+	return 1;
+}
+
+int lzw_output ( archive_writer *aw, int code ) /* emette un codice: la larghezza segue lo stato del decompressore (unlzw), che allarga i codici > */
+{                                               /* > quando la sua prossima voce non ci sta più, dopo aver completato il gruppo di 8 codici */
+	lzw_state *l = aw->lzw;
+	if (l->dec_free > l->maxcode) {
+		while (l->group%8 != 0) {          // padding del gruppo corrente alla vecchia larghezza
+			if ( ! lzw_putbits(aw, 0, l->n_bits) )
+				return 0;
+			l->group++;
+		}
+		l->n_bits++;
+		l->maxcode = (l->n_bits==l->maxbits) ? (1<<l->maxbits) : (1<<l->n_bits)-1;
+		l->group = 0;
+	}
+	if ( ! lzw_putbits(aw, code, l->n_bits) )
+		return 0;
+	l->group++;
+	if (l->first)                  // il primo codice dello stream non crea voci nel dizionario del decompressore
+		l->first = 0;
+	else if (l->dec_free < (1<<l->maxbits))
+		l->dec_free++;
+	return 1;
+}
+
+int lzw_init ( archive_writer *aw )  /* codec compress: LZW fino a 16 bit (il livello) in "block mode", formato .Z leggibile da uncompress e gzip -d */
+{
+	lzw_state *l = malloc(sizeof(lzw_state));
+	if (l==NULL)
+		return 0;
+	memset(l->htab, 0xff, sizeof(l->htab));           // -1: posizione libera
+	l->free_ent = l->dec_free = 257;                  // 0..255 letterali, 256 codice CLEAR (vedi lzw_clear)
+	l->n_bits = 9;
+	l->maxcode = (1<<9)-1;
+	l->maxbits = aw->level;
+	l->ent = -1;
+	l->first = 1;
+	l->group = l->nacc = l->outlen = 0;
+	l->acc = 0;
+	l->in_count = l->out_count = l->ratio = 0;
+	l->checkpoint = LZW_CHECK_GAP;
+	aw->lzw = l;
+	aw->out[0] = 0x1f;                                // magic number di compress(1)
+	aw->out[1] = 0x9d;
+	aw->out[2] = l->maxbits | 0x80;                   // n° massimo di bit + block mode
+	l->outlen = 3;
+	return 1;
+}
+
+int lzw_clear ( archive_writer *aw ) /* emette CLEAR (block mode), completa il gruppo di 8 codici alla larghezza attuale e riparte con il > */
+{                                     /* > dizionario vuoto e i codici a 9 bit, come fa il decompressore quando legge CLEAR */
+	lzw_state *l = aw->lzw;
+	if ( ! lzw_output(aw, 256) )
+		return 0;
+	while (l->group%8 != 0) {
+		if ( ! lzw_putbits(aw, 0, l->n_bits) )
+			return 0;
+		l->group++;
+	}
+	memset(l->htab, 0xff, sizeof(l->htab));
+	l->free_ent = l->dec_free = 257;
+	l->n_bits = 9;
+	l->maxcode = (1<<9)-1;
+	l->group = 0;
+	l->first = 1;                  // il codice dopo CLEAR non crea voci utili nel dizionario del decompressore (la sua va in 256)
+	l->ratio = 0;
+	return 1;
+}
+
+int lzw_write ( archive_writer *aw, const void *data, size_t len )
+{
+	lzw_state *l = aw->lzw;
+	const unsigned char *p = data;
+	size_t k;
+	for (k=0; k<len; k++) {
+		int c = p[k], i, disp;
+		int32_t fcode;
+		uint64_t rat;
+		l->in_count++;
+		if (l->ent==-1) {
+			l->ent = c;
+			continue;
+		}
+		fcode = ((int32_t)c << 16) | l->ent;          // chiave della coppia (prefisso, carattere)
+		i = ((c << 8) ^ l->ent) % LZW_HSIZE;
+		disp = (i==0) ? 1 : LZW_HSIZE-i;                // hashing doppio, come in compress(1)
+		while (l->htab[i]!=-1 && l->htab[i]!=fcode) {
+			i -= disp;
+			if (i<0)
+				i += LZW_HSIZE;
+		}
+		if (l->htab[i]==fcode) {                      // la stringa è già nel dizionario: la allungo
+			l->ent = l->codetab[i];
+			continue;
+		}
+		if ( ! lzw_output(aw, l->ent) )
+			return 0;
+		if (l->free_ent < (1<<l->maxbits)) {
+			l->htab[i] = fcode;
+			l->codetab[i] = l->free_ent++;
+		}
+		else if (l->in_count >= l->checkpoint) {        // dizionario pieno: ogni LZW_CHECK_GAP byte si misura il rapporto, e se è peggiorato ..
+			l->checkpoint = l->in_count + LZW_CHECK_GAP;  // .. il dizionario (fatto sui dati precedenti) si azzera, come in compress(1)
+			rat = (l->out_count>0) ? (l->in_count<<8) / l->out_count : UINT64_MAX;
+			if (rat >= l->ratio)
+				l->ratio = rat;
+			else if ( ! lzw_clear(aw) )
+				return 0;
+		}
+		l->ent = c;
+	}
+	return 1;
+}
+
+int lzw_finish ( archive_writer *aw )
+{
+	lzw_state *l = aw->lzw;
+	if (l->ent!=-1 && ! lzw_output(aw, l->ent) )
+		return 0;
+	if (l->nacc>0 && ! lzw_putbits(aw, 0, 8-l->nacc) ) // completo l'ultimo byte
+		return 0;
+	if ( ! aw_emit(aw, l->outlen) )
+		return 0;
+	l->outlen = 0;
+	return 1;
+}
+
+void lzw_end ( archive_writer *aw ) { free(aw->lzw); aw->lzw = NULL; }
+
+int gz_block ( const unsigned char *in, size_t in_len, unsigned char *out, size_t *out_len, int level ) /* comprime un blocco come membro gzip completo */
+{
+	z_stream z;
+	int rc;
+	memset(&z, 0, sizeof(z_stream));
+	if (deflateInit2(&z, level, Z_DEFLATED, 15+16, 8, Z_DEFAULT_STRATEGY)!=Z_OK)
+		return 0;
+	z.next_in = (Bytef*)in;
+	z.avail_in = in_len;
+	z.next_out = out;
+	z.avail_out = *out_len;
+	rc = deflate(&z, Z_FINISH);
+	*out_len -= z.avail_out;
+	deflateEnd(&z);
+	return rc==Z_STREAM_END;
+}
+
+size_t gz_bound ( size_t len ) { return compressBound(len) + 64; } // + intestazione e trailer gzip
+
+int bz_block ( const unsigned char *in, size_t in_len, unsigned char *out, size_t *out_len, int level ) /* comprime un blocco come stream bzip2 completo */
+{
+	unsigned int l = *out_len;
+	int rc = BZ2_bzBuffToBuffCompress((char*)out, &l, (char*)in, in_len, level, 0, 0);
+	*out_len = l;
+	return rc==BZ_OK;
+}
+
+size_t bz_bound ( size_t len ) { return len + len/100 + 600; } // limite documentato da libbz2
+
+int xz_block ( const unsigned char *in, size_t in_len, unsigned char *out, size_t *out_len, int level ) /* comprime un blocco come stream xz completo */
+{
+	size_t pos = 0;
+	int rc = lzma_easy_buffer_encode(level, LZMA_CHECK_CRC64, NULL, in, in_len, out, &pos, *out_len);
+	*out_len = pos;
+	return rc==LZMA_OK;
+}
+
+size_t xz_bound ( size_t len ) { return lzma_stream_buffer_bound(len); }
+
+int lz4_block ( const unsigned char *in, size_t in_len, unsigned char *out, size_t *out_len, int level ) /* comprime un blocco come frame lz4 completo */
+{
+	LZ4F_preferences_t prefs;
+	size_t n;
+	memset(&prefs, 0, sizeof(prefs));
+	prefs.compressionLevel = level;
+	prefs.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+	n = LZ4F_compressFrame(out, *out_len, in, in_len, &prefs);
+	if (LZ4F_isError(n))
+		return 0;
+	*out_len = n;
+	return 1;
+}
+
+size_t lz4_bound ( size_t len ) { return LZ4F_compressFrameBound(len, NULL) + 64; } // + checksum del contenuto
+
+codec_ops codecs[NUM_COMPRESSORS] = {  // stesse righe di compressors_matrix; LZW è un unico stream e non ha la versione a blocchi, zstd ha i propri thread
+	{ gz_init, gz_write, gz_finish, gz_end, gz_block, gz_bound, GZ_BLOCK_SIZE, 1, 9, GZ_LEVEL },
+	{ bz_init, bz_write, bz_finish, bz_end, bz_block, bz_bound, BZ_BLOCK_SIZE, 1, 9, BZ_LEVEL },
+	{ xz_init, xz_write, xz_finish, xz_end, xz_block, xz_bound, XZ_BLOCK_SIZE, 0, 9, XZ_LEVEL },
+	{ lzw_init, lzw_write, lzw_finish, lzw_end, NULL, NULL, 0, 9, LZW_BITS, LZW_BITS },
+	{ zst_init, zst_write, zst_finish, zst_end, NULL, NULL, 0, 1, MAX_LEVEL, ZST_LEVEL },
+	{ lz4_init, lz4_write, lz4_finish, lz4_end, lz4_block, lz4_bound, LZ4_BLOCK_SIZE, 1, 12, LZ4_LEVEL }
+};
+
+int codec_level ( int compressor_index, int level ) /* livello effettivo del codec [compressor_index] per il livello [level] scelto dal > */
+{                                                   /* > client: quello di default se LEVEL_DEFAULT, altrimenti ricondotto all'intervallo del codec */
+	codec_ops *c = &codecs[compressor_index];
+	if (level==LEVEL_DEFAULT)
+		return c->def_level;
+	return (level < c->min_level) ? c->min_level : (level > c->max_level) ? c->max_level : level;
+}
+
+void pc_block_task ( void *arg ) /* lavoro dello scheduler: comprime un blocco */
+{
+	pblock *b = arg;
+	b->out_len = b->out_cap;
+	b->state = b->pc->block(b->in, b->in_len, b->out, &b->out_len, b->pc->level) ? PB_DONE : PB_ERROR;
+}
+
+int pc_emit_oldest ( archive_writer *aw ) /* attende il blocco più vecchio in volo, lo consegna alla destinazione (in ordine) e libera lo slot */
+{
+	pcodec *pc = aw->par;
+	pblock *b = &pc->slots[pc->next_emit % pc->nslots];
+	int ok;
+	sched_wait(&b->task);                  // un worker nel frattempo esegue altri lavori (anche i blocchi di questo archivio)
+	ok = (b->state==PB_DONE) && aw_deliver(aw, b->out, b->out_len);
+	b->state = PB_FREE;
+	b->in_len = 0;
+	pc->next_emit++;
+	return ok;
+}
+
+int pc_submit ( archive_writer *aw ) /* affida allo scheduler il blocco in riempimento (se non vuoto) */
+{
+	pcodec *pc = aw->par;
+	pblock *b = &pc->slots[pc->next_fill % pc->nslots];
+	if (b->in_len==0)
+		return 1;
+	b->seq = pc->next_fill++;
+	b->state = PB_READY;
+	sched_submit(&b->task, pc_block_task, b, 0);
+	if (pc->next_fill - pc->next_emit == (uint64_t)pc->nslots) // tutti gli slot in volo: consegno il più vecchio per liberarne uno
+		return pc_emit_oldest(aw);
+	return 1;
+}
+
+int pc_write ( archive_writer *aw, const void *data, size_t len ) /* accumula lo stream tar nel blocco corrente, affidandolo allo scheduler quando è pieno */
+{
+	pcodec *pc = aw->par;
+	const unsigned char *p = data;
+	while (len>0) {
+		pblock *b = &pc->slots[pc->next_fill % pc->nslots];
+		size_t n = pc->block_size - b->in_len;
+		if (n > len)
+			n = len;
+		memcpy(b->in + b->in_len, p, n);
+		b->in_len += n;
+		p += n;
+		len -= n;
+		if (b->in_len==pc->block_size && ! pc_submit(aw) )
+			return 0;
+	}
+	return 1;
+}
+
+int pc_finish ( archive_writer *aw ) /* invia l'ultimo blocco (parziale) e consegna in ordine tutti quelli ancora in volo */
+{
+	pcodec *pc = aw->par;
+	int ok = pc_submit(aw);
+	while (ok && pc->next_emit < pc->next_fill)
+		ok = pc_emit_oldest(aw);
+	return ok;
+}
+
+void pc_end ( archive_writer *aw ) /* attende i blocchi ancora in compressione (un lavoro avviato non si può ritirare) e libera i blocchi */
+{
+	pcodec *pc = aw->par;
+	int i;
+	for (i=0; i<pc->nslots; i++) {
+		if (pc->slots[i].state==PB_READY)
+			sched_wait(&pc->slots[i].task);
+		free(pc->slots[i].in);
+		free(pc->slots[i].out);
+	}
+	free(pc->slots);
+	free(pc);
+	aw->par = NULL;
+}
+
+int pc_init ( archive_writer *aw, int threads ) /* compressione a blocchi indipendenti, fino a [threads] in parallelo: ogni blocco è un membro/stream > */
+{                                              /* > completo del formato, e i decompressori standard leggono la concatenazione: 1-ok, 0-errore */
+	codec_ops *c = &codecs[aw->compressor_index];
+	pcodec *pc = calloc(1, sizeof(pcodec));
+	int i;
+	if (pc==NULL)
+		return 0;
+	pc->block = c->block;
+	pc->block_size = c->block_size;
+	pc->level = aw->level;
+	pc->nslots = 2*threads;                  // mentre i worker comprimono, il produttore riempie i blocchi successivi
+	pc->slots = calloc(pc->nslots, sizeof(pblock));
+	if (pc->slots==NULL) {
+		free(pc);
+		return 0;
+	}
+	aw->par = pc;
+	for (i=0; i<pc->nslots; i++) {
+		pc->slots[i].pc = pc;
+		pc->slots[i].in = malloc(pc->block_size);
+		pc->slots[i].out_cap = c->bound(pc->block_size);
+		pc->slots[i].out = malloc(pc->slots[i].out_cap);
+		if (pc->slots[i].in==NULL || pc->slots[i].out==NULL) {
+			pc_end(aw);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+int aw_open ( archive_writer *aw, int compressor_index, int threads, int level, int (*sink)(void*, const void*, size_t), void *sink_ctx ) /* > */
+{  /* > prepara l'archiviatore al livello [level] (vedi codec_level); con [threads]>1, se il codec lo consente, comprime a blocchi in parallelo > */
+   /* > (zstd con i propri thread): 1-ok, 0-errore */
+	memset(aw, 0, sizeof(archive_writer));
+	aw->compressor_index = compressor_index;
+	aw->level = codec_level(compressor_index, level);
+	aw->threads = threads;
+	aw->sink = sink;
+	aw->sink_ctx = sink_ctx;
+	if (threads>1 && codecs[compressor_index].block!=NULL)
+		return pc_init(aw, threads);
+	return codecs[compressor_index].init(aw);
+}
 
-// funzioni (2) sulle stringhe [uguali per client e server]
+int aw_write ( archive_writer *aw, const void *data, size_t len ) /* passa [len] byte dello stream tar al codec: 1-ok, 0-errore */
+{
+	aw->in_bytes += len;
+	if (aw->par!=NULL)
+		return pc_write(aw, data, len);
+	return codecs[aw->compressor_index].write(aw, data, len);
+}
 
-char *trim_side_spaces ( char *s )  /* toglie gli spazi a sx e dx della stringa [s] e la restituisce */	
-{ 
-  int i=0, k=0, j=(strlen(s)-1);
-  while ( isspace(s[i]) && s[i]!='\0' )
-    i++;
-  while ( isspace(s[j]) && j>= 0 )
-    j--;
-  while ( i<=j )
-    s[k++] = s[i++];
-  s[k]='\0';
-  return s;
+int aw_close ( archive_writer *aw, int ok ) /* se [ok] chiude lo stream (trailer del codec); libera sempre le risorse: 1-ok, 0-errore */
+{
+	if (aw->par!=NULL) {
+		if (ok)
+			ok = pc_finish(aw);
+		pc_end(aw);
+		return ok;
+	}
+	if (ok)
+		ok = codecs[aw->compressor_index].finish(aw);
+	codecs[aw->compressor_index].end(aw);
+	return ok;
 }
 
-char *del_chars ( char *r, char x )  /* toglie tutte le occorrenze del char [x] nella stringa [r]  e restituisce [r] modificata */	
+void tar_octal ( char *field, int width, uint64_t value ) /* scrive [value] in ottale nel campo tar [field] largo [width] (NUL finale); > */
+{                                                        /* > se non ci sta usa la codifica binaria base-256 di GNU tar (file > 8GiB) */
+	int i;
+	if ( value < ((uint64_t)1 << (3*(width-1))) ) {
+		snprintf(field, width, "%0*llo", width-1, (unsigned long long)value);
+		return;
+	}
+	for (i=width-1; i>0; i--) {
+		field[i] = value & 0xff;
+		value >>= 8;
+	}
+	field[0] = (char)0x80;
+}
+
+int tar_header ( archive_writer *aw, const char *name, char type, uint64_t size, struct stat *st ) /* scrive un header ustar per [name] */
 {
-  int i=0, k=0;
-  char s[strlen(r)+1];
-  strcpy(s,r);
-  for (i=0; s[i]!='\0'; i++) 
-		if (s[i]!=x)
-			r[k++]=s[i];
-  r[k]='\0';
-  return r;
+	char h[TAR_BLOCK];
+	unsigned int sum = 0;
+	size_t l = strlen(name);
+	int i;
+	memset(h, 0, TAR_BLOCK);
+	if (l > 100) {              // nome troppo lungo per il campo ustar: prima un header GNU "././@LongLink" con il nome completo
+		char block[TAR_BLOCK];
+		size_t done;
+		if ( ! tar_header(aw, "././@LongLink", 'L', l+1, st) )
+			return 0;
+		for (done=0; done<l+1; done+=TAR_BLOCK) {
+			memset(block, 0, TAR_BLOCK);
+			memcpy(block, name+done, (l+1-done > TAR_BLOCK) ? TAR_BLOCK : l+1-done);
+			if ( ! aw_write(aw, block, TAR_BLOCK) )
+				return 0;
+		}
+		l = 100;
+	}
+	memcpy(h, name, l);                                    // name[100]
+	tar_octal(h+100, 8, st->st_mode & 07777);              // mode
+	tar_octal(h+108, 8, st->st_uid);                       // uid
+	tar_octal(h+116, 8, st->st_gid);                       // gid
+	tar_octal(h+124, 12, size);                            // size
+	tar_octal(h+136, 12, st->st_mtime);                    // mtime
+	memset(h+148, ' ', 8);                                 // chksum (spazi durante il calcolo)
+	h[156] = type;                                         // typeflag
+	memcpy(h+257, "ustar", 6);                             // magic + version "00"
+	memcpy(h+263, "00", 2);
+	for (i=0; i<TAR_BLOCK; i++)
+		sum += (unsigned char)h[i];
+	snprintf(h+148, 8, "%06o", sum);
+	return aw_write(aw, h, TAR_BLOCK);
 }
 
+int tar_add_fd ( archive_writer *aw, const char *name, int fd, struct stat *st ) /* aggiunge all'archivio il file [name], con gli attributi > */
+{                                        /* > [st], leggendolo da [fd] dall'inizio (e poi lo chiude): 1-ok, 0-errore del codec o della destinazione, -1-file illeggibile */
+	char buf[CHUNK_SIZE];
+	uint64_t left;
+	if ( ! tar_header(aw, name, '0', st->st_size, st) ) {
+		close(fd);
+		return 0;
+	}
+	for (left=st->st_size; left>0; ) {                       // contenuto del file, a blocchi, senza mai tenerlo tutto in memoria
+		ssize_t n = pread(fd, buf, (left > CHUNK_SIZE) ? CHUNK_SIZE : left, st->st_size-left); // (pread: il descrittore di un memfd è un dup, >
+		                                                   // > con la posizione in comune con gli altri lettori dello stesso file)
+		if (n<=0) {
+			close(fd);
+			return -1;           // il file si è accorciato: l'archivio non sarebbe coerente con l'header
+		}
+		if ( ! aw_write(aw, buf, n) ) {
+			close(fd);
+			return 0;
+		}
+		left -= n;
+	}
+	close(fd);
+	if (st->st_size % TAR_BLOCK) {                         // padding fino al blocco da 512 byte
+		memset(buf, 0, TAR_BLOCK);
+		return aw_write(aw, buf, TAR_BLOCK - st->st_size % TAR_BLOCK);
+	}
+	return 1;
+}
 
-// funzioni (2) sui socket: 1-ok, 0-errore [uguali per client e server]
-   /* quando c'è una dall'altra parte della connessione c'è l'altra: esse fanno tx dimensione dati-> rx dimensione dati -> tx dati -> rx dati */
-int SendData ( int sock, const void *data, size_t dim )  /* invio la quantita' [dim] di dati puntati da [data] a [sock] */
-{ 
-    int total = 0, rc, n, bytesleft = dim;
-    rc = send( sock, &dim, sizeof(int), 0 ); // invio al ricevente la dimensione totale dai dati da inviare
-    if ( (rc==-1) || (rc<sizeof(int)) )
-		return 0;
-    while( total < dim ) { 				  // invio finche' non ho spedito tutti i dati
-        n = send( sock, data+total, bytesleft, 0 );
-        if (n == -1) 
-	       	break;    
-        total += n;     				 // aggiornamento sui dati inviati e rimanenti
-        bytesleft -= n; 
-    }				
-    return (n==-1)?0:1;  				 // errore su una send: esco 
-} 
+int tar_add_file ( archive_writer *aw, workspace *ws, int i ) /* aggiunge all'archivio il file [i] dell'area di lavoro [ws] (in memoria o > */
+{                                                             /* > su disco): 1-ok, 0-errore del codec o della destinazione, -1-file illeggibile */
+	struct stat st;
+	int fd;
+	if ( ! ws_stat(ws, &ws->files, i, &st) )
+		return -1;
+	fd = ws_reader(ws, &ws->files, i);
+	if (fd==-1)
+		return -1;
+	return tar_add_fd(aw, ws->files.v[i].name, fd, &st);
+}
 
-int ReceiveData ( int sock, void *data, int *len ) /* ricevo da [sock] mettendo dove punta [data]; ne scrivo la quantita' dove punta [len], se non è NULL */
-{												
-    int total = 0, rc, n, dim, bytesleft; 
-    rc = recv( sock, &dim, sizeof(int), MSG_WAITALL ); // ricevo la dimensione dei dati che saranno spediti
-    if ( (rc==-1) || (rc<sizeof(int)) )     
-	 	return 0;
-    bytesleft = dim;
-    while( total < dim ) {  			      	// ricevo finche' non ho avuto tutti i dati
-        n = recv( sock, data+total, bytesleft, 0 );
-        if (n == -1) 
-		 		break;
-        total += n;      			         // aggiornamento sui dati ricevuti e ancora da ricevere
-        bytesleft -= n; 
-    }
-    if (len!=NULL)       			         // in molti casi il ricevente sa di certo quanti dati arrivano e quindi mette NULL a [3°arg]
-		*len=dim;
-    return (n==-1)?0:1; 				        // esito della funzione (1->ok, 0->no)
-} 
+int tar_finish ( archive_writer *aw ) /* due blocchi a zero di fine archivio e padding al record da 10240 byte (come tar) */
+{
+	char zero[TAR_BLOCK];
+	memset(zero, 0, TAR_BLOCK);
+	do {
+		if ( ! aw_write(aw, zero, TAR_BLOCK) )
+			return 0;
+	} while ( aw->in_bytes % TAR_RECORD != 0 );
+	return 1;
+}
+
+int build_archive ( archive_writer *aw, workspace *ws ) /* archivia (tar) e comprime tutti i file dell'area di lavoro [ws], in ordine > */
+{                                                       /* > alfabetico: 1-ok, 0-errore della destinazione o del codec, -1-file illeggibile */
+	int i, rc = 1;
+	for (i=0; i<ws->files.n && rc==1; i++)
+		rc = tar_add_file(aw, ws, i);
+	if (rc==1)
+		rc = tar_finish(aw);
+	return rc;
+}
+
+int socket_sink ( void *ctx, const void *buf, size_t len ) /* destinazione dei byte compressi: frame SendData di al più CHUNK_SIZE byte verso il client */
+{
+	const char *p = buf;
+	while (len>0) {                      // i blocchi della compressione parallela possono superare CHUNK_SIZE, il buffer del client
+		size_t n = (len > CHUNK_SIZE) ? CHUNK_SIZE : len;
+		if ( ! SendFrame(*(int*)ctx, p, n, 1) ) // MSG_MORE: i frame si accorpano in segmenti pieni, li svuota il frame dell'esito
+			return 0;
+		p += n;
+		len -= n;
+	}
+	return 1;
+}
+
+void compress_job_run ( void *arg ) /* lavoro dello scheduler per la compress: tar e compressione dei file della sessione, chiusura del codec */
+{
+	compress_job *j = arg;
+	j->rc = build_archive(j->aw, j->ws);
+	if ( ! aw_close(j->aw, j->rc==1) && j->rc==1 )  // chiusura dello stream compresso (trailer del codec)
+		j->rc = 0;
+}
 
 
-// funzioni (4) su semafori, thread e variabili globali (condivise)
+// funzioni (4) per la scelta automatica del compressore (configure-compressor auto): campioni, entropia, prove di compressione
 
-void create_pool ( int *taskids[], pthread_t *threads, void *(*thread_code)(void *) )  /* il ListenerThread crea un POOL_DIMENSION ServerThreads */
-{                                                      /* I Poolthread sono puntati da [threads], identificati da [taskids) e  eseguono [thread_code] */
-	int t;	      // conterra' i progressivi [0,1..] PoolID dei vari ServerThread del Pool
-	ReadyThreads=0; // ancora non ci sono Threads del pool, dunque 0 sono pronti (è incrementato nelle azioni iniziali dei thread appena creati)        
-	pthread_cond_init(&PoolSleep, NULL);   // inizializzazione dei semafori
-	pthread_cond_init(&PoolBusy, NULL);
-	pthread_cond_init(&PoolReady, NULL);
-	pthread_cond_init(&ClientAssigned, NULL);       
-	in_service=0;                         // inizialmente non ci sono ServerThread del pool che sono pronti a servire un client 
-	for (t=0; t<POOL_DIMENSION;t++){   // ATTENZIONE: stiamo assegnando a ciascuno thread un PoolID [da 0 a (POOL_DIMENSION-1)]    
-	    taskids[t] = (int *) malloc(sizeof(int)); // Intero assegnato a ogni ServerThread (lo decide ListenerThread creandolo) ma NON è il suo TID
-	    *taskids[t] = t;
-	    if (pthread_create(&threads[t], NULL, thread_code, (void *) taskids[t])<0) { //creazione singolo thread del pool
-		     char *sret = malloc(30);
-		     fprintf (stderr, REDf"Errore di creazione del thread %d."RST"\n", t);
-		     strcpy(sret,"Pool thread creation error");		
-		     pthread_exit((void*)sret);     	//se fallisce la creazione d'un solo thread ServerThread termina e riporta l'errore (join del main)
-	    } 	
+uint64_t auto_sample ( workspace *ws, unsigned char *buf, size_t *len ) /* mette in [buf] AUTO_SAMPLES campioni di AUTO_SAMPLE_SIZE byte presi > */
+{   /* > a intervalli regolari dai file di [ws] in ordine alfabetico (tutti i file, se ci stanno), in [len] i byte letti; restituisce i byte dei file */
+	struct stat st;
+	uint64_t total = 0, *size, pos, start;
+	size_t want;
+	ssize_t got;
+	int n = ws->files.n, i, k, samples, fd;
+	*len = 0;
+	if (n==0)
+		return 0;
+	size = malloc(n*sizeof(uint64_t));
+	if (size==NULL)
+		return 0;
+	for (i=0; i<n; i++) {
+		size[i] = ws_stat(ws, &ws->files, i, &st) ? st.st_size : 0;
+		total += size[i];
 	}
-	pthread_mutex_lock(&mutex);
-	while (ReadyThreads<POOL_DIMENSION)             // attendo che tutti i ServerThread si siano bloccati in attesa di un cliente >
-		pthread_cond_wait(&PoolReady, &mutex);  // > (mi sveglia l'ultimo che diventa pronto con la Signal nel suo codice)
-	pthread_mutex_unlock(&mutex);
+	samples = (total <= AUTO_SAMPLES*AUTO_SAMPLE_SIZE) ? 1 : AUTO_SAMPLES;  // pochi dati: un unico campione con tutto
+	for (k=0; k<samples; k++) {
+		pos = (samples==1) ? 0 : total/samples*k;
+		want = (samples==1) ? (size_t)total : AUTO_SAMPLE_SIZE;
+		for (i=0, start=0; i<n && want>0; start += size[i], i++) {  // un campione può proseguire nel file successivo
+			if (pos >= start+size[i])
+				continue;
+			got = 0;
+			if ( (fd = ws_reader(ws, &ws->files, i))>=0 ) {
+				got = pread(fd, buf+*len, (start+size[i]-pos < want) ? (size_t)(start+size[i]-pos) : want, pos-start);
+				close(fd);
+			}
+			if (got<=0)
+				break;                // file illeggibile: il campione resta più corto
+			*len += got;
+			want -= got;
+			pos += got;
+		}
+	}
+	free(size);
+	return total;
+}
+
+double byte_entropy ( const unsigned char *buf, size_t len ) /* entropia di ordine 0 dei [len] byte di [buf], in bit per byte (8: casuali) */
+{
+	size_t count[256] = {0}, i;
+	double h = 0, f;
+	for (i=0; i<len; i++)
+		count[buf[i]]++;
+	for (i=0; i<256; i++)
+		if (count[i]>0) {
+			f = (double)count[i]/len;
+			h -= f*log2(f);
+		}
+	return h;
 }
 
-void assign_client ( struct sockaddr_in c_addr, int c_sock )  /* con essa ListenerThread sveglia 1 ServerThread del pool (in attesa su PoolBusy)  >   */
-{	                                                      /* > e gli passa IP:PORT del client [c_addr] e socket connesso ad esso[c_sock])         */
-	pthread_mutex_lock(&mutex);            // il client che il Listener (chiamante) sta servendo è in attesa del suo ServerThread (da prendere dal pool)
-	while (in_service==POOL_DIMENSION)       // controllo il numero di thread occupati e se lo sono tutti mi blocco in attesa che uno si liberi 
-		pthread_cond_wait(&PoolBusy, &mutex); // attende bloccato che si liberi un PoolThread (lo Segnala la ciclica wait&start)       
-	assignedFlag=0; 
-	c_sockaddr_array=c_addr; // permetto al thread del pool, che sveglierò dopo, di vedere IP#port del client che servirà [info senza utilità pratica] 
-	c_sock_array=c_sock;   	 // permetto al thread del pool, che sveglierò dopo, di vedere il conn. socket locale per comunicare col client che servirà 
-	pthread_cond_signal(&PoolSleep); // sveglio un singolo PoolThread (random), cui verrà assegnato il client; era in attesa sulla wait&start   
-	while (assignedFlag==0)  // Listener attende che il ServerPoolThread svegliato abbia preso in consegna il client (lo segnale settando assignedFlag)
-		pthread_cond_wait(&ClientAssigned, &mutex); 
-	pthread_mutex_unlock(&mutex); 
+int null_sink ( void *ctx, const void *buf, size_t len ) { return 1; } // destinazione delle prove di compressione: conta solo i byte (out_bytes)
+
+void auto_choose ( void *arg ) /* lavoro dello scheduler: prova le coppie di auto_candidates sui campioni dei file di [ws] e sceglie > */
+{   /* > quella che rispetta l'obiettivo di [p] (il rapporto migliore entro il tempo, o la più veloce che raggiunge il rapporto; se nessuna > */
+    /* > lo rispetta, la più vicina). Tempi e rapporti previsti sono quelli dei campioni, estesi all'intero archivio */
+	auto_pick *a = arg;
+	unsigned char *buf = malloc(AUTO_SAMPLES*AUTO_SAMPLE_SIZE);
+	double ratio[AUTO_CANDIDATES], secs[AUTO_CANDIDATES];
+	struct timespec t0, t1;
+	archive_writer aw;
+	size_t len = 0;
+	int i, c, ok, met = -1, any = -1, speedup;
+	a->compressor_index = -1;
+	a->total = (buf!=NULL) ? auto_sample(a->ws, buf, &len) : 0;
+	a->entropy = byte_entropy(buf, len);
+	for (i=0; i<AUTO_CANDIDATES; i++) {
+		ratio[i] = 0;            // coppia non provata
+		if ( len==0 || (a->entropy>AUTO_ENTROPY_MAX && i>0) )
+			continue;            // dati già compressi: nessun codec li riduce, conta solo la velocità (la prima coppia, la più veloce)
+		c = auto_candidates[i][0];
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		if ( ! aw_open(&aw, c, 1, auto_candidates[i][1], null_sink, NULL) )
+			continue;
+		ok = aw_write(&aw, buf, len);
+		ok = aw_close(&aw, ok);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		if (!ok || aw.out_bytes==0)
+			continue;
+		speedup = 1;             // in parallelo: a blocchi sullo scheduler, o con i thread di zstd
+		if ( a->p->threads>1 && (codecs[c].block!=NULL || codecs[c].init==zst_init) )
+			speedup = (a->p->threads < sched.nworkers) ? a->p->threads : sched.nworkers;
+		ratio[i] = (double)len/aw.out_bytes;
+		secs[i] = ( (t1.tv_sec-t0.tv_sec) + (t1.tv_nsec-t0.tv_nsec)/1e9 ) / len * a->total / speedup;
+		if ( (a->p->auto_mode==AUTO_TIME) ? secs[i]<=a->p->auto_target : ratio[i]>=a->p->auto_target ) { // rispetta l'obiettivo
+			if ( met<0 || ( (a->p->auto_mode==AUTO_TIME)
+			                ? ratio[i]>ratio[met]*(1+AUTO_RATIO_SLACK) || (ratio[i]>=ratio[met]*(1-AUTO_RATIO_SLACK) && secs[i]<secs[met])
+			                : secs[i]<secs[met] ) )
+				met = i;
+		}
+		if ( any<0 || ( (a->p->auto_mode==AUTO_TIME) ? secs[i]<secs[any] : ratio[i]>ratio[any] ) ) // la più vicina all'obiettivo
+			any = i;
+	}
+	free(buf);
+	i = (met>=0) ? met : any;
+	if (i>=0) {
+		a->compressor_index = auto_candidates[i][0];
+		a->level = auto_candidates[i][1];
+		a->ratio = ratio[i];
+		a->seconds = secs[i];
+	}
 }
- 
-void wait_and_start( int* sock, struct sockaddr_in *addr, int id ) /* il ServerThread [id]-esimo del pool attende la sveglia e poi memorizza > */
-{                                                               /* >  i parametri del client (IPa+PORTn[addr] e sd per parlarci[sock])      */
-	pthread_mutex_lock(&mutex);
-	if ( in_service==(POOL_DIMENSION-1) ) {    // ramo eseguito solo se dopo aver finito di servire un client il thread e' l'unico libero
-		pthread_cond_signal(&PoolBusy);        // se  ListenerThread attendeva che un ServerThread si liberasse per assegnargli un client lo sveglio
-	}
-	while ( (assignedFlag==1) && (closing==0) ) // l'attesa finisce quando mi vogliono assegnare un client o quando SIGINT attiva la chiusura del server
-		pthread_cond_wait(&PoolSleep, &mutex); // aspetto che ListenerThread mi svegli (mi assegna una richiesta) - la wait libera da se' il mutex
-	if (closing==0) {         //ASSEGNAMENTO DEL CLIENT AL THREAD          
-		*sock = c_sock_array;        		   // memorizzo localmente al thread il connected socket da usare e i dati sul client da servire
-		*addr= c_sockaddr_array; 
-		in_service++;
-		printf(REDf"CLIENT "RST"%s"REDf" connesso.", inet_ntoa(addr->sin_addr));
-		if (in_service==POOL_DIMENSION)		
-			printf(" [servito dal thread "RST"%d"REDf": "YELf"tutti i %d thread sono occupati"REDf"]"RST"\n", id, POOL_DIMENSION);
+
+
+// funzioni (8) per la compressione anticipata (--eager): l'archivio della sessione si costruisce mentre arrivano i file, la compress lo chiude soltanto
+
+int eager_sink ( void *ctx, const void *buf, size_t len ) /* destinazione dei byte compressi dell'archivio anticipato: il suo file temporaneo > */
+{                                                         /* > nella cache (0 se l'archivio è stato scartato: il codec si ferma subito) */
+	eager_archive *e = ctx;
+	return !atomic_load(&e->cancel) && fwrite(buf, 1, len, e->fp)==len;
+}
+
+void eager_run ( void *arg ) /* lavoro dello scheduler: archivia e comprime i file in coda, nell'ordine d'arrivo, finché ce ne sono */
+{
+	eager_archive *e = arg;
+	eager_file f;
+	uint64_t t;
+	pthread_mutex_lock(&e->m);
+	while (e->nq>0) {
+		f = e->q[e->head];
+		e->head = (e->head+1) % EAGER_QUEUE;
+		e->nq--;
+		pthread_cond_broadcast(&e->c);        // c'è di nuovo posto nella coda
+		pthread_mutex_unlock(&e->m);
+		t = mono_us();
+		if (e->rc==1 && !atomic_load(&e->cancel))
+			e->rc = tar_add_fd(&e->aw, f.name, f.fd, &f.st);
 		else
-			printf(" [servito dal thread "RST"%d"REDf": "YELf"%d"REDf"/%d liberi]"RST"\n", id, (POOL_DIMENSION-in_service), POOL_DIMENSION);
-		assignedFlag=1;			         // settando questo flag segnalo al Listener (che dopo sveglio) d'aver preso in consegna il client
-		pthread_cond_signal(&ClientAssigned);    //sveglio il ListenerThread in attesa che questo thread abbia preso in consegna il client
-	}       //se il risveglio  è quello collettivo dovuto alla chiusura totale (via SIGINT) non faccio nulla (non ci sono client da servire)
-	pthread_mutex_unlock(&mutex);
+			close(f.fd);                      // archivio già fallito o scartato: i file rimasti si lasciano andare
+		e->us += mono_us()-t;
+		free(f.name);
+		pthread_mutex_lock(&e->m);
+	}
+	e->running = 0;
+	pthread_cond_broadcast(&e->c);
+	pthread_mutex_unlock(&e->m);
 }
 
-void ListenerSock_and_Sem_Destroy( int list_sock )  /* il ListenerThread elimina tutti i semafori e chiude il socket di ascolto [list_sock] */
+void eager_wait ( eager_archive *e ) /* attende che il lavoro dell'archivio anticipato [e] abbia svuotato la coda e sia terminato */
 {
-	pthread_mutex_destroy(&mutex);        // distruzione dei semafori 
-	pthread_cond_destroy(&PoolSleep);
-	pthread_cond_destroy(&PoolBusy);
-	pthread_cond_destroy(&PoolReady);
-	pthread_cond_destroy(&ClientAssigned); 
-	if (close(list_sock)<0)    	     // chiusura del listening socket
-		perror("close");
+	pthread_mutex_lock(&e->m);
+	while (e->running)
+		pthread_cond_wait(&e->c, &e->m);
+	pthread_mutex_unlock(&e->m);
+	if (e->submitted)
+		sched_wait(&e->task);
+}
+
+void eager_free ( eager_archive *e ) /* ferma il lavoro dell'archivio anticipato [e], ne cancella il file temporaneo e lo libera */
+{
+	atomic_store(&e->cancel, 1);
+	eager_wait(e);
+	if (e->fp!=NULL) {
+		aw_close(&e->aw, 0);
+		fclose(e->fp);
+	}
+	remove(e->tmp);                  // (non c'è più se è entrato in cache)
+	pthread_mutex_destroy(&e->m);
+	pthread_cond_destroy(&e->c);
+	free(e);
+}
+
+void eager_drop ( workspace *ws ) /* scarta l'archivio anticipato di [ws], se c'è (file tolti, parametri cambiati, archivio servito dalla cache) */
+{
+	eager_archive *e = ws->eager;
+	if (e==NULL)
+		return;
+	ws->eager = NULL;
+	eager_free(e);
+}
+
+void eager_prepare ( workspace *ws, const comp_param *p, int SessionID ) /* (prima di ogni send della sessione [SessionID]) scarta l'archivio > */
+{  /* > anticipato di [ws] se i parametri [p] non sono più quelli con cui è stato preparato; con l'area di lavoro vuota (l'archivio deve avere > */
+   /* > tutti i file) e un compressore fisso ne prepara uno nuovo, che si apre al primo file ricevuto */
+	eager_archive *e = ws->eager;
+	if ( e!=NULL && (p->auto_mode!=AUTO_NONE || e->compressor_index!=p->compressor_index || e->level!=p->level || e->threads!=p->threads) )
+		eager_drop(ws);
+	if (!eager_mode || ws->eager!=NULL || ws->files.n>0 || p->auto_mode!=AUTO_NONE || (e = calloc(1, sizeof(eager_archive)))==NULL)
+		return;
+	e->compressor_index = p->compressor_index;
+	e->level = p->level;
+	e->threads = p->threads;
+	e->rc = 1;
+	pthread_mutex_init(&e->m, NULL);
+	pthread_cond_init(&e->c, NULL);
+	sprintf(e->tmp, "./%s/tmpe%d", ARCHIVE_CACHE_DIR, SessionID); // "tmp..": come gli archivi in costruzione, ignorato da cache_evict
+	ws->eager = e;
+}
+
+void eager_feed ( workspace *ws, const char *name ) /* il file [name] è appena entrato tra quelli della sessione: lo accoda all'archivio > */
+{  /* > anticipato di [ws] (se c'è) e riaffida allo scheduler il lavoro che lo svuota, se era fermo. Con la coda piena attende un posto libero: > */
+   /* > la compressione non tiene il passo della rete. Se il file non si può accodare l'archivio, incompleto, si scarta */
+	eager_archive *e = ws->eager;
+	eager_file f;
+	int i, go;
+	if (e==NULL)
+		return;
+	if (e->fp==NULL) {               // primo file: si apre l'archivio
+		if ( (e->fp = fopen(e->tmp, "wb"))!=NULL && !aw_open(&e->aw, e->compressor_index, e->threads, e->level, eager_sink, e) ) {
+			fclose(e->fp);
+			e->fp = NULL;
+		}
+		if (e->fp==NULL) {
+			eager_drop(ws);
+			return;
+		}
+	}
+	f.name = strdup(name);
+	f.fd = ( (i = ws_find(&ws->files, name))>=0 && ws_stat(ws, &ws->files, i, &f.st) ) ? ws_reader(ws, &ws->files, i) : -1;
+	if (f.name==NULL || f.fd<0) {
+		free(f.name);
+		if (f.fd>=0)
+			close(f.fd);
+		eager_drop(ws);
+		return;
+	}
+	pthread_mutex_lock(&e->m);
+	while (e->nq==EAGER_QUEUE)
+		pthread_cond_wait(&e->c, &e->m);
+	e->q[(e->head+e->nq) % EAGER_QUEUE] = f;
+	e->nq++;
+	e->files++;
+	go = !e->running;
+	e->running = 1;
+	pthread_mutex_unlock(&e->m);
+	if (go) {
+		if (e->submitted)
+			sched_wait(&e->task);        // il lavoro precedente ha appena svuotato la coda: lo si lascia chiudere prima di riaffidarlo
+		sched_submit(&e->task, eager_run, e, 1);
+		e->submitted = 1;
+	}
+}
+
+eager_archive *eager_finish ( workspace *ws, const comp_param *p, int *fd, uint64_t *size ) /* (compress) chiude l'archivio anticipato > */
+{  /* > di [ws], se ha tutti i file della sessione compressi con i parametri [p]: attende che la coda si svuoti, poi fine del tar e trailer > */
+   /* > del codec. L'archivio chiuso esce comunque da [ws] (le send successive non devono riaprirlo con i soli file nuovi): se pronto lo si > */
+   /* > restituisce, con il file [tmp] aperto in lettura come [fd], di [size] byte, e chi lo riceve lo libera con eager_free; NULL-nessun > */
+   /* > archivio utilizzabile (scartato) */
+	eager_archive *e = ws->eager;
+	struct stat st;
+	uint64_t t;
+	int ok;
+	if (e==NULL)
+		return NULL;
+	if ( e->fp==NULL || p->auto_mode!=AUTO_NONE || e->compressor_index!=p->compressor_index || e->level!=p->level || e->threads!=p->threads ) {
+		eager_drop(ws);
+		return NULL;
+	}
+	ws->eager = NULL;
+	eager_wait(e);
+	t = mono_us();
+	ok = (e->rc==1 && e->files==ws->files.n && tar_finish(&e->aw)); // (un file entrato senza passare dalla coda: l'archivio non è completo)
+	ok = aw_close(&e->aw, ok) && ok;
+	e->us += mono_us()-t;
+	ok = (fclose(e->fp)==0) && ok;
+	e->fp = NULL;
+	if (ok && (*fd = open(e->tmp, O_RDONLY|O_CLOEXEC))>=0) { // (resta valido anche quando il file entra in cache con cache_commit)
+		if (fstat(*fd, &st)==0) {
+			*size = st.st_size;
+			return e;
+		}
+		close(*fd);
+	}
+	eager_free(e);
+	return NULL;
+}
+
+
+// funzioni (8) sulle impronte dei file ricevuti e sulla cache degli archivi compressi (su disco, LRU, entro ARCHIVE_CACHE_BUDGET byte)
+
+int hash_prefix ( int fd, uint64_t len, xxh64_state *h ) /* aggiunge all'impronta [h] i primi [len] byte letti da [fd] (UINT64_MAX: fino alla > */
+{                                                        /* > fine): 1-ok, 0-errore o file più corto di [len] */
+	char buf[CHUNK_SIZE];
+	uint64_t done = 0;
+	ssize_t r;
+	while (done < len && (r = read(fd, buf, (len-done > sizeof(buf)) ? sizeof(buf) : (size_t)(len-done))) != 0) {
+		if (r<0) {
+			if (errno==EINTR)
+				continue;
+			return 0;
+		}
+		xxh64_update(h, buf, r);
+		done += r;
+	}
+	return done==len || len==UINT64_MAX;
+}
+
+int archive_key ( workspace *ws, int compressor_index, int level, uint64_t *key ) /* calcola in [key] la chiave dell'archivio dei file di > */
+{        /* > [ws] col compressore [compressor_index] al livello [level]: impronta del codec, del livello effettivo e dell'elenco ordinato > */
+         /* > (nome, dimensione, impronta del contenuto e, per i file di una cartella, permessi e data che finiscono nell'header tar). > */
+         /* > 1-ok, 0-file illeggibile */
+	int codec[2] = { compressor_index, codec_level(compressor_index, level) };
+	xxh64_state k, f;
+	uint64_t v[4];
+	struct stat st;
+	int i, fd;
+	xxh64_init(&k);
+	xxh64_update(&k, codec, sizeof(codec));
+	for (i=0; i<ws->files.n; i++) {   // stesso ordine di build_archive
+		fd = ws_reader(ws, &ws->files, i);
+		xxh64_init(&f);
+		if ( fd<0 || ! hash_prefix(fd, UINT64_MAX, &f) || (ws->files.v[i].meta && ! ws_stat(ws, &ws->files, i, &st)) ) {
+			if (fd>=0)
+				close(fd);
+			*key = 0;
+			return 0;
+		}
+		close(fd);
+		v[0] = f.total;
+		v[1] = xxh64_digest(&f);
+		v[2] = ws->files.v[i].meta ? (uint64_t)(st.st_mode & 07777) : 0;  // (gli altri file hanno la data d'arrivo sul server: ..
+		v[3] = ws->files.v[i].meta ? (uint64_t)st.st_mtime : 0;           // .. nella chiave, nessuna sessione ritroverebbe l'archivio)
+		xxh64_update(&k, ws->files.v[i].name, strlen(ws->files.v[i].name)+1); // il NUL separa il nome dal resto
+		xxh64_update(&k, v, sizeof(v));
+	}
+	*key = xxh64_digest(&k);
+	return 1;
+}
+
+int cache_lookup ( uint64_t key, int *fd, uint64_t *size ) /* cerca in cache l'archivio [key]: se c'è (1) ne restituisce descrittore e > */
+{                                                           /* > dimensione e lo segna come appena usato (mtime, ordine LRU); 0 altrimenti */
+	char path[64];
+	struct stat st;
+	sprintf(path, "./%s/%016llx", ARCHIVE_CACHE_DIR, (unsigned long long)key);
+	*fd = open(path, O_RDONLY);
+	if (*fd<0)
+		return 0;
+	if (fstat(*fd, &st)!=0) {
+		close(*fd);
+		return 0;
+	}
+	futimens(*fd, NULL);             // un'eliminazione concorrente non fa danni: il descrittore aperto resta valido
+	*size = st.st_size;
+	return 1;
+}
+
+int cache_tee_sink ( void *ctx, const void *buf, size_t len ) /* destinazione dei byte compressi: socket del client (come socket_sink) e copia > */
+{   /* > per la cache; un errore sulla copia la abbandona senza fermare l'invio, la caduta del client non ferma la copia: 0 se sono fallite entrambe */
+	cache_tee *t = ctx;
+	if ( t->fp!=NULL && fwrite(buf, 1, len, t->fp)!=len ) {
+		fclose(t->fp);
+		t->fp = NULL;
+	}
+	if (t->sock_ok && !socket_sink(t->sock, buf, len))
+		t->sock_ok = 0;
+	return t->sock_ok || t->fp!=NULL;
 }
 
+int cache_mtime_cmp ( const void *a, const void *b ) /* per qsort: archivi della cache dal meno recente */
+{
+	const cache_entry *x = a, *y = b;
+	if (x->used.tv_sec!=y->used.tv_sec)
+		return (x->used.tv_sec < y->used.tv_sec) ? -1 : 1;
+	return (x->used.tv_nsec < y->used.tv_nsec) ? -1 : (x->used.tv_nsec > y->used.tv_nsec);
+}
+
+void cache_evict ( void ) /* elimina gli archivi usati meno di recente finché la cache non rientra in ARCHIVE_CACHE_BUDGET byte */
+{
+	struct dirent **names;
+	char path[300];
+	struct stat st;
+	cache_entry *e;
+	uint64_t total = 0;
+	int n, i, m = 0;
+	pthread_mutex_lock(&cache_lock);
+	n = scandir(ARCHIVE_CACHE_DIR, &names, workspace_filter, NULL);
+	if (n<0) {
+		pthread_mutex_unlock(&cache_lock);
+		return;
+	}
+	e = malloc((n+1)*sizeof(cache_entry));
+	for (i=0; i<n; i++) {
+		if (e!=NULL && strncmp(names[i]->d_name, "tmp", 3)!=0) { // i file temporanei (archivi in costruzione) non si toccano
+			sprintf(path, "./%s/%s", ARCHIVE_CACHE_DIR, names[i]->d_name);
+			if (stat(path, &st)==0) {
+				e[m].key = strtoull(names[i]->d_name, NULL, 16);
+				e[m].size = st.st_size;
+				e[m].used = st.st_mtim;
+				total += st.st_size;
+				m++;
+			}
+		}
+		free(names[i]);
+	}
+	free(names);
+	if (e!=NULL) {
+		qsort(e, m, sizeof(cache_entry), cache_mtime_cmp);
+		for (i=0; i<m && total>ARCHIVE_CACHE_BUDGET; i++) {
+			sprintf(path, "./%s/%016llx", ARCHIVE_CACHE_DIR, (unsigned long long)e[i].key);
+			if (unlink(path)==0)
+				total -= e[i].size;
+		}
+		free(e);
+	}
+	pthread_mutex_unlock(&cache_lock);
+}
 
-// funzioni (1) per la compressione
+int cache_commit ( const char *tmp, uint64_t key ) /* il file [tmp], completo, diventa l'archivio [key] della cache; poi applica il budget > */
+{                                                   /* > (un archivio più grande dell'intero budget non viene tenuto): 1-ok, 0-errore */
+	char path[64];
+	int fd;
+	sprintf(path, "./%s/%016llx", ARCHIVE_CACHE_DIR, (unsigned long long)key);
+	if (fsync_policy!=FSYNC_NONE && (fd = open(tmp, O_RDONLY|O_CLOEXEC))>=0) { // (--fsync) l'archivio è su disco prima di entrare in cache
+		fdatasync(fd);
+		close(fd);
+	}
+	if (rename(tmp, path)!=0) {      // rename atomica: chi cerca la stessa chiave vede l'archivio intero o niente
+		remove(tmp);
+		return 0;
+	}
+	if (fsync_policy==FSYNC_FULL)
+		sync_dir(ARCHIVE_CACHE_DIR);
+	cache_evict();
+	return 1;
+}
 
-char* tar_cmd (comp_param p, int PoolID) /* crea il comando di compressione con parametri [p] dei files nella cartella locale del Thread [PoolID]-esimo */
+void cache_clean ( void ) /* (all'avvio) cancella dalla cache gli archivi rimasti a metà (file "tmp..") da un'esecuzione precedente */
 {
-	int i = p.compressor_index;              // indice dell'algoritmo da usare
-	char* s = malloc( (MAX_MSG_LEN+50)*sizeof(char) );
-	sprintf(s, "cd %s/%s%d && tar -c", POOL_ROOT_DIR, POOL_FOLDER_PREFIX, PoolID); // entro nella cartella personale e inizio il comando  tar
-	strcat(s,compressors_matrix[i][2]);  // opzione compressore da usare (e.g. "z" se uso bzip2)
-	strcat(s,"f \"");                    // opzione file
-	strcat(s,p.archive_name);            // nome archivio (tutto tra virgolette)
-	strcat(s,".tar.");             	      // prima parte estensione archivio (uguale per tutti)
-	strcat(s, compressors_matrix[i][1]); // estensione relativa al compressore (e.g. "xz" se uso xz")
-	strcat(s, "\" * && cd .. && cd .."); // comprimo tutti i file (nella cartella locale); infine torno alla directory dove gira il processo
-	return s;     //comando completo pronto per la system()
+	DIR *d = opendir(ARCHIVE_CACHE_DIR);
+	struct dirent *de;
+	if (d==NULL)
+		return;
+	while ( (de = readdir(d))!=NULL )
+		if (strncmp(de->d_name, "tmp", 3)==0)
+			unlinkat(dirfd(d), de->d_name, 0);
+	closedir(d);
 }
 
 
@@ -327,7 +3531,7 @@ int match_regex (regex_t *r,  char *to_match, list *li) /* trova i path con rege
 }
 
 
-// funzioni (5) sulle stringhe che contengono i comandi e i loro parametri
+// funzioni (6) sulle stringhe che contengono i comandi e i loro parametri
 
 void getpar ( char *cmdString, int Len ) /* estrapola il parametro da "<comando> [parametri]" [cmdString]; [Len] è la lunghezza del comando più 1, e > */
 {        /* > sostituisce la suddetta stringa con quella formata dai/l parametri/o (sovrascrivendo [cmdString])                     */
@@ -380,8 +3584,23 @@ char *getfilename ( char *path )  /* dato in ingresso il [path] (/../../xxx) di
 	return fn;    // per finire ritorno la stringa che contiene il nome del file da inviare
 }										 
 
+char *getfoldername ( char *path ) /* (protocollo 10) come getfilename, per il [path] di una cartella da inviare: il nome dell'ultima > */
+{                                  /* > cartella (senza "/" finali), o "" per "." e ".." (i suoi file arrivano allora senza prefisso) */
+	int l = strlen(path);
+	char copy[l+1], *fn;
+	strcpy(copy, path);
+	while (l>1 && copy[l-1]=='/')
+		copy[--l] = '\0';
+	fn = getfilename(copy);
+	if (strcmp(fn, ".")==0 || strcmp(fn, "..")==0)
+		fn[0] = '\0';
+	return fn;
+}
+
 int identify_command ( char *word, char *parameter ) /* data la [word] digitata ritorna l'indice assegnato al comando e eventuali parametri [parameter] */
-{ /* Gli indici sono Help:1, Config-compr[]:2, Config-name[]:3, Show-config:4, Send[]:5, Compr[]:6, Show-list:7, Empty-list:8, Quit:9; O ALTRIMENTI  */   
+{ /* Gli indici sono Help:1, Config-compr[]:2, Config-name[]:3, Show-config:4, Send[]:5, Compr[]:6, Show-list:7, Empty-list:8, Quit:9, Config-threads[]:10, > */
+   /* > Protocol[]:11 (inviato dal client alla connessione, non digitato), Config-level[]:12, Stats:13, Attach[]:14 (primo comando di una > */
+   /* > connessione dati, non digitato); O ALTRIMENTI  */   
 	int l, i; 
 	word = trim_side_spaces(word);      // levo gli spazi inutili
 	l = strlen(word);
@@ -396,6 +3615,8 @@ int identify_command ( char *word, char *parameter ) /* data la [word] digitata
 			return 9;
 		return 0;
 	} 
+	if (strcmp(word, "stats")==0)
+		return 13;
 	if (strncmp(word, "send ",5)==0) {
 		strcpy(parameter,word);
 		getpar(parameter, 5);   // tale funzione sostituirà la stringa con comando e parametro con il solo parametro
@@ -410,11 +3631,31 @@ int identify_command ( char *word, char *parameter ) /* data la [word] digitata
 		return 7;
 	if (strncmp(word, "empty-list",10)==0) 
 		return 8;
+	if (strncmp(word, "protocol ",9)==0) {
+		strcpy(parameter,word);
+		getpar(parameter, 9);
+		return 11;
+	}
+	if (strncmp(word, "attach ",7)==0) {
+		strcpy(parameter,word);
+		getpar(parameter, 7);
+		return 14;
+	}
 	if (strncmp(word, "configure-name ",15)==0){ 
 		strcpy(parameter,word);
 		getpar(parameter, 15);
 		return 3;
 	}
+	if (strncmp(word, "configure-threads ",18)==0){ 
+		strcpy(parameter,word);
+		getpar(parameter, 18);
+		return 10;
+	}
+	if (strncmp(word, "configure-level ",16)==0){ 
+		strcpy(parameter,word);
+		getpar(parameter, 16);
+		return 12;
+	}
 	if (l==18){
 		if (strncmp(word, "show-configuration",18)==0) 
 			return 4;
@@ -429,7 +3670,279 @@ int identify_command ( char *word, char *parameter ) /* data la [word] digitata
 }
 
 
-// funzioni (9) invocate dai ServerThread ("sXXX") in risposta alle richieste del client (il 1° argomento è sempre il suo socket [client_socket]); >
+// funzioni (7) sui file in arrivo con una send a lotti: apertura, ricezione a pezzi da più connessioni (protocollo 9), chiusura con l'esito; >
+// > file delle cartelle, in pacchi o da soli (protocollo 10)
+
+void upload_open ( workspace *ws, upload *u, const char *filename, const char *partname, uint64_t size, uint64_t offset, int proto, int pieces ) /* > */
+{  /* > prepara in [u] la ricezione del file [filename] ([size] byte, dal byte [offset]): dal protocollo 4 tra i file a metà, come [partname] (se c'è > */
+   /* > già, la ripresa ne riparte); un nome già presente si riceve scartandolo. Con [pieces] (protocollo 9) l'impronta si calcola alla chiusura */
+	memset(u, 0, sizeof(upload));
+	u->target = &ws->files;
+	u->k = -1;
+	u->active = 1;
+	u->r = 1;
+	u->size = size;
+	u->offset = offset;
+	u->dup = (ws_find(&ws->files, filename)>=0); // già inviato (anche in questo stesso lotto): il contenuto viene ricevuto e scartato
+	xxh64_init(&u->h);
+	if (!u->dup && proto>=4 && size>0) {
+		u->target = &ws->parts;
+		u->k = ws_find(u->target, partname);
+		if (u->k>=0 && offset>0 && !pieces) { // ripresa: l'impronta comprende anche la parte già ricevuta
+			int fd = ws_reader(ws, u->target, u->k);
+			if (fd>=0) {
+				hash_prefix(fd, offset, &u->h);
+				close(fd);
+			}
+		}
+		else if (u->k>=0 && offset==0) {     // parte non riprendibile: si riceve da capo
+			ws_drop(ws, u->target, u->k);
+			u->k = -1;
+		}
+	}
+	u->name = (u->target==&ws->parts) ? partname : filename;
+	if (!u->dup && u->k<0)
+		u->k = ws_create(ws, u->target, u->name, size); // in memoria se c'è posto
+	if (u->k>=0 && (u->fp = ws_writer(ws, u->target, u->k))==NULL)
+		ws_drop(ws, u->target, u->k);
+}
+
+int ReceivePieces ( int *socks, int k, upload *u, int n, uint64_t *wire ) /* (protocollo 9) riceve i contenuti degli [n] file [u] a pezzi, > */
+{   /* > nell'ordine in cui arrivano dalle [k] connessioni [socks] della sessione: ogni pezzo è un frame con intestazione (PIECE_HEADER: file e > */
+    /* > posizione) e blocco (WIRE_*), scritto al suo posto con pwrite. Un pezzo senza blocco abbandona il file (errore di lettura del client), > */
+    /* > un frame vuoto chiude la connessione per questa send. Somma in [wire] i byte arrivati dalla rete. 1-ok, 0-errore sul socket o pezzo non valido */
+    char buf[PIECE_HEADER+1+CHUNK_SIZE], out[CHUNK_SIZE], *data;
+    struct pollfd pfd[k];
+    uint32_t f;
+    uint64_t off, t = 0;
+    int j, len, open = k;
+    for (j=0; j<k; j++) {
+        pfd[j].fd = socks[j];
+        pfd[j].events = POLLIN;
+    }
+    while (open > 0) {
+        if (cur_trace.on)
+            t = mono_us();
+        if (poll(pfd, k, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            return 0;
+        }
+        for (j=0; j<k; j++) {
+            if (pfd[j].fd < 0 || pfd[j].revents == 0)
+                continue;
+            if ( ! ReceiveChunk(pfd[j].fd, buf, sizeof(buf), &len) ) // un pezzo intero: il client invia ogni frame di seguito
+                return 0;
+            if (cur_trace.on) {               // (--trace) attesa dei dati dalla rete
+                cur_trace.us[TRACE_RECV] += mono_us()-t;
+                cur_trace.bytes[TRACE_RECV] += len;
+                t = mono_us();
+            }
+            if (len == 0) {                   // questa connessione ha finito (poll ignora i descrittori negativi)
+                pfd[j].fd = -1;
+                open--;
+                continue;
+            }
+            memcpy(&f, buf, sizeof(f));
+            memcpy(&off, buf+8, sizeof(off));
+            if (len < PIECE_HEADER || f >= (uint32_t)n || !u[f].active)
+                return 0;
+            *wire += len;
+            if (len == PIECE_HEADER) {        // il client non riesce più a leggere il file: i pezzi che restano si scartano
+                u[f].r = -1;
+                continue;
+            }
+            data = buf+PIECE_HEADER+1;
+            len -= PIECE_HEADER+1;
+            if (buf[PIECE_HEADER] == WIRE_LZ4)
+                len = LZ4_decompress_safe(data, out, len, CHUNK_SIZE), data = out;
+            else if (buf[PIECE_HEADER] != WIRE_RAW)
+                len = -1;
+            if (len <= 0 || off < u[f].offset || off+len > u[f].size) // blocco corrotto o fuori dal file: il flusso non è più affidabile
+                return 0;
+            if ( u[f].fp!=NULL && u[f].r==1 && !u[f].werr && pwrite(fileno(u[f].fp), data, len, off)!=len )
+                u[f].werr = 1;                // disco pieno o simili: si continua a ricevere (scartando) per restare allineati col client
+            if (cur_trace.on) {               // (--trace) decompressione LZ4 e scrittura
+                cur_trace.us[TRACE_WRITE] += mono_us()-t;
+                cur_trace.bytes[TRACE_WRITE] += len;
+            }
+            u[f].got += len;
+        }
+    }
+    return 1;
+}
+
+int upload_close ( workspace *ws, upload *u, const char *filename, uint64_t hash, int proto, int pieces, int SessionID, int *counter, char *client_IPaddr ) /* > */
+{ /* > chiude il file [u] ricevuto (a pezzi se [pieces]) e ne dà l'esito per il rapporto della send a lotti (BATCH_..; -1 se il client è caduto): > */
+  /* > un file intero, con l'impronta [hash] verificata se ripreso, passa tra quelli della sessione (e [counter] cresce); con l'impronta verificata > */
+  /* > va anche nello store. Dopo una caduta un file a metà resta, per la ripresa, solo se arrivato in ordine (non a pezzi) */
+	char blobpath[64];
+	int werr = u->werr, fd;
+	u->active = 0;
+	if (pieces && u->r==1 && u->got!=u->size-u->offset) // mancano dei pezzi: il client non ha finito il file
+		u->r = -1;
+	if (pieces && u->fp!=NULL)       // gli altri file del lotto, creati o chiusi dopo questo, ne hanno spostato la posizione
+		u->k = ws_find(u->target, u->name);
+	if (u->fp!=NULL) {
+		werr |= ferror(u->fp);       // distingue l'errore di scrittura dall'invio interrotto dal client (entrambi -1 per ReceiveStream)
+		if (ws_close(ws, u->target, u->k, u->fp)!=0)
+			werr = 1;
+		if (pieces && u->r==1 && !werr && hash!=0 && (fd = ws_reader(ws, u->target, u->k))>=0) { // pezzi in ordine sparso: l'impronta >
+			hash_prefix(fd, u->size, &u->h);                                                       // > si calcola sul file intero
+			close(fd);
+		}
+		if (u->r==1 && !werr && u->offset>0 && xxh64_digest(&u->h)!=hash)
+			u->r = -1;               // la parte ripresa non combacia con quella ricevuta prima (il file è cambiato): da rinviare intero
+		if (u->r==0 && u->target==&ws->parts && !werr && !pieces)
+			;                        // client caduto: la parte ricevuta resta, per riprendere dopo la riconnessione
+		else if (u->r!=1 || werr)
+			ws_drop(ws, u->target, u->k);  // file incompleto (client caduto, invio interrotto o errore di scrittura)
+		else if (u->target==&ws->parts && !ws_move(ws, u->k, filename)) {
+			ws_drop(ws, u->target, u->k);
+			werr = 1;
+		}
+	}
+	if (u->r==0)
+		return -1;
+	if (u->dup)
+		return BATCH_DUPLICATE;
+	if (u->fp==NULL || werr)
+		return BATCH_WRITE_ERROR;
+	if (u->r==-1)
+		return BATCH_READ_ERROR;
+	(*counter)++;
+	log_event(LOG_INFO, "file_received", "s:client", client_IPaddr, "d:session", SessionID, "s:file", filename,
+	          "u:bytes", u->size, "u:resumed_from", u->offset, "d:files", *counter, NULL);
+	if (proto>=3 && u->size>0 && xxh64_digest(&u->h)==hash) { // nello store solo contenuti la cui impronta è verificata
+		sprintf(blobpath, "./%s/%016llx-%llu", BLOB_STORE_DIR, (unsigned long long)hash, (unsigned long long)u->size);
+		ws_store(ws, ws_find(&ws->files, filename), blobpath);
+	}
+	eager_feed(ws, filename);         // (--eager) nell'archivio subito, mentre arrivano gli altri
+	return BATCH_SENT;
+}
+
+
+int tree_entry ( const char *p, size_t avail, int body, const char *root, char *name, uint32_t *plen, uint32_t *mode, uint64_t *size, int64_t *mtime ) /* > */
+{  /* > (protocollo 10) legge l'intestazione (PACK_ENTRY) e il percorso del file di una cartella che iniziano in [p], dove restano [avail] byte > */
+   /* > (con [body] anche il contenuto, che li segue): mette in [name] "[root]/percorso" e negli altri argomenti i suoi campi. 1-ok, 0-voce non > */
+   /* > valida (fuori da [avail], o percorso vuoto, assoluto, con componenti vuote, "." o "..", che uscirebbe dalla cartella) */
+	const char *rel = p+PACK_ENTRY;
+	uint32_t i, start = 0;
+	if (avail < PACK_ENTRY)
+		return 0;
+	memcpy(plen, p, 4);
+	memcpy(mode, p+4, 4);
+	memcpy(size, p+8, 8);
+	memcpy(mtime, p+16, 8);
+	if (*plen==0 || *plen>TREE_PATH_MAX || avail-PACK_ENTRY < *plen || memchr(rel, '\0', *plen)!=NULL || rel[0]=='/')
+		return 0;
+	if (body ? (avail-PACK_ENTRY-*plen < *size) : (avail != PACK_ENTRY+*plen))
+		return 0;
+	for (i=0; i<=*plen; i++)
+		if (i==*plen || rel[i]=='/') {
+			if (i==start || (i-start==1 && rel[start]=='.') || (i-start==2 && rel[start]=='.' && rel[start+1]=='.'))
+				return 0;
+			start = i+1;
+		}
+	sprintf(name, "%s%s%.*s", root, (root[0]!='\0') ? "/" : "", (int)*plen, rel);
+	return 1;
+}
+
+FILE *tree_open ( workspace *ws, const char *name, uint64_t size, int *k, tree_result *t ) /* (protocollo 10) crea tra i file della sessione > */
+{   /* > [name], di una cartella, che riceverà [size] byte e lo apre in scrittura ([k]: la sua posizione). NULL se c'è già un file con quel nome > */
+    /* > (il contenuto si scarta) o se non si può creare; lo conta in [t] */
+	FILE *fp = NULL;
+	if (ws_find(&ws->files, name)>=0) {
+		t->dup++;
+		return NULL;
+	}
+	if ( (*k = ws_create(ws, &ws->files, name, size))>=0 && (fp = ws_writer(ws, &ws->files, *k))==NULL )
+		ws_drop(ws, &ws->files, *k);
+	if (fp==NULL)
+		t->werr++;
+	return fp;
+}
+
+void tree_close ( workspace *ws, int k, FILE *fp, int r, uint32_t mode, int64_t mtime, uint64_t size, tree_result *t ) /* (protocollo 10) > */
+{   /* > chiude il file [k] di una cartella, aperto con tree_open, ricevuto con esito [r] (come ReceiveStream): se è intero prende i permessi > */
+    /* > [mode] e la data [mtime] che aveva sul client, altrimenti si elimina; l'esito va in [t] */
+	struct timespec ts[2];
+	int werr = (fflush(fp)!=0 || ferror(fp));  // i dati prima della data: scriverli dopo la cambierebbe
+	if (r==1 && !werr) {
+		ts[0].tv_sec = ts[1].tv_sec = mtime;
+		ts[0].tv_nsec = ts[1].tv_nsec = 0;
+		fchmod(fileno(fp), mode & 0777);
+		futimens(fileno(fp), ts);
+		ws->files.v[k].meta = 1;
+	}
+	if (ws_close(ws, &ws->files, k, fp)!=0)
+		werr = 1;
+	if (r==1 && !werr) {
+		t->files++;
+		t->bytes += size;
+		eager_feed(ws, ws->files.v[k].name);
+		return;
+	}
+	ws_drop(ws, &ws->files, k);
+	if (werr)
+		t->werr++;
+	else if (r==-1)
+		t->rerr++;
+}
+
+int ReceiveTree ( int sock, workspace *ws, const char *root, tree_result *t, uint64_t *wire ) /* (protocollo 10) riceve da [sock] i file > */
+{   /* > della cartella [root] fino al frame vuoto: pacchi di file piccoli (PACK_FILES, ciascuno con intestazione, percorso e contenuto, compressi > */
+    /* > insieme con LZ4 se si riducono) e file grandi (PACK_LARGE: intestazione e percorso, poi il contenuto a blocchi come in ReceiveStream). > */
+    /* > Ognuno va tra i file della sessione come "[root]/percorso relativo", con i suoi permessi e la sua data; gli esiti vanno in [t], i byte > */
+    /* > arrivati dalla rete si sommano in [wire]. 1-ok, 0-errore sul socket o frame non valido */
+	char *buf = malloc(2+PACK_SIZE), *raw = malloc(PACK_SIZE), *p, *end, name[MAX_MSG_LEN+TREE_PATH_MAX+2];
+	uint32_t plen, mode;
+	uint64_t size;
+	int64_t mtime;
+	int len, k, r, rc = -1;          // rc: -1 finché arrivano frame
+	FILE *fp;
+	if (buf==NULL || raw==NULL)
+		rc = 0;                      // senza memoria non si può restare allineati col client
+	while (rc==-1) {
+		if ( ! ReceiveChunk(sock, buf, 2+PACK_SIZE, &len) )
+			rc = 0;
+		else if (len==0)             // fine della cartella
+			rc = 1;
+		else if (buf[0]==PACK_FILES && len>=2) {
+			*wire += len;
+			p = buf+2;
+			len -= 2;
+			if (buf[1]==WIRE_LZ4)
+				len = LZ4_decompress_safe(p, raw, len, PACK_SIZE), p = raw;
+			else if (buf[1]!=WIRE_RAW)
+				len = -1;
+			if (len<=0)              // pacco corrotto o formato sconosciuto: il flusso non è più affidabile
+				rc = 0;
+			for (end=p+len; rc==-1 && p<end; p+=PACK_ENTRY+plen+size) {
+				if ( ! tree_entry(p, end-p, 1, root, name, &plen, &mode, &size, &mtime) )
+					rc = 0;
+				else if ( (fp = tree_open(ws, name, size, &k, t))!=NULL )
+					tree_close(ws, k, fp, (fwrite(p+PACK_ENTRY+plen, 1, size, fp)==size) ? 1 : -1, mode, mtime, size, t);
+			}
+		}
+		else if (buf[0]==PACK_LARGE && tree_entry(buf+1, len-1, 0, root, name, &plen, &mode, &size, &mtime)) {
+			*wire += len;
+			fp = tree_open(ws, name, size, &k, t);     // NULL: il contenuto si riceve e si scarta
+			r = ReceiveStream(sock, fp, size, NULL, wire);
+			if (fp!=NULL)
+				tree_close(ws, k, fp, r, mode, mtime, size, t);
+			if (r==0)
+				rc = 0;
+		}
+		else
+			rc = 0;
+	}
+	free(buf);
+	free(raw);
+	return rc;
+}
+
+// funzioni (15) invocate dai ServerThread ("sXXX") in risposta alle richieste del client (il 1° argomento è sempre il suo socket [client_socket]); >
 // > tutte ritornano: 0[tutto ok]  -1[il client non risponde]    1[il parametro del comando è errato o altri errori]                             
 
 int sINVALIDCOMMAND ( int client_socket )   /* corrispettivo sul client: cCMDS0_478 [0 è il n° associato ad un comando non esistente] */
@@ -441,27 +3954,50 @@ int sINVALIDCOMMAND ( int client_socket )   /* corrispettivo sul client: cCMDS0_
 
 int sHELP ( int client_socket)   /* Corrispettivo sul client: cCMDS0_478{1-help} */
 {
-	char info[MAX_MSG_LEN*2];
+	char info[MAX_MSG_LEN*5];     // deve contenere tutto l'elenco dei comandi (il client riceve fino a MAX_MSG_LEN*5 byte)
 	sprintf(info, GREf" - I comandi supportati da remote-compressor sono i seguenti:\n"
-							"%4c-> configure-compressor [compressor]\n"
+							"%4c-> configure-compressor [compressor|auto]\n"
 							"%4c-> configure-name [name]\n"
+							"%4c-> configure-threads [n]\n"
+							"%4c-> configure-level [n|default]\n"
 							"%4c-> show-configuration\n"
-							"%4c-> send [local-file]\n"
+							"%4c-> send [local-file|local-folder]\n"
 							"%4c-> compress [path]\n"
 							"%4c-> show-list\n"
 							"%4c-> empty-list\n"
+							"%4c-> stats\n"
 							"%4c-> quit"RST
-							"\n",' ',' ',' ',' ',' ',' ',' ',' '); // "%4c" inserisce 4 volte il char specificato (lo spazio)
+							"\n",' ',' ',' ',' ',' ',' ',' ',' ',' ',' ',' '); // "%4c" inserisce 4 volte il char specificato (lo spazio)
 	return ( SendData(client_socket, &info, strlen(info)) -1 );         // 1) invio del messaggio (non inviando il NUL risparmio 1B) 
 }
 
 int sCONFIGURECOMPRESSOR ( int client_socket, char compr[], comp_param *p )  /* Corrispettivo sul client: cCMDS0_478{2: configure-compressor}. */
-{ /* [compr]: nome compr. scelto (può non essere disponibile); [p] punta una struct con l'indice del compr. da usare e il nome archivio in uso   */
+{ /* [compr]: nome compr. scelto (può non essere disponibile), oppure "auto [time <s> | ratio <r>]" (scelta ad ogni compress, entro <s> secondi > */
+  /* > previsti o al rapporto <r>); [p] punta una struct con l'indice del compr. da usare e il nome archivio in uso   */
 	int i;                                                
-	char info [110 + (NUM_COMPRESSORS*MAX_COMPR_NAME_LENGTH)]; // al massimo dovrà contenere il messaggio che elenca tutti i compressori disponibili
+	char info [200 + (NUM_COMPRESSORS*MAX_COMPR_NAME_LENGTH)]; // al massimo dovrà contenere il messaggio che elenca tutti i compressori disponibili
+	if (strncmp(compr, "auto", 4)==0 && (compr[4]=='\0' || compr[4]==' ')) {
+		char kind[10] = "time", extra[2];
+		double target = AUTO_DEFAULT_SECONDS;
+		int n = sscanf(compr+4, " %9s %lf %1s", kind, &target, extra);  // il terzo campo c'è solo se il comando ha parametri di troppo
+		if ( n==1 || n==3 || (strcmp(kind,"time")!=0 && strcmp(kind,"ratio")!=0) || target<=0 || (strcmp(kind,"ratio")==0 && target<1) ) {
+			sprintf(info, REDf" - Uso: configure-compressor auto [time <secondi> | ratio <rapporto>=1>] (default: time %.0f)."RST"\n", AUTO_DEFAULT_SECONDS);
+			if ( ! SendData(client_socket, info, strlen(info)) )
+				return -1;
+			return 1;
+		}
+		p->auto_mode = (strcmp(kind,"time")==0) ? AUTO_TIME : AUTO_RATIO;
+		p->auto_target = target;
+		if (p->auto_mode==AUTO_TIME)
+			sprintf(info, CYAf" - Compressore scelto ad ogni compress: il migliore entro "GREf"%.1f"CYAf" secondi previsti."RST"\n", target);
+		else
+			sprintf(info, CYAf" - Compressore scelto ad ogni compress: il piu' veloce che comprime almeno "GREf"%.2f"CYAf":1."RST"\n", target);
+		return ( SendData(client_socket, info, strlen(info)) -1 );
+	}
 	for (i=0; i<NUM_COMPRESSORS; i++) { 				       // guardo se il compressore scritto dal client è tra quelli disponibili
 		if ( strcmp(compr, compressors_matrix[i][0])==0) { 	   // il compressore specificato è tra quelli usabili 
 			p->compressor_index=i;                             // imposto il nuovo compressore di default
+			p->auto_mode = AUTO_NONE;
 			sprintf( info, CYAf" - Compressore configurato correttamente a "GREf"%s"CYAf"."RST"\n", compr );
 			break; 		      	   // trovato il compressore è inutile continuare (e l'intero "i" finisce con un valore minore di 4!)
 		}
@@ -473,6 +4009,7 @@ int sCONFIGURECOMPRESSOR ( int client_socket, char compr[], comp_param *p )  /*
 			sprintf (temp, "   * %s\n", compressors_matrix[i][0]); 
 			strcat( info, temp );		         // aggiungo una riga all'elenco
 		}
+		strcat( info, "   * auto [time <secondi> | ratio <rapporto>]\n" );
 	}									
 	if ( ! SendData(client_socket, info, strlen(info)) )       // 1) invio ( byte de)l messaggio, NUL finale escluso, con gestione errore
 		return (-1);
@@ -482,6 +4019,49 @@ int sCONFIGURECOMPRESSOR ( int client_socket, char compr[], comp_param *p )  /*
 		return 0;   	          // il compressore è stato impostato correttamente (il messaggio inviato al client conferma l'esito positivo)
 }
 
+int sCONFIGURETHREADS ( int client_socket, char n[], comp_param *p ) /* Corrispettivo sul client: cCMDS0_478{10: configure-threads}. */
+{   /* [n] è il numero di thread scelto dal client (da 1 a MAX_THREADS); [p] punta alla struct dei parametri di compressione da aggiornare */
+	char info[MAX_MSG_LEN], *end;
+	long t = strtol(n, &end, 10);
+	if (end==n || *end!='\0' || t<1 || t>MAX_THREADS) {       // gestione errore sul parametro (non numerico o fuori intervallo)
+		sprintf(info, REDf" - Numero di thread non valido (intero compreso tra 1 e %d)."RST"\n", MAX_THREADS);
+		if ( ! SendData(client_socket, &info, strlen(info)) )   // 1) invio messaggio con gestione errore
+			return -1;
+		return 1;
+	}
+	p->threads = t;
+	if (t==1)
+		sprintf(info, CYAf" - Compressione configurata su "GREf"1"CYAf" thread (sequenziale)."RST"\n");
+	else
+		sprintf(info, CYAf" - Compressione configurata su "GREf"%ld"CYAf" thread (a blocchi, zstd con i propri thread; compress resta sequenziale)."RST"\n", t);
+	return ( SendData(client_socket, &info, strlen(info)) -1 );  // 1) invio messaggio con gestione errore
+}
+
+int sCONFIGURELEVEL ( int client_socket, char n[], comp_param *p ) /* Corrispettivo sul client: cCMDS0_478{12: configure-level}. */
+{   /* [n] è il livello scelto dal client (da 0 a MAX_LEVEL, ricondotto all'intervallo di ogni codec) o "default"; [p] punta ai parametri da aggiornare */
+	char info[MAX_MSG_LEN*2], *end;
+	long l = strtol(n, &end, 10);
+	if (strcmp(n, "default")==0)
+		l = LEVEL_DEFAULT;
+	else if (end==n || *end!='\0' || l<0 || l>MAX_LEVEL) {       // gestione errore sul parametro (non numerico o fuori intervallo)
+		sprintf(info, REDf" - Livello non valido (intero compreso tra 0 e %d, oppure \"default\")."RST"\n", MAX_LEVEL);
+		if ( ! SendData(client_socket, &info, strlen(info)) )   // 1) invio messaggio con gestione errore
+			return -1;
+		return 1;
+	}
+	p->level = l;
+	if (l==LEVEL_DEFAULT)
+		sprintf(info, CYAf" - Livello configurato a "GREf"default"CYAf" (quello di ciascun compressore)"RST);
+	else
+		sprintf(info, CYAf" - Livello configurato a "GREf"%ld"CYAf RST, l);
+	if (p->auto_mode!=AUTO_NONE)
+		strcat(info, CYAf": vale per i compressori scelti per nome (la scelta automatica sceglie anche il livello)."RST"\n");
+	else
+		sprintf(info+strlen(info), CYAf" ("GREf"%s"CYAf" usera' il livello "GREf"%d"CYAf")."RST"\n", compressors_matrix[p->compressor_index][0],
+				codec_level(p->compressor_index, p->level));
+	return ( SendData(client_socket, &info, strlen(info)) -1 );  // 1) invio messaggio con gestione errore
+}
+
 int sCONFIGURENAME ( int client_socket, char* chosenName, comp_param *p ) /* Corrispettivo sul client: cCMDS0_478{3: configure-name}. */   
 {   /*  [chosenName] punta al nome  da dare al tar, scelto dal client; [p] punta alla struct contenente quello vecchio, da sostituire con [chosenName]  */
 	char info[MAX_MSG_LEN];			   
@@ -511,18 +4091,24 @@ int sSHOWCONFIGURATION ( int client_socket, comp_param *p )  /* Corrispettivo su
 	strcpy(info,CYAf"  Nome: "GREf);  	  // creazione messaggio da spedire al client con i parametri impostati attualmente
 	strcat(info, p->archive_name);	        	// nome archivio
 	strcat(info, CYAf"\n  Compressore: "GREf);      // prosecuzione messaggio
-	strcat(info, compressors_matrix[p->compressor_index][0]);   	// algoritmo di compressione
+	if (p->auto_mode==AUTO_TIME)                                 // algoritmo di compressione (o obiettivo della scelta automatica)
+		sprintf(info+strlen(info), "auto (entro %.1f s)", p->auto_target);
+	else if (p->auto_mode==AUTO_RATIO)
+		sprintf(info+strlen(info), "auto (almeno %.2f:1)", p->auto_target);
+	else
+		sprintf(info+strlen(info), "%s (livello %d)", compressors_matrix[p->compressor_index][0], codec_level(p->compressor_index, p->level));
+	sprintf(info+strlen(info), CYAf"\n  Thread: "GREf"%d", p->threads);  // thread di compressione
 	strcat(info, "\n"RST);											// infine a capo
 	return ( SendData(client_socket, &info, strlen(info)) -1 ); // 1) invio messaggio sui parametri in uso per la compressione; gestione errore inclusa
 }
 
-int sSEND ( int client_socket, char parameter[], int PoolID, int* counter ) /* Corrispettivo client: cSEND. [parameter] è  il path del  file da inviare */
-{ /* [PoolID] identifica il thread che esegue sSend (chiamante); il puntatore a [counter] (n° di file inviati finora dal thread [PoolID]-esimo)> */
+int sSEND ( int client_socket, char parameter[], workspace *ws, int* counter ) /* Corrispettivo client: cSEND. [parameter] è  il path del  file da inviare */
+{ /* [ws] è l'area di lavoro della sessione (in memoria o nella sua cartella locale); il puntatore a [counter] (n° di file inviati finora nella sessione)> */
 	FILE *fp;       	/* > Se l'invio si conclude con successo in [parameter] il chiamante troverà il nome del file inviato */
 	char info[MAX_MSG_LEN+1], temp[MAX_MSG_LEN/4];
-	char *dyn, *filename, *filepath;                                               /*RICEZIONE FILE INVIATO DAL CLIENT E SUA MEMORIZZAZIONE*/
-	unsigned int size; 			   	  // usando un intero C senza segno per la dimensione del file questo potrà essere al massimo 4GiB
-	int risp, l;  
+	char *filename;                                                          /*RICEZIONE FILE INVIATO DAL CLIENT E SUA MEMORIZZAZIONE*/
+	uint64_t size; 			   	  // dimensione a 64 bit; il contenuto arriva a blocchi e viene scritto man mano (in memoria o su disco)
+	int risp, i;  
 	if ( !SendData(client_socket, parameter, strlen(parameter)) ) // 1) invio al client path del file da inviare [".../../../nome[.estensione]"] 
 		return -1;                                              
 	if ( ! ReceiveData(client_socket, &risp, NULL) )              // 2) il client mi comunica se il file verrà inviato (1) o meno (0) 
@@ -530,38 +4116,54 @@ int sSEND ( int client_socket, char parameter[], int PoolID, int* counter ) /* C
 	if (risp==0)   	          // se il client non è in grado di accedere al file (non esiste a quel path, oppure non è un file) esco
 		return 1;		
 	filename = getfilename(parameter); // prelevo dal path il nome del file ("nome[.estensione]"); getfilename mi dà il pointer a una stringa dinamica
-	l = strlen(filename);		
-	filepath = malloc( (l+50)*(sizeof(char)) );     	  // creazione percorso del file inviato (salvato nella cartella locale del thread) 
-	sprintf(filepath, "./%s/%s%d/%s", POOL_ROOT_DIR, POOL_FOLDER_PREFIX, PoolID, filename);
-	risp = access(filepath, F_OK);  	    // se il file (nella cartella locale del poool thread) c'è gia access=0, se non c'è access=-1          
-	if ( !SendData(client_socket, &risp, sizeof(int)) )    // 3) comunico al client se possiamo procedere (-1) oppure se il file è già stato inviato (0)
+	risp = (ws_find(&ws->files, filename)>=0) ? 0 : -1;  // se il file è già nell'area di lavoro della sessione 0, altrimenti -1 (come access)
+	if ( !SendData(client_socket, &risp, sizeof(int)) ) {  // 3) comunico al client se possiamo procedere (-1) oppure se il file è già stato inviato (0)
+		free(filename);
 		return -1;	
-	if (risp==0)         									  // se il file è già stato inviato la funzione termina
+	}
+	if (risp==0) {        									  // se il file è già stato inviato la funzione termina
+		free(filename);
 		return (1);                                  
-	if ( ! ReceiveData(client_socket, &size, NULL) ) 			  // 4) ricezione dimensione file
+	}
+	if ( ! ReceiveData(client_socket, &size, NULL) ) {			  // 4) ricezione dimensione file (64 bit)
+		free(filename);
 		return -1;
+	}
 	if (size!=0){	                                  //se il file è vuoto è tutto più semplice (conta solo il suo nome, che ho già)
-	    if ( ! ReceiveData(client_socket, &risp, NULL) )          	  // 5[opz]) il client è in grado di aprire il file?
+	    if ( ! ReceiveData(client_socket, &risp, NULL) ) {         	  // 5[opz]) il client è in grado di aprire il file?
+		    free(filename);
 		    return -1;
-	    if (risp==0)					        // il client non riesce ad aprire il file locale che mi vuoel spedire  esco
+	    }
+	    if (risp==0) {				        // il client non riesce ad aprire il file locale che mi vuoel spedire  esco
+		    free(filename);
 		    return 1;				
-		dyn = malloc(size);			        	  // vi metto momentaneamente il contenuto del file che mi manderà il client
-		if ( ! ReceiveData(client_socket, dyn, NULL) )  	    // 6[opzionale se file nn vuoto]) ricezione contenuto del file (va in dyn)	
-			return -1;
-	}
-	fp = fopen(filepath, "wb");      // apertura del file (se ne crea uno nuovo) in cui sarà copiato il contenuto del file "inviato" (sta in dyn)
-	if(fp==NULL) { 			        	  // gestione errore di apertura del file (copia locale del file inviatomi dal client)
-		fprintf (stderr, REDf"Impossibile creare il file."RST"\n"); 
-		strcpy(info,YELf"CLIENT: il server non e' stato in grado di creare il file; invio fallito."RST"\n");                                        
-		return SendData(client_socket, &info, strlen(info))-1;	  // 7e) informo il client sulla mancata creazione del file
+	    }
 	}
+	fp = NULL;                       // creazione del file (in memoria se c'è posto) in cui sarà scritto, blocco per blocco, il contenuto inviato
+	if ( (i = ws_create(ws, &ws->files, filename, size))>=0 && (fp = ws_writer(ws, &ws->files, i))==NULL )
+		ws_drop(ws, &ws->files, i);
+	risp = 1;
 	if (size!=0)
-		fwrite(dyn, 1, size, fp);    // trasferimento (scrittura) del contenuto (del file) inviato dal client nel file, aperto, creato lato server
-	fflush(fp);
-	fclose(fp);				      	  // chiudo il file: ora il thread server ha nella sua cartella locale il file inviato dal client
-	if (size!=0)
-		free(dyn);	        // se l'avevo creato cancello il buffer dove avevo appoggiato i dati ricevuti (il contenuto del file inviato)	  
+		risp = ReceiveStream(client_socket, fp, size, NULL, NULL);  // 6[opzionale se file nn vuoto]) ricezione a blocchi del contenuto, scritto man mano
+	if (fp!=NULL && ws_close(ws, &ws->files, i, fp)!=0 && risp==1)   // chiudo il file: ora l'area di lavoro della sessione ha il file inviato dal client
+		risp = -1;
+	if (risp==0) {                   // il client è caduto durante il trasferimento: elimino il file incompleto
+		if (fp!=NULL)
+			ws_drop(ws, &ws->files, i);
+		free(filename);
+		return -1;
+	}
+	if (fp==NULL || risp==-1) { 			        	  // gestione errore di creazione/scrittura del file (o invio interrotto dal client)
+		if (fp==NULL)
+			log_event(LOG_ERROR, "file_create_error", "s:file", filename, NULL);
+		else
+			ws_drop(ws, &ws->files, i);
+		strcpy(info,YELf"CLIENT: il server non e' stato in grado di ricevere il file; invio fallito."RST"\n");                                        
+		free(filename);
+		return SendData(client_socket, &info, strlen(info))-1;	  // 7e) informo il client sulla mancata ricezione del file
+	}
 	(*counter)++;             									  // tutto ok: posso incrementare il contatore
+	eager_feed(ws, filename);                                     // (--eager) il file entra subito nell'archivio
 	if ((*counter)==1) 
 		strcpy(temp,CYAf"("GREf"1"CYAf" file inviato).\n"RST);
 	else                                // comunico al client che l'invio è andato a buon fine e quanti file ha inviato in totale 
@@ -573,20 +4175,175 @@ int sSEND ( int client_socket, char parameter[], int PoolID, int* counter ) /* C
 	if ( !SendData(client_socket, &info, strlen(info)) ) 	  // 7) informo il client che è andato tutto bene spedendogli il messaggio da stampare	
 		return -1;
 	strcpy(parameter, filename);  	         // il chiamante troverà il nome del file nel 2° argomento, e lo stamperà a video (lato server)
-	free(filepath);
 	free(filename);   	          // libero la memoria dinamica utilizzata fin qui per path e nome del file inviato
 	return 0; 	        	  // tutto ok se arrivo fin qui (la fine corretta di sSEND ritorna 0: file inviato)
 } 
-int sCOMPRESS ( int client_socket, char remote_path[], comp_param p, int PoolID, int* counter, char* client_IPaddr ) /* Corrispettivo client: cCOMPRESS.*/
-{ /* ATTENZIONE: una volta creato tar i files inviati sono eliminati. [remote_path] è la directory dove il client vuole avere l'archivio compresso */
-	int w, rc; 	 /*  la struct [p] contiene i parametri per la compressione; [PoolID] è l'id del serverthread chiamante; */         		    
-	char *dyn; 	 /* [counter] contiene il n°  di files inviati fino ad adesso al server dal client con IPv4 [client_IPaddr]    */ 
-	FILE *fp;                                                                     			   						 
+int sSENDBATCH ( int client_socket, list *paths, int n, int proto, int SessionID, workspace *ws, int* counter, char* client_IPaddr, int *chan, int nchan ) /* > */
+{ /* > Corrispettivo client: cSENDBATCH. Send a lotti (protocollo 2) degli [n] file di [paths]: un solo scambio per l'intero elenco invece di uno > */
+  /* > per file. Con [proto]>=3 il manifesto porta anche l'impronta di ogni file, e quelli già presenti nello store non vengono trasferiti ma > */
+  /* > collegati (hard link) nella cartella. [ws] e [counter] come in sSEND; [SessionID] e [client_IPaddr] servono per il log. 0-tutto ok (anche > */
+  /* > se alcuni file non sono stati salvati), -1-il client è caduto. Dal protocollo 4 i file arrivati a metà restano nell'area di lavoro (tra i > */
+  /* > file a metà) e la send ripetuta dopo la riconnessione ne riprende l'invio dall'ultimo byte ricevuto; dal 5 i blocchi arrivano compressi > */
+  /* > (LZ4) e sono decompressi prima di scriverli; dal 9, se il client ha aggiunto le [nchan] connessioni dati [chan], i contenuti arrivano a > */
+  /* > pezzi su tutte le connessioni insieme e sono ricomposti al loro posto; dal 10 un path può essere una cartella, i cui file arrivano dopo i > */
+  /* > contenuti (ReceiveTree) e restano nella sessione con il percorso relativo */
+	char list_msg[MAX_MSG_LEN+1] = "", *path[n], *filename[n], blobpath[64], partname[n][MAX_MSG_LEN+40];
+	uint64_t manifest[2*n], size[n], hash[n], offset[n], wire = 0, plain = 0; // [protocollo 5] byte arrivati dalla rete e byte dei file
+	struct stat st;
+	upload u[n];                     // file in ricezione
+	int status[2*n+1];               // esito di ciascun file, più il n° di file ricevuti finora nella sessione e (protocollo 10) quelli di ogni path
+	tree_result tree[n];             // (protocollo 10) esiti dei file delle cartelle
+	int socks[1+nchan];              // (protocollo 9) connessioni da cui arrivano i pezzi: quella dei comandi e quelle dati
+	int i, j, k, len, per_file = (proto>=3) ? 2 : 1, rc = 0, streams = (proto>=9) ? 1+nchan : 1;
+	for (i=0; i<n; i++) {            // elenco dei path separati da '\n' (l'espressione regolare dei path non ammette a capo)
+		path[i] = extract_path(paths);
+		filename[i] = getfilename(path[i]);
+		if (i>0)
+			strcat(list_msg, "\n");
+		strcat(list_msg, path[i]);
+	}
+	if ( !SendData(client_socket, list_msg, strlen(list_msg)) )   // 1) invio al client l'elenco dei path da inviare
+		rc = -1;
+	if ( rc==0 && ( !ReceiveChunk(client_socket, manifest, n*per_file*sizeof(uint64_t), &len) || len!=(int)(n*per_file*sizeof(uint64_t)) ) )
+		rc = -1;                     // 2) manifesto: dimensione (e, dal protocollo 3, impronta) di ogni file (BATCH_NOT_SENT se non accessibile)
+	for (i=0; i<n && rc==0; i++) {   // esiti già decisi prima dei contenuti; BATCH_UPLOAD per quelli da ricevere
+		size[i] = manifest[i*per_file];
+		hash[i] = (proto>=3) ? manifest[i*per_file+1] : 0;
+		sprintf(partname[i], "%016llx-%llu-%s", (unsigned long long)hash[i], (unsigned long long)size[i], filename[i]); // stesso contenuto >
+		                             // > (impronta) o niente ripresa
+		offset[i] = 0;
+		status[i] = BATCH_UPLOAD;
+		memset(&tree[i], 0, sizeof(tree_result));
+		if (size[i]==BATCH_NOT_SENT || (size[i]==BATCH_TREE && proto<10))
+			status[i] = BATCH_SKIPPED;
+		else if (size[i]==BATCH_TREE) {  // [protocollo 10] cartella: i suoi file prendono il nome della cartella come prefisso
+			free(filename[i]);
+			filename[i] = getfoldername(path[i]);
+		}
+		else if (proto<3)
+			continue;                // protocollo 2: ogni contenuto accessibile arriva comunque (i doppioni sono scartati alla ricezione)
+		else if (ws_find(&ws->files, filename[i])>=0)
+			status[i] = BATCH_DUPLICATE;
+		else {
+			for (j=0; j<i; j++)      // doppione nello stesso lotto: il nome sarà già occupato dal file precedente
+				if (status[j]!=BATCH_SKIPPED && size[j]!=BATCH_TREE && strcmp(filename[j], filename[i])==0)
+					status[i] = BATCH_DUPLICATE;
+			sprintf(blobpath, "./%s/%016llx-%llu", BLOB_STORE_DIR, (unsigned long long)hash[i], (unsigned long long)size[i]);
+			if (status[i]==BATCH_UPLOAD && size[i]>0 && ws_link(ws, filename[i], blobpath)) { // contenuto già nello store: basta collegarlo
+				status[i] = BATCH_STORED;
+				(*counter)++;
+				eager_feed(ws, filename[i]);
+				log_event(LOG_INFO, "file_received", "s:client", client_IPaddr, "d:session", SessionID, "s:file", filename[i],
+				          "u:bytes", size[i], "s:source", "store", "d:files", *counter, NULL);  // senza trasferimento
+			}
+			else if ( status[i]==BATCH_UPLOAD && proto>=4 && hash[i]!=0 && (k = ws_find(&ws->parts, partname[i]))>=0
+			          && ws_stat(ws, &ws->parts, k, &st) && (uint64_t)st.st_size<size[i] )
+				offset[i] = st.st_size;  // arrivato a metà prima di una caduta: il client riprende da qui
+		}
+	}
+	if ( rc==0 && proto>=3 && !SendData(client_socket, status, n*sizeof(int)) ) // 2b) [protocollo 3] quali contenuti il client deve inviare ..
+		rc = -1;
+	if ( rc==0 && proto>=4 && !SendData(client_socket, offset, n*sizeof(uint64_t)) ) // .. e [protocollo 4] da quale byte
+		rc = -1;
+	if ( rc==0 && proto>=9 && !SendData(client_socket, &streams, sizeof(int)) ) // 2c) [protocollo 9] connessioni su cui arriveranno i contenuti
+		rc = -1;
+	socks[0] = client_socket;
+	for (i=0; i<nchan; i++)
+		socks[1+i] = chan[i];
+	for (i=0; i<n; i++)
+		u[i].active = 0;
+	for (i=0; i<n && rc==0; i++) {  // 3) i contenuti arrivano uno dopo l'altro, senza attendere risposte (dal protocollo 9, con più connessioni, >
+		if (status[i]!=BATCH_UPLOAD || size[i]==BATCH_TREE) // > a pezzi su tutte insieme: si ricevono dopo aver preparato tutti i file)
+			continue;
+		upload_open(ws, &u[i], filename[i], partname[i], size[i], offset[i], proto, streams>1);
+		if (streams>1)
+			continue;
+		if (size[i]!=0)
+			u[i].r = ReceiveStream(client_socket, u[i].fp, size[i]-offset[i], &u[i].h, (proto>=5) ? &wire : NULL);
+		if ( (status[i] = upload_close(ws, &u[i], filename[i], hash[i], proto, 0, SessionID, counter, client_IPaddr))<0 )
+			rc = -1;
+		else if (status[i]==BATCH_SENT)
+			plain += size[i]-offset[i];
+	}
+	if (streams>1 && rc==0) {
+		if ( ! ReceivePieces(socks, streams, u, n, &wire) )
+			rc = -1;
+		for (i=0; i<n; i++) {
+			if (!u[i].active)
+				continue;
+			if (rc==-1)
+				u[i].r = 0;          // connessione caduta: tutti i file ancora aperti sono incompleti
+			if ( (status[i] = upload_close(ws, &u[i], filename[i], hash[i], proto, 1, SessionID, counter, client_IPaddr))<0 )
+				rc = -1;
+			else if (status[i]==BATCH_SENT)
+				plain += size[i]-offset[i];
+		}
+	}
+	for (i=0; i<n && rc==0; i++) {  // 3b) [protocollo 10] le cartelle, una dopo l'altra: pacchi di file piccoli e file grandi
+		if (status[i]!=BATCH_UPLOAD || size[i]!=BATCH_TREE)
+			continue;
+		if ( ! ReceiveTree(client_socket, ws, filename[i], &tree[i], &wire) )
+			rc = -1;                 // i file già arrivati interi restano nella sessione
+		*counter += tree[i].files;
+		plain += tree[i].bytes;
+		status[i] = tree[i].werr ? BATCH_WRITE_ERROR : tree[i].rerr ? BATCH_READ_ERROR : tree[i].dup ? BATCH_DUPLICATE : BATCH_SENT;
+		log_event(LOG_INFO, "folder_received", "s:client", client_IPaddr, "d:session", SessionID, "s:folder", filename[i],
+		          "d:received", tree[i].files, "u:bytes", tree[i].bytes, "d:duplicates", tree[i].dup, "d:errors", tree[i].werr+tree[i].rerr,
+		          "d:files", *counter, NULL);  // un evento per cartella, non per ciascuno dei suoi file
+	}
+	for (i=0; i<n; i++) {
+		free(path[i]);
+		free(filename[i]);
+	}
+	if (rc==-1)
+		return -1;
+	if (wire>0)
+		log_event(LOG_INFO, "upload_wire", "s:client", client_IPaddr, "d:session", SessionID, "u:bytes", plain, "u:wire_bytes", wire,
+		          "f:ratio", (double)plain/wire, "d:streams", streams, NULL);   // contenuti ricevuti compressi (LZ4), su [streams] connessioni
+	status[n] = *counter;
+	for (i=0; i<n; i++)              // [protocollo 10] file ricevuti per ogni path (quelli di una cartella possono essere molti)
+		status[n+1+i] = (size[i]==BATCH_TREE) ? tree[i].files : (status[i]==BATCH_SENT || status[i]==BATCH_STORED);
+	if ( !SendData(client_socket, status, ((proto>=10) ? 2*n+1 : n+1)*sizeof(int)) ) // 4) rapporto unico con l'esito di ogni file
+		return -1;
+	return 0;
+}
+
+int sCOMPRESS ( int client_socket, char remote_path[], comp_param p, int proto, int SessionID, workspace *ws, int* counter, char* client_IPaddr ) /* > */
+{ /* > Corrispettivo client: cCOMPRESS. ATTENZIONE: una volta creato tar i files inviati sono eliminati. [remote_path] è la directory dove il > */
+  /* > client vuole avere l'archivio compresso; > */
+  /* > dal protocollo 4 ([proto]) un archivio già in cache viene spedito dal byte che il client ha già (download interrotto da una caduta). > */
+  /* > Con "configure-compressor auto" il compressore è scelto qui, sui file inviati; dal protocollo 6 scelta e previsioni, confrontate con > */
+  /* > il risultato effettivo, sono riferite al client alla fine. Con --eager l'archivio, costruito mentre arrivavano i file, qui viene solo > */
+  /* > chiuso: entra in cache e parte come un archivio già in cache */
+	int w, rc; 	 /*  la struct [p] contiene i parametri per la compressione; [SessionID] è l'id della sessione, [ws] la sua area di lavoro */         		    
+	 	 	 /* [counter] contiene il n°  di files inviati fino ad adesso al server dal client con IPv4 [client_IPaddr]    */ 
 	char archive_name[MAX_MSG_LEN+1];			   /*CREAZIONE ARCHIVIO TAR, INVIO AL CLIENT, ELIMINAZIONE*/			
-	char archive_local_path[strlen(POOL_ROOT_DIR)+strlen(POOL_FOLDER_PREFIX)+MAX_MSG_LEN+10];     					
-	char temp[ 20 + strlen(POOL_ROOT_DIR) + strlen(POOL_FOLDER_PREFIX) ];        
-	unsigned int size;		        // usando un unsigned int per la dimensione del tar, questo potrà essere massimo 4 GiB
-	struct stat inf;		 // conterrà in particolare il campo che mi dice quanto è grande il file compresso                                 
+	uint64_t size;		        // dimensione del tar a 64 bit: l'archivio non passa mai per la memoria né per il disco, quindi può superare la RAM
+	archive_writer aw;		 // archiviatore in-process (tar + codec) con uscita sul socket del client                                 
+	compress_job job;		 // la compressione viene eseguita dallo scheduler: questo thread ne attende solo la fine
+	cache_tee tee;           // con la cache: socket del client e copia dell'archivio in costruzione
+	char cache_tmp[64];
+	uint64_t key;            // chiave dell'archivio nella cache (file inviati e compressore)
+	int keyed, cfd;
+	eager_archive *eager = NULL; // (--eager) archivio chiuso da eager_finish, da liberare qui
+	uint64_t have = 0;       // byte dell'archivio che il client ha già (protocollo 4)
+	auto_pick pick;          // scelta automatica del compressore (configure-compressor auto)
+	char report[MAX_MSG_LEN*2] = "";
+	struct timespec t0, t1;
+	uint64_t ts;             // (--trace) inizio della compressione
+	pick.compressor_index = -1;
+	if (p.auto_mode!=AUTO_NONE) {    // prove sui campioni dei file (sullo scheduler, come la compressione), prima di dare il nome all'archivio
+		pick.ws = ws;
+		pick.p = &p;
+		sched_submit(&pick.task, auto_choose, &pick, 1);
+		sched_wait(&pick.task);
+		if (pick.compressor_index>=0) {
+			p.compressor_index = pick.compressor_index;
+			p.level = pick.level;
+			log_event(LOG_INFO, "auto_choice", "s:client", client_IPaddr, "d:session", SessionID, "s:codec", compressors_matrix[p.compressor_index][0],
+			          "d:codec_level", p.level, "f:entropy", pick.entropy, "f:ratio_expected", pick.ratio, "f:seconds_expected", pick.seconds, NULL);
+		}
+	}
 	strcpy(archive_name, p.archive_name);  						        // creo il nome dell'archivio compresso che verrà creato
 	strcat(archive_name,".tar.");        							    // ..prima metto "tar"	   
 	w = p.compressor_index;					           // ..poi l'estensione utilizzata dall'algoritmo di compressione in uso
@@ -599,294 +4356,563 @@ int sCOMPRESS ( int client_socket, char remote_path[], comp_param p, int PoolID,
 	if ( ! ReceiveData(client_socket, &w, NULL) ) 		        	// 3) il path remoto è accessibile dal client (1) o no (0)?   
 		return -1;	
 	if (w==0) { 			       // se il client non può usare il percorso salta tutto (non può memorizzare localmente il tar che gli invierò 
-		printf (REDf"Il client %s non puo' accedere al path %s."RST"\n", client_IPaddr, remote_path);
+		log_event(LOG_WARN, "remote_path_denied", "s:client", client_IPaddr, "d:session", SessionID, "s:path", remote_path, NULL);
 		return 1;
 	}
-	if ((*counter)==1) 						        	// nel tar ci saranno uno o più files?
-		strcpy(temp,"file"); 
-	else
-		strcpy(temp,"files");
-	printf("SERVER: compressione di "CYAf"%d"RST" %s in corso ", *counter, temp); // numero file che conterrà il tar
-	printf("("CYAf"%s"RST"),", archive_name);							// nome dell'archivio
-	printf("richiesta dal client "GREf"%s"RST".\n", client_IPaddr);		// indirizzo (IPv4) del client richiedente (a cui spedirò il tar)
-	system( tar_cmd(p, PoolID) );     // comprimo (tar_cmd da' il comando aposito); non passo nomi di file (tutti quelli nella cartella del thread)	
-	sprintf(archive_local_path, "./%s/%s%d/%s", POOL_ROOT_DIR, POOL_FOLDER_PREFIX, PoolID, archive_name); 
-	w=1;							        	// suppongo che il tar sia stato creato e sia accessibile
-	fp = fopen(archive_local_path, "rb");  		        	// apertura del file compresso (creato nella cartella locale dalla tar precedente) 
-	if(fp==NULL)   
-		w=0;    // errore apertura file tar
-	rc = SendData(client_socket, &w, sizeof(int));    // 4) comunico al client se la creazione del file compresso è fallita (w=0) o è tutto ok (w=1) 
-	if (w==0) {	
-		fprintf (stderr, REDf"Impossibile creare o accedere al file archivio %s."RST"\n", archive_name);
-		remove(archive_local_path); 			        	// gestione mancata apertura o creazione del file archivio 
-		if (rc==0)
-			return (-1);   	// il client s'è disconnesso 
-		return 1;			  // il client è connesso e gli ho comunicato che non sono riuscito a creare o aprire l'archivio tar
-	}
-	stat(archive_local_path, &inf);// mi procuro la dimensione dell'archivio compresso appena creato (sta nella cartella locale del thread)
-	size = inf.st_size;
-	dyn = malloc(size);  // alloco un buffer dinamico grande quanto il tar creato
-	fread(dyn, 1, size, fp);   // lettura del file(archivio tar) nella sua interezza e trasferimento del contenuto nel buffer          
-	if ( ! SendData(client_socket, &size, sizeof(unsigned int)) ) // 5) invio dimensione tar: è vero che con la Send dopo invio di nuovo questo dato,>
-		return -1;	        	// > ma il client prima di ricevere i dati deve sapere quanta memoria allocargli (può essere fino a 4GiB!)
-	if ( ! SendData(client_socket, dyn, size) )     	// 6) invio del contenuto dell'archivio compresso (lo prelevo dal buffer)
-		return -1;
-	fflush(fp);							        	// pulizia stream (scrivo il rimanente sul file)
-	fclose(fp);							        		// chiudo il file/tar locale	(fstream)
-	free(dyn);						        	// libero il buffer dove avevo appoggiato il contenuto dell'archivio tar
-	remove(archive_local_path);			       	// qualsiasi cosa sia accaduta comunque l'archivio non mi serve più (tanto ho i file...) 
+	log_event(LOG_INFO, "compress_start", "s:client", client_IPaddr, "d:session", SessionID, "s:archive", archive_name,
+	          "d:files", *counter, "s:codec", compressors_matrix[p.compressor_index][0], "d:codec_level", p.level, "d:threads", p.threads, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	keyed = archive_key(ws, p.compressor_index, p.level, &key); // chiave per la cache (0 se un file non è leggibile: niente cache)
+	if (proto>=4) {
+		uint64_t k = keyed ? key : 0;
+		if ( ! SendData(client_socket, &k, sizeof(uint64_t)) )  // 3b) [protocollo 4] chiave dell'archivio (il client vi associa il file a metà) ..
+			return -1;
+		if ( ! ReceiveData(client_socket, &have, NULL) )        // .. e byte che il client ne ha già
+			return -1;
+	}
+	ts = cur_trace.on ? mono_us() : 0;
+	if ( (keyed && cache_lookup(key, &cfd, &size)) || (eager = eager_finish(ws, &p, &cfd, &size))!=NULL ) { // archivio già in cache, o (--eager) > 
+		uint64_t from = (have<size && !eager) ? have : 0;  // > già compresso mentre arrivavano i file: nessuna compressione, lo spedisco dal disco
+		if (eager && cur_trace.on) {                    // (--trace) solo la chiusura dell'archivio: il resto è avvenuto durante le send
+			cur_trace.us[TRACE_COMPRESS] += mono_us()-ts;
+			cur_trace.bytes[TRACE_COMPRESS] += eager->aw.in_bytes;
+		}
+		if (eager) {
+			atomic_fetch_add(&cache_misses, 1);
+			if (keyed)
+				cache_commit(eager->tmp, key);      // come ogni archivio compresso: una compress uguale, o la ripresa del download, lo trova
+		}
+		w = 1;
+		rc = SendData(client_socket, &w, sizeof(int))   // 4) archivio pronto ..
+		     && SendData(client_socket, &size, sizeof(uint64_t)) // 5) .. di dimensione nota ..
+		     && ( proto<4 || SendData(client_socket, &from, sizeof(uint64_t)) ) // 5b) [protocollo 4] .. dal byte [from] ..
+		     && lseek(cfd, from, SEEK_SET)==(off_t)from
+		     && SendFileRaw(client_socket, cfd, size-from);  // 6) .. spedito così com'è (byte grezzi, sendfile)
+		close(cfd);
+		if (!rc) {
+			if (eager)
+				eager_free(eager);
+			return -1;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		if (eager) {
+			hist_record(&srv_metrics.codec_time[p.compressor_index], eager->us);  // tempo di tar e compressione, anche se passato durante le send
+			atomic_fetch_add_explicit(&srv_metrics.codec_in[p.compressor_index], eager->aw.in_bytes, memory_order_relaxed);
+			atomic_fetch_add_explicit(&srv_metrics.codec_out[p.compressor_index], eager->aw.out_bytes, memory_order_relaxed);
+			log_event(LOG_INFO, "eager_archive", "s:client", client_IPaddr, "d:session", SessionID, "s:archive", archive_name, "u:bytes", size,
+			          "d:files", eager->files, "u:compress_us", eager->us, NULL);
+			eager_free(eager);
+		}
+		else {
+			if (pick.compressor_index>=0)
+				strcpy(report, " (dalla cache)");
+			log_event(LOG_INFO, "cache_hit", "s:client", client_IPaddr, "d:session", SessionID, "s:archive", archive_name, "u:bytes", size,
+			          "u:resumed_from", from, "d:hits", (int)atomic_fetch_add(&cache_hits, 1)+1, "d:misses", (int)atomic_load(&cache_misses), NULL);
+		}
+	}
+	else {
+		atomic_fetch_add(&cache_misses, 1);
+		tee.sock = &client_socket;
+		tee.sock_ok = 1;
+		tee.fp = NULL;
+		if (keyed) {                 // l'archivio prodotto viene anche copiato in cache, mentre lo si spedisce
+			sprintf(cache_tmp, "./%s/tmp%d", ARCHIVE_CACHE_DIR, SessionID);
+			tee.fp = fopen(cache_tmp, "wb");
+		}
+		if (tee.fp!=NULL)
+			w = aw_open(&aw, p.compressor_index, p.threads, p.level, cache_tee_sink, &tee); // archiviatore in-process: tar + codec, in uscita sul socket (e in cache)
+		else
+			w = aw_open(&aw, p.compressor_index, p.threads, p.level, socket_sink, &client_socket); // archiviatore in-process: tar + codec, in uscita direttamente sul socket
+		rc = SendData(client_socket, &w, sizeof(int));    // 4) comunico al client se la creazione del file compresso è fallita (w=0) o è tutto ok (w=1) 
+		if (w==0 || rc==0) {
+			if (tee.fp!=NULL) {
+				fclose(tee.fp);
+				remove(cache_tmp);
+			}
+			if (w!=0)
+				aw_close(&aw, 0);
+			else
+				log_event(LOG_ERROR, "compress_error", "s:client", client_IPaddr, "d:session", SessionID, "s:archive", archive_name,
+				          "s:reason", "inizializzazione del compressore", NULL);
+			if (rc==0)
+				return (-1);   	// il client s'è disconnesso 
+			return 1;			  // il client è connesso e gli ho comunicato che non sono riuscito a creare l'archivio
+		}
+		size = ARCHIVE_SIZE_UNKNOWN;   // la dimensione non è nota in anticipo: l'archivio viene spedito mentre viene prodotto
+		if ( ! SendData(client_socket, &size, sizeof(uint64_t)) ) { // 5) invio dimensione tar (64 bit): qui "ignota", quindi seguono frame fino a uno vuoto
+			aw_close(&aw, 0);
+			if (tee.fp!=NULL) {
+				fclose(tee.fp);
+				remove(cache_tmp);
+			}
+			return -1;
+		}
+		job.aw = &aw;
+		job.ws = ws;
+		ts = cur_trace.on ? mono_us() : 0;
+		sched_submit(&job.task, compress_job_run, &job, 1); // 6) tar + compressione dei file inviati (su un worker dello scheduler), ..
+		sched_wait(&job.task);                         // .. spediti al client blocco per blocco
+		rc = job.rc;
+		if (cur_trace.on) {                             // (--trace) il tempo passato a spedire i blocchi non è compressione
+			cur_trace.us[TRACE_COMPRESS] += mono_us()-ts-aw.sink_us;
+			cur_trace.bytes[TRACE_COMPRESS] += aw.in_bytes;
+			cur_trace.us[TRACE_SEND] += aw.sink_us;
+			cur_trace.bytes[TRACE_SEND] += aw.out_bytes;
+		}
+		if (tee.fp!=NULL) {                             // archivio completo e copia riuscita: entra in cache (anche se il client cade ora)
+			if (fclose(tee.fp)==0 && rc==1)
+				cache_commit(cache_tmp, key);
+			else
+				remove(cache_tmp);
+		}
+		if (aw.failed || !tee.sock_ok)                  // la destinazione (il socket) ha rifiutato i dati: il client è caduto
+			return -1;
+		w = (rc==1);
+		if ( ! SendFrame(client_socket, &w, 0, 1) || ! SendData(client_socket, &w, sizeof(int)) ) // 6b) frame vuoto di fine stream ed esito della compressione
+			return -1;
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		size = aw.out_bytes;
+		if (w==1) {                                     // metriche per codec: durata, byte del tar e byte compressi
+			hist_record(&srv_metrics.codec_time[p.compressor_index], elapsed_us(&t0));
+			atomic_fetch_add_explicit(&srv_metrics.codec_in[p.compressor_index], aw.in_bytes, memory_order_relaxed);
+			atomic_fetch_add_explicit(&srv_metrics.codec_out[p.compressor_index], aw.out_bytes, memory_order_relaxed);
+		}
+		if (w==0) {
+			log_event(LOG_ERROR, "compress_error", "s:client", client_IPaddr, "d:session", SessionID, "s:archive", archive_name,
+			          "s:reason", "file non leggibili o errore del compressore", NULL);
+			ReceiveData(client_socket, &w, NULL);        // 7) il client conferma di aver scartato l'archivio incompleto
+			return 1;
+		}
+	}
 	rc = ReceiveData(client_socket, &w, NULL);  // 7) ricevo l'esito della creazione dell'archivio, appena spedito,lato client: 0-errore, 1-tutto ok
 	if ( (w==0) || (rc==0) )  {		        	// se il client non riesce a salvare (problemi sui file o perchè s'è disconnesso)
-		printf (REDf"Il client non e' riuscito a salvare il file %s."RST"\n", archive_name);
+		log_event(LOG_WARN, "client_save_error", "s:client", client_IPaddr, "d:session", SessionID, "s:archive", archive_name, NULL);
 		return 1;   				      // se il client non è riuscito a salvare l'archivio non devo cancellare i file finora inviati
 	}
+	if (pick.compressor_index>=0) {      // scelta automatica: previsioni e risultato effettivo
+		char cached[20];
+		strcpy(cached, report);
+		sprintf(report, CYAf"- Scelta automatica: "GREf"%s -%d"CYAf" (entropia %.2f bit/byte); previsti "GREf"%.2f:1"CYAf" in "GREf"%.1f"CYAf" s, "
+				"ottenuti "GREf"%.2f:1"CYAf" in "GREf"%.1f"CYAf" s%s."RST"\n", compressors_matrix[p.compressor_index][0], p.level, pick.entropy,
+				pick.ratio, pick.seconds, (size>0) ? (double)pick.total/size : 0, (t1.tv_sec-t0.tv_sec) + (t1.tv_nsec-t0.tv_nsec)/1e9, cached);
+		log_event(LOG_INFO, "auto_result", "s:client", client_IPaddr, "d:session", SessionID, "s:codec", compressors_matrix[p.compressor_index][0],
+		          "d:codec_level", p.level, "f:ratio_expected", pick.ratio, "f:ratio", (size>0) ? (double)pick.total/size : 0,
+		          "f:seconds_expected", pick.seconds, "f:seconds", (t1.tv_sec-t0.tv_sec) + (t1.tv_nsec-t0.tv_nsec)/1e9, NULL);
+	}
+	if ( proto>=6 && ! SendData(client_socket, report, strlen(report)) ) // 8) [protocollo 6] resoconto della scelta automatica (vuoto senza "auto")
+		return -1;
 	(*counter) = 0;                                 	// tutto ok, per cui devo azzerare il computo dei file inviati da questo client e ...   
-	sprintf(temp, "rm -r ./%s/%s%d", POOL_ROOT_DIR, POOL_FOLDER_PREFIX, PoolID);
-	system(temp);                     	        	// ..cancellare la cartella "personale" del thread (contiene file inviati e archivio) .. 
-	sprintf(temp, "mkdir ./%s/%s%d", POOL_ROOT_DIR, POOL_FOLDER_PREFIX, PoolID);
-	system(temp);                     			// ..ed infine ricrearla vuota, per i prossimi invii.
+	ws_reset(ws, 0);                     	        	// ..svuotare l'area di lavoro della sessione (memoria e cartella), per i prossimi invii
 	strcpy(remote_path, archive_name); 	        	// in questo modo comunico al chiamante il nome dell'archivio compresso
 	return 0;
 }
 
-int sSHOWLIST ( int client_socket, int counter, int PoolID)  /* Corrispettivo sul client: cCMDS0_478{7: show-list}. */
-{	     /* L'intero [counter] memorizza quanti   sono i file inviati finora dal client al [PoolID]-esimo thread, cui è stato assegnato   */
-	char info[(counter+1)*MAX_MSG_LEN], temp[MAX_MSG_LEN];  	// messaggio e la lista dei nomi di tutti i file inviati fino ad adesso	
-	struct dirent *de = NULL;                                           // per "scorrere" i file nella directory del thread
-	if (counter==0) 													
+int sPROTOCOL ( int client_socket, char version[], session *s ) /* Corrispettivo sul client: negotiate_protocol (alla connessione). */
+{ /* il client propone la versione [version] del protocollo: si concorda la minore tra questa e PROTOCOL_VERSION, salvata nella sessione [s]; > */
+  /* > dal protocollo 4 il client che si riconnette dopo una caduta presenta il token della sessione precedente, che riprende: 0-ok, -1-errore */
+	int v = atoi(version), files;
+	uint64_t token;
+	if (v<1)
+		v = 1;
+	if (v>PROTOCOL_VERSION)
+		v = PROTOCOL_VERSION;
+	s->proto = v;
+	if ( ! SendData(client_socket, &v, sizeof(int)) ) // 1) comunico al client la versione concordata
+		return -1;
+	if (v<4)
+		return 0;
+	if ( ! ReceiveData(client_socket, &token, NULL) ) // 2) token della sessione da riprendere (0: sessione nuova)
+		return -1;
+	files = -1;
+	if (token!=0 && session_resume(s, token)) {
+		files = s->file_counter;
+		log_event(LOG_INFO, "session_resumed", "s:client", inet_ntoa(s->addr.sin_addr), "d:session", s->id, "d:files", files, NULL);
+	}
+	if ( ! SendData(client_socket, &s->token, sizeof(uint64_t)) ) // 3) token con cui riprendere questa sessione, ..
+		return -1;
+	return SendData(client_socket, &files, sizeof(int))-1;       // .. file già inviati se è stata ripresa una sessione (-1: sessione nuova)
+}
+
+int sATTACH ( int client_socket, char token[], session *s ) /* Corrispettivo sul client: attach_streams (connessioni dati, protocollo 9). */
+{ /* la connessione della sessione [s] si aggiunge come connessione dati a quella attiva del [token] (esadecimale); si può fare solo come primo > */
+  /* > comando di una connessione. 0-aggiunta (la sessione [s] non serve più), 1-rifiutata (risposta 0: token sconosciuto, troppe connessioni), -1-errore */
+	uint64_t t = strtoull(token, NULL, 16);
+	int rc = 0;
+	if (s->proto==1 && s->file_counter==0 && t!=0 && (rc = session_attach(s, t))!=0)
+		return (rc==1) ? 0 : -1;
+	return SendData(client_socket, &rc, sizeof(int)) ? 1 : -1;
+}
+
+int sSHOWLIST ( int client_socket, int counter, int proto, workspace *ws )  /* Corrispettivo sul client: cCMDS0_478{7: show-list}. */
+{	     /* L'intero [counter] memorizza quanti   sono i file inviati finora dal client nella sessione, che li ha nell'area di lavoro [ws]; > */
+	     /* > l'elenco non supera quanto il client riceve in un blocco: STATS_MAX_LEN byte dal protocollo 10 ([proto], una sola send di una > */
+	     /* > cartella porta migliaia di file, con percorsi lunghi), meno di MAX_MSG_LEN*5 prima; i nomi che non ci stanno sono riassunti in un'ultima riga */
+	char info[MAX_MSG_LEN], *text = NULL;
+	size_t len = 0, max = (proto>=10) ? STATS_MAX_LEN : MAX_MSG_LEN*5-1; // (i client precedenti aggiungono il NUL nel loro buffer)
+	int i, rc;
+	FILE *out;
+	if (counter==0) {	 							
 		strcpy(info, CYAf"- Non sono stati ancora inviati file al server."RST"\n"); // se non ho file inviati mi fermo qui
-	else {						        	// procedo a elencare i nomi dei file spediti dal client al suo serverthread
-		char path[10+strlen(POOL_ROOT_DIR)+strlen(POOL_FOLDER_PREFIX)];	// deve contenere l'intero percorso della cartella locale di questo thread
-		DIR* d;
-		sprintf(path, "./%s/%s%d/", POOL_ROOT_DIR, POOL_FOLDER_PREFIX, PoolID);	  
-		d = opendir(path);			       	// apro la directory locale di questo thread per poter vedere i files contenuti		
-		if (counter==1) 				        	// se c'è un solo file il ciclo sarà di 3 ma una sola stampa video 
-			sprintf(info, CYAf" - Il server ha ricevuto il seguente file:\n");
-		else  
-			sprintf(info, CYAf" - Il server ha ricevuto i seguenti "GREf"%d"CYAf" files:\n", counter);
-		while ( (de = readdir(d))!= NULL ) {	        	// passo in rassegna tutti i file contenuti nella cartella locale
-			if ( strcmp(de->d_name,".")!=0 && strcmp(de->d_name,"..")!=0) {	// escludo la DIR corrente e quella padre	
-				sprintf(temp,"%4c-> %s\n",' ', de->d_name);	// "%4c" significa che va inserito 4 volte il char specificato (lo spazio)
-				strcat(info, temp);     		// preparo la lista dei nomi (non i path!) dei files, esclusi "." e ".." 
-			}
-		}
-		closedir(d);		        	// ho finito di scorrere la cartella, quindi chiudo la directory
+		return ( SendData(client_socket, info, strlen(info)) -1 );
+	}
+	if ( (out = open_memstream(&text, &len))==NULL ) {      // testo di lunghezza qualsiasi, in memoria (non sullo stack)
+		strcpy(info, REDf" - Elenco dei file non disponibile."RST"\n");
+		return ( SendData(client_socket, info, strlen(info)) -1 );
+	}
+	if (counter==1) 				        	// se c'è un solo file una sola stampa video 
+		fprintf(out, CYAf" - Il server ha ricevuto il seguente file:\n");
+	else  
+		fprintf(out, CYAf" - Il server ha ricevuto i seguenti "GREf"%d"CYAf" files:\n", counter);
+	for (i=0; i<ws->files.n && i<counter; i++) {	  // passo in rassegna tutti i file dell'area di lavoro (in memoria o su disco)
+		if ( ftell(out) + strlen(ws->files.v[i].name) + 8 + MAX_MSG_LEN > max ) // resta posto solo per la riga riassuntiva
+			break;
+		fprintf(out, "%4c-> %s\n", ' ', ws->files.v[i].name);	// "%4c" significa che va inserito 4 volte il char specificato (lo spazio)
 	}
-	return ( SendData(client_socket, &info, strlen(info)) -1 ); 		// 1) invio messaggio, con gestione errori inclusa		
+	if (i < ws->files.n && i < counter)
+		fprintf(out, "%4c.. e altri "GREf"%d"CYAf" file.\n", ' ', ((counter < ws->files.n) ? counter : ws->files.n) - i);
+	fclose(out);
+	rc = SendData(client_socket, text, (len > max) ? max : len); 	// 1) invio messaggio, con gestione errori inclusa
+	free(text);
+	return rc-1;
 }
 
-int sEMPTYLIST ( int client_socket, int counter, int PoolID ) /* Corrispettivo sul client: cCMDS00_478{8:empty-list}. */
-{		         /* [counter] e' il n° di file inviati finora dal client al [PoolID]-esimo threadserver, al quale è stato assegnato   */
-	char temp[MAX_MSG_LEN];	        	// vi appoggio il comando da eseguire e poi il messaggio sull'esito (da mandare al client)
-	if (counter>0) {			        				// se c'è almeno un file inviatomi dal client
-		sprintf(temp, "cd ./%s/%s%d/ && rm * && cd .. && cd ..", POOL_ROOT_DIR, POOL_FOLDER_PREFIX, PoolID);
-		system(temp);   // entro nella cartella locale del thread, cancello tutto e poi "torno su" dove gira il thread
-	}       // non decremento il contatore (oltretutto passato per valore), ci penserà il chiamante
+int sEMPTYLIST ( int client_socket, int counter, workspace *ws ) /* Corrispettivo sul client: cCMDS00_478{8:empty-list}. */
+{		         /* [counter] e' il n° di file inviati finora dal client nella sessione, che ha l'area di lavoro [ws] */
+	char temp[MAX_MSG_LEN];	        	// vi appoggio il messaggio sull'esito (da mandare al client)
+	ws_reset(ws, 1);    // cancello tutti i file (in memoria e nella cartella locale); anche gli invii rimasti a metà (protocollo 4) non verranno >
+	                    // > più ripresi. Non decremento il contatore (oltretutto passato per valore), ci penserà il chiamante
 	strcpy(temp, CYAf" - Sono stati eliminati tutti i file che erano stati inviati al server.\n"RST);				
 	return ( SendData(client_socket, &temp, strlen(temp)) -1 ); 	// 1) invio messaggio con gestione errori inclusa nella funzione chiamata
 }
 
+int sSTATS ( int client_socket, int proto ) /* Corrispettivo sul client: cSTATS{13: stats}. Invia le metriche del server in forma di tabella; > */
+{                                           /* > ai client precedenti al protocollo 8 ([proto]), che stampano al più MAX_MSG_LEN*5 byte, solo un avviso */
+	char info[MAX_MSG_LEN], *text = NULL;
+	size_t len = 0;
+	int rc;
+	FILE *out = (proto>=8) ? open_memstream(&text, &len) : NULL; // testo di lunghezza qualsiasi, in memoria
+	if (out==NULL) {
+		if (proto<8)
+			strcpy(info, REDf" - Il comando stats richiede un client aggiornato (protocollo 8)."RST"\n");
+		else
+			strcpy(info, REDf" - Statistiche non disponibili."RST"\n");
+		return ( SendData(client_socket, info, strlen(info)) -1 );
+	}
+	metrics_text(out);
+	fclose(out);
+	rc = SendData(client_socket, text, (len > STATS_MAX_LEN) ? STATS_MAX_LEN : len); // 1) tabella delle metriche (troncata a STATS_MAX_LEN)
+	free(text);
+	return rc-1;
+}
+
 
 
 /* GESTORI DI SEGNALI */
 
 void gestoreSIGINT ( int signum )  /* Gestore del segnale SIGINT(2).*/
 {		/* [signum] sarà sempre 2, poiché ridefinisco solo la INT, in modo che Ctrl+C provochi la chiusura ordinata del server */	
+	int i;
 	signal(SIGINT, gestoreSIGINT);  		// per retrocompatibilità con alcuni vecchi sistemi operativi
-	pthread_mutex_lock(&mutex);				// poiché accedo a in_service, closing, PoolSleep,
-	if (in_service>0)  	        	// il segnale non ha effetto:  il programma si può chiudere solo quando tutti i client si sono disconnessi
+	pthread_mutex_lock(&mutex);				// poiché accedo a n_sessions, closing, pool_threads
+	if (n_sessions>0)  	        	// il segnale non ha effetto:  il programma si può chiudere solo quando tutti i client si sono disconnessi
 		printf(REDf"\nNon e' possibile terminare il programma finche' ci sono client connessi!"RST"\n");
 	else { 		    // SIGINT fa partire la procedura di chiusura del programma; nell'ordine: pool thread, main thread (via join), main (via join)
 		closing=1;  						// settaggio che indica globalmente l'inizio della chiusura ordinata del server
 		printf(YELf"\nRicevuto segnale INT: avvio procedura di terminazione del server."RST"\n");
-		pthread_cond_broadcast(&PoolSleep); // sveglio i pool thread, che sono certamente tutti inattivi, poichè devono terminare
+		for (i=0; i<pool_threads; i++)
+			sem_post(&PoolItems);     // sveglio i pool thread, che sono certamente tutti inattivi, poichè devono terminare (la coda è vuota)
 		shutdown(ss, 2);    // chiudo il list. socket, così sblocco il thread  sulla accept, in modo che possa terminare (e dopo di lui il main)
+		if (ms>=0)
+			shutdown(ms, 2);    // idem per il thread delle metriche
 	}
 	pthread_mutex_unlock(&mutex);			// avendo fatto la lock all'inizio
 }
 	
 	
 
+// esecuzione dei comandi
+
+int run_command ( session *s ) /* esegue (su un ServerThread del pool) il comando della sessione [s] già letto dal thread di I/O: 1-la sessione > */
+{                              /* > prosegue, 0-il client non risponde più, 2-il client ha chiuso con quit, 3-la connessione è diventata una > */
+                               /* > connessione dati di un'altra sessione (attach) */
+	int choiceID, rc;
+	char parameters[MAX_MSG_LEN+1];
+	char* clientIP = inet_ntoa(s->addr.sin_addr);       // traduco in una stringa l'indirizzo IP del processo client che sto servendo
+	choiceID = identify_command(s->cmd, parameters); // analisi del comando e individuazione eventuale/i parametro/i dello stesso
+	s->choice = choiceID;
+	rc = ((choiceID==12 && s->proto<7) || (choiceID==13 && s->proto<8)) ? 2 : choiceID; // configure-level e stats: i client precedenti al >
+	                        // > protocollo che li ha introdotti li trattano come configure-compressor..
+	if ( ! SendData(s->sock, &rc, sizeof(int)) ) 		 // 3) invio al client il numero d'ordine del comando ricevuto (..solo un messaggio da stampare)
+		return 0;	      // se il client salta chiudo la sessione
+	switch(choiceID){       	// a seconda del comando ricevuto (suo n° d'ordine) faccio determinate azioni  
+		case 0:{ //COMANDO NON VALIDO
+				if (sINVALIDCOMMAND(s->sock)==-1)  // se ho problemi con il socket chiudo la sessione
+					return 0;
+				return 1;	        // semplicemente il comando non è valido quindi ne chiedo un altro a prompt
+		}
+		case 1:{ //help
+				if (sHELP(s->sock)==-1)   // se ho problemi con il socket chiudo la sessione (il client s'è disconnesso)
+					return 0;
+				log_event(LOG_INFO, "command", "s:client", clientIP, "d:session", s->id, "s:command", s->cmd, NULL);		// esito positivo
+				return 1;      // sHelp restituisce o 0 o, se arriva qua, 1, cioè è andato tutto bene			
+		}
+		case 2:{ //configure-compressor [name]
+				int ris = sCONFIGURECOMPRESSOR(s->sock, parameters, &s->p);
+				if (ris==-1)    // gestione errore di comunicazione col client via socket: chiudo la sessione
+					return 0;
+				if (ris==0)          // la configurazione del compressore era corretta, quindi il comando è stato eseguito 
+					log_event(LOG_INFO, "command", "s:client", clientIP, "d:session", s->id, "s:command", s->cmd, NULL); // esito positivo 
+				return 1;  // passa al ciclo dopo sia se il compressore indicato esisteva (ris==0) sia se no (ris==1)
+		}
+		case 3:{ //configure-name [name]
+				int ris = sCONFIGURENAME(s->sock, del_chars(parameters,'\"'), &s->p);
+				if (ris==-1) 
+					return 0;	// gestione errore di comunicazione su socket: chiudo la sessione
+				if (ris==0) // tutto ok: il nome dell futuro archivio è stato cambiato: il comando ha avuto successo	
+					log_event(LOG_INFO, "command", "s:client", clientIP, "d:session", s->id, "s:command", s->cmd, NULL);	// esito positivo	
+				return 1;    // torno al prompt sia se il nome andava bene sia se era "vuoto" (tutti spazi)	
+		}
+		case 4:{ //show-configuration
+				if (sSHOWCONFIGURATION(s->sock,  &s->p)==-1)
+					return 0;	       	// fallisce solo se cade la connessione: in tal caso chiudo la sessione
+				log_event(LOG_INFO, "command", "s:client", clientIP, "d:session", s->id, "s:command", s->cmd, NULL); // esito positivo
+				return 1;	
+		}
+		case 5:{ //send [file]
+			char temp[MAX_MSG_LEN];
+			int i, counter;
+			list FilesToSend = create_path_list(parameters, &counter); // lista dei file che il client vuole inviarmi
+			eager_prepare(&s->ws, &s->p, s->id);    // (--eager) archivio costruito man mano che arrivano i file
+			if ( ! SendData(s->sock, &counter, sizeof(int)) ) 	// 0) invio al client il n° dei file che mi deve spedire 
+				return 0;					
+			if (s->proto>=2) {   // protocollo 2: tutto il lotto in un unico scambio (elenco, manifesto e contenuti, rapporto)
+				int chan[MAX_STREAMS], nchan;
+				pthread_mutex_lock(&park_lock);  // (protocollo 9) connessioni dati aggiunte finora
+				nchan = s->nchan;
+				memcpy(chan, s->chan, nchan*sizeof(int));
+				pthread_mutex_unlock(&park_lock);
+				if (counter>0 && sSENDBATCH(s->sock, &FilesToSend, counter, s->proto, s->id, &s->ws, &s->file_counter, clientIP, chan, nchan)==-1)
+					return 0;
+				return 1;
+			}
+			for(i=0; i<counter; i++) {  // finchè ci sono file da inviare
+				strcpy(temp, extract_path(&FilesToSend));  //  estraggo dalla testa il path del file da inviare e lo salvo
+				rc = sSEND(s->sock, temp, &s->ws, &s->file_counter);
+				if ( rc == -1)   	// il client non risponde, mi libero per poter essere assegnato ad un altro
+					return 0;
+				if ( rc==1 )      // file non inviato per problemi non critici (e.g. path inesistente, permessi mancanti)..
+					continue; // ..passo a quello successivo
+				log_event(LOG_INFO, "file_received", "s:client", clientIP, "d:session", s->id, "s:file", temp,
+				          "d:files", s->file_counter, NULL);  // esito positivo
+			}
+			return 1;
+		}
+		case 6:{ //compress [path]
+			if ( ! SendData(s->sock, &s->file_counter, sizeof(int)) ) // 0) deduce da countere quello cosa fare (nulla se e' 0)    
+				return 0;     // problema di connessione: chiudo la sessione
+			if (s->file_counter!=0) {  	//  solo se sono stati inviati file faccio partire la funzione di decompressione
+				rc = sCOMPRESS(s->sock, parameters, s->p, s->proto, s->id, &s->ws, &s->file_counter, clientIP ); 
+				if (rc == -1)   	// c'è stata la disconnessione del client durante l'esecuzione della sCompress 
+					return 0;
+				if (rc==0) 										// tutto bene
+					log_event(LOG_INFO, "archive_sent", "s:client", clientIP, "d:session", s->id, "s:archive", parameters, NULL);
+			}      	// il caso di rc=1 significa che la compress ha avuto problemi e quindi non è stata eseguita tutta e >
+			return 1;      	// dunque come nel caso di successo vado semplicemente a ricevere un nuovo comando dal prompt
+		}
+		case 7:{ //show-list
+				if (sSHOWLIST(s->sock, s->file_counter, s->proto, &s->ws)==-1)  // problemi col s. del client? Chiudo la sessione
+					return 0;
+				log_event(LOG_INFO, "command", "s:client", clientIP, "d:session", s->id, "s:command", s->cmd, NULL);
+				return 1;       	// questa funzione non ha successo solo se salta la connessione	
+		}
+		case 8:{ //empty-list
+				
+				if (sEMPTYLIST(s->sock, s->file_counter, &s->ws)==-1) // problemi socket del client? Chiudo la sessione
+					return 0;
+				s->file_counter=0;
+				log_event(LOG_INFO, "command", "s:client", clientIP, "d:session", s->id, "s:command", s->cmd, NULL); // esito positivo
+				return 1;       	// questa funzione non ha successo solo se salta la connessione	
+		}			
+		case 10:{ //configure-threads [n]
+				int ris = sCONFIGURETHREADS(s->sock, parameters, &s->p);
+				if (ris==-1) 
+					return 0;	// gestione errore di comunicazione su socket: chiudo la sessione
+				if (ris==0)
+					log_event(LOG_INFO, "command", "s:client", clientIP, "d:session", s->id, "s:command", s->cmd, NULL);	// esito positivo	
+				return 1;
+		}
+		case 12:{ //configure-level [n]
+				int ris = sCONFIGURELEVEL(s->sock, parameters, &s->p);
+				if (ris==-1) 
+					return 0;	// gestione errore di comunicazione su socket: chiudo la sessione
+				if (ris==0)
+					log_event(LOG_INFO, "command", "s:client", clientIP, "d:session", s->id, "s:command", s->cmd, NULL);	// esito positivo	
+				return 1;
+		}
+		case 13:{ //stats
+				if (sSTATS(s->sock, s->proto)==-1)
+					return 0;	       	// fallisce solo se cade la connessione: in tal caso chiudo la sessione
+				log_event(LOG_INFO, "command", "s:client", clientIP, "d:session", s->id, "s:command", s->cmd, NULL); // esito positivo
+				return 1;
+		}
+		case 11:{ //protocol [versione]
+				if (sPROTOCOL(s->sock, parameters, s)==-1)
+					return 0;
+				return 1;
+		}
+		case 14:{ //attach [token]
+				int ris = sATTACH(s->sock, parameters, s);
+				if (ris==-1)
+					return 0;
+				return (ris==0) ? 3 : 1;   // aggiunta: la connessione appartiene ora all'altra sessione
+		}
+		case 9:{ //quit
+			return 2;			// la disconnessione del client avviene in modo corretto
+		} 
+	}    	//fine switch
+	return 1;
+}
+
+
 /* CODICI DEI THREAD SERVER */
 
 // thread del pool
-void *codice__Server_Thread ( void *PoolID ) /* THREAD SERVER: codice di ciascuno dei POOL_DIMENSION ServerThread del pool, creato dal ListenerThread */
+void *codice__Server_Thread ( void *PoolID ) /* THREAD SERVER: codice di ciascuno dei ServerThread del pool (da pool_min a pool_max), creati con grow_pool */
 { 	
-	int id, file_counter, choiceID, Bs_rcvd, c_sock, rc;    	// c_sock è il socket con il quale il thread comunica col client assegnatogli 
-	char clientCommand[MAX_MSG_LEN+1], parameters[MAX_MSG_LEN+1];
-	char shellCommand[ 20 + strlen(POOL_ROOT_DIR) + strlen(POOL_FOLDER_PREFIX)];
- 	int quit;        //segnala se la disconnessione del client è stata anomala (0) o no (1, cioè tramite il comando quit)
- 	struct sockaddr_in c_address;   	// ci metterò i dati del client servito (passati dal Listener tramite la variabile globale c_sockaddr_array)
- 	comp_param p;   		// la struct contiene i parametri (nome compressore e archivio) per questo thread (messi di default ad ogni nuovo >
-	p.archive_name=NULL;		    // > client): inizialmente tale struttura è vuota (pointer a NULL e indice inesistente) ma sarà presto riempita
-	p.compressor_index=-1;
-	id = *(int*)PoolID;		   // id assegnato dal padre al thread in esecuzione (da 0 a POOL_DIMENSION-1), non è il suo TID (quello di self)!!
-	printf(RST"Creato thread %d.\n", id);           // informo che sono stato creato
+	int id, rc, n;
+	struct timespec t0;
+	session *s;     // sessione servita (ne esegue un comando alla volta: tra un comando e l'altro la sessione resta sul suo thread di I/O)
+	id = *(int*)PoolID;		   // id assegnato da grow_pool al thread in esecuzione (progressivo), non è il suo TID (quello di self)!!
+	free(PoolID);
 	pthread_mutex_lock(&mutex);	        	// poichè accedo alla variabile globale ReadyThreads e poi uso la signal
-	if ( (++ReadyThreads)==POOL_DIMENSION )  // se è l'ultimo PoolThread a bloccarsi sveglia il Listener (in attesa sulla create_pool) in modo che >
+	n = pool_threads;
+	if ( (++ReadyThreads)==pool_min )  // se è l'ultimo PoolThread iniziale a bloccarsi sveglia il Listener (in attesa sulla create_pool) in modo che >
 		pthread_cond_signal(&PoolReady); // > esso sappia che tutti i thread del pool sono pronti e può iniziare fare le accept e assegnare i client
 	pthread_mutex_unlock(&mutex);	        	// provvede eventualmente anche a rilasciare il lock per la signal
-	do {     	        	// ad ogni ciclo ci si blocca in attesa che gli si assegni un client e quando si sveglia lo si serve  
-		sprintf(shellCommand, "mkdir %s/%s%d", POOL_ROOT_DIR, POOL_FOLDER_PREFIX, id); 
-		system(shellCommand);	        	// creo la cartella personale del thread (sotto POOL_ROOT_DIR, già creata dal ListenerThread)
-		file_counter = 0;    		        	// inizialmente non ho file inviati dal client
-		quit=0;			      //solo il comando quit lo setta, segnalando una disconnessione del client ordinata 		
- 		if (p.archive_name!=NULL)    // se puntava ad un vecchio valore (il nome scelto dall'ultimo client servito) elimino la stringa (dinamica) >
-			free(p.archive_name); // >  puntata dal campo p della struttura, in modo che successivamente possa ricrearla col nome di default    
- 		p.archive_name = malloc( (strlen(DEFAULT_ARCHIVE_NAME)+1)*(sizeof(char)) );
-		strcpy ( p.archive_name, DEFAULT_ARCHIVE_NAME );                // impostazione di default sul nome dell'archivio compresso (una stringa)
- 		p.compressor_index = DEFAULT_COMPRESSOR_INDEX; // opzione di default sul compressore da utilizzare (indice entry compressors_matrix)
-		wait_and_start(&c_sock, &c_address, id);       // attendo che il main thread mi assegni un client oppure mi svegli la SIGINT per terminare 
-		while(closing==0){ // resta in attesa di comandi: una volta entrato nel  ciclo interagisce col client assegnatogli (finisce con INT)	 
-			char* clientIP = inet_ntoa(c_address.sin_addr);       // traduco in una stringa l'indirizzo IP del processo client che sto servendo
-			if ( ! ReceiveData(c_sock, &clientCommand, &Bs_rcvd) )  	// 2) ricezione del comando inviato dal client
-				break;  	// se il client salta termino il ciclo di attesa comandi e avvio la procedura per ricevere un altro client
-			clientCommand[Bs_rcvd] = '\0';
-			choiceID = identify_command(clientCommand, parameters); // analisi del comando e individuazione eventuale/i parametro/i dello stesso
-			if ( ! SendData(c_sock, &choiceID, sizeof(int)) ) 		 // 3) invio al client il numero d'ordine del comando ricevuto 
-				break;	      // se il client salta termino l' attesa comandi e avvio la procedura per ricevere un altro client
-			switch(choiceID){       	// a seconda del comando ricevuto (suo n° d'ordine) faccio determinate azioni  
-				case 0:{ //COMANDO NON VALIDO
-						if (sINVALIDCOMMAND(c_sock)==-1)  // se ho problemi con il socket passo a servire un altro client
-							break;
-						continue;	        // semplicemente il comando non è valido quindi ne chiedo un altro a prompt
-				}
-				case 1:{ //help
-						if (sHELP(c_sock)==-1)   // se ho problemi con il socket servo un altro client (questo s'è disconnesso)
-							break;
-						printf(YELf"CLIENT "CYAf"%s"YELf" eseguito il comando "
-								GREf"help"YELf".\n"RST, clientIP);		// esito positivo
-						continue;      // sHelp restituisce o 0 o, se arriva qua, 1, cioè è andato tutto bene			
-				}
-				case 2:{ //configure-compressor [name]
-						int ris = sCONFIGURECOMPRESSOR(c_sock, parameters, &p);
-						if (ris==-1)    // gestione errore di comunicazione col client via socket: ne servo un altro
-							break;
-						if (ris==0)          // la configurazione del compressore era corretta, quindi il comando è stato eseguito 
-							printf(YELf"CLIENT "CYAf"%s"YELf" eseguito il comando "
-									GREf"%s"YELf".\n"RST, clientIP, clientCommand); // esito positivo 
-						continue;  // passa al ciclo dopo sia se il compressore indicato esisteva (ris==0) sia se no (ris==1)
-				}
-				case 3:{ //configure-name [name]
-						int ris = sCONFIGURENAME(c_sock, del_chars(parameters,'\"'), &p);
-						if (ris==-1) 
-							break;	// gestione errore di comunicazione su socket: mi rendo libero per un altro client
-						if (ris==0) // tutto ok: il nome dell futuro archivio è stato cambiato: il comando ha avuto successo	
-							printf(YELf"CLIENT "CYAf"%s"YELf" eseguito il comando "
-							       GREf"%s"YELf".\n"RST, clientIP, clientCommand);	// esito positivo	
-						continue;    // torno al prompt sia se il nome andava bene sia se era "vuoto" (tutti spazi)	
-				}
-				case 4:{ //show-configuration
-						if (sSHOWCONFIGURATION(c_sock,  &p)==-1)
-							break;	       	// fallisce solo se cade la connessione: in tal caso mi libero per un altro client
-						printf(YELf"CLIENT "CYAf"%s"YELf" eseguito il comando "
-								GREf"show-configuration"YELf".\n"RST, clientIP ); // esito positivo
-						continue;	
-				}
-				case 5:{ //send [file]
-					char temp[MAX_MSG_LEN];
-					int i, counter;
-					list FilesToSend = create_path_list(parameters, &counter); // lista dei file che il client vuole inviarmi
-					if ( ! SendData(c_sock, &counter, sizeof(int)) ) 	// 0) invio al client il n° dei file che mi deve spedire 
-						break;					
-					for(i=0; i<counter; i++) {  // finchè ci sono file da inviare
-						strcpy(temp, extract_path(&FilesToSend));  //  estraggo dalla testa il path del file da inviare e lo salvo
-						rc = sSEND(c_sock, temp, id, &file_counter);
-						if ( rc == -1)   	// il client non risponde, mi libero per poter essere assegnato ad un altro
-							break;
-						if ( rc==1 )      // file non inviato per problemi non critici (e.g. path inesistente, permessi mancanti)..
-							continue; // ..passo a quello successivo
-						strcpy(parameters,temp);
-						if (file_counter==1) 	// invio tutto ok
-							strcpy(temp,"("CYAf"1"RST" file ricevuto).\n");
-						else    	// preparo il messaggio di successo per l'invio di questo singolo file
-							sprintf(temp,"("CYAf"%d"RST" file ricevuti).\n", file_counter);
-						printf("SERVER: ricevuto il file "CYAf"%s"RST" dal client "
-								GREf"%s"RST" %s", parameters, clientIP, temp); // esito positivo
-					}
-					continue;
-				}
-				case 6:{ //compress [path]
-					if ( ! SendData(c_sock, &file_counter, sizeof(int)) ) // 0) deduce da countere quello cosa fare (nulla se e' 0)    
-						break;     // problema di connessione: torno all'assegnazione di un nuovo client da parte del ListenerThread
-					if (file_counter!=0) {  	//  solo se sono stati inviati file faccio partire la funzione di decompressione
-						rc = sCOMPRESS(c_sock, parameters, p, id, &file_counter, clientIP ); 
-						if (rc == -1)   	// c'è stata la disconnessione del client durante l'esecuzione della sCompress 
-							break;
-						if (rc==0) 										// tutto bene
-							printf("SERVER: spedito archivio compresso "CYAf"%s"RST" al client "
-									GREf"%s"RST".\n", parameters, clientIP );	
-					}      	// il caso di rc=1 significa che la compress ha avuto problemi e quindi non è stata eseguita tutta e >
-					continue;      	// dunque come nel caso di successo vado semplicemente a ricevere un nuovo comando dal prompt
-				}
-				case 7:{ //show-list
-						if (sSHOWLIST(c_sock, file_counter, id)==-1)  // problemi col s. del client? Mi libero per servirne un altro
-							break;
-						printf(YELf"CLIENT "CYAf"%s"YELf" eseguito il comando "
-								GREf"show-list"YELf".\n"RST, clientIP );
-						continue;       	// questa funzione non ha successo solo se salta la connessione	
-				}
-				case 8:{ //empty-list
-						
-						if (sEMPTYLIST(c_sock, file_counter, id)==-1) // problemi socket del client? Mi libero per servirne un altro
-							break;
-						file_counter=0;
-						printf(YELf"CLIENT "CYAf"%s"YELf" eseguito il comando "
-								GREf"empty-list"YELf".\n"RST, clientIP ); // esito positivo
-						continue;       	// questa funzione non ha successo solo se salta la connessione	
-				}			
-				case 9:{ //quit
-					quit=1;				// la disconnessione del client avviene in modo corretto
-					break;          	// esco dallo switch (voglio liberarmi e servire un nuovo client)
-				} 
-			}    	//fine switch
-			break;         	// se esco dallo switch (solo via quit) esco anche dal while sul prompt (attesa comandi) 		
-		} 	// fine while sul prompt (mancato contatto col socket del client o quit dello stesso)
-		if (closing==0) {       // se è vero sono uscito per disconnessione del client, non per arrivo della SIGINT (chiusura server) 
-			pthread_mutex_lock(&mutex);    	// decremento  in_service (devo usare il mutex) per iniziare la procedura di liberazione..
-			in_service--;               // .. ma non sveglio subito il Listener (lo farò nella  wait_and_start) altrimenti (se tutti i thread >
-			pthread_mutex_unlock(&mutex);  // >  sono occupati) potrebbe accadergli di fare assign_client, trovare in_service<NUMTHREADS ed   > 
-			if (quit==1){ //disconnessione client via quit
-				if (shutdown(c_sock, SHUT_RDWR)<0)      	// >  eseguire una signal senza effetto perchè questo thread non è ancora pronto
-					perror("shutdown");
-				if (close(c_sock)<0)         								
-					perror("close");	 	// chiudo il socket di comunicazione ("connected") col client che stavo servendo 
-				printf( REDf"CLIENT "RST"%s"REDf" chiude la connessione ", inet_ntoa(c_address.sin_addr) );
-			}
-			else { 							// la connessione col client è saltata (non per effetto del comando quit)
-				shutdown(c_sock, SHUT_RDWR);
-				close(c_sock);
-				printf( REDf"CLIENT "RST"%s"REDf" disconnesso in modo inaspettato ",inet_ntoa(c_address.sin_addr) );	
-			}			
-			printf( "["RST"%d"REDf"/%d thread liberi]\n"RST, (POOL_DIMENSION-in_service), POOL_DIMENSION ); 
-		} 
-		sprintf(shellCommand, "rm -r ./%s/%s%d", POOL_ROOT_DIR, POOL_FOLDER_PREFIX, id); 
-		system(shellCommand);   // cancello la cartella personale del pool thread server (la directory madre verrà eliminata dal Listener)
-	} 	// fine while del pool thread server (vi esco solo se il server sta terminando)
-	while (closing==0);     	// condizione del do..while in cui ad ogni ciclo servo un client
-	printf( RST"\nTerminato thread %d", id );
+	log_event(LOG_INFO, "pool_thread_start", "d:pool_thread", id, "d:pool", n, NULL);  // informo che sono stato creato
+	while ( (s = wait_and_start(id)) != NULL ) {  // attendo che un thread di I/O mi consegni una sessione con un comando pronto, o di dover terminare 
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		memset(&cur_trace, 0, sizeof(trace));
+		cur_trace.on = log_trace;
+		rc = run_command(s);              // eseguo il comando (i trasferimenti di file avvengono qui, in modo bloccante)
+		hist_record(&srv_metrics.cmd[s->choice], elapsed_us(&t0)); // durata del comando, per n° d'ordine (metriche)
+		if (cur_trace.on)                 // (--trace) fasi del comando: rete in ingresso, disco, compressione, rete in uscita
+			log_event(LOG_INFO, "trace", "d:session", s->id, "s:command", command_names[s->choice],
+			          "u:start_us", t0.tv_sec*1000000ULL + t0.tv_nsec/1000, "u:total_us", elapsed_us(&t0),
+			          "u:recv_us", cur_trace.us[TRACE_RECV], "u:recv_bytes", cur_trace.bytes[TRACE_RECV],
+			          "u:write_us", cur_trace.us[TRACE_WRITE], "u:write_bytes", cur_trace.bytes[TRACE_WRITE],
+			          "u:compress_us", cur_trace.us[TRACE_COMPRESS], "u:compress_bytes", cur_trace.bytes[TRACE_COMPRESS],
+			          "u:send_us", cur_trace.us[TRACE_SEND], "u:send_bytes", cur_trace.bytes[TRACE_SEND], NULL);
+		if (rc==0)
+			atomic_fetch_add_explicit(&srv_metrics.cmd_lost[s->choice], 1, memory_order_relaxed);
+		if (rc==1)
+			session_wait_command(s);   // la sessione torna in attesa del prossimo comando sul suo thread di I/O (senza occupare questo thread)
+		else if (rc==3)
+			session_detach(s);         // connessione passata a un'altra sessione (attach)
+		else
+			session_end(s, rc==2);     // quit (rc=2) o connessione caduta (rc=0)
+	} 	// fine while del pool thread server (vi esco se il server sta terminando o se il pool si restringe)
+	log_event(LOG_INFO, "pool_thread_stop", "d:pool_thread", id, NULL);
 	pthread_exit(NULL);
 } //fine codice pool thread 
 
 
+// thread di I/O
+void *codice__IO_Thread ( void *IoID ) /* THREAD DI I/O: attende con epoll i comandi di tutte le sessioni affidategli, li legge senza bloccarsi > */
+{                                      /* > e passa ai ServerThread del pool solo le sessioni con un comando completo da eseguire            */
+	int io = *(int*)IoID, n, i;
+	struct epoll_event events[IO_MAX_EVENTS];
+	while (closing==0) {               // il timeout permette di accorgersi della chiusura del server (SIGINT)
+		n = epoll_wait(epfd[io], events, IO_MAX_EVENTS, IO_TIMEOUT_MS);
+		if (io==0)
+			session_expire();          // un solo thread di I/O controlla le sessioni parcheggiate
+		for (i=0; i<n; i++) {
+			session *s = events[i].data.ptr;
+			int rc = read_command(s);
+			if (rc==1)
+				assign_client(s);          // comando completo: lo eseguirà un ServerThread
+			else if (rc==0)
+				session_wait_command(s);   // comando incompleto: riprendo la lettura al prossimo evento
+			else
+				session_end(s, 0);         // il client ha chiuso la connessione (o ha inviato un frame non valido)
+		}
+	}
+	pthread_exit(NULL);
+}
+
+
+// thread delle metriche
+void *codice__Metrics_Thread ( void *unused ) /* THREAD DELLE METRICHE: risponde sul socket [ms] (127.0.0.1) alle richieste HTTP "GET /metrics" > */
+{                                            /* > con le metriche in formato Prometheus, una connessione alla volta, finché SIGINT non lo chiude */
+	char req[1024];
+	struct timeval tv = { 2, 0 };   // un client lento non blocca le richieste successive oltre 2 secondi
+	int c, n;
+	FILE *out;
+	while (1) {
+		c = accept(ms, NULL, NULL);
+		if (c<0) {
+			if (closing==0 && errno==EINTR)
+				continue;
+			break;                      // socket chiuso da SIGINT
+		}
+		setsockopt(c, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		n = recv(c, req, sizeof(req)-1, 0);
+		req[(n>0) ? n : 0] = '\0';
+		out = fdopen(c, "w");
+		if (out==NULL) {
+			close(c);
+			continue;
+		}
+		if (strncmp(req, "GET /metrics", 12)==0 && (req[12]==' ' || req[12]=='?')) {
+			fprintf(out, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nConnection: close\r\n\r\n");
+			metrics_prometheus(out);
+		}
+		else
+			fprintf(out, "HTTP/1.0 404 Not Found\r\nContent-Type: text/plain\r\nConnection: close\r\n\r\nGET /metrics\n");
+		fclose(out);                    // chiude anche il socket
+	}
+	pthread_exit(NULL);
+}
+
+
 // thread di ascolto
 void *codice__Listener_Thread ( void* serverPort ) /* THREAD LISTENER: creato main, a sua volta crea POOL_DIMENSION thread e si mette in ascolto  > */
 {  /*> di richieste di client da assegnare loro; [serverPort] indica la porta su cui ascolta il server (necessario per creare il socket d'ascolto)     */
-	int i, rc, listening_sock_server, port;             // il socket è di tipo "listening" (per accettare le richieste)
+	int i, listening_sock_server, port;             // il socket è di tipo "listening" (per accettare le richieste)
 	struct sockaddr_in client_address, server_address;  // contengono l'indirizzo del client e del server
 	pthread_attr_t attr;
-	pthread_t pool_thread[POOL_DIMENSION];
-	int *taskids[POOL_DIMENSION];
+	pthread_t io_thread[IO_THREADS];                    // thread di I/O (attendono i comandi delle sessioni)
+	pthread_t metrics_thread;                           // thread delle metriche (endpoint Prometheus locale)
+	int io_ids[IO_THREADS];
 	int saddrlen= sizeof(struct sockaddr_in); 		    // lunghezza struttura sockaddr_in 
 	int option = 1;				         // per settare il SO_REUSEADDR della listening socket a "true" (non-zero value)
-	char shellCommand[50+2*strlen(POOL_ROOT_DIR)];
-	void *status=NULL;				      	// per la join sui thread del pool quando sto terminando
 	printf(GREf"Creato thread di ascolto."RST"\n");     // informo che sono stato creato  
-	sprintf(shellCommand, "rm -fr %s && mkdir %s", POOL_ROOT_DIR,  POOL_ROOT_DIR);        
-	system(shellCommand);			        	// directory che conterrà le POOL_DIMENSION cartelle dei vari Thread del pool 
+	rm_tree_at(AT_FDCWD, POOL_ROOT_DIR);        // directory che conterrà le cartelle delle sessioni (vuota: via quelle di un'esecuzione precedente)
+	mkdir(POOL_ROOT_DIR, 0755);
+	pool_dirfd = open(POOL_ROOT_DIR, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	reclaim_start();                            // thread di pulizia delle cartelle scartate dalle sessioni
+	mkdir(ARCHIVE_CACHE_DIR, 0755);             // cache degli archivi: come lo store, sopravvive ai riavvii ..
+	cache_clean();                              // .. tranne gli archivi rimasti a metà
+	cache_evict();                              // (il budget potrebbe essere cambiato)
+	mkdir(BLOB_STORE_DIR, 0755);                // store dei contenuti: se c'è già lo riuso (i file collegati da sessioni passate restano validi)
 	pthread_attr_init(&attr);                           // inizializzazione attributi
 	pthread_attr_setdetachstate(&attr,PTHREAD_CREATE_JOINABLE);
-	create_pool( taskids, pool_thread, codice__Server_Thread ); // creazione pool (POOL_DIMENSION thread gestori)
+	if (!sched_init(job_workers)) {                    // scheduler dei lavori di compressione (dimensionato sui core, non sul pool)
+		char *sret = malloc(20);
+		strcpy(sret,"Scheduler error");
+		pthread_exit((void*)sret);
+	}
+	create_pool();                                      // creazione pool (pool_min thread gestori, poi cresce con il carico)
+	for (i=0; i<IO_THREADS; i++) {                      // creazione dei thread di I/O, ciascuno con la propria istanza epoll
+		io_ids[i] = i;
+		epfd[i] = epoll_create1(0);
+		if (epfd[i]<0 || pthread_create(&io_thread[i], &attr, codice__IO_Thread, (void*)&io_ids[i])!=0) {
+			char *sret = malloc(20);
+			strcpy(sret,"I/O thread error");
+			perror("epoll");
+			pthread_exit((void*)sret);
+		}
+	}
 	port = *(int*) serverPort;
 	memset(&server_address, 0, sizeof(server_address)); // preparazione indirizzo del server (in ascolto su una qualsiasi delle sue NIC)
 	server_address.sin_family = AF_INET;                // uso le HtoNl/s perchè l’indirizzo IP (Long) ed il n° di porta (Short)  devono essere > 
@@ -923,6 +4949,16 @@ void *codice__Listener_Thread ( void* serverPort ) /* THREAD LISTENER: creato ma
 		perror("listen");
 		pthread_exit((void*)sret);
 	}
+	ms = (port+METRICS_PORT_OFFSET<=65535) ? metrics_open(port+METRICS_PORT_OFFSET) : -1; // metriche: se la porta non è disponibile il server >
+	                                                  // > funziona comunque, senza endpoint
+	if (ms>=0 && pthread_create(&metrics_thread, &attr, codice__Metrics_Thread, NULL)!=0) {
+		close(ms);
+		ms = -1;
+	}
+	if (ms>=0)
+		printf(GREf"Metriche (Prometheus) su "CYAf"http://127.0.0.1:%d/metrics"RST"\n", port+METRICS_PORT_OFFSET);
+	else
+		fprintf(stderr, REDf"Metriche non disponibili: porta %d non utilizzabile."RST"\n", port+METRICS_PORT_OFFSET);
 	printf (GREf"Attesa di connessioni..."RST"\n"); 
 	while(1) {           		      	// rimane permanentemente in attesa di connessioni richieste dai client, poi le smista ad un thread del pool
 		int client_sock; 	       	// socket di tipo "connected" (per la comunicazione vera e propria con il client)
@@ -933,60 +4969,803 @@ void *codice__Listener_Thread ( void* serverPort ) /* THREAD LISTENER: creato ma
 				perror("accept");        // è "giusto" che la accept dia errore quando SIGINT chiude il listening socket (closing=1)
 			break;
 		}
-		if (closing==0)
-			assign_client(client_address, client_sock); // sveglio dal pool un Thread Server a cui assegnare il client che si sta connettendo
-		else
+		if (closing!=0)
 			break;          	// quando termino esco dal ciclo (non c'è un client connesso poichè la accept è stata terminata da SIGINT)  
-		if ( ! SendData(client_sock, &i, sizeof(int)) )	// 1) comunico al client che gli ho assegnato un thread del pool (potrà inviare comandi)
-			continue;	 	// se il client che si era connesso non riceve nulla passo al prossimo
+		else {
+			struct epoll_event ev;
+			int greeting = 1;
+			session *sn = session_open(client_sock, client_address); // la sessione vive finché il client resta connesso (nessun thread la occupa)
+			if (sn==NULL) {
+				close(client_sock);
+				continue;
+			}
+			SetNoDelay(client_sock);    // comandi e risposte sono frame brevi: partono subito, senza attendere ACK (Nagle)
+			if ( ! SendData(client_sock, &greeting, sizeof(int)) ) {	// 1) comunico al client che la sessione è aperta (potrà inviare comandi)
+				session_end(sn, 0); 	// se il client che si era connesso non riceve nulla passo al prossimo
+				continue;
+			}
+			ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+			ev.data.ptr = sn;
+			if (epoll_ctl(epfd[sn->io], EPOLL_CTL_ADD, client_sock, &ev)<0) { // affido la sessione al suo thread di I/O
+				perror("epoll_ctl");
+				session_end(sn, 0);
+			}
+		}
 	} // per effetto della SIGINT il ciclo termina (break del secondo if dentro il ciclo infinito)
-	for (i=0; i<POOL_DIMENSION; i++) { // da qui si passa al codice del singolo thread
-		rc = pthread_join(pool_thread[i], (void**)&status); // si blocca finchè non terminano tutti i pool threads (figli), poi > 
-		if (rc) {		        	            // > quando gli ha joinati tutti (sono finiti) prosegue la sua procedura di chiusura
-			char *sret = malloc(15);
-			printf("Errore nel join del thread n° %d: codice di ritorno %d\n,", i, rc);
-			strcpy(sret,"Join error");		
-			ListenerSock_and_Sem_Destroy(listening_sock_server);
-			perror("join");
-			pthread_exit((void*)sret);
-		}	    
-	} // fine attesa di join su tutti i thread del pool
+	pthread_mutex_lock(&mutex);       // i thread del pool sono distaccati: attendo che siano terminati tutti (li ha svegliati SIGINT)
+	while (pool_threads>0)
+		pthread_cond_wait(&PoolExit, &mutex);
+	pthread_mutex_unlock(&mutex);
+	sched_stop();                     // nessuna sessione, quindi nessun lavoro: fermo lo scheduler
+	if (ms>=0) {                      // il thread delle metriche è uscito dalla accept (socket chiuso da SIGINT)
+		pthread_join(metrics_thread, NULL);
+		close(ms);
+	}
+	for (i=0; i<IO_THREADS; i++) {  // i thread di I/O escono dalla epoll_wait entro IO_TIMEOUT_MS da quando closing=1
+		pthread_join(io_thread[i], NULL);
+		close(epfd[i]);
+	}
 	ListenerSock_and_Sem_Destroy(listening_sock_server);// distruggo i semafori e chiudo il socket di ascolto 
 	pthread_attr_destroy(&attr); 						
-	sprintf(shellCommand, "rm -r %s", POOL_ROOT_DIR);// distruzone directory "madre", quella che conteneva le cartelle dei thread, ciascuno >
-	system(shellCommand);			                   // > dei quali ha già provveduto, prima di terminare, a cancellare la propria (e.g. xx22)	
+	reclaim_stop();                   // cancella le cartelle scartate ancora in coda (quelle delle ultime sessioni chiuse)
+	close(pool_dirfd);
+	rm_tree_at(AT_FDCWD, POOL_ROOT_DIR);// distruzone directory "madre", quella che conteneva le cartelle delle sessioni, ciascuna delle quali >
+	                                  // > è già stata cancellata alla chiusura della sessione (e.g. T22)
 	printf(GREf"\nTerminato thread di ascolto."RST"\n");  // comunico che il listener thread è in procino di terminare (sarà jionato dal main)
 	pthread_exit(NULL);
 } //fine main thread
 
 
 
+#ifdef CODEC_BENCH
+
+/*       BANCO DI PROVA DEI CODEC (compilato al posto del server con -DCODEC_BENCH)     */
+
+// funzioni (7) che preparano i corpus: sintetici (text, log, binary, media, tiny) o cartelle già esistenti
+uint64_t xorshift64 ( uint64_t *s ) /* generatore pseudo-casuale (xorshift64) dei corpus sintetici: ripetibili a parità di seme */
+{
+	*s ^= *s << 13;
+	*s ^= *s >> 7;
+	*s ^= *s << 17;
+	return *s;
+}
+
+size_t cb_line ( uint64_t *s, int log, char *line ) /* scrive in [line] una riga di testo ([log]=0) o di log ([log]=1), dal generatore [s]: > */
+{                                                   /* > parole con frequenze sbilanciate, come in un testo vero; ne restituisce la lunghezza */
+	static const char *words[] = { "il", "di", "che", "la", "e", "un", "per", "non", "in", "una", "del", "con", "si", "archivio",
+	        "server", "client", "file", "sessione", "compressione", "thread", "socket", "blocco", "richiesta", "risposta", "errore",
+	        "connessione", "protocollo", "cartella", "comando", "dati", "byte", "codice", "valore", "tempo", "coda", "livello" };
+	static const char *levels[] = { "INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR" };
+	uint64_t r = xorshift64(s);
+	size_t n = 0;
+	int i, k = 6 + r%12;
+	if (log)
+		n = sprintf(line, "2026-10-16 %02d:%02d:%02d.%03d %-5s [worker-%d] ", (int)(r>>8)%24, (int)(r>>16)%60, (int)(r>>24)%60,
+		            (int)(r>>32)%1000, levels[(r>>42)%6], (int)(r>>48)%16);
+	for (i=0; i<k; i++) {
+		r = xorshift64(s);
+		n += sprintf(line+n, (i==0) ? "%s" : " %s", words[ r % (1 + (r>>32) % 36) ]); // indici piccoli più frequenti (Zipf, circa)
+		if (log && (r>>40)%4==0)
+			n += sprintf(line+n, " id=%u ms=%u", (unsigned)(r>>44)%100000, (unsigned)(r>>20)%2000);
+	}
+	line[n++] = log ? '\n' : ((r>>50)%5==0 ? '\n' : '.');
+	if (!log && line[n-1]=='.')
+		line[n++] = ' ';
+	return n;
+}
+
+int cb_write_file ( const char *path, int kind, uint64_t size, uint64_t *seed ) /* crea [path] con [size] byte sintetici: 0-testo, 1-log, > */
+{                                                                              /* > 2-casuali (media già compressi). 1-ok, 0-errore */
+	char buf[CHUNK_SIZE+1024];           // una riga non supera 1024 byte
+	size_t n = 0, w;
+	uint64_t done = 0, r;
+	FILE *fp = fopen(path, "wb");
+	if (fp==NULL)
+		return 0;
+	while (done < size) {
+		if (kind==2) {
+			r = xorshift64(seed);
+			memcpy(buf+n, &r, 8);
+			n += 8;
+		}
+		else
+			n += cb_line(seed, kind, buf+n);
+		if (n >= CHUNK_SIZE || done+n >= size) {
+			w = (done+n > size) ? (size_t)(size-done) : n;
+			if ( fwrite(buf, 1, w, fp)!=w ) {
+				fclose(fp);
+				return 0;
+			}
+			done += w;
+			n = 0;
+		}
+	}
+	return fclose(fp)==0;
+}
+
+uint64_t cb_copy_file ( const char *from, const char *to, uint64_t max ) /* copia in [to] al più [max] byte del file [from]; restituisce i byte > */
+{                                                                    /* > copiati (0 se [from] non è leggibile) */
+	char buf[CHUNK_SIZE];
+	uint64_t done = 0;
+	size_t n;
+	FILE *in = fopen(from, "rb"), *out;
+	if (in==NULL)
+		return 0;
+	out = fopen(to, "wb");
+	if (out==NULL) {
+		fclose(in);
+		return 0;
+	}
+	while ( done<max && (n = fread(buf, 1, (max-done > CHUNK_SIZE) ? CHUNK_SIZE : (size_t)(max-done), in)) > 0 && fwrite(buf, 1, n, out)==n )
+		done += n;
+	fclose(in);
+	fclose(out);
+	return done;
+}
+
+int cb_binaries ( const char *dir, uint64_t size ) /* corpus "binary": copia in [dir] l'eseguibile e le librerie mappate da questo processo > */
+{                                                  /* > (codice macchina vero: i codec linkati, la libc), fino a [size] byte. 1-ok, 0-errore */
+	char line[MAX_MSG_LEN*4], last[MAX_MSG_LEN*4] = "", path[MAX_MSG_LEN*5], *name;
+	uint64_t done = 0;
+	int i = 0;
+	FILE *maps = fopen("/proc/self/maps", "r");
+	if (maps==NULL)                         // niente /proc (non Linux): solo l'eseguibile, se si trova
+		return cb_copy_file("/proc/self/exe", "binary.0", size)>0;
+	while ( done<size && fgets(line, sizeof(line), maps)!=NULL ) {
+		name = strchr(line, '/');
+		if (name==NULL)
+			continue;
+		name[strcspn(name, "\n")] = '\0';
+		if (strcmp(name, last)==0)          // le sezioni dello stesso file sono righe consecutive
+			continue;
+		strcpy(last, name);
+		sprintf(path, "%s/%02d-%s", dir, i, strrchr(name, '/')+1);
+		if (cb_copy_file(name, path, size-done)>0) {
+			struct stat st;
+			if (stat(path, &st)==0)
+				done += st.st_size;
+			i++;
+		}
+	}
+	fclose(maps);
+	return done>0;
+}
+
+int cb_make_corpus ( const char *dir, const char *kind, uint64_t size ) /* crea nella cartella [dir] il corpus sintetico [kind]: 1-ok, 0-errore */
+{
+	char path[strlen(dir)+32];
+	uint64_t seed = 0x9E3779B97F4A7C15ULL, done;
+	int i, n;
+	if (mkdir(dir, 0700)!=0)
+		return 0;
+	if (strcmp(kind, "binary")==0)
+		return cb_binaries(dir, size);
+	if (strcmp(kind, "tiny")==0) {          // tanti file piccoli (testo e log, alternati): pesano soprattutto gli header tar
+		for (i=0, done=0; done<CB_TINY_SIZE; i++) {
+			n = CB_TINY_MIN + xorshift64(&seed) % (CB_TINY_MAX-CB_TINY_MIN+1);
+			sprintf(path, "%s/record-%05d.txt", dir, i);
+			if ( ! cb_write_file(path, i%2, n, &seed) )
+				return 0;
+			done += n;
+		}
+		return 1;
+	}
+	n = (strcmp(kind, "log")==0) ? 1 : (strcmp(kind, "media")==0) ? 2 : 0;
+	for (i=0; i<4; i++) {                   // 4 file da un quarto del corpus
+		sprintf(path, "%s/%s.%d", dir, kind, i);
+		if ( ! cb_write_file(path, n, size/4, &seed) )
+			return 0;
+	}
+	return 1;
+}
+
+int cb_corpus_bytes ( const char *dir, const char *links, uint64_t *bytes ) /* somma in [bytes] le dimensioni dei file regolari di [dir] e, > */
+{   /* > se [links]!=NULL, li collega (symlink) nella cartella [links], che diventa il corpus senza sottocartelle: n° di file, -1 se errore */
+	struct dirent **names;
+	struct stat st;
+	char path[MAX_MSG_LEN*5], link[MAX_MSG_LEN*5], *abs;
+	int n, i, files = 0;
+	*bytes = 0;
+	if (links!=NULL && mkdir(links, 0700)!=0)
+		return -1;
+	n = scandir(dir, &names, workspace_filter, alphasort);
+	if (n<0)
+		return -1;
+	for (i=0; i<n; i++) {
+		snprintf(path, sizeof(path), "%s/%s", dir, names[i]->d_name);
+		if (stat(path, &st)==0 && S_ISREG(st.st_mode)) {
+			if (links!=NULL) {
+				snprintf(link, sizeof(link), "%s/%s", links, names[i]->d_name);
+				abs = realpath(path, NULL);     // percorso assoluto: il collegamento vale da qualsiasi cartella
+				if (abs==NULL || symlink(abs, link)!=0)
+					st.st_size = -1;            // file escluso dal corpus
+				free(abs);
+			}
+			if (st.st_size>=0) {
+				*bytes += st.st_size;
+				files++;
+			}
+		}
+		free(names[i]);
+	}
+	free(names);
+	return files;
+}
+
+// funzioni (6) di decompressione (una per codec, nell'ordine di compressors_matrix): leggono l'archivio [in] a blocchi e ne contano in [out] >
+   /* > i byte dello stream tar, senza conservarli. Accettano più membri/stream/frame di seguito (compressione parallela a blocchi) e verificano >
+    * > il controllo d'integrità del formato, dove c'è: 1-ok, 0-archivio non valido */
+int cb_gunzip ( FILE *in, uint64_t *out )
+{
+	unsigned char ib[CHUNK_SIZE], ob[CHUNK_SIZE];
+	z_stream z;
+	int rc = Z_OK, full = 0;
+	memset(&z, 0, sizeof(z));
+	if (inflateInit2(&z, 15+16)!=Z_OK)
+		return 0;
+	while (1) {
+		if (z.avail_in==0 && !full) {      // nuovo input solo se l'ultima chiamata non ha riempito l'uscita (potrebbe averne ancora)
+			z.avail_in = fread(ib, 1, sizeof(ib), in);
+			z.next_in = ib;
+			if (z.avail_in==0)
+				break;
+		}
+		z.next_out = ob;
+		z.avail_out = sizeof(ob);
+		rc = inflate(&z, Z_NO_FLUSH);
+		*out += sizeof(ob) - z.avail_out;
+		full = (z.avail_out==0);
+		if (rc==Z_STREAM_END)
+			inflateReset(&z);               // membro concluso (CRC32 verificato): ne può seguire un altro
+		else if (rc!=Z_OK && rc!=Z_BUF_ERROR)
+			break;
+	}
+	inflateEnd(&z);
+	return rc==Z_STREAM_END;
+}
+
+int cb_bunzip2 ( FILE *in, uint64_t *out )
+{
+	char ib[CHUNK_SIZE], ob[CHUNK_SIZE];
+	bz_stream b;
+	int rc = BZ_OK, full = 0;
+	memset(&b, 0, sizeof(b));
+	if (BZ2_bzDecompressInit(&b, 0, 0)!=BZ_OK)
+		return 0;
+	while (1) {
+		if (b.avail_in==0 && !full) {
+			b.avail_in = fread(ib, 1, sizeof(ib), in);
+			b.next_in = ib;
+			if (b.avail_in==0)
+				break;
+		}
+		b.next_out = ob;
+		b.avail_out = sizeof(ob);
+		rc = BZ2_bzDecompress(&b);
+		*out += sizeof(ob) - b.avail_out;
+		full = (b.avail_out==0);
+		if (rc==BZ_STREAM_END) {            // stream concluso (CRC verificato): ne può seguire un altro
+			char *next = b.next_in;
+			unsigned avail = b.avail_in;
+			BZ2_bzDecompressEnd(&b);
+			memset(&b, 0, sizeof(b));
+			if (BZ2_bzDecompressInit(&b, 0, 0)!=BZ_OK)
+				return 0;
+			b.next_in = next;
+			b.avail_in = avail;
+		}
+		else if (rc!=BZ_OK)
+			break;
+	}
+	BZ2_bzDecompressEnd(&b);
+	return rc==BZ_STREAM_END;
+}
+
+int cb_unxz ( FILE *in, uint64_t *out )
+{
+	uint8_t ib[CHUNK_SIZE], ob[CHUNK_SIZE];
+	lzma_stream x = LZMA_STREAM_INIT;
+	lzma_action action = LZMA_RUN;
+	lzma_ret rc;
+	if (lzma_stream_decoder(&x, UINT64_MAX, LZMA_CONCATENATED)!=LZMA_OK) // più stream xz di seguito, ciascuno con il suo CRC64
+		return 0;
+	do {
+		if (x.avail_in==0 && action==LZMA_RUN) {
+			x.avail_in = fread(ib, 1, sizeof(ib), in);
+			x.next_in = ib;
+			if (x.avail_in==0)
+				action = LZMA_FINISH;
+		}
+		x.next_out = ob;
+		x.avail_out = sizeof(ob);
+		rc = lzma_code(&x, action);
+		*out += sizeof(ob) - x.avail_out;
+	} while (rc==LZMA_OK);
+	lzma_end(&x);
+	return rc==LZMA_STREAM_END;
+}
+
+int cb_uncompress ( FILE *in, uint64_t *out ) /* LZW (.Z): decodifica speculare a lzw_output, con i gruppi di 8 codici completati ad ogni > */
+{                                             /* > allargamento dei codici e dopo ogni CLEAR (come unlzw di gzip); il formato non ha controlli d'integrità */
+	uint16_t *prefix = malloc(sizeof(uint16_t)<<16);
+	unsigned char *suffix = malloc(1<<16), *stack = malloc(1<<16);
+	uint64_t acc = 0;
+	int c, nacc = 0, maxbits, n_bits = 9, maxcode = (1<<9)-1, free_ent = 257, group = 0, code, incode, oldcode = -1, finchar = 0, sp, ok = 0;
+	int clear = 0;
+	if (prefix==NULL || suffix==NULL || stack==NULL || getc(in)!=0x1f || getc(in)!=0x9d || (c = getc(in))==EOF || !(c & 0x80))
+		goto out;
+	maxbits = c & 0x1f;
+	if (maxbits<9 || maxbits>LZW_BITS)
+		goto out;
+	while (1) {
+		if (free_ent > maxcode || clear) {  // il compressore ha allargato i codici (o li ha riportati a 9 bit con CLEAR) dopo aver completato il > 
+		                                    // > gruppo corrente: salto il padding
+			int skip = ((8 - group%8) % 8) * n_bits;
+			while (skip>0) {
+				if (nacc==0) {
+					if ((c = getc(in))==EOF)
+						break;
+					acc = c;
+					nacc = 8;
+				}
+				int k = (skip < nacc) ? skip : nacc;
+				acc >>= k;
+				nacc -= k;
+				skip -= k;
+			}
+			n_bits = clear ? 9 : n_bits+1;
+			maxcode = (n_bits==maxbits && !clear) ? (1<<maxbits) : (1<<n_bits)-1; // (dopo CLEAR come all'inizio dello stream)
+			group = 0;
+			clear = 0;
+		}
+		while (nacc < n_bits && (c = getc(in))!=EOF) { // codici dal bit meno significativo (come lzw_putbits)
+			acc |= (uint64_t)c << nacc;
+			nacc += 8;
+		}
+		if (nacc < n_bits) {                // fine dello stream: restano solo i bit a zero che completano l'ultimo byte
+			ok = (nacc < 8);
+			break;
+		}
+		code = acc & ((1<<n_bits)-1);
+		acc >>= n_bits;
+		nacc -= n_bits;
+		group++;
+		if (oldcode==-1) {                  // il primo codice è un letterale e non crea voci
+			if (code>255)
+				break;
+			oldcode = finchar = code;
+			(*out)++;
+			continue;
+		}
+		if (code==256) {                    // CLEAR: dizionario vuoto (la voce creata dal codice seguente va in 256 e non si usa)
+			free_ent = 256;
+			clear = 1;
+			continue;
+		}
+		incode = code;
+		sp = 0;
+		if (code >= free_ent) {             // caso KwKwK: la voce è quella che sta per essere creata
+			if (code > free_ent)
+				break;
+			stack[sp++] = finchar;
+			code = oldcode;
+		}
+		while (code >= 256) {
+			stack[sp++] = suffix[code];
+			code = prefix[code];
+		}
+		stack[sp++] = finchar = code;
+		*out += sp;                         // la stringa ricostruita (al contrario) basta contarla
+		if (free_ent < (1<<maxbits)) {
+			prefix[free_ent] = oldcode;
+			suffix[free_ent] = finchar;
+			free_ent++;
+		}
+		oldcode = incode;
+	}
+out:
+	free(prefix);
+	free(suffix);
+	free(stack);
+	return ok;
+}
+
+int cb_unzstd ( FILE *in, uint64_t *out )
+{
+	unsigned char ib[CHUNK_SIZE], ob[CHUNK_SIZE];
+	ZSTD_DCtx *d = ZSTD_createDCtx();
+	ZSTD_inBuffer zi = { ib, 0, 0 };
+	ZSTD_outBuffer zo;
+	size_t rc = 1;
+	int full = 0;
+	if (d==NULL)
+		return 0;
+	while (1) {
+		if (zi.pos==zi.size && !full) {
+			zi.size = fread(ib, 1, sizeof(ib), in);
+			zi.pos = 0;
+			if (zi.size==0)
+				break;
+		}
+		zo.dst = ob;
+		zo.size = sizeof(ob);
+		zo.pos = 0;
+		rc = ZSTD_decompressStream(d, &zo, &zi); // 0: frame concluso (checksum verificato); i frame successivi ripartono da soli
+		*out += zo.pos;
+		full = (zo.pos==zo.size);
+		if (ZSTD_isError(rc))
+			break;
+	}
+	ZSTD_freeDCtx(d);
+	return rc==0;
+}
+
+int cb_unlz4 ( FILE *in, uint64_t *out )
+{
+	unsigned char ib[CHUNK_SIZE], ob[CHUNK_SIZE];
+	LZ4F_dctx *d;
+	size_t rc = 1, have = 0, pos = 0, isz, osz;
+	int full = 0;
+	if (LZ4F_isError(LZ4F_createDecompressionContext(&d, LZ4F_VERSION)))
+		return 0;
+	while (1) {
+		if (pos==have && !full) {
+			have = fread(ib, 1, sizeof(ib), in);
+			pos = 0;
+			if (have==0)
+				break;
+		}
+		isz = have-pos;
+		osz = sizeof(ob);
+		rc = LZ4F_decompress(d, ob, &osz, ib+pos, &isz, NULL); // 0: frame concluso (checksum verificato), pronto per il successivo
+		pos += isz;
+		*out += osz;
+		full = (osz==sizeof(ob));
+		if (LZ4F_isError(rc))
+			break;
+	}
+	LZ4F_freeDecompressionContext(d);
+	return rc==0;
+}
+
+int (*cb_decoders[NUM_COMPRESSORS])( FILE *in, uint64_t *out ) = { // stesse righe di compressors_matrix (e di codecs)
+	cb_gunzip, cb_bunzip2, cb_unxz, cb_uncompress, cb_unzstd, cb_unlz4
+};
+
+// funzioni (4) che eseguono le prove, ciascuna in un processo figlio (il picco di memoria è così quello della sola prova)
+long cb_maxrss ( void ) /* picco di memoria residente del processo finora (KiB) */
+{
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_maxrss;
+}
+
+int fd_sink ( void *ctx, const void *buf, size_t len ) /* destinazione dei byte compressi: il file (descrittore) [ctx] */
+{
+	const char *p = buf;
+	while (len>0) {
+		ssize_t n = write(*(int*)ctx, p, len);
+		if (n<=0)
+			return 0;
+		p += n;
+		len -= n;
+	}
+	return 1;
+}
+
+void cb_child ( int idx, int level, int threads, const char *corpus, const char *archive, int decompress, cb_result *r ) /* corpo del > */
+{   /* > figlio: comprime il corpus [corpus] nell'archivio [archive] (come la compress del server), o lo decomprime ([decompress]=1) */
+	struct timespec t0, t1;
+	archive_writer aw;
+	workspace ws;                    // i file del corpus, lasciati su disco (come quelli delle sessioni oltre i budget di memoria)
+	long base = cb_maxrss();
+	FILE *in;
+	int fd;
+	memset(r, 0, sizeof(cb_result));
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if (decompress) {
+		in = fopen(archive, "rb");
+		if (in==NULL)
+			return;
+		r->ok = cb_decoders[idx](in, &r->in_bytes);
+		fclose(in);
+	}
+	else {
+		if ( threads>1 && ! sched_init(threads) ) // la compressione parallela a blocchi usa i worker dello scheduler, come nel server
+			return;
+		fd = open(archive, O_WRONLY|O_CREAT|O_TRUNC, 0600);
+		if (fd==-1)
+			return;
+		if ( aw_open(&aw, idx, threads, level, fd_sink, &fd) ) {
+			r->ok = (ws_scan(&ws, corpus)>=0 && build_archive(&aw, &ws)==1);
+			r->ok = aw_close(&aw, r->ok) && r->ok;
+			r->in_bytes = aw.in_bytes;
+			r->out_bytes = aw.out_bytes;
+		}
+		close(fd);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	r->seconds = (t1.tv_sec-t0.tv_sec) + (t1.tv_nsec-t0.tv_nsec)/1e9;
+	r->peak_kib = cb_maxrss() - base;
+}
+
+int cb_run ( int idx, int level, int threads, const char *corpus, const char *archive, int decompress, cb_result *r ) /* esegue la prova > */
+{   /* > (vedi cb_child) in un processo figlio e ne raccoglie la misura in [r]: 1-ok, 0-errore */
+	int fds[2], st;
+	pid_t pid;
+	memset(r, 0, sizeof(cb_result));
+	if (pipe(fds)!=0)
+		return 0;
+	fflush(stdout);                         // il figlio non deve ristampare ciò che il padre ha ancora nel buffer
+	pid = fork();
+	if (pid==-1) {
+		close(fds[0]);
+		close(fds[1]);
+		return 0;
+	}
+	if (pid==0) {
+		int null = open("/dev/null", O_WRONLY);
+		if (null!=-1)
+			dup2(null, STDOUT_FILENO);      // (messaggi dello scheduler)
+		close(fds[0]);
+		cb_child(idx, level, threads, corpus, archive, decompress, r);
+		_exit( write(fds[1], r, sizeof(cb_result))==sizeof(cb_result) ? 0 : 1 );
+	}
+	close(fds[1]);
+	st = (read(fds[0], r, sizeof(cb_result))==sizeof(cb_result));
+	close(fds[0]);
+	waitpid(pid, NULL, 0);
+	return st && r->ok;
+}
+
+void cb_usage ( void ) /* sintassi di codec-bench */
+{
+	fprintf(stderr, REDf"\nUso: codec-bench [--size S[k|m|g]] [--threads N] [--codec nome]... [--level L | --all-levels] "
+	        "[--corpus text|log|binary|media|tiny]... [--json file] [cartella...]\n"RST"\n");
+}
+
+// main (codec-bench)
+int main ( int argc, char* argv[] ) /* banco di prova dei codec: ogni compressore (ai livelli scelti) su ogni corpus, con compressione e > */
+{   /* > decompressione misurate in processi figli; risultati in tabella e, con --json, in JSON ("-": standard output) */
+	static const char *synthetic[] = { "text", "log", "binary", "media", "tiny" };
+	char dir[] = CB_DIR_TEMPLATE, archive[64], *json = NULL, *end;
+	char *corpus_name[CB_MAX_CORPORA], *corpus_dir[CB_MAX_CORPORA];
+	int use_codec[NUM_COMPRESSORS], ncorpora = 0, ncodecs = 0, threads = 1, level = LEVEL_DEFAULT, all_levels = 0, bad = 0, first = 1;
+	int i, k, c, l, lo, hi, ok, files, nsynth = sizeof(synthetic)/sizeof(synthetic[0]);
+	uint64_t size = CB_DEFAULT_SIZE, bytes;
+	cb_result cr, dr;
+	FILE *js = NULL, *tab = stdout;
+	memset(use_codec, 0, sizeof(use_codec));
+	for (i=1; i<argc && !bad; i++) {
+		if (strcmp(argv[i], "--all-levels")==0)
+			all_levels = 1;
+		else if (strncmp(argv[i], "--", 2)!=0) {      // cartella da usare come corpus (i suoi file regolari, come la cartella di una sessione)
+			if (ncorpora==CB_MAX_CORPORA)
+				bad = 1;
+			else {
+				corpus_dir[ncorpora] = argv[i];
+				corpus_name[ncorpora++] = (strrchr(argv[i], '/')!=NULL && strrchr(argv[i], '/')[1]!='\0') ? strrchr(argv[i], '/')+1 : argv[i];
+			}
+		}
+		else if (i+1>=argc)
+			bad = 1;
+		else if (strcmp(argv[i], "--size")==0) {
+			size = strtoull(argv[++i], &end, 10);
+			size <<= (*end=='k' || *end=='K') ? 10 : (*end=='m' || *end=='M') ? 20 : (*end=='g' || *end=='G') ? 30 : 0;
+			bad = (size==0);
+		}
+		else if (strcmp(argv[i], "--threads")==0) {
+			threads = atoi(argv[++i]);
+			bad = (threads<1 || threads>MAX_THREADS);
+		}
+		else if (strcmp(argv[i], "--level")==0) {
+			level = atoi(argv[++i]);
+			bad = (level<0 || level>MAX_LEVEL);
+		}
+		else if (strcmp(argv[i], "--codec")==0) {
+			for (c=0; c<NUM_COMPRESSORS && strcmp(argv[i+1], compressors_matrix[c][0])!=0; c++)
+				;
+			bad = (c==NUM_COMPRESSORS);
+			if (!bad && !use_codec[c]) {
+				use_codec[c] = 1;
+				ncodecs++;
+			}
+			i++;
+		}
+		else if (strcmp(argv[i], "--corpus")==0) {
+			for (k=0; k<nsynth && strcmp(argv[i+1], synthetic[k])!=0; k++)
+				;
+			bad = (k==nsynth || ncorpora==CB_MAX_CORPORA);
+			if (!bad) {
+				corpus_name[ncorpora] = (char*)synthetic[k];
+				corpus_dir[ncorpora++] = NULL;    // da generare
+			}
+			i++;
+		}
+		else if (strcmp(argv[i], "--json")==0)
+			json = argv[++i];
+		else
+			bad = 1;
+	}
+	if (bad) {
+		cb_usage();
+		return 1;
+	}
+	if (ncodecs==0)                             // default: tutti i compressori, su tutti i corpus sintetici
+		for (c=0; c<NUM_COMPRESSORS; c++)
+			use_codec[c] = 1;
+	if (ncorpora==0)
+		for (k=0; k<nsynth; k++) {
+			corpus_name[ncorpora] = (char*)synthetic[k];
+			corpus_dir[ncorpora++] = NULL;
+		}
+	if (mkdtemp(dir)==NULL) {
+		fprintf(stderr, REDf"Impossibile creare la cartella dei corpus."RST"\n");
+		return 1;
+	}
+	if (json!=NULL) {
+		js = (strcmp(json, "-")==0) ? stdout : fopen(json, "w");
+		if (js==NULL)
+			fprintf(stderr, REDf"- %s: impossibile scrivere i risultati."RST"\n", json);
+		else
+			fprintf(js, "{\"version\":\"%s\",\"threads\":%d,\"size\":%llu,\"results\":[", VERSION, threads, (unsigned long long)size);
+	}
+	if (js==stdout)                             // JSON sullo standard output: la tabella va sullo standard error
+		tab = stderr;
+	sprintf(archive, "%s/archive", dir);
+	fprintf(tab, CYAf"codec-bench v %s: %d thread, corpus sintetici da %llu byte in "GREf"%s"RST"\n", VERSION, threads, (unsigned long long)size, dir);
+	fprintf(tab, "%-10s %-9s %7s %6s %9s %8s %11s %13s %11s %13s\n", "corpus", "codec", "livello", "file", "MiB", "rapporto",
+	       "compr MB/s", "decompr MB/s", "picco c MiB", "picco d MiB");
+	for (k=0; k<ncorpora; k++) {
+		char path[strlen(dir)+16];
+		if (corpus_dir[k]==NULL) {              // corpus sintetico: generato una volta sola
+			sprintf(path, "%s/%s", dir, corpus_name[k]);
+			if ( ! cb_make_corpus(path, corpus_name[k], size) ) {
+				fprintf(stderr, REDf"- %s: impossibile creare il corpus."RST"\n", corpus_name[k]);
+				continue;
+			}
+			corpus_dir[k] = strdup(path);
+		}
+		else {                                  // cartella dell'utente: solo i suoi file regolari, come nella cartella di una sessione
+			sprintf(path, "%s/dir-%d", dir, k);
+			if ( cb_corpus_bytes(corpus_dir[k], path, &bytes)<=0 ) {
+				fprintf(stderr, REDf"- %s: cartella vuota o non leggibile."RST"\n", corpus_dir[k]);
+				continue;
+			}
+			corpus_dir[k] = strdup(path);
+		}
+		files = cb_corpus_bytes(corpus_dir[k], NULL, &bytes);
+		if (files<=0) {
+			fprintf(stderr, REDf"- %s: cartella vuota o non leggibile."RST"\n", corpus_dir[k]);
+			continue;
+		}
+		for (c=0; c<NUM_COMPRESSORS; c++) {
+			if (!use_codec[c])
+				continue;
+			lo = hi = codec_level(c, level);    // un livello (quello scelto o il default del codec), oppure tutti
+			if (all_levels) {
+				lo = codecs[c].min_level;
+				hi = codecs[c].max_level;
+			}
+			for (l=lo; l<=hi; l++) {
+				ok = cb_run(c, l, threads, corpus_dir[k], archive, 0, &cr) && cb_run(c, l, threads, corpus_dir[k], archive, 1, &dr)
+				    && dr.in_bytes==cr.in_bytes;  // la decompressione deve restituire esattamente lo stream tar
+				fprintf(tab, "%-10s %-9s %7d %6d %9.1f ", corpus_name[k], compressors_matrix[c][0], l, files, cr.in_bytes/1048576.0);
+				if (ok)
+					fprintf(tab, "%8.3f %11.1f %13.1f %11.1f %13.1f\n", (double)cr.in_bytes/cr.out_bytes, cr.in_bytes/cr.seconds/1e6,
+					       dr.in_bytes/dr.seconds/1e6, cr.peak_kib/1024.0, dr.peak_kib/1024.0);
+				else
+					fprintf(tab, REDf"%8s"RST"\n", "ERRORE");
+				if (js!=NULL) {
+					fprintf(js, "%s{\"corpus\":\"%s\",\"codec\":\"%s\",\"level\":%d,\"files\":%d,\"ok\":%s,\"in_bytes\":%llu,\"out_bytes\":%llu,"
+					        "\"ratio\":%.4f,\"compress_mb_s\":%.2f,\"decompress_mb_s\":%.2f,\"compress_peak_kib\":%ld,\"decompress_peak_kib\":%ld}",
+					        first ? "" : ",", corpus_name[k], compressors_matrix[c][0], l, files, ok ? "true" : "false",
+					        (unsigned long long)cr.in_bytes, (unsigned long long)cr.out_bytes, ok ? (double)cr.in_bytes/cr.out_bytes : 0,
+					        ok ? cr.in_bytes/cr.seconds/1e6 : 0, ok ? dr.in_bytes/dr.seconds/1e6 : 0, cr.peak_kib, dr.peak_kib);
+					first = 0;
+				}
+			}
+		}
+	}
+	if (js!=NULL) {
+		fprintf(js, "]}\n");
+		if (js!=stdout)
+			fclose(js);
+	}
+	rm_tree_at(AT_FDCWD, dir);        // corpus sintetici e archivio di prova
+	return 0;
+}
+
+#else
+
 /*       CORPO DEL PROCESSO SERVER     */
 
 // main (compressor-server)
 int main ( int argc, char* argv[] ) /* Il processo server si limita ad alcune azioni base e poi delega  il servizio al ListenerThread (che a > */
-{  			            /* > sua volta lo smisterà tra i ServerThreads del pool); la sintassi è "compressor-server <porta>"        */
+{  			            /* > sua volta lo smisterà tra i ServerThreads del pool); la sintassi è "compressor-server [opzioni] <porta> [min max [job]]", > */
+   			            /* > con le opzioni del log --log text|json, --log-level debug|info|warn|error e --trace, --workspace-mem MiB, --fsync none|data|full > */
+   			            /* > e --eager */
 	pthread_t main_thread;     
 	pthread_attr_t attr;                    // per il thread listener
-	int port, rc; 
+	int port, rc, i, j; 
 	void *status=NULL;	        	// per la join sul ListenerThread
 	struct sigaction sa;
+	struct rlimit rl;               // descrittori aperti consentiti
 	sa.sa_handler = gestoreSIGINT;               //assegno il signal handler per la SIGINT(ctrl+c)
 	sigemptyset(&sa.sa_mask);
 	sa.sa_flags = SA_RESTART;
 	if (sigaction(SIGINT, &sa, NULL) == -1) 
 	  fprintf (stderr,"Errore inizializzazione handler SIGINT via sigaction\n\n");						
 	signal(SIGINT, gestoreSIGINT);	
-	assignedFlag=1;      // inizialmente non ci sono client in attesa quindi nessuno di essi aspetta un thread
+	signal(SIGPIPE, SIG_IGN);   // un client che cade durante un invio (e.g. sendfile dell'archivio) dà un errore, non termina il server
+	if (getrlimit(RLIMIT_NOFILE, &rl)==0) {      // descrittori: il massimo consentito, e un quarto sempre libero per connessioni e archivi
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+		getrlimit(RLIMIT_NOFILE, &rl);
+		ws_fd_max = (rl.rlim_cur==RLIM_INFINITY || rl.rlim_cur > 4*(rlim_t)INT_MAX/3) ? INT_MAX : (int)(rl.rlim_cur/4*3);
+	}
 	closing=0;	     // inizialmente la procedura di chiusura del server (via INT) è disattivata
+	srv_metrics.started = time(NULL);
 	pthread_attr_init(&attr);
 	pthread_attr_setdetachstate(&attr,PTHREAD_CREATE_JOINABLE);    // inizializzazione del mutex e degli attributi del main thread
 	pthread_mutex_init(&mutex, NULL); 								
-	if (argc!=2) {   			      // gestione errori sul n° dei parametri con cui viene lanciato il server 
+	for (i=j=1; i<argc; i++) {           // tolgo le opzioni del log da argv: restano solo gli argomenti posizionali
+		if (strcmp(argv[i], "--trace")==0)
+			log_trace = 1;
+		else if (strcmp(argv[i], "--eager")==0)
+			eager_mode = 1;
+		else if (strcmp(argv[i], "--log")==0 && i+1<argc && (strcmp(argv[i+1], "text")==0 || strcmp(argv[i+1], "json")==0))
+			log_json = (strcmp(argv[++i], "json")==0);
+		else if (strcmp(argv[i], "--log-level")==0 && i+1<argc) {
+			const char *levels[] = { "debug", "info", "warn", "error" };
+			for (log_level=LOG_DEBUG; log_level<=LOG_ERROR && strcmp(argv[i+1], levels[log_level])!=0; log_level++)
+				;
+			if (log_level>LOG_ERROR) {
+				fprintf (stderr, REDf"\nLivello del log non valido (debug, info, warn o error)."RST"\n\n");
+				return 0;
+			}
+			i++;
+		}
+		else if (strcmp(argv[i], "--workspace-mem")==0 && i+1<argc && isdigit(argv[i+1][0]))
+			ws_mem_session = strtoull(argv[++i], NULL, 10)<<20;   // MiB per sessione (0: i file delle sessioni sempre su disco)
+		else if (strcmp(argv[i], "--fsync")==0 && i+1<argc && (strcmp(argv[i+1],"none")==0 || strcmp(argv[i+1],"data")==0 
+		         || strcmp(argv[i+1],"full")==0)) {
+			fsync_policy = (argv[i+1][0]=='n') ? FSYNC_NONE : (argv[i+1][0]=='d') ? FSYNC_DATA : FSYNC_FULL;
+			i++;
+		}
+		else if (strncmp(argv[i], "--", 2)==0) {
+			fprintf (stderr, REDf"\nOpzione %s non valida: compressor-server [--log text|json] [--log-level debug|info|warn|error] [--trace] "
+			                 "[--workspace-mem MiB] [--fsync none|data|full] [--eager] <porta> [min max [job]]."RST"\n\n", argv[i]);
+			return 0;
+		}
+		else
+			argv[j++] = argv[i];
+	}
+	argc = j;
+	if (argc!=2 && argc!=4 && argc!=5) {   			      // gestione errori sul n° dei parametri con cui viene lanciato il server 
 		fprintf (stderr, REDf"\nIl programma compressor-server deve essere lanciato specificando "
-				       "la porta su cui si deve mettere in ascolto il server."RST"\n\n");
+				       "la porta su cui si deve mettere in ascolto il server (ed eventualmente "
+				       "le dimensioni minima e massima del pool e i worker di compressione)."RST"\n\n");
 		return 0;
 	}
+	pool_min = POOL_MIN_THREADS;
+	pool_max = POOL_MAX_THREADS;
+	job_workers = 0;                      // di default un worker di compressione per core
+	if (argc>=4) {
+		pool_min = atoi(argv[2]);
+		pool_max = atoi(argv[3]);
+		if ( (pool_min<1)||(pool_max<pool_min)||(pool_max>POOL_LIMIT) ) {
+			fprintf (stderr, REDf"\nDimensioni del pool non valide (1 <= min <= max <= %d)."RST"\n\n", POOL_LIMIT);
+			return 0;
+		}
+	}
+	if (argc==5) {
+		job_workers = atoi(argv[4]);
+		if ( (job_workers<1)||(job_workers>MAX_THREADS) ) {
+			fprintf (stderr, REDf"\nNumero di worker di compressione non valido (da 1 a %d)."RST"\n\n", MAX_THREADS);
+			return 0;
+		}
+	}
 	port = atoi(argv[1]);              												
 	if ( (port<1024)||(port>65535) ) {    	// intervallo di porte ammesse
 		fprintf (stderr, REDf"\nNumero porta non valido (intero compreso tra 1024 e 65535)."RST"\n\n");
@@ -995,6 +5774,9 @@ int main ( int argc, char* argv[] ) /* Il processo server si limita ad alcune az
 	printf (YELf"\nProcesso server (pid "RST"%d"YELf            // non usando una well-known port il client dovra' conoscere su quale il server ascolta
 	              ") in ascolto sulla Porta "CYAf"%d"YELf"."RST"\n\n",getpid(),port);     //se si vuole usare kill per arrestare il server
 	printf (REDb"REMOTE COMPRESSOR server, v %s"RST"\n", VERSION);          // comunico l'avvio del processo server
+	printf (YELf"Pool di thread: da "CYAf"%d"YELf" a "CYAf"%d"YELf"."RST"\n", pool_min, pool_max);
+	if ( ! log_start() )                 // da qui gli eventi delle sessioni passano per il thread del log
+		fprintf (stderr, REDf"Errore di creazione del thread del log: eventi non registrati."RST"\n");
 	if (pthread_create(&main_thread, &attr, codice__Listener_Thread, &port)<0) {   //  creazione Thread Listener: uso un thread perchè quando (ad es.) >
 	       fprintf (stderr, REDf"Errore di creazione del main thread."RST"\n"RST); //  > il pool è tutto occupato il main si deve bloccare per    >
 	       exit(-1);                                                               //  > poi essere svegliato: essendo più leggero conviene       >
@@ -1010,6 +5792,9 @@ int main ( int argc, char* argv[] ) /* Il processo server si limita ad alcune az
 		free(status);
 	}
 	pthread_attr_destroy(&attr);  
+	log_stop();                          // scarica gli ultimi eventi (tutti i thread che li registrano sono terminati)
 	printf(REDb"Terminazione REMOTE COMPRESSOR server."RST"\n\n"); 		// il processo compressor-server sta per terminare
 	return 0;				       // la pthread_exit servirebbe se morto il main altri thrtead andassero avanti, ma li ho tutti joinati
-} // fine codice del processo main
\ No newline at end of file
+} // fine codice del processo main
+
+#endif
\ No newline at end of file